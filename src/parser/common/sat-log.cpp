@@ -20,4 +20,18 @@ namespace sat {
     unsigned global_debug_level = 0;
     bool     global_use_stderr  = true;
 
+    namespace {
+        thread_local FILE* thread_output_stream = nullptr;
+    }
+
+    FILE* output_stream()
+    {
+        return thread_output_stream ? thread_output_stream : stdout;
+    }
+
+    void redirect_output_stream(FILE* stream)
+    {
+        thread_output_stream = stream;
+    }
+
 }
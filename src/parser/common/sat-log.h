@@ -19,17 +19,18 @@
 #include <cstdio>
 
 #define SAT_LOG(level, format, ...) \
-    if (global_debug_level >= level) std::printf("# " format, ##__VA_ARGS__);
+    if (global_debug_level >= level) std::fprintf(sat::output_stream(), "# " format, ##__VA_ARGS__);
 
 #define SAT_PIPED_OUTPUT_PREFIX "@ "
 #define SAT_OUTPUT_PREFIX       "! "
 
-#define SAT_OUTPUT(kind, format, ...)   \
-    std::printf(SAT_PIPED_OUTPUT_PREFIX \
-                SAT_OUTPUT_PREFIX       \
-                kind                    \
-                format, ##__VA_ARGS__); \
-    if (global_use_stderr)              \
+#define SAT_OUTPUT(kind, format, ...)    \
+    std::fprintf(sat::output_stream(),   \
+                 SAT_PIPED_OUTPUT_PREFIX \
+                 SAT_OUTPUT_PREFIX       \
+                 kind                    \
+                 format, ##__VA_ARGS__); \
+    if (global_use_stderr)               \
         std::fprintf(stderr, format, ##__VA_ARGS__);
 
 
@@ -40,6 +41,12 @@
 namespace sat {
     extern unsigned global_debug_level;
     extern bool     global_use_stderr;
+
+    // Log messages and output go to stdout, unless the calling thread
+    // has redirected them elsewhere; a model running a task on a
+    // worker thread writes everything to the output file of the task.
+    FILE* output_stream();
+    void  redirect_output_stream(FILE* stream);
 }
 
 #endif
@@ -15,23 +15,36 @@
 */
 #include "sat-md5.h"
 #include "md5.h"
+#include <algorithm>
 
 namespace sat {
 
 using namespace std;
 
 string md5(const string& s)
+{
+    return md5(s.c_str(), s.size());
+}
+
+string md5(const void* data, size_t size)
 {
     md5_state_s state;
 
     md5_init(&state);
-    md5_append(&state, (const md5_byte_t*)s.c_str(), s.size());
+    const md5_byte_t* p = (const md5_byte_t*)data;
+    while (size) {
+        // md5_append() takes an int count
+        int n = min<size_t>(size, 1 << 30);
+        md5_append(&state, p, n);
+        p    += n;
+        size -= n;
+    }
     md5_byte_t digest[16];
     md5_finish(&state, digest);
     char ascii_digest[33];
     char* a = ascii_digest;
     for (auto d : digest) {
-        sprintf(a, "%0x", d);
+        sprintf(a, "%02x", d);
         a += 2;
     }
 
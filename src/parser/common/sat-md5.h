@@ -17,12 +17,14 @@
 #define SAT_MD5_H
 
 #include <string>
+#include <cstddef>
 
 namespace sat {
 
     using namespace std;
 
     string md5(const string& s);
+    string md5(const void* data, size_t size);
 
 } // sat
 
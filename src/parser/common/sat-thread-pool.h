@@ -0,0 +1,195 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_THREAD_POOL_H
+#define SAT_THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <memory>
+
+namespace sat {
+
+using namespace std;
+
+// A fixed set of worker threads running submitted tasks.
+//
+// Each worker has a queue of its own. Tasks submitted from outside the
+// pool are dealt out to the queues in turn; tasks submitted by a
+// running task go to the queue of its worker. A worker runs the tasks
+// of its own queue in the order they were submitted and, when it has
+// run out of them, steals the oldest task queued for another worker.
+// Submitting the biggest jobs first thus keeps them running first.
+class thread_pool {
+public:
+    using task = function<void()>;
+
+    // zero workers means one per hardware thread
+    explicit thread_pool(unsigned workers = 0) :
+        next_queue_(), queued_(), pending_(), stopping_()
+    {
+        if (workers == 0) {
+            workers = hardware_threads();
+        }
+        for (unsigned w = 0; w < workers; ++w) {
+            queues_.push_back(unique_ptr<queue>(new queue));
+        }
+        for (unsigned w = 0; w < workers; ++w) {
+            workers_.push_back(thread([this, w]() { work(w); }));
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (auto& w : workers_) {
+            w.join();
+        }
+    }
+
+    void submit(task t)
+    {
+        unsigned q;
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (current_pool() == this) {
+                q = current_worker();
+            } else {
+                q = next_queue_++ % queues_.size();
+            }
+            ++queued_;
+            ++pending_;
+        }
+        {
+            lock_guard<mutex> lock(queues_[q]->mutex_);
+            queues_[q]->tasks_.push_back(move(t));
+        }
+        work_available_.notify_one();
+    }
+
+    // wait until all submitted tasks have been run
+    void wait()
+    {
+        unique_lock<mutex> lock(mutex_);
+        all_done_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+    unsigned size() const { return workers_.size(); }
+
+    // the index of the worker running the calling thread, if it is a
+    // worker of some pool; -1 otherwise
+    static int worker_index()
+    {
+        return current_pool() ? current_worker() : -1;
+    }
+
+    static unsigned hardware_threads()
+    {
+        unsigned n = thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+private:
+    struct queue {
+        mutex       mutex_;
+        deque<task> tasks_;
+    }; // queue
+
+    static thread_pool*& current_pool()
+    {
+        static thread_local thread_pool* pool = nullptr;
+        return pool;
+    }
+
+    static unsigned& current_worker()
+    {
+        static thread_local unsigned worker = 0;
+        return worker;
+    }
+
+    void work(unsigned w)
+    {
+        current_pool()   = this;
+        current_worker() = w;
+
+        for (;;) {
+            task t;
+            if (!take(w, t)) {
+                unique_lock<mutex> lock(mutex_);
+                work_available_.wait(lock, [this]() {
+                    return stopping_ || queued_ != 0;
+                });
+                if (stopping_ && queued_ == 0) {
+                    return;
+                }
+                continue; // a task was queued; go get it
+            }
+
+            t();
+
+            {
+                lock_guard<mutex> lock(mutex_);
+                if (--pending_ == 0) {
+                    all_done_.notify_all();
+                }
+            }
+        }
+    }
+
+    // take a task from our own queue or steal one from another
+    bool take(unsigned w, task& t)
+    {
+        bool took = false;
+
+        for (unsigned i = 0; !took && i < queues_.size(); ++i) {
+            queue& q = *queues_[(w + i) % queues_.size()];
+            lock_guard<mutex> lock(q.mutex_);
+            if (!q.tasks_.empty()) {
+                t = move(q.tasks_.front());
+                q.tasks_.pop_front();
+                took = true;
+            }
+        }
+
+        if (took) {
+            lock_guard<mutex> lock(mutex_);
+            --queued_;
+        }
+
+        return took;
+    }
+
+    vector<unique_ptr<queue>> queues_;
+    vector<thread>            workers_;
+    mutex                     mutex_; // for the counters below
+    condition_variable        work_available_;
+    condition_variable        all_done_;
+    unsigned                  next_queue_;
+    unsigned                  queued_;
+    unsigned                  pending_;
+    bool                      stopping_;
+}; // thread_pool
+
+} // namespace sat
+
+#endif // SAT_THREAD_POOL_H
@@ -0,0 +1,285 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "sat-decode-cache.h"
+#include "sat-md5.h"
+#include "sat-log.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sat {
+
+namespace {
+
+const char     decode_cache_magic[8] = {'S', 'A', 'T', 'T', 'D', 'E', 'C', '\0'};
+const uint32_t decode_cache_version  = 1;
+
+struct decode_cache_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t bits;
+    uint64_t code_size;
+    uint64_t record_count;
+}; // decode_cache_header
+
+bool by_offset(const decoded_record& a, const decoded_record& b)
+{
+    return a.offset < b.offset;
+}
+
+// a mapped cache file
+struct mapping {
+    mapping() : memory(), size(), records(), count() {}
+    ~mapping()
+    {
+        if (memory) {
+            (void)munmap(memory, size);
+        }
+    }
+
+    bool map(const string& path, unsigned bits, unsigned code_size)
+    {
+        bool done = false;
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 &&
+                (size_t)st.st_size >= sizeof(decode_cache_header))
+            {
+                void* m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (m != MAP_FAILED) {
+                    decode_cache_header header;
+                    memcpy(&header, m, sizeof(header));
+                    if (memcmp(header.magic,
+                               decode_cache_magic,
+                               sizeof(header.magic)) == 0 &&
+                        header.version   == decode_cache_version  &&
+                        header.bits      == bits                  &&
+                        header.code_size == code_size             &&
+                        st.st_size == (off_t)(sizeof(header) +
+                                              header.record_count *
+                                              sizeof(decoded_record)))
+                    {
+                        memory  = m;
+                        size    = st.st_size;
+                        records = reinterpret_cast<const decoded_record*>(
+                                      static_cast<const char*>(m) +
+                                      sizeof(header));
+                        count   = header.record_count;
+                        done    = true;
+                    } else {
+                        SAT_LOG(0, "ignoring invalid decode cache '%s'\n",
+                                path.c_str());
+                        (void)munmap(m, st.st_size);
+                    }
+                }
+            }
+            (void)close(fd);
+        }
+
+        return done;
+    }
+
+    const decoded_record* find(uint32_t offset) const
+    {
+        const decoded_record* end = records + count;
+        const decoded_record* r   = lower_bound(records,
+                                                end,
+                                                decoded_record{offset},
+                                                by_offset);
+        return (r != end && r->offset == offset) ? r : nullptr;
+    }
+
+    void*                 memory;
+    size_t                size;
+    const decoded_record* records;
+    uint64_t              count;
+}; // mapping
+
+mutex                                    cache_mutex;
+string                                   cache_directory;
+map<string, shared_ptr<decode_cache>>    caches; // by file path
+
+} // anonymous namespace
+
+
+class decode_cache::imp {
+public:
+    void save()
+    {
+        lock_guard<mutex> lock(mutex_);
+
+        if (added_.empty()) {
+            return;
+        }
+
+        // merge with what is in the file now; other runs may have
+        // written it since it was mapped
+        vector<decoded_record> records;
+        {
+            mapping current;
+            if (current.map(path_, bits_, code_size_)) {
+                records.assign(current.records,
+                               current.records + current.count);
+            }
+        }
+        for (auto& a : added_) {
+            records.push_back(a.second);
+        }
+        stable_sort(records.begin(), records.end(), by_offset);
+        records.erase(unique(records.begin(),
+                             records.end(),
+                             [](const decoded_record& a,
+                                const decoded_record& b) {
+                                 return a.offset == b.offset;
+                             }),
+                      records.end());
+
+        decode_cache_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, decode_cache_magic, sizeof(header.magic));
+        header.version      = decode_cache_version;
+        header.bits         = bits_;
+        header.code_size    = code_size_;
+        header.record_count = records.size();
+
+        string temp = path_ + "." + to_string(getpid());
+        bool   done = false;
+        FILE*  f    = fopen(temp.c_str(), "w");
+        if (f) {
+            done = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   fwrite(records.data(),
+                          sizeof(decoded_record),
+                          records.size(),
+                          f) == records.size();
+            done = (fclose(f) == 0) && done;
+            done = done && rename(temp.c_str(), path_.c_str()) == 0;
+            if (!done) {
+                (void)unlink(temp.c_str());
+            }
+        }
+
+        if (done) {
+            SAT_LOG(1, "wrote %zu records to decode cache '%s'\n",
+                    records.size(), path_.c_str());
+            added_.clear();
+        } else {
+            SAT_LOG(0, "could not write decode cache '%s'\n", path_.c_str());
+        }
+    }
+
+    string                                     path_;
+    unsigned                                   bits_;
+    unsigned                                   code_size_;
+    mapping                                    mapped_;
+    mutable mutex                              mutex_; // for added_
+    unordered_map<uint32_t, decoded_record>    added_;
+}; // decode_cache::imp
+
+
+decode_cache::decode_cache() : imp_{new imp} {}
+
+decode_cache::~decode_cache() {}
+
+// static
+void decode_cache::set_directory(const string& path)
+{
+    lock_guard<mutex> lock(cache_mutex);
+    cache_directory = path;
+}
+
+// static
+shared_ptr<decode_cache> decode_cache::obtain(const unsigned char* code,
+                                              unsigned             size,
+                                              unsigned             bits)
+{
+    shared_ptr<decode_cache> result;
+
+    string directory;
+    {
+        lock_guard<mutex> lock(cache_mutex);
+        directory = cache_directory;
+    }
+    if (directory == "" || !code || !size) {
+        return result;
+    }
+
+    string path = directory + "/" + md5(code, size) + "." +
+                  to_string(bits) + ".decode";
+
+    lock_guard<mutex> lock(cache_mutex);
+    auto& cache = caches[path];
+    if (!cache) {
+        cache.reset(new decode_cache);
+        cache->imp_->path_      = path;
+        cache->imp_->bits_      = bits;
+        cache->imp_->code_size_ = size;
+        if (cache->imp_->mapped_.map(path, bits, size)) {
+            SAT_LOG(1, "mapped %" PRIu64 " records from decode cache '%s'\n",
+                    cache->imp_->mapped_.count, path.c_str());
+        }
+    }
+    result = cache;
+
+    return result;
+}
+
+// static
+void decode_cache::save_all()
+{
+    lock_guard<mutex> lock(cache_mutex);
+    for (auto& c : caches) {
+        c.second->imp_->save();
+    }
+}
+
+bool decode_cache::find(uint32_t offset, decoded_record& record) const
+{
+    bool found = false;
+
+    const decoded_record* r = imp_->mapped_.find(offset);
+    if (r) {
+        record = *r;
+        found  = true;
+    } else {
+        lock_guard<mutex> lock(imp_->mutex_);
+        auto a = imp_->added_.find(offset);
+        if (a != imp_->added_.end()) {
+            record = a->second;
+            found  = true;
+        }
+    }
+
+    return found;
+}
+
+void decode_cache::add(const decoded_record& record)
+{
+    lock_guard<mutex> lock(imp_->mutex_);
+    imp_->added_.insert({record.offset, record});
+}
+
+} // sat
@@ -0,0 +1,68 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_DECODE_CACHE_H
+#define SAT_DECODE_CACHE_H
+
+#include "sat-types.h"
+#include <memory>
+#include <string>
+
+namespace sat {
+
+using namespace std;
+
+// What the model needs to know of a decoded instruction.
+struct decoded_record {
+    uint32_t offset;     // from the beginning of the module code
+    uint8_t  length;
+    uint8_t  type;       // disassembled_instruction transfer type bits
+    uint8_t  has_target;
+    uint8_t  reserved;
+    int64_t  target;     // relative to the module load address
+}; // decoded_record
+
+// The instructions decoded from the code of one module. The records
+// are kept across runs in a file named after the md5 of the code in the
+// cache directory; the file is mapped when the cache is obtained and the
+// records decoded since then are merged into it by save_all().
+class decode_cache {
+public:
+    // keep the caches in the given directory; no caching unless set
+    static void set_directory(const string& path);
+
+    // the cache for the given code; nullptr if caching is not on
+    static shared_ptr<decode_cache> obtain(const unsigned char* code,
+                                           unsigned             size,
+                                           unsigned             bits);
+
+    // write out the records decoded into all caches obtained so far
+    static void save_all();
+
+    ~decode_cache();
+
+    bool find(uint32_t offset, decoded_record& record) const;
+    void add(const decoded_record& record);
+
+private:
+    decode_cache();
+
+    class imp;
+    unique_ptr<imp> imp_;
+}; // decode_cache
+
+} // sat
+
+#endif // SAT_DECODE_CACHE_H
@@ -15,10 +15,13 @@
 */
 #include "sat-disassembler-capstone.h"
 #include "sat-mmapped.h"
+#include "sat-decode-cache.h"
+#include "sat-x86-decoder.h"
 #include "sat-log.h"
 #include <capstone/capstone.h>
 #include <sstream>
 #include <map>
+#include <mutex>
 #include <cinttypes>
 #include <string.h>
 
@@ -37,6 +40,8 @@ public:
     cs_insn     *insn_;                // capstone instruction storage
     cs_mode     mode_;                 // 16/32/64-bit disassembler, model id
     unsigned    bits_;                 // 16/32/64-bit disassembler, numeric value
+    mutex       mutex_;                // for the capstone handle and insn_
+    shared_ptr<decode_cache> decoded_; // decoded in this or earlier runs
 // TODO: put all private nonvirtual members here
 };
 
@@ -129,7 +134,11 @@ bool disassembled_instruction::parse(const disassembler::impl* i, uint16_t* size
 namespace {
 
 
-// two-level cache for holding an arbitrary number of disassemblers
+// decode with the x86 tables before trying capstone
+bool use_x86_tables_first = false;
+
+// two-level cache for holding an arbitrary number of disassemblers;
+// the first level is per thread, the second one is shared
 class disassembler_cache
 {
 public:
@@ -145,6 +154,7 @@ public:
             result = cached_disassembler_;
             got_it = true;
         } else {
+            lock_guard<mutex> lock(second_level_mutex_);
             auto i(second_level_cache_.find({host_path, target_load_address}));
             if (i != second_level_cache_.end()) {
                 result = i->second;
@@ -159,32 +169,40 @@ public:
         return got_it;
     }
 
+    // if another thread got to add a disassembler for the same
+    // executable first, d is replaced with that one
     static void add(const string&             host_path,
                     rva                       target_load_address,
                     shared_ptr<disassembler>& d)
     {
+        {
+            lock_guard<mutex> lock(second_level_mutex_);
+            d = second_level_cache_.insert(
+                    {{host_path, target_load_address}, d}).first->second;
+        }
+
         cached_host_path_           = host_path;
         cached_target_load_address_ = target_load_address;
         cached_disassembler_        = d;
-
-        second_level_cache_.insert({{host_path, target_load_address}, d});
     }
 
 private:
     typedef map<pair<string, rva>, shared_ptr<disassembler>> disassembler_map;
 
-    static shared_ptr<disassembler> cached_disassembler_;
-    static string                   cached_host_path_;
-    static rva                      cached_target_load_address_;
+    static thread_local shared_ptr<disassembler> cached_disassembler_;
+    static thread_local string                   cached_host_path_;
+    static thread_local rva                      cached_target_load_address_;
 
-    static disassembler_map         second_level_cache_;
+    static mutex                                 second_level_mutex_;
+    static disassembler_map                      second_level_cache_;
 };
 
 // static
-shared_ptr<disassembler> disassembler_cache::cached_disassembler_{};
-string                   disassembler_cache::cached_host_path_{};
-rva                      disassembler_cache::cached_target_load_address_{};
-disassembler_cache::disassembler_map disassembler_cache::second_level_cache_{};
+thread_local shared_ptr<disassembler> disassembler_cache::cached_disassembler_{};
+thread_local string                   disassembler_cache::cached_host_path_{};
+thread_local rva                      disassembler_cache::cached_target_load_address_{};
+mutex                                  disassembler_cache::second_level_mutex_{};
+disassembler_cache::disassembler_map   disassembler_cache::second_level_cache_{};
 
 } // anonymous namespace
 
@@ -246,6 +264,8 @@ shared_ptr<disassembler> disassembler::obtain(const string& host_path,
                     result->pimpl_->target_load_address_ = target_load_address;
                     result->pimpl_->bits_                = bits;
                     result->pimpl_->mode_                = mode;
+                    result->pimpl_->decoded_             =
+                        decode_cache::obtain(host_load_address, size, bits);
                 }
             } else {
                 SAT_LOG(0, "could not get host mmap\n");
@@ -272,6 +292,24 @@ shared_ptr<disassembler> disassembler::obtain(const string& host_path,
 }
 
 
+// static
+void disassembler::use_decode_cache(const string& directory)
+{
+    decode_cache::set_directory(directory);
+}
+
+// static
+void disassembler::use_x86_tables(bool use)
+{
+    use_x86_tables_first = use;
+}
+
+// static
+void disassembler::save_decode_cache()
+{
+    decode_cache::save_all();
+}
+
 rva disassembler::target_load_address()
 {
     return pimpl_->target_load_address_;
@@ -292,61 +330,144 @@ bool disassembler::disassemble(rva address, disassembled_instruction& instr)
     bool done = false;
 
     if (pimpl_->host_load_address_) {
+        decoded_record record;
+        rva            offset = address - pimpl_->target_load_address_;
+        if (pimpl_->decoded_ && pimpl_->decoded_->find(offset, record)) {
+            instr.text_.clear();
+            instr.type_            = record.type;
+            instr.has_jump_target_ = record.has_target;
+            instr.jump_target_     = pimpl_->target_load_address_ +
+                                     record.target;
+            instr.next_address_    = address + record.length;
+            done = true;
+        } else {
+            x86_instruction x;
+            if (use_x86_tables_first                        &&
+                offset < pimpl_->size_                      &&
+                x86_decode(pimpl_->host_load_address_ + offset,
+                           pimpl_->size_ - offset,
+                           address,
+                           pimpl_->bits_,
+                           x))
+            {
+                instr.text_.clear();
+                switch (x.transfer) {
+                case x86_transfer::CALL:
+                    instr.type_ = disassembled_instruction::CALL;
+                    break;
+                case x86_transfer::JUMP:
+                    instr.type_ = disassembled_instruction::JUMP;
+                    break;
+                case x86_transfer::CONDITIONAL:
+                    instr.type_ = disassembled_instruction::CONDITIONAL;
+                    break;
+                case x86_transfer::RETURN:
+                    instr.type_ = disassembled_instruction::RETURN;
+                    break;
+                case x86_transfer::NONE:
+                default:
+                    instr.type_ = 0;
+                    break;
+                }
+                instr.has_jump_target_ = x.has_target;
+                instr.jump_target_     = x.target;
+                instr.next_address_    = address + x.length;
+                done = true;
+            } else {
+                done = decode(address, instr);
+            }
+            if (done && pimpl_->decoded_) {
+                record.offset     = offset;
+                record.length     = instr.next_address_ - address;
+                record.type       = instr.type_;
+                record.has_target = instr.has_jump_target_;
+                record.reserved   = 0;
+                record.target     = instr.jump_target_ -
+                                    pimpl_->target_load_address_;
+                pimpl_->decoded_->add(record);
+            }
+        }
+    }
+
+    return done;
+}
+
+bool disassembler::get_text(rva address, string& text)
+{
+    disassembled_instruction instr;
+    bool got_it = pimpl_->host_load_address_ && decode(address, instr);
+    if (got_it) {
+        text = instr.text();
+    }
+    return got_it;
+}
+
+bool disassembler::decode(rva address, disassembled_instruction& instr)
+{
+    bool done = false;
+
+    // the handle is shared by all threads; the model decodes each
+    // instruction once for all of its workers (see shared_module_cache),
+    // so they only wait here for code that none of them has seen
+    lock_guard<mutex> lock(pimpl_->mutex_);
 #if 0
-        printf("disassembling at %lx in [%lx..%lx) -> ",
-               address,
-               pimpl_->target_load_address_,
-               pimpl_->target_load_address_ + pimpl_->size_);
+    printf("disassembling at %lx in [%lx..%lx) -> ",
+           address,
+           pimpl_->target_load_address_,
+           pimpl_->target_load_address_ + pimpl_->size_);
 #endif
-        rva original_addr = address;
-        rva offset = address - pimpl_->target_load_address_;
-        csh                  cps_h = pimpl_->cps_h_;
-        const unsigned char* p = pimpl_->host_load_address_ + offset;   // pointer to the actual code
-        const unsigned char* orig_p = p;
-        size_t               s = pimpl_->size_              - offset;   // Size of the code
-
-        bool success = cs_disasm_iter(cps_h, &p, &s, &address, pimpl_->insn_);
+    rva original_addr = address;
+    rva offset = address - pimpl_->target_load_address_;
+    csh                  cps_h = pimpl_->cps_h_;
+    const unsigned char* p = pimpl_->host_load_address_ + offset;   // pointer to the actual code
+    const unsigned char* orig_p = p;
+    size_t               s = pimpl_->size_              - offset;   // Size of the code
+
+    bool success = cs_disasm_iter(cps_h, &p, &s, &address, pimpl_->insn_);
 #if 0
-        printf("%lx (%lx bytes), address %lx\n", (uint64_t)p, s, original_addr);
+    printf("%lx (%lx bytes), address %lx\n", (uint64_t)p, s, original_addr);
 #endif
-        if (success) {
-            uint16_t size;
-            done = instr.parse(pimpl_.get(), &size);
-            instr.next_address_ = address;  // address is already updated by cs_disasm_iter()
-                                            // to point to next instruction
-            if (!done ) {
-                uint8_t* bytes = pimpl_->insn_->bytes;
-                printf("   %" PRIx64 ": COULD NOT DISASSEMBLE - code: %02x %02x %02x %02x\n",
-                       original_addr, bytes[0], bytes[1], bytes[2], bytes[3]);
-            }
-        } else {
-            /* [ Fix: Missing opcodes in capstone */
-            //printf("   %" PRIx64 ": COULD NOT DISASSEMBLE - code: %02x %02x %02x %02x\n",
-            //    original_addr, orig_p[0], orig_p[1], orig_p[2], orig_p[3]);
-            // xsaves64:
-            if ( (orig_p[0] == 0x48) &&
-                 (orig_p[1] == 0x0f) &&
-                 (orig_p[2] == 0xc7) &&
-                 (orig_p[3] == 0x2f))
-                 {
-                     done = instr.parse_missing_instructions("xsaves64 (%rdi)", false, 0);
-                     instr.next_address_ = original_addr + 4;
-                 }
-            else if ( (orig_p[0] == 0x48) &&
-                      (orig_p[1] == 0x0f) &&
-                      (orig_p[2] == 0xc7) &&
-                      (orig_p[3] == 0x1f))
-                      {
-                          done = instr.parse_missing_instructions("xrstors64 (%rdi)", false, 0);
-                          instr.next_address_ = original_addr + 4;
-                      }
-            /* Fix: Missing opcodes in capstone ] */
-            else {
-                printf("   %" PRIx64 ": COULD NOT DISASSEMBLE - code: %02x %02x %02x %02x\n",
+    if (success) {
+        uint16_t size;
+        done = instr.parse(pimpl_.get(), &size);
+        instr.next_address_ = address;  // address is already updated by cs_disasm_iter()
+                                        // to point to next instruction
+        if (!done ) {
+            uint8_t* bytes = pimpl_->insn_->bytes;
+            fprintf(output_stream(),
+                    "   %" PRIx64 ": COULD NOT DISASSEMBLE - code: %02x %02x %02x %02x\n",
+                    original_addr, bytes[0], bytes[1], bytes[2], bytes[3]);
+        }
+    } else {
+        /* [ Fix: Missing opcodes in capstone */
+        //printf("   %" PRIx64 ": COULD NOT DISASSEMBLE - code: %02x %02x %02x %02x\n",
+        //    original_addr, orig_p[0], orig_p[1], orig_p[2], orig_p[3]);
+        // xsaves64:
+        if ( (orig_p[0] == 0x48) &&
+             (orig_p[1] == 0x0f) &&
+             (orig_p[2] == 0xc7) &&
+             (orig_p[3] == 0x2f))
+             {
+                 done = instr.parse_missing_instructions("xsaves64 (%rdi)", false, 0);
+                 instr.next_address_ = original_addr + 4;
+             }
+        else if ( (orig_p[0] == 0x48) &&
+                  (orig_p[1] == 0x0f) &&
+                  (orig_p[2] == 0xc7) &&
+                  (orig_p[3] == 0x1f))
+                  {
+                      done = instr.parse_missing_instructions("xrstors64 (%rdi)", false, 0);
+                      instr.next_address_ = original_addr + 4;
+                  }
+        /* Fix: Missing opcodes in capstone ] */
+        else {
+            fprintf(output_stream(),
+                    "   %" PRIx64 ": COULD NOT DISASSEMBLE - code: %02x %02x %02x %02x\n",
                     original_addr, orig_p[0], orig_p[1], orig_p[2], orig_p[3]);
-                cs_err code = cs_err(cps_h);
-                printf("   %" PRIx64 ": COULD NOT DISASSEMBLE - ERROR: %s\n", original_addr, cs_strerror(code));
-            }
+            cs_err code = cs_err(cps_h);
+            fprintf(output_stream(),
+                    "   %" PRIx64 ": COULD NOT DISASSEMBLE - ERROR: %s\n",
+                    original_addr, cs_strerror(code));
         }
     }
 
@@ -361,6 +482,21 @@ bool disassembler::get_function(rva address, string& name, unsigned& offset)
                                     offset);
 }
 
+bool disassembler::get_function_id(rva        address,
+                                   symbol_id& name,
+                                   unsigned&  offset)
+{
+    return pimpl_->executable_->get_function_id(
+                                    address - pimpl_->target_load_address_,
+                                    name,
+                                    offset);
+}
+
+const char* disassembler::symbol_name(symbol_id name)
+{
+    return pimpl_->executable_->symbol_name(name);
+}
+
 bool disassembler::get_global_function(string name, rva& address)
 {
     bool got_it = pimpl_->executable_->get_global_function(name, address);
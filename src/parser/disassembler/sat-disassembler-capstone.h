@@ -35,15 +35,34 @@ namespace sat {
 
         rva target_load_address();
         bool disassemble(rva address, disassembled_instruction& instr);
+        // the text of the instruction at address, decoded anew
+        bool get_text(rva address, string& text);
         bool get_function(rva address, string& name, unsigned& offset);
+        // like get_function(), but give the name as an id instead of a
+        // copy; symbol_name() gives the name for an id, valid as long
+        // as the disassembler
+        typedef uint32_t symbol_id;
+        bool get_function_id(rva address, symbol_id& name, unsigned& offset);
+        const char* symbol_name(symbol_id name);
         bool get_global_function(string name, rva& address);
         bool get_relocation(rva address, string& name);
         void add_x86_64_region(rva begin, rva end);
 
+        // keep the instructions decoded from each module in the given
+        // directory across runs; instructions found there have no text,
+        // use get_text() for that
+        static void use_decode_cache(const string& directory);
+        static void save_decode_cache();
+        // decode the length and control flow of common x86 instructions
+        // with opcode tables, falling back to capstone for the rest; those
+        // instructions have no text either
+        static void use_x86_tables(bool use);
+
         class impl;
     private:
         disassembler();
         bool is_x86_64_func_region(rva address);
+        bool decode(rva address, disassembled_instruction& instr);
 
         unique_ptr<impl> pimpl_;
     };
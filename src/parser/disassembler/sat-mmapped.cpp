@@ -23,7 +23,12 @@
 #include <iostream>
 #include <iomanip>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
 #include <cstdint>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -37,14 +42,32 @@ namespace sat {
 using namespace ELFIO;
 using namespace std;
 
+// The sections of a module, sorted by address.
 class section_cache
 {
 public:
     void add(rva address, rva target_address, size_t size, const string& name, rva flags)
     {
         if (address != 0 && size != 0) {
-            if (cache_[address].size < size) {
-                cache_[address] = {target_address, size, name, flags};
+            // keep the biggest section at each address
+            auto s = lower_bound(sections_.begin(),
+                                 sections_.end(),
+                                 address,
+                                 [](const section& s, rva a) {
+                                     return s.address < a;
+                                 });
+            if (s == sections_.end() || s->address != address) {
+                sections_.insert(s, {address, target_address, size, name, flags});
+            } else if (s->size < size) {
+                *s = {address, target_address, size, name, flags};
+            }
+
+            // sections may overlap; keep track of how far they reach
+            reach_.resize(sections_.size());
+            rva reach = 0;
+            for (size_t i = 0; i < sections_.size(); ++i) {
+                reach     = max(reach, sections_[i].address + sections_[i].size);
+                reach_[i] = reach;
             }
         }
     }
@@ -53,8 +76,8 @@ public:
                                size_t        size,
                                const string& name)> callback)
     {
-        for (auto& section : cache_) {
-            callback(section.first, section.second.size, section.second.name);
+        for (auto& section : sections_) {
+            callback(section.address, section.size, section.name);
         }
     }
 
@@ -64,72 +87,82 @@ public:
                                      size_t        /*size*/,
                                      const string& /*name*/)> callback)
     {
-        for (auto& section : cache_) {
-            if (section.second.flags & SHF_EXECINSTR) {
-                callback(section.first, section.second.target_address, section.second.size, section.second.name);
+        for (auto& section : sections_) {
+            if (section.flags & SHF_EXECINSTR) {
+                callback(section.address, section.target_address, section.size, section.name);
             }
         }
     }
 
     bool find(rva address, string& name) const
     {
-        bool found = false;
-        for (auto& section : cache_) {
-            if (section.first <= address &&
-                section.first + section.second.size > address)
-            {
-                name = section.second.name;
-                found = true;
-                break;
-            }
+        const section* s = find_first(address, false);
+        if (s) {
+            name = s->name;
         }
-        return found;
+        return s;
     }
 
     bool find(rva address, rva& start, size_t& size, string& name) const
     {
-        bool found = false;
-        for (auto& section : cache_) {
-            if (section.first <= address &&
-                section.first + section.second.size > address)
-            {
-                start = section.first;
-                size  = section.second.size;
-                name  = section.second.name;
-                found = true;
-                break;
-            }
+        const section* s = find_first(address, false);
+        if (s) {
+            start = s->address;
+            size  = s->size;
+            name  = s->name;
         }
-        return found;
+        return s;
     }
 
     bool find(rva func_offset, rva& target_address) const
     {
-        bool found = false;
-        for (auto& section : cache_) {
-            if (section.second.flags & SHF_EXECINSTR) {
-                if (section.first <= func_offset &&
-                    section.first + section.second.size > func_offset)
-                {
-                    target_address = (section.second.target_address - section.first) + func_offset;
-                    found = true;
-                    break;
-                }
-            }
+        const section* s = find_first(func_offset, true);
+        if (s) {
+            target_address = (s->target_address - s->address) + func_offset;
         }
-        return found;
+        return s;
     }
 
 private:
-    typedef struct section { rva target_address; size_t size; string name; rva flags; } section;
+    typedef struct section { rva address; rva target_address; size_t size; string name; rva flags; } section;
 
-    map<rva /*address*/, section> cache_;
+    // the lowest section containing address
+    const section* find_first(rva address, bool executable) const
+    {
+        const section* found = nullptr;
+
+        size_t i = upper_bound(sections_.begin(),
+                               sections_.end(),
+                               address,
+                               [](rva a, const section& s) {
+                                   return a < s.address;
+                               }) - sections_.begin();
+        while (i-- > 0 && reach_[i] > address) {
+            const section& s = sections_[i];
+            if (s.address + s.size > address &&
+                (!executable || (s.flags & SHF_EXECINSTR)))
+            {
+                found = &s;
+            }
+        }
+
+        return found;
+    }
+
+    vector<section> sections_; // by address
+    vector<rva>     reach_;    // the furthest end of sections_[0..i]
 };
 
+// The functions of a module. While the module is being loaded, they are
+// collected with add(); freeze() then sorts them into flat arrays with
+// the names interned, so that looking up a function is a binary search
+// that gives an index to the names instead of a string.
 class object_cache
 {
 public:
-    object_cache() {}
+    typedef mmapped::symbol_id symbol_id;
+
+    object_cache() : start_id_(no_name) {}
 
     void add(const section_cache& sections,
              rva                  address,
@@ -144,15 +177,42 @@ public:
             // hence we need to resort to some trickery here.
             // For now, set the size of the object to cover everything
             // from the beginning of the object to the end of the section.
-            // Then, later in fix_sizes(), truncate sizes so that none of
+            // Then, later in freeze(), truncate sizes so that none of
             // the objects overlap.
-            cache_[address] = {section_size - (address - section_start), name};
+            added_.push_back({address,
+                              section_size - (address - section_start),
+                              intern(name)});
         }
     }
 
-    void fix_sizes()
+    void freeze()
     {
-        // Iterate through the cache, fixing object sizes.
+        // of the objects added at the same address, the last one counts
+        stable_sort(added_.begin(),
+                    added_.end(),
+                    [](const added_object& a, const added_object& b) {
+                        return a.address < b.address;
+                    });
+        size_t count = 0;
+        for (size_t i = 0; i < added_.size(); ++i) {
+            if (count && added_[count - 1].address == added_[i].address) {
+                added_[count - 1] = added_[i];
+            } else {
+                added_[count++] = added_[i];
+            }
+        }
+        added_.resize(count);
+
+        offsets_.resize(count);
+        sizes_.resize(count);
+        names_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            offsets_[i] = added_[i].address;
+            sizes_[i]   = added_[i].size;
+            names_[i]   = added_[i].name;
+        }
+
+        // Truncate the object sizes.
         // add() has set each object's size so that the object covers memory
         // from the beginning of the object to the end of the section.
         // Now truncate them so that each object ends where the next one
@@ -160,49 +220,56 @@ public:
         // We do this because some libraries do funky stuff, like have
         // nested objects or code between objects. This solution is crude,
         // but at least gives us a name for all code.
-        auto next = cache_.begin();
-        if (next != cache_.end()) {
-            auto prev = next;
-            ++next;
-            while (next != cache_.end()) {
-                if (prev->second.size > (next->first - prev->first)) {
-                    prev->second.size = next->first - prev->first;
-                }
+        for (size_t i = 0; i + 1 < count; ++i) {
+            if (sizes_[i] > offsets_[i + 1] - offsets_[i]) {
+                sizes_[i] = offsets_[i + 1] - offsets_[i];
+            }
 #if 1
-                SAT_LOG(2, "FIX SIZE: %" PRIx64 ", %" PRIx64 " %s\n",
-                        prev->first, prev->second.size, prev->second.name.c_str());
+            SAT_LOG(2, "FIX SIZE: %" PRIx64 ", %" PRIx64 " %s\n",
+                    offsets_[i], (uint64_t)sizes_[i], name(names_[i]));
 #endif
-                prev = next;
-                ++next;
-            }
         }
+
+        auto s = ids_.find("_start");
+        if (s != ids_.end()) {
+            start_id_ = s->second;
+        }
+
+        // the objects and names are in place; drop what was needed to
+        // collect them
+        vector<added_object>().swap(added_);
+        unordered_map<string, symbol_id>().swap(ids_);
+        offsets_.shrink_to_fit();
+        sizes_.shrink_to_fit();
+        names_.shrink_to_fit();
+        name_offsets_.shrink_to_fit();
+        name_pool_.shrink_to_fit();
     }
 
-    bool get_cached(rva       offset,
-                    bool&     valid,
-                    string&   name,
-                    unsigned& offset_in_object) const
+    bool get_cached(rva        offset,
+                    bool&      valid,
+                    symbol_id& id,
+                    unsigned&  offset_in_object) const
     {
         bool found = false;
 
-        auto i = cache_.upper_bound(offset);
-        if (i != cache_.begin()) {
-            --i;
-            if (i->first == offset && !i->second.size) {
+        size_t i;
+        if (find(offset, i)) {
+            if (offsets_[i] == offset && !sizes_[i]) {
                 // unknown symbols have been cached with size 0
                 valid = false;
                 found = true;
-            } else if (i->first + i->second.size > offset) {
-                name             = i->second.name;
-                offset_in_object = offset - i->first;
+            } else if (offsets_[i] + sizes_[i] > offset) {
+                id               = names_[i];
+                offset_in_object = offset - offsets_[i];
                 valid            = true;
                 found            = true;
             }
 #ifndef NO_SILLY_HEURISTICS
             // _start is sometimes marked with size 0 in elf headers
-            if (!valid && i->second.name == "_start") {
-                name             = i->second.name;
-                offset_in_object = offset - i->first;
+            if (!valid && names_[i] == start_id_) {
+                id               = names_[i];
+                offset_in_object = offset - offsets_[i];
                 valid            = true;
                 found            = true;
             }
@@ -212,12 +279,17 @@ public:
         return found;
     }
 
+    const char* name(symbol_id id) const
+    {
+        return &name_pool_[name_offsets_[id]];
+    }
+
     void iterate(function<void(rva           address,
                                size_t        size,
                                const string& name)> callback)
     {
-        for (auto& object : cache_) {
-            callback(object.first, object.second.size, object.second.name);
+        for (size_t i = 0; i < offsets_.size(); ++i) {
+            callback(offsets_[i], sizes_[i], name(names_[i]));
         }
     }
 
@@ -225,14 +297,12 @@ public:
     bool find(const section_cache& sections, const string name, rva& address, size_t& size) const
     {
         bool found = false;
-        size_t pos = string::npos;
-        for (auto& object : cache_) {
-            pos = object.second.name.find(name);
-            if (pos != string::npos)
+        for (size_t i = 0; i < offsets_.size(); ++i) {
+            if (strstr(this->name(names_[i]), name.c_str()))
             {
-                if (sections.find(object.first, address))
+                if (sections.find(offsets_[i], address))
                 {
-                    size = object.second.size;
+                    size = sizes_[i];
                     found = true;
                     break;
                 }
@@ -242,9 +312,52 @@ public:
     }
 
 private:
-    typedef struct object { size_t size; string name; } object;
+    static const symbol_id no_name = ~0U;
+
+    // the index of the last object at or before offset
+    bool find(rva offset, size_t& index) const
+    {
+        size_t n = offsets_.size();
+        if (n == 0 || offset < offsets_[0]) {
+            return false;
+        }
+        const rva* base = offsets_.data();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = (base[half] <= offset) ? base + half : base;
+            n   -= half;
+        }
+        index = base - offsets_.data();
+        return true;
+    }
+
+    symbol_id intern(const string& name)
+    {
+        auto i = ids_.find(name);
+        if (i == ids_.end()) {
+            i = ids_.insert({name, (symbol_id)name_offsets_.size()}).first;
+            name_offsets_.push_back(name_pool_.size());
+            name_pool_.insert(name_pool_.end(), name.begin(), name.end());
+            name_pool_.push_back('\0');
+        }
+        return i->second;
+    }
+
+    struct added_object { rva address; size_t size; symbol_id name; };
+
+    // while collecting
+    vector<added_object>             added_;
+    unordered_map<string, symbol_id> ids_;
 
-    map<rva /*address*/, object> cache_;
+    // by address
+    vector<rva>                      offsets_;
+    vector<uint32_t>                 sizes_;
+    vector<symbol_id>                names_;
+
+    // the names, nul-terminated, one after another
+    vector<uint32_t>                 name_offsets_; // by symbol id
+    vector<char>                     name_pool_;
+    symbol_id                        start_id_;
 };
 
 class robuf : public std::streambuf
@@ -410,6 +523,17 @@ protected:
 public:
     virtual void fill_object_cache() = 0;
 
+    // fill the object cache on first use; any number of threads
+    // may be using the same executable
+    void fill_object_cache_once()
+    {
+        call_once(object_cache_once_, [this]() {
+            if (!object_cache_filled_) {
+                fill_object_cache();
+            }
+        });
+    }
+
     virtual void add_x86_64_region(rva begin, rva end)
     {}
     virtual bool is_x86_64_region(rva address)
@@ -418,6 +542,7 @@ public:
     rommapbuf              streambuf_;
     rommapbuf              *sym_streambuf_;
     bool                   object_cache_filled_;
+    once_flag              object_cache_once_;
     object_cache           objects_;
     section_cache          sections_;
     rva                    default_load_address_;
@@ -689,7 +814,7 @@ public:
         fill_object_cache_relocs();
         fill_object_cache_symbols();
 
-        objects_.fix_sizes();
+        objects_.freeze();
         object_cache_filled_ = true;
     }
 
@@ -761,7 +886,7 @@ public:
             }
         }
 
-        objects_.fix_sizes();
+        objects_.freeze();
 
         object_cache_filled_ = true;
     }
@@ -843,7 +968,7 @@ public:
                 }
             }
         }
-        objects_.fix_sizes();
+        objects_.freeze();
 
         object_cache_filled_ = true;
     }
@@ -899,7 +1024,10 @@ shared_ptr<mmapped> mmapped::obtain(const string& path, const string& sym_path,
 {
     shared_ptr<mmapped> result{nullptr};
 
+    static mutex                            cache_mutex;
     static map<string, shared_ptr<mmapped>> cache;
+
+    lock_guard<mutex> lock(cache_mutex);
     auto m = cache.find(path);
     if (m != cache.end()) {
         result = m->second;
@@ -924,15 +1052,18 @@ bool mmapped::is_ok()
     return pimpl_->streambuf_.get(dummy1, dummy2);
 }
 
+void mmapped::load_symbols()
+{
+    pimpl_->fill_object_cache_once();
+}
+
 bool mmapped::get_host_mmap(const unsigned char*& host_load_address,
                             unsigned&             size,
                             unsigned&             bits) const
 {
     bool got_it = false;
 
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
 
     const void* p;
     size_t      s;
@@ -948,22 +1079,39 @@ bool mmapped::get_host_mmap(const unsigned char*& host_load_address,
 
 bool mmapped::get_function(rva offset, string& name, unsigned& offset_in_func)
 {
-    bool got_it = false;
+    symbol_id id;
+    bool      got_it = get_function_id(offset, id, offset_in_func);
 
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
+    if (got_it) {
+        name = pimpl_->objects_.name(id);
     }
 
+    return got_it;
+}
+
+bool mmapped::get_function_id(rva        offset,
+                              symbol_id& name,
+                              unsigned&  offset_in_func)
+{
+    bool got_it = false;
+
+    pimpl_->fill_object_cache_once();
+
     pimpl_->objects_.get_cached(offset, got_it, name, offset_in_func);
 
     return got_it;
 }
 
+const char* mmapped::symbol_name(symbol_id name)
+{
+    pimpl_->fill_object_cache_once();
+
+    return pimpl_->objects_.name(name);
+}
+
 bool mmapped::get_function(string name, rva& address, size_t& size)
 {
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
 
     return pimpl_->objects_.find(pimpl_->sections_, name, address, size);
 }
@@ -972,9 +1120,7 @@ bool mmapped::get_global_function(const string& name, rva& offset)
 {
     bool got_it = false;
 
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
 
     const auto& f = pimpl_->global_function_cache_.find(name);
     if (f != pimpl_->global_function_cache_.end()) {
@@ -989,9 +1135,7 @@ bool mmapped::get_relocation(rva offset, string& name)
 {
     bool got_it = false;
 
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
 
     const auto& r = pimpl_->relocation_cache_.find(offset);
     if (r != pimpl_->relocation_cache_.end()) {
@@ -1006,9 +1150,7 @@ bool mmapped::get_text_section(rva& offset, size_t& size)
 {
     bool got_it = false;
 
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
 
     if (pimpl_->text_section_offset_ && pimpl_->text_section_size_) {
         offset = pimpl_->text_section_offset_;
@@ -1024,45 +1166,45 @@ void mmapped::iterate_functions(function<void(
                                     size_t        /*size*/,
                                     const string& /*name*/)> callback)
 {
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
     pimpl_->objects_.iterate(callback);
 }
 
+void mmapped::iterate_global_functions(function<void(
+                                           const string& /*name*/,
+                                           rva           /*offset*/)> callback)
+{
+    pimpl_->fill_object_cache_once();
+    for (const auto& f : pimpl_->global_function_cache_) {
+        callback(f.first, f.second);
+    }
+}
+
 void mmapped::iterate_executable_sections(function<void(
                                      rva           /*offset*/,
                                      rva           /*target_address*/,
                                      size_t        /*size*/,
                                      const string& /*name*/)> callback)
 {
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
     pimpl_->sections_.iterate_executables(callback);
 }
 
 rva mmapped::default_load_address()
 {
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
     return pimpl_->default_load_address_;
 }
 
 void mmapped::add_x86_64_region(rva begin, rva end)
 {
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
     return pimpl_->add_x86_64_region(begin, end);
 }
 
 bool mmapped::is_x86_64_region(rva address)
 {
-    if (!pimpl_->object_cache_filled_) {
-        pimpl_->fill_object_cache();
-    }
+    pimpl_->fill_object_cache_once();
     return pimpl_->is_x86_64_region(address);
 }
 
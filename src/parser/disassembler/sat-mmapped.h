@@ -38,11 +38,21 @@ public:
 
     bool is_ok();
 
+    // load the symbols, sections and relocations now instead of on
+    // first use
+    void load_symbols();
+
     bool get_host_mmap(const unsigned char*& host_load_address,
                        unsigned&             size,
                        unsigned&             bits) const;
 
     bool get_function(rva offset, string& name, unsigned& offset_in_func);
+    // like get_function() above, but give the name as an id instead of
+    // a copy; the ids of a module are dense, and symbol_name() gives the
+    // name for one
+    typedef uint32_t symbol_id;
+    bool get_function_id(rva offset, symbol_id& name, unsigned& offset_in_func);
+    const char* symbol_name(symbol_id name);
     bool get_function(string name, rva& address, size_t& size);
     bool get_global_function(const string& name, rva& offset);
     bool get_relocation(rva offset, string& name);
@@ -52,6 +62,10 @@ public:
                                          size_t        /*size*/,
                                          const string& /*name*/)> callback);
 
+    // the global functions; the names stay valid as long as the mmapped
+    void iterate_global_functions(function<void(const string& /*name*/,
+                                                rva           /*offset*/)> callback);
+
     void iterate_executable_sections(function<void(
                                               rva           /*offset*/,
                                               rva           /*target_address*/,
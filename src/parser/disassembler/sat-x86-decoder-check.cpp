@@ -0,0 +1,214 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Check the table-driven x86 decoder against capstone over all functions
+// in the given ELF files, and compare their decoding speed.
+#include "sat-mmapped.h"
+#include "sat-disassembler.h"
+#include "sat-x86-decoder.h"
+#include "sat-log.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+const unsigned max_reported_mismatches = 20;
+
+struct statistics {
+    uint64_t instructions; // decoded by capstone
+    uint64_t by_tables;    // of which also decoded by the tables
+    uint64_t mismatches;
+    uint64_t undecodable;  // by capstone
+    uint64_t only_tables;  // decoded by the tables but not by capstone
+    double   capstone_seconds;
+    double   tables_seconds;
+}; // statistics
+
+x86_transfer transfer(const disassembled_instruction& i)
+{
+    x86_transfer t = x86_transfer::NONE;
+    if (i.is_call()) {
+        t = x86_transfer::CALL;
+    } else if (i.is_conditional()) {
+        t = x86_transfer::CONDITIONAL;
+    } else if (i.is_jump()) {
+        t = x86_transfer::JUMP;
+    } else if (i.is_return()) {
+        t = x86_transfer::RETURN;
+    }
+    return t;
+}
+
+bool same(const disassembled_instruction& i, rva address, const x86_instruction& x)
+{
+    return address + x.length == i.next_address()             &&
+           !i.is_syscall() && !i.is_ireturn()                   &&
+           transfer(i)         == x.transfer                    &&
+           i.has_jump_target() == x.has_target                  &&
+           (!x.has_target || i.jump_target() == x.target);
+}
+
+void report(const unsigned char*            code,
+            rva                             address,
+            const disassembled_instruction& i,
+            const x86_instruction&          x)
+{
+    printf("  %" PRIx64 ":", address);
+    for (unsigned n = 0; n < 15 && address + n < i.next_address(); ++n) {
+        printf(" %02x", code[n]);
+    }
+    printf("  %s\n", i.text().c_str());
+    printf("    capstone: length %u, transfer %u, target %s%" PRIx64 "\n",
+           (unsigned)(i.next_address() - address),
+           (unsigned)transfer(i) |
+           (i.is_syscall() || i.is_ireturn() ? 0x80 : 0),
+           i.has_jump_target() ? "" : "-",
+           i.has_jump_target() ? i.jump_target() : 0);
+    printf("    tables:   length %u, transfer %u, target %s%" PRIx64 "\n",
+           x.length,
+           (unsigned)x.transfer,
+           x.has_target ? "" : "-",
+           x.has_target ? x.target : 0);
+}
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void check(const string& path, statistics& s)
+{
+    shared_ptr<mmapped> m = mmapped::obtain(path, path);
+    const unsigned char* host;
+    unsigned             size;
+    unsigned             bits;
+    if (!m || !m->is_ok() || !m->get_host_mmap(host, size, bits)) {
+        fprintf(stderr, "cannot map '%s'\n", path.c_str());
+        return;
+    }
+    rva load_address = 0;
+    shared_ptr<disassembler> d = disassembler::obtain(path, path, load_address);
+    if (!d) {
+        fprintf(stderr, "cannot disassemble '%s'\n", path.c_str());
+        return;
+    }
+
+    printf("%s (%u bits)\n", path.c_str(), bits);
+
+    // sweep through the functions with capstone, checking each instruction
+    // boundary it finds with the tables
+    vector<rva> addresses;
+    set<rva>    functions;
+    m->iterate_functions([&](rva offset, size_t function_size, const string&)
+    {
+        if (!functions.insert(offset).second) {
+            return; // an alias
+        }
+        rva address = load_address + offset;
+        rva end     = address + function_size;
+        while (address < end && address - load_address < size) {
+            const unsigned char* code = host + (address - load_address);
+            size_t               left = size - (address - load_address);
+
+            disassembled_instruction i;
+            x86_instruction          x;
+            bool by_capstone = d->disassemble(address, i);
+            bool by_tables   = x86_decode(code, left, address, bits, x);
+
+            if (!by_capstone) {
+                ++s.undecodable;
+                if (by_tables) {
+                    ++s.only_tables;
+                }
+                ++address;
+                continue;
+            }
+
+            ++s.instructions;
+            addresses.push_back(address);
+            if (by_tables) {
+                ++s.by_tables;
+                if (!same(i, address, x)) {
+                    if (s.mismatches++ < max_reported_mismatches) {
+                        report(code, address, i, x);
+                    }
+                }
+            }
+            address = i.next_address();
+        }
+    });
+
+    // time both over the same instructions
+    auto start = chrono::steady_clock::now();
+    for (auto a : addresses) {
+        disassembled_instruction i;
+        d->disassemble(a, i);
+    }
+    s.capstone_seconds += seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    for (auto a : addresses) {
+        x86_instruction x;
+        if (!x86_decode(host + (a - load_address),
+                        size - (a - load_address),
+                        a,
+                        bits,
+                        x))
+        {
+            disassembled_instruction i;
+            d->disassemble(a, i);
+        }
+    }
+    s.tables_seconds += seconds_since(start);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <elf-file>...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    statistics s{};
+    for (int a = 1; a < argc; ++a) {
+        check(argv[a], s);
+    }
+
+    printf("%" PRIu64 " instructions, %" PRIu64 " (%.1f%%) decoded by the tables\n",
+           s.instructions,
+           s.by_tables,
+           s.instructions ? 100.0 * s.by_tables / s.instructions : 0.0);
+    printf("%" PRIu64 " mismatches\n", s.mismatches);
+    printf("%" PRIu64 " bytes not decodable by capstone, "
+           "%" PRIu64 " of them decodable by the tables\n",
+           s.undecodable, s.only_tables);
+    if (s.capstone_seconds > 0 && s.tables_seconds > 0) {
+        printf("capstone: %.0f instructions/s, "
+               "tables with capstone fallback: %.0f instructions/s\n",
+               s.instructions / s.capstone_seconds,
+               s.instructions / s.tables_seconds);
+    }
+
+    exit(s.mismatches ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,373 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "sat-x86-decoder.h"
+
+namespace sat {
+
+namespace {
+
+// what follows an opcode
+enum : uint16_t {
+    M   = 0x0001, // ModRM byte
+    I8  = 0x0002, // imm8
+    I16 = 0x0004, // imm16
+    IZ  = 0x0008, // imm16/32 by operand size
+    IV  = 0x0010, // imm16/32/64 by operand size
+    MO  = 0x0020, // memory offset by address size
+    R8  = 0x0040, // rel8 branch target
+    RZ  = 0x0080, // rel32 branch target
+    G   = 0x0100, // depends on the ModRM reg field or the prefixes
+    MR  = 0x0200, // ModRM byte that always names registers
+    C   = 0x0400, // leave to capstone
+    X64 = 0x0800, // invalid in 64-bit mode; leave to capstone there
+    P   = 0x1000, // legacy prefix
+    E   = 0x2000, // escape to another opcode map
+};
+
+const uint16_t one_byte[256] = {
+/*        0       1       2       3       4       5       6       7       8       9       a       b       c       d       e       f */
+/* 0 */   M,      M,      M,      M,      I8,     IZ,     X64,    X64,    M,      M,      M,      M,      I8,     IZ,     X64,    E,
+/* 1 */   M,      M,      M,      M,      I8,     IZ,     X64,    X64,    M,      M,      M,      M,      I8,     IZ,     X64,    X64,
+/* 2 */   M,      M,      M,      M,      I8,     IZ,     P,      X64,    M,      M,      M,      M,      I8,     IZ,     P,      X64,
+/* 3 */   M,      M,      M,      M,      I8,     IZ,     P,      X64,    M,      M,      M,      M,      I8,     IZ,     P,      X64,
+/* 4 */   0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,
+/* 5 */   0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,
+/* 6 */   X64,    X64,    E,      M,      P,      P,      P,      P,      IZ,     M|IZ,   I8,     M|I8,   0,      0,      0,      0,
+/* 7 */   R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,     R8,
+/* 8 */   M|I8,   M|IZ,   M|I8|X64, M|I8, M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M|G,
+/* 9 */   0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      C,      0,      0,      0,      0,      0,
+/* a */   MO,     MO,     MO,     MO,     0,      0,      0,      0,      I8,     IZ,     0,      0,      0,      0,      0,      0,
+/* b */   I8,     I8,     I8,     I8,     I8,     I8,     I8,     I8,     IV,     IV,     IV,     IV,     IV,     IV,     IV,     IV,
+/* c */   M|I8,   M|I8,   I16,    0,      E,      E,      M|I8,   M|G,    I16|I8, 0,      C,      C,      C,      C,      C,      C,
+/* d */   M,      M,      M,      M,      C,      C,      C,      0,      M,      M,      M,      M,      M,      M,      M,      M,
+/* e */   C,      C,      C,      C,      I8,     I8,     I8,     I8,     RZ,     RZ,     C,      R8,     0,      0,      0,      0,
+/* f */   P,      C,      P,      P,      0,      0,      M|G,    M|G,    0,      0,      0,      0,      0,      0,      M,      M|G,
+};
+
+const uint16_t two_byte[256] = {
+/*        0       1       2       3       4       5       6       7       8       9       a       b       c       d       e       f */
+/* 0 */   M,      M,      M,      M,      C,      C,      0,      C,      0,      0,      C,      C,      C,      M,      C,      C,
+/* 1 */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* 2 */   MR,     MR,     MR,     MR,     C,      C,      C,      C,      M,      M,      M,      M,      M,      M,      M,      M,
+/* 3 */   0,      0,      0,      0,      C,      C,      C,      0,      E,      C,      E,      C,      C,      C,      C,      C,
+/* 4 */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* 5 */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* 6 */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* 7 */   M|I8,   M|I8,   M|I8,   M|I8,   M,      M,      M,      0,      M|G,    M,      C,      C,      M,      M,      M,      M,
+/* 8 */   RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,     RZ,
+/* 9 */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* a */   0,      0,      0,      M,      M|I8,   M,      C,      C,      0,      0,      0,      M,      M|I8,   M,      M,      M,
+/* b */   M,      M,      M,      M,      M,      M,      M,      M,      M|G,    C,      M|I8,   M,      M,      M,      M,      M,
+/* c */   M,      M,      M|I8,   M,      M|I8,   M|I8,   M|I8,   M,      0,      0,      0,      0,      0,      0,      0,      0,
+/* d */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* e */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,
+/* f */   M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      M,      C,
+};
+
+// VEX and EVEX encoded instructions of the 0F map with an imm8
+bool vex_map1_has_imm8(uint8_t opcode)
+{
+    return (opcode >= 0x70 && opcode <= 0x73) ||
+           opcode == 0xc2                       ||
+           (opcode >= 0xc4 && opcode <= 0xc6);
+}
+
+// the number of bytes of ModRM, SIB and displacement at p
+unsigned modrm_length(const unsigned char* p, const unsigned char* end,
+                      bool address16)
+{
+    if (p >= end) {
+        return 0;
+    }
+
+    unsigned mod = *p >> 6;
+    unsigned rm  = *p & 7;
+    unsigned n   = 1;
+
+    if (mod == 3) {
+        return n;
+    }
+    if (address16) {
+        if (mod == 0 && rm == 6) {
+            n += 2;
+        } else {
+            n += mod == 1 ? 1 : mod == 2 ? 2 : 0;
+        }
+    } else {
+        if (rm == 4) {
+            if (p + 1 >= end) {
+                return 0;
+            }
+            ++n; // SIB
+            if (mod == 0 && (p[1] & 7) == 5) {
+                n += 4;
+            }
+        } else if (mod == 0 && rm == 5) {
+            n += 4;
+        }
+        n += mod == 1 ? 1 : mod == 2 ? 4 : 0;
+    }
+
+    return n;
+}
+
+} // anonymous namespace
+
+
+bool x86_decode(const unsigned char* code,
+                size_t               size,
+                rva                  address,
+                unsigned             bits,
+                x86_instruction&     instruction)
+{
+    if (bits != 32 && bits != 64) {
+        return false;
+    }
+
+    const unsigned max_length = 15;
+    const unsigned char* end = code + (size < max_length ? size : max_length);
+    const unsigned char* p   = code;
+
+    // legacy prefixes and REX
+    bool operand16 = false;
+    bool address16 = false; // in 32-bit mode
+    bool address32 = false; // in 64-bit mode
+    bool f2        = false;
+    bool f3        = false;
+    bool lock      = false;
+    bool rex       = false;
+    bool rex_w     = false;
+    for (; p < end; ++p) {
+        if (one_byte[*p] & P) {
+            if (*p == 0x66) {
+                operand16 = true;
+            } else if (*p == 0x67) {
+                if (bits == 64) {
+                    address32 = true;
+                } else {
+                    address16 = true;
+                }
+            } else if (*p == 0xf2) {
+                f2 = true;
+            } else if (*p == 0xf3) {
+                f3 = true;
+            } else if (*p == 0xf0) {
+                lock = true;
+            }
+            rex   = false; // REX must come last
+            rex_w = false;
+        } else if (bits == 64 && (*p & 0xf0) == 0x40) {
+            rex   = true;
+            rex_w = *p & 0x08;
+        } else {
+            break;
+        }
+    }
+    if (p >= end) {
+        return false;
+    }
+
+    // the opcode
+    uint8_t  opcode = *p++;
+    uint16_t flags;
+    unsigned map    = 0; // 0: one byte, 1: 0F, 2: 0F 38, 3: 0F 3A
+
+    if (opcode == 0x0f) {
+        if (p >= end) {
+            return false;
+        }
+        opcode = *p++;
+        map    = 1;
+        if (opcode == 0x38 || opcode == 0x3a) {
+            if (p >= end) {
+                return false;
+            }
+            map    = opcode == 0x38 ? 2 : 3;
+            opcode = *p++;
+            flags  = map == 2 ? M : M | I8;
+        } else {
+            flags = two_byte[opcode];
+        }
+    } else if (opcode == 0xc4 || opcode == 0xc5 || opcode == 0x62) {
+        // VEX or EVEX in 64-bit mode, or when the next byte would be a
+        // ModRM byte naming registers; otherwise LES, LDS or BOUND
+        if (p >= end || (bits == 32 && (*p & 0xc0) != 0xc0)) {
+            return false;
+        }
+        // no legacy SSE prefixes or REX with VEX
+        if (operand16 || f2 || f3 || lock || rex) {
+            return false;
+        }
+        unsigned payload = opcode == 0xc5 ? 1 : opcode == 0xc4 ? 2 : 3;
+        if (p + payload >= end) {
+            return false;
+        }
+        map = opcode == 0xc5 ? 1 : opcode == 0xc4 ? (p[0] & 0x1f) : (p[0] & 0x07);
+        if (map < 1 || map > 3) {
+            return false;
+        }
+        p      += payload;
+        opcode  = *p++;
+        if (map == 1) {
+            flags = opcode == 0x77 ? 0 : vex_map1_has_imm8(opcode) ? M | I8 : M;
+        } else {
+            flags = map == 2 ? M : M | I8;
+        }
+    } else {
+        flags = one_byte[opcode];
+    }
+
+    if ((flags & (C | E)) || (bits == 64 && (flags & X64))) {
+        return false;
+    }
+
+    // ModRM dependent and prefix dependent encodings
+    unsigned reg = p < end ? (*p >> 3) & 7 : 0;
+    if (flags & G) {
+        if (p >= end) {
+            return false;
+        }
+        if (map == 0) {
+            switch (opcode) {
+            case 0x8f: // XOP unless POP
+                if (reg != 0) {
+                    return false;
+                }
+                break;
+            case 0xc7: // XBEGIN
+                if (*p == 0xf8) {
+                    return false;
+                }
+                flags |= IZ;
+                break;
+            case 0xf6: // TEST imm8
+                if (reg < 2) {
+                    flags |= I8;
+                }
+                break;
+            case 0xf7: // TEST imm
+                if (reg < 2) {
+                    flags |= IZ;
+                }
+                break;
+            case 0xff: // far CALL and JMP
+                if (reg == 3 || reg == 5) {
+                    return false;
+                }
+                break;
+            }
+        } else if (map == 1) {
+            switch (opcode) {
+            case 0x78: // EXTRQ and INSERTQ
+                if (operand16 || f2) {
+                    return false;
+                }
+                break;
+            case 0xb8: // POPCNT unless JMPE
+                if (!f3) {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+
+    // branches with an operand size prefix are handled differently by
+    // different processors
+    if ((flags & (R8 | RZ)) && operand16) {
+        return false;
+    }
+
+    // ModRM, SIB and displacement
+    if (flags & MR) {
+        if (p >= end) {
+            return false;
+        }
+        ++p;
+    } else if (flags & M) {
+        unsigned n = modrm_length(p, end, address16);
+        if (n == 0) {
+            return false;
+        }
+        p += n;
+    }
+
+    // immediates
+    unsigned immediate = 0;
+    if (flags & I8) {
+        immediate += 1;
+    }
+    if (flags & I16) {
+        immediate += 2;
+    }
+    if (flags & IZ) {
+        immediate += operand16 ? 2 : 4;
+    }
+    if (flags & IV) {
+        immediate += rex_w ? 8 : operand16 ? 2 : 4;
+    }
+    if (flags & MO) {
+        immediate += bits == 64 ? (address32 ? 4 : 8) : (address16 ? 2 : 4);
+    }
+    if (flags & R8) {
+        immediate += 1;
+    }
+    if (flags & RZ) {
+        immediate += 4;
+    }
+    if (p + immediate > end) {
+        return false;
+    }
+    p += immediate;
+
+    instruction.length     = p - code;
+    instruction.transfer   = x86_transfer::NONE;
+    instruction.has_target = false;
+    instruction.target     = 0;
+
+    // control transfers
+    if (flags & (R8 | RZ)) {
+        int64_t relative = (flags & R8) ? (int8_t)p[-1]
+                                        : (int32_t)(p[-4]         |
+                                                    p[-3] << 8    |
+                                                    p[-2] << 16   |
+                                                    (uint32_t)p[-1] << 24);
+        instruction.has_target = true;
+        instruction.target     = address + instruction.length + relative;
+        if (bits == 32) {
+            instruction.target &= 0xffffffff;
+        }
+        if (map == 1 || (map == 0 && opcode >= 0x70 && opcode <= 0x7f)) {
+            instruction.transfer = x86_transfer::CONDITIONAL;
+        } else if (opcode == 0xe8) {
+            instruction.transfer = x86_transfer::CALL;
+        } else {
+            instruction.transfer = x86_transfer::JUMP;
+        }
+    } else if (map == 0 && (opcode == 0xc2 || opcode == 0xc3)) {
+        instruction.transfer = x86_transfer::RETURN;
+    } else if (map == 0 && opcode == 0xff) {
+        if (reg == 2) {
+            instruction.transfer = x86_transfer::CALL;
+        } else if (reg == 4) {
+            instruction.transfer = x86_transfer::JUMP;
+        }
+    }
+
+    return true;
+}
+
+} // sat
@@ -0,0 +1,50 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_X86_DECODER_H
+#define SAT_X86_DECODER_H
+
+#include "sat-types.h"
+#include <cstddef>
+
+namespace sat {
+
+// The control transfers that x86_decode() classifies; they correspond
+// to the capstone instruction groups that the disassembler looks at.
+enum class x86_transfer : uint8_t {
+    NONE, CALL, JUMP, CONDITIONAL, RETURN
+}; // x86_transfer
+
+struct x86_instruction {
+    uint8_t      length;
+    x86_transfer transfer;
+    bool         has_target;
+    rva          target;     // direct target, if has_target
+}; // x86_instruction
+
+// Find out the length of the 32- or 64-bit x86 instruction at code and
+// the control transfer it makes, with opcode tables instead of a full
+// disassembly. Returns false for encodings that are rare, invalid or
+// ambiguous, and for transfers other than plain calls, jumps and returns;
+// leave those to capstone.
+bool x86_decode(const unsigned char* code,
+                size_t               size,
+                rva                  address,
+                unsigned             bits,
+                x86_instruction&     instruction);
+
+} // sat
+
+#endif // SAT_X86_DECODER_H
@@ -105,6 +105,7 @@ bool caching_path_mapper::find_file(const string& target_path,
 {
     bool found = false;
 
+    lock_guard<mutex> lock(mutex_);
     auto i = ram_cache_.find(target_path);
     if (i != ram_cache_.end()) {
         if (i->second.first != "" && i->second.second != "") {
@@ -18,6 +18,7 @@
 
 #include "sat-path-mapper.h"
 #include <map>
+#include <mutex>
 
 namespace sat {
 
@@ -42,6 +43,7 @@ protected:
 private:
     bool resolve_host_path(const string& target_path, string& host_path, string& sym_path) const;
 
+    mutable mutex                             mutex_; // for ram_cache_
     mutable map<string, pair<string, string>> ram_cache_;
     FILE*                                     file_cache_;
     string                                    cache_dir_path_;
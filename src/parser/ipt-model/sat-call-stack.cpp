@@ -18,17 +18,22 @@
 #include <cstdio>
 #include <string>
 #include <cinttypes>
+#include <algorithm>
 
 
 namespace sat {
 
-int call_stack::max_depth_ = 0;
+atomic<int> call_stack::max_depth_{0};
 
 void call_stack::check_for_max_depth()
 {
-    if (stack_ptr_->peak_ - stack_ptr_->low_water_mark_ > max_depth_) {
-        max_depth_ = stack_ptr_->peak_ - stack_ptr_->low_water_mark_;
-        SAT_LOG(1, "@ ! d %d\n", max_depth_);
+    int depth = stack_ptr_->peak_ - stack_ptr_->low_water_mark_;
+    int max   = max_depth_;
+    while (depth > max) {
+        if (max_depth_.compare_exchange_weak(max, depth)) {
+            SAT_LOG(1, "@ ! d %d\n", depth);
+            break;
+        }
     }
 }
 
@@ -43,11 +48,26 @@ void call_stack::push(rva caller_nlip)
 }
 
 rva call_stack::pop(bool lost)
+{
+    return pop(lost, true);
+}
+
+rva call_stack::pop_known_target()
+{
+    return pop(false, false);
+}
+
+rva call_stack::pop(bool lost, bool need_address)
 {
     rva pc = 0;
     if (stack_ptr_->stack_.empty()) {
         if (!lost) {
             --stack_ptr_->offset_;
+            if (need_address && relative_ && !using_temp_stack() &&
+                !needed_underflow_)
+            {
+                needed_underflow_ = -stack_ptr_->offset_;
+            }
             if (stack_ptr_->offset_ < stack_ptr_->low_water_mark_) {
                 stack_ptr_->low_water_mark_ = stack_ptr_->offset_;
                 check_for_max_depth();
@@ -68,4 +88,46 @@ void call_stack::iterate(std::function<void(rva)> callback) const
     }
 }
 
+void call_stack::make_relative()
+{
+    orig_stack_       = stack_data();
+    relative_         = true;
+    needed_underflow_ = 0;
+}
+
+bool call_stack::fits_on(const call_stack& base) const
+{
+    return !needed_underflow_ ||
+           needed_underflow_ > base.orig_stack_.stack_.size();
+}
+
+void call_stack::rebase(const call_stack& base)
+{
+    // the offset of a relative stack counts its returns below the start;
+    // they returned to the top of base until it ran out
+    stack_data rebased(base.orig_stack_);
+    size_t     underflows = -orig_stack_.offset_;
+    size_t     size       = rebased.stack_.size();
+
+    if (underflows <= size) {
+        rebased.stack_.resize(size - underflows);
+    } else {
+        rebased.stack_.clear();
+        rebased.offset_        -= underflows - size;
+        rebased.low_water_mark_ = min(rebased.low_water_mark_,
+                                      rebased.offset_);
+    }
+    rebased.stack_.insert(rebased.stack_.end(),
+                          orig_stack_.stack_.begin(),
+                          orig_stack_.stack_.end());
+    rebased.peak_ = max(rebased.peak_,
+                        base.original_depth() + orig_stack_.peak_);
+
+    orig_stack_ = rebased;
+    tmp_stack_.low_water_mark_ = min(tmp_stack_.low_water_mark_,
+                                     base.tmp_stack_.low_water_mark_);
+    relative_         = false;
+    needed_underflow_ = 0;
+}
+
 }
@@ -19,6 +19,7 @@
 #include "sat-types.h"
 #include <vector>
 #include <functional>
+#include <atomic>
 
 namespace sat{
 
@@ -32,13 +33,35 @@ namespace sat{
 
     class call_stack {
     public:
-        call_stack() : orig_stack_(), tmp_stack_()
+        call_stack() :
+            orig_stack_(), tmp_stack_(), relative_(), needed_underflow_()
         {
             temp_stack_disable();
         }
 
+        call_stack(const call_stack& other) :
+            orig_stack_(other.orig_stack_), tmp_stack_(other.tmp_stack_),
+            relative_(other.relative_),
+            needed_underflow_(other.needed_underflow_)
+        {
+            stack_ptr_ = other.using_temp_stack() ? &tmp_stack_ : &orig_stack_;
+        }
+
+        call_stack& operator=(const call_stack& other)
+        {
+            orig_stack_       = other.orig_stack_;
+            tmp_stack_        = other.tmp_stack_;
+            relative_         = other.relative_;
+            needed_underflow_ = other.needed_underflow_;
+            stack_ptr_  = other.using_temp_stack() ? &tmp_stack_ : &orig_stack_;
+            return *this;
+        }
+
         void push(rva caller_nlip);
         rva pop(bool lost = false);
+        // pop for a return whose target is known from the trace;
+        // the return address is only good for checking the target
+        rva pop_known_target();
         void clear() { stack_ptr_->stack_.clear(); stack_ptr_->offset_ = 0; stack_ptr_->peak_ = 0; }
         void temp_stack_enable() { stack_ptr_ = &tmp_stack_; clear(); }
         void temp_stack_disable() { stack_ptr_ = &orig_stack_; }
@@ -47,14 +70,41 @@ namespace sat{
 
         void iterate(std::function<void(rva)> callback) const;
 
+        // A relative call stack starts out empty on top of an original
+        // stack that is not known yet. Depths of the original stack are
+        // output marked with '~' so that they can be rebased later.
+        void make_relative();
+        const char* depth_mark() const
+        {
+            return relative_ && !using_temp_stack() ? "~" : "";
+        }
+        // forget how low the temporary stack has been so far
+        void restart_temp_low_water_mark() { tmp_stack_.low_water_mark_ = 0; }
+        // true unless a return below the start of this relative stack
+        // needed a return address that base has
+        bool fits_on(const call_stack& base) const;
+        // put this relative stack on top of the original stack of base
+        void rebase(const call_stack& base);
+        int original_depth() const
+        {
+            return orig_stack_.stack_.size() + orig_stack_.offset_;
+        }
+
     private:
+        bool using_temp_stack() const { return stack_ptr_ == &tmp_stack_; }
+
         void check_for_max_depth();
+        rva pop(bool lost, bool need_address);
 
         stack_data   orig_stack_;
         stack_data   tmp_stack_;
         stack_data*  stack_ptr_;
+        bool         relative_;
+        unsigned     needed_underflow_; // first return below the start of
+                                        // a relative stack that needed
+                                        // the return address, 1-based
 
-        static int max_depth_;
+        static atomic<int> max_depth_; // over all call stacks
     };
 
 }
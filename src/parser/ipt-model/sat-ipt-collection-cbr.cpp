@@ -14,7 +14,7 @@
 // limitations under the License.
 */
 #include "sat-ipt-collection.h"
-#include "sat-ipt-iterator.h"
+#include "sat-ipt-index.h"
 #include <fstream>
 #include <cinttypes>
 
@@ -44,26 +44,31 @@ int main(int argc, char* argv[])
 
     /* new implementation */
     for (const auto& p : collection.ipt_paths()) {
-        ipt_iterator ipt(p);
-        ipt.iterate([&](const ipt_iterator::token& t, size_t offset) {
-            if (t.func == &ipt_iterator::output::tsc) {
-                if (t.tsc >= earliest_tsc) {
+        auto index = ipt_index::obtain(p);
+        if (!index) {
+            fprintf(stderr, "could not index IPT file '%s'\n", p.c_str());
+            exit(EXIT_FAILURE);
+        }
+        auto packets = index->packets();
+        for (size_t i = 0; i < packets.size; ++i) {
+            if (packets.kind[i] == ipt_packet_kind::TSC) {
+                if (packets.payload[i] >= earliest_tsc) {
                     output_cbr = true;
-                    latest_tsc = t.tsc;
+                    latest_tsc = packets.payload[i];
                 } else {
                     output_cbr = false;
                 }
             }
-            if (t.func == &ipt_iterator::output::cbr) {
+            if (packets.kind[i] == ipt_packet_kind::CBR) {
                 if (output_cbr) {
                     printf("%" PRIu64 "|%u|%u|%u\n", 
                            latest_tsc - earliest_tsc,
                            cpu,
-                           t.cbr,
-                           t.cbr);
+                           (unsigned)packets.payload[i],
+                           (unsigned)packets.payload[i]);
                 }
             }
-        });
+        }
         ++cpu;
     }
 }
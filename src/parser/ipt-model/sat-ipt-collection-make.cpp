@@ -14,21 +14,155 @@
 // limitations under the License.
 */
 #include "sat-ipt-collection.h"
+#include "sat-ipt-index.h"
+#include "sat-ipt-parser-sideband-info.h"
+#include "sat-sideband-model.h"
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace sat;
 
 void usage(const char* name)
 {
-    printf("Usage: %s -s <sideband-file> -t <ipt-file> \n", name);
+    printf("Usage: %s -s <sideband-file> -t <ipt-file> \n"
+           "       %s -f -o <collection-file> [-i <seconds>] [-q <seconds>] "
+           "-s <sideband-file> -t <ipt-file>\n"
+           "  -f  follow the files while they are still being written,\n"
+           "      rewriting the collection file when they have grown by a\n"
+           "      quarter or have stopped growing for a poll; each one is\n"
+           "      a whole collection of the blocks complete by then, and\n"
+           "      sat-ipt-model models all of it again when run on it\n"
+           "  -o  collection file to write in follow mode\n"
+           "  -i  seconds between polls for new data (default 1)\n"
+           "  -q  seconds without new data after which the capture is\n"
+           "      taken to be finished (default 10)\n",
+           name, name);
 }
 
+namespace {
+
+// replace the collection file atomically, so that readers always see
+// a whole collection
+bool write_collection(ipt_collection& collection, const string& path)
+{
+    if (!collection) {
+        fprintf(stderr, "could not collect the traces; "
+                        "not writing collection '%s'\n", path.c_str());
+        return false;
+    }
+
+    string temp = path + "." + to_string(getpid());
+    bool   done = false;
+    {
+        ofstream out(temp);
+        done = out && collection.serialize(out) && out.flush();
+    }
+    done = done && rename(temp.c_str(), path.c_str()) == 0;
+    if (!done) {
+        (void)unlink(temp.c_str());
+        fprintf(stderr, "could not write collection '%s'\n", path.c_str());
+    }
+    return done;
+}
+
+off_t file_size(const string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// poll the trace files until they have not grown for quiet_seconds,
+// writing a collection of the blocks that are complete as they grow
+// and a collection of all blocks in the end.
+//
+// Every collection is built from the whole traces, so intermediate
+// collections are only written when the traces have grown by a quarter
+// since the last one, or have stopped growing for a poll; that keeps
+// the work for all of them within a constant factor of building the
+// final collection, instead of growing with the square of the trace.
+//
+// Only the sideband model and the IPT indices are extended as the files
+// grow. Collections are not appended to, and the model has no follow
+// mode: it takes a whole collection, so modeling an intermediate one
+// gives early results for the blocks in it, and the tasks get modeled
+// from their beginning again on the next collection.
+int follow(const string&         sideband_path,
+           const vector<string>& ipt_paths,
+           const string&         collection_path,
+           unsigned              poll_seconds,
+           unsigned              quiet_seconds)
+{
+    sideband_info::follow(sideband_path);
+    for (const auto& p : ipt_paths) {
+        ipt_index::follow(p);
+    }
+
+    auto           sideband = make_shared<sideband_model>();
+    vector<off_t>  sizes(ipt_paths.size());
+    off_t          written  = 0; // total size at the last collection
+    bool           pending  = false;
+    unsigned       quiet    = 0;
+
+    for (;;) {
+        bool grew = sideband->update(sideband_path);
+        for (unsigned i = 0; i < ipt_paths.size(); ++i) {
+            off_t size = file_size(ipt_paths[i]);
+            if (size != sizes[i]) {
+                sizes[i] = size;
+                grew     = true;
+            }
+        }
+
+        off_t total = file_size(sideband_path);
+        for (auto size : sizes) {
+            total += size;
+        }
+
+        if (grew) {
+            quiet   = 0;
+            pending = true;
+        } else if ((quiet += poll_seconds) >= quiet_seconds) {
+            break;
+        }
+
+        if (pending && (!grew || total >= written + written / 4)) {
+            ipt_collection collection(sideband,
+                                      sideband_path,
+                                      ipt_paths,
+                                      ipt_collection::tsc_horizon(ipt_paths));
+            (void)write_collection(collection, collection_path);
+            written = total;
+            pending = false;
+        }
+
+        sleep(poll_seconds);
+    }
+
+    ipt_collection collection(sideband,
+                              sideband_path,
+                              ipt_paths,
+                              numeric_limits<uint64_t>::max());
+    return write_collection(collection, collection_path) ? EXIT_SUCCESS :
+                                                           EXIT_FAILURE;
+}
+
+} // anonymous namespace
+
 int main(int argc, char* argv[])
 {
     string         sideband_path;
     vector<string> ipt_paths;
+    bool           following     = false;
+    string         collection_path;
+    unsigned       poll_seconds  = 1;
+    unsigned       quiet_seconds = 10;
     int            c;
 
-    while ((c = getopt(argc, argv, ":s:t:r:")) != EOF) {
+    while ((c = getopt(argc, argv, ":s:t:r:fo:i:q:")) != EOF) {
         switch (c) {
         case 's':
             sideband_path = optarg;
@@ -40,6 +174,18 @@ int main(int argc, char* argv[])
         case 'r':
             ipt_paths.push_back(optarg);
             break;
+        case 'f':
+            following = true;
+            break;
+        case 'o':
+            collection_path = optarg;
+            break;
+        case 'i':
+            poll_seconds = max(1, atoi(optarg));
+            break;
+        case 'q':
+            quiet_seconds = max(1, atoi(optarg));
+            break;
         case '?':
             fprintf(stderr, "unknown option '%c'\n", optopt);
             usage(argv[0]);
@@ -53,11 +199,21 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (sideband_path.empty() || ipt_paths.empty()) {
+    if (sideband_path.empty() || ipt_paths.empty() ||
+        (following && collection_path.empty()))
+    {
         usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    if (following) {
+        return follow(sideband_path,
+                      ipt_paths,
+                      collection_path,
+                      poll_seconds,
+                      quiet_seconds);
+    }
+
     ipt_collection collection(sideband_path, ipt_paths);
     collection.serialize(cout);
 } // main
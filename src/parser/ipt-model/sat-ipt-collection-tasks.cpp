@@ -51,7 +51,7 @@ int main(int argc, char* argv[])
         stringstream ss;
         int thread_id_int;
 
-        if (!tid_get_info(tid, pid, thread_id, cpu)) {
+        if (!sideband->get_tid_info(tid, pid, thread_id, cpu)) {
             fprintf(stderr, "could not get pid & thread id for tid %u\n", tid);
             exit(EXIT_FAILURE);
         }
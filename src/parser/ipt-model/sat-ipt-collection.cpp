@@ -18,9 +18,12 @@
 #include "sat-getline.h"
 #include "sat-sideband-model.h"
 #include "sat-ipt-file.h"
+#include "sat-ipt-index.h"
 #include "sat-log.h"
 #include <map>
 #include <set>
+#include <limits>
+#include <algorithm>
 
 namespace sat {
 
@@ -33,7 +36,7 @@ string task_name(tid_t tid, shared_ptr<sideband_model> sideband)
     pid_t              thread_id;
     unsigned           cpu;
 
-    if (tid_get_info(tid, pid, thread_id, cpu)) {
+    if (sideband->get_tid_info(tid, pid, thread_id, cpu)) {
         string t;
         if (sideband->get_thread_name(thread_id, t)) {
             // task has its own name; use it
@@ -55,6 +58,13 @@ string task_name(tid_t tid, shared_ptr<sideband_model> sideband)
 } // anonymous namespace
 
 struct ipt_collection::imp {
+    imp() : ok_(true) {}
+
+    bool build(shared_ptr<sideband_model> sideband,
+               const string&              sideband_path,
+               const vector<string>&      ipt_paths,
+               uint64_t                   tsc_horizon,
+               bool                       partial);
     bool serialize(ostream& stream) const;
     bool deserialize(istream& is);
 
@@ -145,16 +155,47 @@ ipt_collection::ipt_collection(const string&         sideband_path,
     imp_(make_unique<imp>())
 {
     // build sideband
-    imp_->sideband_path_ = sideband_path;
     auto sideband = make_shared<sideband_model>();
     sideband->build(sideband_path);
 
-    imp_->ipt_paths_ = ipt_paths;
+    if (!imp_->build(sideband, sideband_path, ipt_paths,
+                     numeric_limits<uint64_t>::max(), false))
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+ipt_collection::ipt_collection(shared_ptr<sideband_model> sideband,
+                               const string&              sideband_path,
+                               const vector<string>&      ipt_paths,
+                               uint64_t                   tsc_horizon) :
+    imp_(make_unique<imp>())
+{
+    imp_->ok_ = imp_->build(sideband, sideband_path, ipt_paths,
+                            tsc_horizon, true);
+}
+
+bool ipt_collection::imp::build(shared_ptr<sideband_model> sideband,
+                                const string&              sideband_path,
+                                const vector<string>&      ipt_paths,
+                                uint64_t                   tsc_horizon,
+                                bool                       partial)
+{
+    sideband_path_ = sideband_path;
+    ipt_paths_     = ipt_paths;
 // TODO should this be in IMP ?? bstorola
     vector<shared_ptr<ipt_file>> ipt_files;
     unsigned cpu = 0;
     for (const auto& ipt_path : ipt_paths) {
-        ipt_files.push_back(make_shared<ipt_file>(cpu, ipt_path, sideband, sideband_path));
+        auto f = make_shared<ipt_file>(cpu, ipt_path, sideband, sideband_path);
+        if (!f->ok()) {
+            if (!partial) {
+                return false;
+            }
+            // the trace has not got to the first quantum yet
+        } else {
+            ipt_files.push_back(f);
+        }
         ++cpu;
     }
 
@@ -192,14 +233,17 @@ ipt_collection::ipt_collection(const string&         sideband_path,
         do {
             shared_ptr<ipt_task> task;
             auto tid = (*first)->current()->tid_;
-            auto t = imp_->tasks_.find(tid);
-            if (t == imp_->tasks_.end()) {
-                task = make_shared<ipt_task>(tid, task_name(tid, sideband));
-                imp_->tasks_.insert({tid, task});
-            } else {
-                task = t->second;
+            auto block = (*first)->current();
+            if (!partial || block->tsc_.second < tsc_horizon) {
+                auto t = tasks_.find(tid);
+                if (t == tasks_.end()) {
+                    task = make_shared<ipt_task>(tid, task_name(tid, sideband));
+                    tasks_.insert({tid, task});
+                } else {
+                    task = t->second;
+                }
+                task->append_block(block);
             }
-            task->append_block((*first)->current());
             (*first)->advance();
             if (!(*first)->current()) {
                 ipt_files.erase(first);
@@ -211,6 +255,7 @@ ipt_collection::ipt_collection(const string&         sideband_path,
 
     }
 
+    return true;
 }
 
 ipt_collection::ipt_collection(istream& is) :
@@ -290,6 +335,28 @@ shared_ptr<ipt_task> ipt_collection::task(tid_t tid) const
     return result;
 }
 
+uint64_t ipt_collection::tsc_horizon(const vector<string>& ipt_paths)
+{
+    uint64_t result = numeric_limits<uint64_t>::max();
+
+    for (const auto& p : ipt_paths) {
+        auto     index  = ipt_index::obtain(p);
+        uint64_t latest = 0;
+        if (index) {
+            auto packets = index->packets();
+            for (size_t i = packets.size; i > 0; --i) {
+                if (packets.kind[i - 1] == ipt_packet_kind::TSC) {
+                    latest = packets.payload[i - 1];
+                    break;
+                }
+            }
+        }
+        result = min(result, latest);
+    }
+
+    return result;
+}
+
 uint64_t ipt_collection::earliest_tsc() const
 {
     uint64_t result = 0;
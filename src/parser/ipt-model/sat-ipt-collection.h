@@ -18,6 +18,7 @@
 
 #include "sat-memory.h"
 #include "sat-ipt-task.h"
+#include "sat-sideband-model.h"
 #include <iostream>
 #include <vector>
 
@@ -29,6 +30,13 @@ class ipt_collection {
 public:
     explicit ipt_collection(const string&         sideband_path,
                             const vector<string>& ipt_paths);
+    // collect the blocks of traces that are still being written, using
+    // a sideband model that is kept up to date by the caller; only the
+    // blocks that end before tsc_horizon are included
+    explicit ipt_collection(shared_ptr<sideband_model> sideband,
+                            const string&              sideband_path,
+                            const vector<string>&      ipt_paths,
+                            uint64_t                   tsc_horizon);
     explicit ipt_collection(istream& is);
     ~ipt_collection();
 
@@ -43,6 +51,10 @@ public:
     vector<tid_t>        tids() const;
     shared_ptr<ipt_task> task(tid_t tid) const;
     vector<tid_t>        tids_in_decreasing_order_of_trace_size() const;
+
+    // the latest tsc that every trace has got to; blocks that end before
+    // it will not change when the traces are appended to
+    static uint64_t tsc_horizon(const vector<string>& ipt_paths);
 private:
     class imp;
     unique_ptr<imp> imp_;
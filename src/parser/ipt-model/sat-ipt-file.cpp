@@ -16,6 +16,7 @@
 #include "sat-ipt-file.h"
 #include "sat-ipt-block.h"
 #include "sat-ipt-tsc-heuristics.h"
+#include "sat-ipt-index.h"
 #include "sat-ipt-scheduling-heuristics.h"
 #include "sat-sideband-model.h"
 #include <vector>
@@ -31,14 +32,19 @@ struct ipt_file::imp {
     const string path_;
     block_set    blocks_;
     block_set::iterator iterator_;
+    bool         ok_;
 };
 
 ipt_file::ipt_file(unsigned                         cpu,
                    const string&                    path,
                    shared_ptr<const sideband_model> sideband,
                    const string&                    sideband_path) :
-    imp_(new imp{cpu, path, block_set{}})
+    imp_(new imp{cpu, path, block_set{}, block_set::iterator{}, true})
 {
+    // index the trace once, watching for the scheduler TIPs as well,
+    // so that the heuristics below can share the index
+    (void)ipt_index::obtain(imp_->path_, sideband->scheduler_tip());
+
     // apply tsc heuristics
     //auto schedulings = make_shared<scheduling_heuristics>(cpu, ipt_path, sideband);
     tsc_heuristics tscs(sideband_path);
@@ -86,7 +92,9 @@ ipt_file::ipt_file(unsigned                         cpu,
                                          quantum_tid))
     {
         fprintf(stderr, "ERROR: No schedule first quantum detected!\n");
-        exit(EXIT_FAILURE);
+        imp_->blocks_.clear();
+        imp_->ok_ = false;
+        return;
     }
 
     uint32_t erased_block_count=0;
@@ -373,6 +381,11 @@ ipt_file::ipt_file(unsigned                         cpu,
 
 }
 
+bool ipt_file::ok() const
+{
+    return imp_->ok_;
+}
+
 shared_ptr<ipt_block> ipt_file::begin() const
 {
     shared_ptr<ipt_block> result = NULL;
@@ -30,6 +30,8 @@ public:
              const string&                    path,
              shared_ptr<const sideband_model> sideband,
              const string&                    sideband_path);
+    // false if the trace could not be split into scheduling quanta
+    bool ok() const;
     shared_ptr<ipt_block> begin() const;
     shared_ptr<ipt_block> current() const;
     void advance() const;
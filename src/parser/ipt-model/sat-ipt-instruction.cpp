@@ -27,125 +27,145 @@ rva instruction::copy_user2_address_ = 0;
 //rva instruction::memset_address_     = 0;
 
 
+bool instruction::tip(context& c) const
+{
+    switch (kind_) {
+    case NON_TRANSFER:       return non_transfer(c);
+    case DIRECT_JUMP:        return direct_jump(c);
+    case DIRECT_CONDITIONAL: return direct_conditional(c);
+    case DIRECT_CALL:        return direct_call(c);
+    case INDIRECT_CALL:      return indirect_call(c);
+    case INDIRECT_JUMP:      return indirect_jump(c);
+    case INDIRECT_RETURN:    return indirect_return(c);
+    case INDIRECT_SYSCALL:   return indirect_syscall(c);
+    case INDIRECT_IRETURN:   return indirect_ireturn(c);
+    case ERROR:
+    default:                 return error(c);
+    }
+}
+
+
 // non-transfer instruction
 
-class non_transfer : public instruction {
-private:
-    inline bool execute(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else {
-            c.pc_ = next_address(c);
-            return false;
-        }
-    }
-public:
-    virtual bool tip(context& c) const
-    {
-        return execute(c);
+bool instruction::non_transfer(context& c) const
+{
+    if (fup_check(c)) {
+        return true;
+    } else {
+        c.pc_ = next_address(c);
+        return false;
     }
-}; // non_transfer
+}
 
 
 // direct transfer instructions
 
-class direct_transfer : public instruction {
-public:
-    explicit direct_transfer(rva target) : target_(target) {}
-
-    inline rva target(const context& c) const
-    {
-        return /* c.offset_ + */ target_;
+bool instruction::direct_jump(context& c) const
+{
+    if (fup_check(c)) {
+        return true;
+    } else {
+        c.pc_ = target(c);
+        return false;
     }
+}
 
-    virtual bool execute(context& c) const = 0;
-protected:
-    const rva target_;
-}; // direct_transfer
-
-class direct_jump : public direct_transfer {
-private:
-    inline bool execute(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else {
+bool instruction::direct_conditional(context& c) const
+{
+    if (fup_check(c)) {
+        return true;
+    } else if (!c.tnts_.empty()) {
+        if (target(c) == c.pc_) {
+            // a branch to itself: consume the whole run of taken bits
+            // at once, counting the spins other than this one; the pc
+            // stays here, so the not-taken bit that ends the run is
+            // handled by the next execution
+            unsigned spins = c.tnts_.consume_taken();
+            if (spins) {
+                c.instruction_count_ += spins - 1;
+                SAT_LOG(1, "taken %u times\n", spins);
+                SAT_LOG(1, "%u TNTs left\n", c.tnts_.size());
+                return false;
+            }
+        }
+        if (c.tnts_.taken()) {
+            SAT_LOG(1, "taken\n");
             c.pc_ = target(c);
-            return false;
+        } else {
+            SAT_LOG(1, "not taken\n");
+            c.pc_ = next_address(c);
         }
-    }
-public:
-    explicit direct_jump(rva target) : direct_transfer(target) {}
-    virtual bool tip(context& c) const
-    {
-        return execute(c);
-    }
-}; // direct_jump
-
-class direct_conditional : public direct_transfer {
-private:
-    inline bool execute(context& c) const
-    {
-        SAT_LOG(0, "ERROR: WE ARE IN execute() OF A DIRECT CONDITIONAL\n");
+        SAT_LOG(1, "%u TNTs left\n", c.tnts_.size());
+        return false;
+    } else {
+        SAT_LOG(0, "ERROR: CONDITIONAL WITHOUT TNT\n");
         c.get_lost();
         return true;
     }
-public:
-    explicit direct_conditional(rva target) : direct_transfer(target) {}
-    virtual bool tip(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else if (!c.tnts_.empty()) {
-            if (c.tnts_.taken()) {
-                SAT_LOG(1, "taken\n");
-                c.pc_ = target(c);
-            } else {
-                SAT_LOG(1, "not taken\n");
-                c.pc_ = next_address(c);
-            }
-            SAT_LOG(1, "%u TNTs left\n", c.tnts_.size());
-            return false;
-        } else {
-            SAT_LOG(0, "ERROR: CONDITIONAL WITHOUT TNT\n");
+}
+
+bool instruction::direct_call(context& c) const
+{
+    rva t    = target(c);
+    rva next = next_address(c);
+
+    if (fup_check(c)) {
+        return true;
+    } else if (t > c.pc_ && t < next) {
+        // it is a call instruction with an address pointing to itself;
+        // must be a relocation that the loader has patched
+        if (!c.resolve_relocation(t)) {
+
+            fprintf(stderr, "ERROR: unknown relocation\n");
+            SAT_LOG(0, "ERROR: unknown relocation; WE ARE LOST\n");
             c.get_lost();
             return true;
         }
+    } else if (t == next) {
+        // It is a call to the next instruction;
+        // assume it is a trick to obtain PC,
+        // and treat it as a regular instruction.
+        // We can be certain that the NLIP created by the call
+        // is useless, so discard the stack item altogether to
+        // avoid a warning when we get the TIP.
+        goto adjust_pc;
+    } else if (c.ignone_stack_manipulation_in_this_function_) {
+        goto adjust_pc;
     }
-}; // direct_conditional
 
-class direct_call : public direct_transfer {
-private:
-    inline bool execute(context& c) const
-    {
-        rva t    = target(c);
-        rva next = next_address(c);
+    c.output_instructions_before_call();
+    c.pending_output_call_ = true;
+    //c.ret_stack_.push_back(next);
+    c.call_stack_.push(next);
+    SAT_LOG(1, "saving return address %" PRIx64 "\n", next);
+    //printf("ret stack depth %u\n", (unsigned)c.ret_stack_.size());
+    SAT_LOG(1, "ret stack depth %d\n", c.call_stack_.depth());
+adjust_pc:
+    c.pc_ = t;
+    return false;
+}
 
-        if (fup_check(c)) {
-            return true;
-        } else if (t > c.pc_ && t < next) {
-            // it is a call instruction with an address pointing to itself;
-            // must be a relocation that the loader has patched
-            if (!c.resolve_relocation(t)) {
 
-                fprintf(stderr, "ERROR: unknown relocation\n");
-                SAT_LOG(0, "ERROR: unknown relocation; WE ARE LOST\n");
-                c.get_lost();
-                return true;
-            }
-        } else if (t == next) {
-            // It is a call to the next instruction;
-            // assume it is a trick to obtain PC,
-            // and treat it as a regular instruction.
-            // We can be certain that the NLIP created by the call
-            // is useless, so discard the stack item altogether to
-            // avoid a warning when we get the TIP.
-            goto adjust_pc;
-        } else if (c.ignone_stack_manipulation_in_this_function_) {
-            goto adjust_pc;
-        }
+// indirect transfer instructions
+
+bool instruction::indirect_jump(context& c) const
+{
+    if (fup_check(c)) {
+        return true;
+    } else {
+        SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
+        c.pc_ = c.tip_;
+    }
+    return true;
+}
 
+bool instruction::indirect_call(context& c) const
+{
+    if (fup_check(c)) {
+        return true;
+    } else {
+        rva next = next_address(c);
+        c.pc_ = c.tip_;
         c.output_instructions_before_call();
         c.pending_output_call_ = true;
         //c.ret_stack_.push_back(next);
@@ -153,229 +173,296 @@ private:
         SAT_LOG(1, "saving return address %" PRIx64 "\n", next);
         //printf("ret stack depth %u\n", (unsigned)c.ret_stack_.size());
         SAT_LOG(1, "ret stack depth %d\n", c.call_stack_.depth());
-adjust_pc:
-        c.pc_ = t;
-        return false;
-    }
-public:
-    explicit direct_call(rva target) : direct_transfer(target) {}
-    virtual bool tip(context& c) const
-    {
-        return execute(c);
-    }
-}; // direct_call
-
-
-// indirect transfer instructions
-
-class indirect_transfer : public instruction {
-public:
-}; // indirect_transfer
-
-class indirect_jump : public indirect_transfer {
-public:
-    virtual bool tip(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else {
-            SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
-            c.pc_ = c.tip_;
-        }
-        return true;
+        SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
     }
-}; // indirect_jump
+    return true;
+}
 
-class indirect_call : public indirect_transfer {
-public:
-    virtual bool tip(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else {
-            rva next = next_address(c);
-            c.pc_ = c.tip_;
-            c.output_instructions_before_call();
-            c.pending_output_call_ = true;
-            //c.ret_stack_.push_back(next);
-            c.call_stack_.push(next);
-            SAT_LOG(1, "saving return address %" PRIx64 "\n", next);
-            //printf("ret stack depth %u\n", (unsigned)c.ret_stack_.size());
-            SAT_LOG(1, "ret stack depth %d\n", c.call_stack_.depth());
-            SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
-        }
+bool instruction::indirect_syscall(context& c) const
+{
+    if (fup_check(c)) {
         return true;
+    } else {
+        c.syscall_ = true;
+        rva next = next_address(c);
+        c.pc_ = c.tip_;
+        c.output_instructions_before_call();
+        c.pending_output_call_ = true;
+        c.call_stack_.push(next);
+        SAT_LOG(1, "saving return address %" PRIx64 "\n", next);
+        SAT_LOG(1, "ret stack depth %d\n", c.call_stack_.depth());
+        SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
     }
-}; // indirect_call
+    return true;
+}
 
-class indirect_syscall : public indirect_transfer {
-public:
-    virtual bool tip(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else {
-            c.syscall_ = true;
-            rva next = next_address(c);
-            c.pc_ = c.tip_;
-            c.output_instructions_before_call();
-            c.pending_output_call_ = true;
-            c.call_stack_.push(next);
-            SAT_LOG(1, "saving return address %" PRIx64 "\n", next);
-            SAT_LOG(1, "ret stack depth %d\n", c.call_stack_.depth());
-            SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
-        }
+bool instruction::indirect_return(context& c) const
+{
+    if (fup_check(c)) {
         return true;
-    }
-}; // indirect_syscall
-
-class indirect_return : public indirect_transfer {
-public:
-    virtual bool tip(context& c) const
-    {
-        if (fup_check(c)) {
-            return true;
-        } else if (!c.tnts_.empty()) {
-            if (c.tnts_.taken()) {
-                c.output_instructions();
-                c.pc_ = c.call_stack_.pop();
-                if (c.pc_) {
-                // if (!c.ret_stack_.empty()) {
-                //     c.pc_ = c.ret_stack_.back();
-                //     c.ret_stack_.pop_back();
-                    SAT_LOG(1, "compressed ret %" PRIx64 "\n", c.pc_);
-                    SAT_LOG(1, "ret stack depth %d\n",
-                            c.call_stack_.depth());
-                           //(unsigned)c.ret_stack_.size());
-                    SAT_LOG(1, "%u TNTs left\n", c.tnts_.size());
-                    return false;
-                } else {
-                    SAT_LOG(0, "ERROR: COMPRESSED RET WITH EMPTY STACK\n");
-                    c.get_lost();
-                    return true;
-                }
+    } else if (!c.tnts_.empty()) {
+        if (c.tnts_.taken()) {
+            c.output_instructions();
+            c.pc_ = c.call_stack_.pop();
+            if (c.pc_) {
+            // if (!c.ret_stack_.empty()) {
+            //     c.pc_ = c.ret_stack_.back();
+            //     c.ret_stack_.pop_back();
+                SAT_LOG(1, "compressed ret %" PRIx64 "\n", c.pc_);
+                SAT_LOG(1, "ret stack depth %d\n",
+                        c.call_stack_.depth());
+                       //(unsigned)c.ret_stack_.size());
+                SAT_LOG(1, "%u TNTs left\n", c.tnts_.size());
+                return false;
             } else {
-                SAT_LOG(0, "ERROR: COMPRESSED RET WITH N\n");
+                SAT_LOG(0, "ERROR: COMPRESSED RET WITH EMPTY STACK\n");
                 c.get_lost();
                 return true;
             }
         } else {
-            SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
-            c.output_instructions();
-            c.pc_ = c.call_stack_.pop();
-            if (c.pc_ && (c.pc_ != c.tip_)) {
-                SAT_LOG(0, "ERROR: TIP does not match with return address from call_stack (%" PRIx64 ")\n", c.pc_);
-            }
-            c.pc_ = c.tip_;
+            SAT_LOG(0, "ERROR: COMPRESSED RET WITH N\n");
+            c.get_lost();
             return true;
         }
+    } else {
+        SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
+        c.output_instructions();
+        c.pc_ = c.call_stack_.pop_known_target();
+        if (c.pc_ && (c.pc_ != c.tip_)) {
+            SAT_LOG(0, "ERROR: TIP does not match with return address from call_stack (%" PRIx64 ")\n", c.pc_);
+        }
+        c.pc_ = c.tip_;
+        return true;
     }
-}; // indirect_return
+}
 
-class indirect_ireturn : public indirect_transfer {
-public:
-    virtual bool tip(context& c) const
-    {
+bool instruction::indirect_ireturn(context& c) const
+{
 #if 0
-        string function;
-        //get_location(c.tip_, function);
-        unsigned u = 0;
-        if (find(c.call_stack_->begin(),
-                 c.call_stack_->end(),
-                 c.tip_) != c.call_stack_->end())
-        {
-            rva dropped;
-            do {
-                dropped = c.call_stack_->back();
-                c.call_stack_->pop_back();
-                ++u;
-            } while (dropped != c.tip_);
-        }
-        printf("DROPPED %u RETURNING FROM AN INTERRUPT TO %s\n", u, function.c_str());
+    string function;
+    //get_location(c.tip_, function);
+    unsigned u = 0;
+    if (find(c.call_stack_->begin(),
+             c.call_stack_->end(),
+             c.tip_) != c.call_stack_->end())
+    {
+        rva dropped;
+        do {
+            dropped = c.call_stack_->back();
+            c.call_stack_->pop_back();
+            ++u;
+        } while (dropped != c.tip_);
+    }
+    fprintf(output_stream(), "DROPPED %u RETURNING FROM AN INTERRUPT TO %s\n", u, function.c_str());
 #endif
 
-        //print_location(c.tip_);
-        SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
-        c.output_iret(c.tip_);
-        c.pc_ = c.tip_;
+    //print_location(c.tip_);
+    SAT_LOG(1, "using tip %" PRIx64 "\n", c.tip_);
+    c.output_iret(c.tip_);
+    c.pc_ = c.tip_;
 
-        return true;
-    }
-};
+    return true;
+}
 
 
-instruction* instruction::make(rva address, const disassembled_instruction& i)
+// an instruction that could not be disassembled
+
+bool instruction::error(context& c) const
 {
-    instruction* result;
+    c.get_lost();
+    fprintf(output_stream(), "tip virtual impl\n");
+    return true;
+}
+
+
+instruction instruction::make(rva address, const disassembled_instruction& i)
+{
+    instruction result;
+
+    result.address_ = address;
+    result.length_  = i.next_address() - address;
 
     // if (address == memcpy_address_ || address == memset_address_) {
-    //     result = new indirect_return;
+    //     result.kind_ = INDIRECT_RETURN;
     if (i.is_transfer()) {
         if (i.has_jump_target()) {
+            result.target_ = i.jump_target();
             if (i.is_call()) {
                 if (i.jump_target() == mcount_address_ ||
                     i.jump_target() == cmpxchg_address_)
                 {
-                    result = new non_transfer;
-                } else if (i.jump_target() == copy_user1_address_) {
-                    result = new direct_call(copy_user2_address_);
+                    result.kind_ = NON_TRANSFER;
                 } else {
-                    result = new direct_call(i.jump_target());
+                    if (i.jump_target() == copy_user1_address_) {
+                        result.target_ = copy_user2_address_;
+                    }
+                    result.kind_ = DIRECT_CALL;
                 }
             } else if (i.is_conditional()) {
-                result = new direct_conditional(i.jump_target());
+                result.kind_ = DIRECT_CONDITIONAL;
             } else {
                 if (i.jump_target() == copy_user1_address_) {
-                    result = new direct_jump(copy_user2_address_);
-                } else {
-                    result = new direct_jump(i.jump_target());
+                    result.target_ = copy_user2_address_;
                 }
+                result.kind_ = DIRECT_JUMP;
             }
         } else {
             if (i.is_call()) {
-                result = new indirect_call;
+                result.kind_ = INDIRECT_CALL;
             } else if (i.is_jump()) {
-                result = new indirect_jump;
+                result.kind_ = INDIRECT_JUMP;
             } else if (i.is_return()) {
-                result = new indirect_return;
+                result.kind_ = INDIRECT_RETURN;
             } else if (i.is_syscall()) {
-                result = new indirect_syscall;
+                result.kind_ = INDIRECT_SYSCALL;
             } else {
-                result = new indirect_ireturn;
+                result.kind_ = INDIRECT_IRETURN;
             }
                 // printf("TODO: INDIRECT IRET\n"); exit(EXIT_FAILURE);
-                // result = new error_instruction(address); // TODO
+                // result.kind_ = ERROR; // TODO
         }
     } else {
-        result = new non_transfer;
+        result.kind_ = NON_TRANSFER;
+    }
+
+    return result;
+}
+
+instruction instruction::make_error(rva address)
+{
+    instruction result;
+
+    result.address_ = address;
+#if 0
+    result.length_  = 0; // TODO: is this the right thing to do?
+#endif
+    result.kind_    = ERROR;
+
+    return result;
+}
+
+
+const instruction* instruction_cache::insert(const instruction& i)
+{
+    if (used_ == chunk_size) {
+        chunks_.emplace_back(new instruction[chunk_size]);
+        used_ = 0;
     }
+    instruction* result = &chunks_.back()[used_++];
+    *result = i;
+    index_.insert({i.address(), result});
+
+    return result;
+}
 
-    result->next_address_ = i.next_address();
-    result->text_         = i.text();
 
+const instruction* shared_module_cache::find(rva address)
+{
+    lock_guard<mutex> lock(mutex_);
+    const instruction* result = instructions_.find(address);
+    if (result) {
+        ++reused_;
+    }
     return result;
 }
 
-instruction_iterator::instruction_iterator(instruction_cache&       cache,
-                                           shared_ptr<disassembler> disassembler,
-                                           unsigned                 offset,
-                                           rva                      address,
-                                           const string&            symbol) :
+const instruction* shared_module_cache::insert(const instruction& i)
+{
+    lock_guard<mutex> lock(mutex_);
+    const instruction* result = instructions_.find(i.address());
+    if (!result) {
+        result = instructions_.insert(i);
+    }
+    return result;
+}
+
+const basic_block* shared_module_cache::find_block(rva address)
+{
+    lock_guard<mutex> lock(mutex_);
+    const basic_block* result = nullptr;
+    auto b = blocks_.find(address);
+    if (b != blocks_.end()) {
+        result = &b->second;
+        ++reused_;
+    }
+    return result;
+}
+
+const basic_block* shared_module_cache::insert_block(rva                address,
+                                                     const basic_block& block)
+{
+    lock_guard<mutex> lock(mutex_);
+    return &blocks_.insert({address, block}).first->second;
+}
+
+void shared_module_cache::statistics(size_t& instructions,
+                                     size_t& blocks,
+                                     size_t& reused)
+{
+    lock_guard<mutex> lock(mutex_);
+    instructions = instructions_.size();
+    blocks       = blocks_.size();
+    reused       = reused_;
+}
+
+
+shared_module_cache& shared_module_caches::get(const shared_ptr<disassembler>& d)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& e = caches_[d.get()];
+    if (!e.cache_) {
+        e.disassembler_ = d;
+        e.cache_.reset(new shared_module_cache);
+    }
+    return *e.cache_;
+}
+
+void shared_module_caches::statistics(size_t& instructions,
+                                      size_t& blocks,
+                                      size_t& reused)
+{
+    lock_guard<mutex> lock(mutex_);
+    instructions = blocks = reused = 0;
+    for (auto& c : caches_) {
+        size_t i, b, r;
+        c.second.cache_->statistics(i, b, r);
+        instructions += i;
+        blocks       += b;
+        reused       += r;
+    }
+}
+
+
+instruction_iterator::instruction_iterator(module_cache&     cache,
+                                           disassembler&     disassembler,
+                                           const system_map* functions,
+                                           unsigned          offset,
+                                           rva               address) :
     first_call_(true),
     cache_(cache),
-    disassembler_(disassembler),
+    current_(),
+    disassembler_(&disassembler),
+    functions_(functions),
     offset_(offset),
     entry_point_(address),
-    symbol_(symbol)
+    symbol_(nullptr)
 {
     seek(address);
 }
 
+void instruction_iterator::reset(rva entry_point)
+{
+    first_call_  = true;
+    entry_point_ = entry_point;
+    symbol_      = nullptr;
+    seek(entry_point);
+}
+
 bool instruction_iterator::seek(rva address)
 {
     bool found = false;
-    ici_ = cache_.lower_bound(address);
-    if (ici_ != cache_.end() && ici_->first == address) {
+    current_ = find(address);
+    if (current_) {
         found = true;
     } else {
         found = disassemble(address);
@@ -385,58 +472,100 @@ bool instruction_iterator::seek(rva address)
 
 const instruction* instruction_iterator::next()
 {
-    const instruction* result = 0;
     if (first_call_) {
-        //printf("in first call, ici_->first is %" PRIx64 "\n", ici_->first);
         first_call_ = false;
-        result = ici_->second;
     } else {
-        //printf("in subsequent call at (%" PRIx64 ", %s)\n", ici_->first, ici_->second->text().c_str());
-        rva next_address = ici_->second->next_address_;
-        //printf("advancing\n");
-        ++ici_;
-        //printf("seeing where we got\n");
-        if (ici_ == cache_.end() || ici_->first != next_address) {
-            //printf("disassembling\n");
+        rva next_address = current_->address_ + current_->length_;
+        current_ = find(next_address);
+        if (!current_) {
             disassemble(next_address);
         }
-        //printf("checking\n");
-        result = ici_->second;
     }
-    return result;
+    return current_;
 }
 
 bool instruction_iterator::disassemble(rva address)
 {
     //printf("disassemble(%" PRIx64 ")\n", address);
     bool done = false;
-    disassembled_instruction instr;
-    instruction* i;
-    if (disassembler_->disassemble(address, instr)) {
-        //printf("disassembled\n");
-        i = instruction::make(address, instr);
-        //printf("made\n");
-    } else {
-        SAT_LOG(0, "UNABLE TO DISASSEMBLE %" PRIx64 "\n", address);
-        i = new error_instruction(address);
-    }
-    if (ici_ != cache_.begin()) {
-        //printf("reversing\n");
-        --ici_;
+
+    // decode it only if no other worker has
+    current_ = cache_.shared_.find(address);
+    if (!current_) {
+        disassembled_instruction instr;
+        if (disassembler_->disassemble(address, instr)) {
+            current_ = cache_.shared_.insert(instruction::make(address, instr));
+        } else {
+            SAT_LOG(0, "UNABLE TO DISASSEMBLE %" PRIx64 "\n", address);
+            current_ = cache_.shared_.insert(instruction::make_error(address));
+        }
     }
-    //printf("inserting %" PRIx64 "\n", address);
-    ici_ = cache_.insert(ici_, {address, i});
-    //printf("inserted (%" PRIx64 ", %s)\n", ici_->first, ici_->second->text().c_str());
+    cache_.instructions_.insert({address, current_});
+
     done = true;
     return done;
 }
 
-const string& instruction_iterator::symbol()
+const basic_block& instruction_iterator::block(rva address)
 {
-    if (symbol_ == "") {
-        // we don't have a symbol yet, resolve it now
+    auto b = cache_.blocks_.find(address);
+    if (b == cache_.blocks_.end()) {
+        const basic_block* shared = cache_.shared_.find_block(address);
+        if (!shared) {
+            // walk the run of instructions with a copy of this iterator
+            instruction_iterator walker(*this);
+            basic_block          block{};
+            const instruction*   i = walker.next();
+
+            while (i->get_kind() == instruction::NON_TRANSFER) {
+                ++block.count_;
+                i = walker.next();
+            }
+            block.kind_       = i->get_kind();
+            block.terminator_ = i;
+
+            shared = cache_.shared_.insert_block(address, block);
+        }
+        b = cache_.blocks_.insert({address, shared}).first;
+    }
+
+    return *b->second;
+}
+
+void instruction_iterator::skip(const basic_block& block)
+{
+    current_    = block.terminator_;
+    first_call_ = true;
+}
+
+string instruction_iterator::text(const instruction& i)
+{
+    string text;
+    if (i.get_kind() == instruction::ERROR ||
+        !disassembler_->get_text(i.address(), text))
+    {
+        text = "COULD NOT DISASSEMBLE";
+    }
+    return text;
+}
+
+const char* instruction_iterator::symbol()
+{
+    if (!symbol_) {
+        // we don't have a symbol yet, resolve it now without copying it
         unsigned dummy;
-        if (!disassembler_->get_function(entry_point_, symbol_, dummy)) {
+        if (functions_) {
+            const string* name;
+            if (functions_->get_function(entry_point_, name, dummy)) {
+                symbol_ = name->c_str();
+            }
+        } else {
+            disassembler::symbol_id id;
+            if (disassembler_->get_function_id(entry_point_, id, dummy)) {
+                symbol_ = disassembler_->symbol_name(id);
+            }
+        }
+        if (!symbol_) {
             symbol_ = "unknown";
         }
     }
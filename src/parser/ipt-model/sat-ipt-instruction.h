@@ -19,10 +19,15 @@
 #include "sat-ipt-tnt.h"
 #include "sat-tid.h"
 #include "sat-disassembler.h"
+#include "sat-system-map.h"
 #include "sat-call-stack.h"
 #include "sat-ipt-model.h"
 #include "sat-log.h"
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace sat {
 
@@ -44,7 +49,7 @@ struct context
     void get_lost()
     {
         lost_     = true;
-        printf("get_lost\n");
+        fprintf(output_stream(), "get_lost\n");
         // Clean tnt buffer.
         tnts_.clean();
         syscall_ = false;
@@ -54,8 +59,9 @@ struct context
     {
         if (previously_output_tsc_ != tsc_.begin) {
             if (!fast_forward_) {
-                printf("@ t %" PRIx64 "\n", // t for timestamp
-                       tsc_.begin - global_initial_tsc);
+                fprintf(output_stream(),
+                        "@ t %" PRIx64 "\n", // t for timestamp
+                        tsc_.begin - global_initial_tsc);
             }
             SAT_LOG(1, "ts %" PRIx64 " <- %" PRIx64 "\n",
                     tsc_.begin - global_initial_tsc, tsc_.begin);
@@ -66,8 +72,9 @@ struct context
     void force_output_timestamp()
     {
         if (!fast_forward_) {
-            printf("@ t %" PRIx64 "\n", // t for timestamp
-                   tsc_.begin - global_initial_tsc + 1);
+            fprintf(output_stream(),
+                    "@ t %" PRIx64 "\n", // t for timestamp
+                    tsc_.begin - global_initial_tsc + 1);
         }
         SAT_LOG(1, "ts %" PRIx64 " <- %" PRIx64 "\n",
                 tsc_.begin - global_initial_tsc + 1, tsc_.begin);
@@ -78,7 +85,7 @@ struct context
     {
         maybe_output_timestamp();
         if (!fast_forward_) {
-            printf("@ > %u\n", cpu_); // i for schedule in
+            fprintf(output_stream(), "@ > %u\n", cpu_); // i for schedule in
         }
     }
 
@@ -87,7 +94,7 @@ struct context
         force_output_timestamp();
         //maybe_output_timestamp();
         if (!fast_forward_) {
-            printf("@ < %u\n", cpu_); // i for schedule in
+            fprintf(output_stream(), "@ < %u\n", cpu_); // i for schedule in
         }
     }
 
@@ -95,18 +102,20 @@ struct context
     {
         maybe_output_timestamp();
         if (!fast_forward_) {
-            printf("@ x %u\n", id); // x for transfer
+            fprintf(output_stream(), "@ x %u\n", id); // x for transfer
         }
     }
 
     void output_instructions(unsigned id)
     {
         if (!fast_forward_) {
-            printf("@ e %d %u %" PRIu64 "\n", // e for execute
-                   call_stack_.depth(),
-                   id,
-                   instruction_count_ -
-                   previously_output_instruction_count_);
+            fprintf(output_stream(),
+                    "@ e %s%d %u %" PRIu64 "\n", // e for execute
+                    call_stack_.depth_mark(),
+                    call_stack_.depth(),
+                    id,
+                    instruction_count_ -
+                    previously_output_instruction_count_);
         }
         previously_output_instruction_count_ = instruction_count_;
     }
@@ -135,8 +144,10 @@ struct context
     void output_call(unsigned function_id)
     {
         if (!fast_forward_) {
-            printf("@ c %d %u\n", // c for call
-               call_stack_.depth() - 1, function_id);
+            fprintf(output_stream(),
+                    "@ c %s%d %u\n", // c for call
+                    call_stack_.depth_mark(),
+                    call_stack_.depth() - 1, function_id);
         }
     }
 
@@ -144,8 +155,10 @@ struct context
     {
         output_previous_instructions();
         if (!fast_forward_) {
-            printf("@ r %d %" PRIx64 " (iret)\n", // r for return
-                   call_stack_.depth(), address);
+            fprintf(output_stream(),
+                    "@ r %s%d %" PRIx64 " (iret)\n", // r for return
+                    call_stack_.depth_mark(),
+                    call_stack_.depth(), address);
         }
         previously_output_instruction_count_ = instruction_count_;
     }
@@ -175,7 +188,7 @@ struct context
 
     void dump()
     {
-        printf("TSC: %lx, PC: %lx\n", tsc_.begin, pc_);
+        fprintf(output_stream(), "TSC: %lx, PC: %lx\n", tsc_.begin, pc_);
     }
 
     tid_t       tid_;
@@ -217,26 +230,42 @@ struct context
 }; // context
 
 
+// A decoded instruction: the kind of control transfer it makes, if any,
+// and its direct target. The text of the instruction is not kept; get it
+// from instruction_iterator::text() when showing disassembly.
 class instruction {
     friend class instruction_iterator;
 public:
-    static instruction* make(rva address, const disassembled_instruction& i);
+    // the kind of control transfer an instruction makes
+    enum kind : uint8_t {
+        NON_TRANSFER,
+        DIRECT_JUMP, DIRECT_CONDITIONAL, DIRECT_CALL,
+        INDIRECT_CALL, INDIRECT_JUMP, INDIRECT_RETURN, INDIRECT_SYSCALL,
+        INDIRECT_IRETURN,
+        ERROR
+    };
 
-    const string& text() const { return text_; }
+    instruction() : address_(), target_(), length_(), kind_(ERROR) {}
+
+    static instruction make(rva address, const disassembled_instruction& i);
+    static instruction make_error(rva address);
+
+    kind get_kind() const { return kind_; }
+    rva  address()  const { return address_; }
 
     inline rva next_address(const context& c) const
     {
-        return /*c.offset_ +*/ next_address_;
+        return /*c.offset_ +*/ address_ + length_;
     }
 
-    virtual bool tip(context& c) const = 0;
+    bool tip(context& c) const;
 
     inline bool fup_check(context& c) const
     {
         bool r = false;
         // FUP can't be deferred, so wait until tnt buffer is empty
         if (c.tnts_.empty() && c.pc_ == c.fup_) {
-            printf("fup %lx found, take fup action %lx\n", c.fup_, c.tip_);
+            fprintf(output_stream(), "fup %lx found, take fup action %lx\n", c.fup_, c.tip_);
             c.pc_ = c.tip_;
             c.fup_ = 0;
             r = true;
@@ -251,50 +280,169 @@ public:
     //static rva memcpy_address_;
     //static rva memset_address_;
 
-protected:
-    rva    next_address_;
-    string text_;
+private:
+    inline rva target(const context& c) const
+    {
+        return /* c.offset_ + */ target_;
+    }
+
+    bool non_transfer      (context& c) const;
+    bool direct_jump       (context& c) const;
+    bool direct_conditional(context& c) const;
+    bool direct_call       (context& c) const;
+    bool indirect_jump     (context& c) const;
+    bool indirect_call     (context& c) const;
+    bool indirect_syscall  (context& c) const;
+    bool indirect_return   (context& c) const;
+    bool indirect_ireturn  (context& c) const;
+    bool error             (context& c) const;
+
+    rva     address_;
+    rva     target_;
+    uint8_t length_;
+    kind    kind_;
 }; // instruction
 
-class error_instruction : public instruction {
+
+// The instructions of a module, indexed by address. They are allocated
+// in chunks and never move, so pointers to them stay valid as more are
+// added.
+class instruction_cache {
 public:
-    error_instruction(rva address)
+    instruction_cache() : used_(chunk_size) {}
+
+    const instruction* find(rva address) const
     {
-#if 0
-        next_address_ = address; // TODO: is this the right thing to do?
-#endif
-        text_         = "COULD NOT DISASSEMBLE";
+        auto i = index_.find(address);
+        return i != index_.end() ? i->second : nullptr;
     }
 
-    virtual bool tip    (context& c) const { c.get_lost(); printf("tip virtual impl\n"); return true; }
-};
+    const instruction* insert(const instruction& i);
+
+    size_t size() const { return index_.size(); }
+
+private:
+    static const size_t chunk_size = 4096;
+
+    vector<unique_ptr<instruction[]>>      chunks_;
+    size_t                                 used_; // of the last chunk
+    unordered_map<rva, const instruction*> index_;
+}; // instruction_cache
+
+// A straight run of non-transfer instructions up to the control transfer
+// that ends it, for executing the whole run in one step.
+struct basic_block {
+    uint32_t           count_;      // of non-transfer instructions
+    instruction::kind  kind_;       // of the terminating transfer
+    const instruction* terminator_;
+}; // basic_block
+
+// The instructions and basic blocks of a module that any worker of a
+// model has seen, so that each is decoded and kept only once. Workers
+// find them through module caches of their own and only come here,
+// under the lock, for the ones they have not seen yet.
+class shared_module_cache {
+public:
+    shared_module_cache() : reused_() {}
+
+    // the instruction at address, if some worker has decoded it
+    const instruction* find(rva address);
 
+    // add an instruction; if another worker got to add the instruction
+    // at the same address first, keep and return that one
+    const instruction* insert(const instruction& i);
 
-using instruction_cache = map<rva, instruction*>;
+    // the same for the basic block starting at address
+    const basic_block* find_block(rva address);
+    const basic_block* insert_block(rva address, const basic_block& block);
+
+    // how many instructions and blocks there are, and how many times a
+    // worker found one that another worker had already made
+    void statistics(size_t& instructions, size_t& blocks, size_t& reused);
+
+private:
+    mutex                           mutex_;
+    instruction_cache               instructions_;
+    unordered_map<rva, basic_block> blocks_; // nodes never move
+    size_t                          reused_;
+}; // shared_module_cache
+
+// The shared module caches of a model, one for each disassembler.
+class shared_module_caches {
+public:
+    shared_module_cache& get(const shared_ptr<disassembler>& d);
+
+    // the totals over all modules
+    void statistics(size_t& instructions, size_t& blocks, size_t& reused);
+
+private:
+    struct entry {
+        shared_ptr<disassembler>        disassembler_; // keeps the key valid
+        unique_ptr<shared_module_cache> cache_;
+    }; // entry
+
+    mutex                     mutex_;
+    map<disassembler*, entry> caches_;
+}; // shared_module_caches
+
+// The instructions and basic blocks of a module that one worker has
+// seen, pointing into the shared cache; only the worker uses it, so
+// finding them again takes no lock.
+struct module_cache {
+    module_cache(shared_module_cache& shared) : shared_(shared) {}
+
+    unordered_map<rva, const instruction*> instructions_;
+    unordered_map<rva, const basic_block*> blocks_;
+    shared_module_cache&                   shared_;
+}; // module_cache
 
 class instruction_iterator {
 public:
-    instruction_iterator(instruction_cache&       cache,
-                         shared_ptr<disassembler> disassembler,
-                         unsigned                 offset,
-                         rva                      entry_point,
-                         const string&            symbol);
+    // the disassembler and the functions must outlive the iterator;
+    // symbols are looked up in the functions if given, otherwise in
+    // the disassembler
+    instruction_iterator(module_cache&     cache,
+                         disassembler&     disassembler,
+                         const system_map* functions,
+                         unsigned          offset,
+                         rva               entry_point);
+
+    // start over at entry_point, as if newly constructed there
+    void reset(rva entry_point);
 
     bool seek(rva address);
     const instruction* next();
 
-    const string& symbol();
+    // the basic block starting at address, which must be the address of
+    // the instruction that next() returns; skip() past the block to have
+    // next() return the terminating transfer
+    const basic_block& block(rva address);
+    void skip(const basic_block& block);
+
+    // the text of an instruction returned by next()
+    string text(const instruction& i);
+
+    // the function that the iterator was started in; the name stays
+    // valid as long as the disassembler and the functions
+    const char* symbol();
 
 private:
     bool disassemble(rva address);
 
+    const instruction* find(rva address) const
+    {
+        auto i = cache_.instructions_.find(address);
+        return i != cache_.instructions_.end() ? i->second : nullptr;
+    }
+
     bool                        first_call_; // TODO: remove?
-    instruction_cache&          cache_;
-    instruction_cache::iterator ici_;
-    shared_ptr<disassembler>    disassembler_;
+    module_cache&               cache_;
+    const instruction*          current_;
+    disassembler*               disassembler_;
+    const system_map*           functions_;
     unsigned                    offset_;
     rva                         entry_point_;
-    string                      symbol_;
+    const char*                 symbol_; // nullptr until resolved
 }; // instruction_iterator
 
 } // sat
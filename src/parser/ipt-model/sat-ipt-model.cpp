@@ -20,33 +20,43 @@
 #include "sat-ipt-block.h"
 #include "sat-ipt-parser.h"
 #include "sat-input.h"
+#include "sat-compressed-input.h"
 #include "sat-ipt-collection.h"
 #include "sat-ipt-instruction.h"
+#include "sat-rebased-output.h"
 #include "sat-ipt-tsc-heuristics.h"
 #include "sat-helper-path-mapper.h"
 #include "sat-disassembler.h"
+#include "sat-mmapped.h"
 #include "sat-system-map.h"
+#include "sat-thread-pool.h"
 #include "sat-log.h"
 #include <memory>
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <cinttypes>
 #include <unistd.h>
 #include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <fcntl.h>
 
 using namespace std;
 
-namespace {
-    unsigned         global_ipt_buffer_overflow_count    = 0;
-    sat::ipt_offset  global_ipt_input_skipped_bytes      = 0;
-} // anonymous namespace
-
 namespace sat {
 uint64_t         global_initial_tsc                  = 0;
 const uint32_t   non_terminating_loop_threshold      = 500;
+// module handles of the model's own; the sideband numbers the rest from 0
+const module_handle no_module     = numeric_limits<module_handle>::max();
+const module_handle kernel_module = numeric_limits<module_handle>::max() - 1;
 
 template <class INPUT>
 class ipt_output :
@@ -56,8 +66,55 @@ public:
     using token = ipt_parser_token<ipt_output<INPUT>>;
 
     ipt_output(INPUT& input) :
-        got_to_eof_(), input_(input)
+        got_to_eof_(),
+        failed_(),
+        sideband_(make_shared<sideband_model>()),
+        sideband_view_(sideband_),
+        input_(input),
+        kernel_map_(make_shared<system_map>()),
+        show_disassembly_(),
+        symbols_(make_shared<file_backed_symbol_table>()),
+        executables_(make_shared<file_backed_symbol_table>()),
+        shared_caches_(make_shared<shared_module_caches>()),
+        cached_switch_to_asm_addr_(),
+        cached_switch_to_asm_size_(),
+        kernel_begin_(),
+        kernel_end_()
     {
+        reset();
+    }
+
+    // share the sideband, symbols, kernel map, decoded instructions and
+    // the rest of the read-only state of another output, so that both
+    // can run tasks at the same time
+    void share(const ipt_output& other)
+    {
+        sideband_                  = other.sideband_;
+        sideband_view_             = sideband_view(sideband_);
+        tsc_heuristics_            = other.tsc_heuristics_;
+        kernel_map_                = other.kernel_map_;
+        kernel_image_path_         = other.kernel_image_path_;
+        host_filesystem_           = other.host_filesystem_;
+        show_disassembly_          = other.show_disassembly_;
+        symbols_                   = other.symbols_;
+        executables_               = other.executables_;
+        host_executables_          = other.host_executables_;
+        shared_caches_             = other.shared_caches_;
+        cached_switch_to_asm_addr_ = other.cached_switch_to_asm_addr_;
+        cached_switch_to_asm_size_ = other.cached_switch_to_asm_size_;
+        kernel_begin_              = other.kernel_begin_;
+        kernel_end_                = other.kernel_end_;
+    }
+
+    // forget the execution state of the previous task
+    void reset()
+    {
+        got_to_eof_ = false;
+        failed_     = false;
+        in_psb_     = false;
+        in_ovf_     = false;
+
+        context_ = context();
         context_.lost_ = true;
         context_.tnts_.clean();
         context_.resolve_relocation_callback =
@@ -65,6 +122,152 @@ public:
             {
                 return resolve_relocation(target);
             };
+
+        ipt_buffer_overflow_count_ = 0;
+        ipt_input_skipped_bytes_   = 0;
+        stack_dumped_              = false;
+        module_                    = no_module;
+        forget_recent_modules();
+
+        speculative_               = false;
+        want_snapshot_             = false;
+        pause_at_snapshot_         = false;
+        have_snapshot_             = false;
+    }
+
+    // the execution state of a task that carries over from one block
+    // to the next
+    struct task_state {
+        context    context_;
+        bool       got_to_eof_;
+        bool       failed_;
+        bool       in_psb_;
+        bool       in_ovf_;
+        unsigned   ipt_buffer_overflow_count_;
+        ipt_offset ipt_input_skipped_bytes_;
+        bool          stack_dumped_;
+        module_handle module_;
+    }; // task_state
+
+    void save(task_state& state) const
+    {
+        state.context_                   = context_;
+        state.got_to_eof_                = got_to_eof_;
+        state.failed_                    = failed_;
+        state.in_psb_                    = in_psb_;
+        state.in_ovf_                    = in_ovf_;
+        state.ipt_buffer_overflow_count_ = ipt_buffer_overflow_count_;
+        state.ipt_input_skipped_bytes_   = ipt_input_skipped_bytes_;
+        state.stack_dumped_              = stack_dumped_;
+        state.module_                    = module_;
+    }
+
+    void restore(const task_state& state)
+    {
+        context_                   = state.context_;
+        got_to_eof_                = state.got_to_eof_;
+        failed_                    = state.failed_;
+        in_psb_                    = state.in_psb_;
+        in_ovf_                    = state.in_ovf_;
+        ipt_buffer_overflow_count_ = state.ipt_buffer_overflow_count_;
+        ipt_input_skipped_bytes_   = state.ipt_input_skipped_bytes_;
+        stack_dumped_              = state.stack_dumped_;
+        module_                    = state.module_;
+
+        context_.resolve_relocation_callback =
+            [this](rva& target) -> bool
+            {
+                return resolve_relocation(target);
+            };
+    }
+
+    // true if the execution from both states will be the same, apart
+    // from the original call stack and the overflow and skip totals,
+    // which get rebased when stitching speculative output
+    static bool alike(const task_state& a, const task_state& b)
+    {
+        const context& x = a.context_;
+        const context& y = b.context_;
+
+        return x.cpu_                    == y.cpu_                    &&
+               x.lost_                   == y.lost_                   &&
+               x.pc_                     == y.pc_                     &&
+               x.entry_id_               == y.entry_id_               &&
+               x.tsc_.begin              == y.tsc_.begin              &&
+               x.tsc_.end                == y.tsc_.end                &&
+               x.previously_output_tsc_  == y.previously_output_tsc_  &&
+               x.last_call_nlip_         == y.last_call_nlip_         &&
+               x.tip_                    == y.tip_                    &&
+               x.fup_                    == y.fup_                    &&
+               x.tnts_                   == y.tnts_                   &&
+               x.instruction_count_ - x.previously_output_instruction_count_ ==
+               y.instruction_count_ - y.previously_output_instruction_count_ &&
+               x.pending_output_call_    == y.pending_output_call_    &&
+               x.exec_loop_count_        == y.exec_loop_count_        &&
+               x.exec_loop_tnts_         == y.exec_loop_tnts_         &&
+               x.exec_loop_ipt_location_ == y.exec_loop_ipt_location_ &&
+               x.fast_forward_           == y.fast_forward_           &&
+               x.syscall_                == y.syscall_                &&
+               x.ignone_stack_manipulation_in_this_function_ ==
+               y.ignone_stack_manipulation_in_this_function_          &&
+               a.got_to_eof_             == b.got_to_eof_             &&
+               a.failed_                 == b.failed_                 &&
+               a.in_psb_                 == b.in_psb_                 &&
+               a.in_ovf_                 == b.in_ovf_                 &&
+               a.module_                 == b.module_;
+    }
+
+    // The state at the end of the first fast-forward of a run of blocks.
+    // From there on, the output only depends on the state and the trace.
+    struct snapshot {
+        task_state state_;
+        unsigned   cpu_;
+        ipt_pos    pos_;           // of the first packet after fast-forward
+        long       output_offset_; // of the output made after the snapshot
+    }; // snapshot
+
+    void take_snapshot(bool pause)
+    {
+        want_snapshot_     = true;
+        pause_at_snapshot_ = pause;
+        have_snapshot_     = false;
+    }
+
+    void forget_snapshot()
+    {
+        want_snapshot_     = false;
+        pause_at_snapshot_ = false;
+        have_snapshot_     = false;
+    }
+
+    bool have_snapshot() const { return have_snapshot_; }
+    const snapshot& get_snapshot() const { return snapshot_; }
+    bool paused() const { return have_snapshot_ && pause_at_snapshot_; }
+
+    // model without knowing the state of the task at the start:
+    // output original call stack depths and overflow and skip totals
+    // relative to the start, marked with '~'
+    void speculate()
+    {
+        speculative_ = true;
+        context_.call_stack_.make_relative();
+    }
+
+    // continue from the end state of a speculatively modelled run of
+    // blocks, given the snapshots of it and of the real execution
+    void restore_rebased(const task_state& end,
+                         const snapshot&   speculated,
+                         const snapshot&   real)
+    {
+        restore(end);
+        context_.call_stack_.rebase(real.state_.context_.call_stack_);
+        ipt_buffer_overflow_count_ +=
+            real.state_.ipt_buffer_overflow_count_ -
+            speculated.state_.ipt_buffer_overflow_count_;
+        ipt_input_skipped_bytes_ +=
+            real.state_.ipt_input_skipped_bytes_ -
+            speculated.state_.ipt_input_skipped_bytes_;
+        stack_dumped_ = stack_dumped_ || real.state_.stack_dumped_;
     }
 
     // ---vvv--- parser token handlers ---vvv---
@@ -113,7 +316,7 @@ public:
     {
         SAT_LOG(1, "%08lx: tip.pgd %08lx\n", input_.beginning_of_packet(), context_.fup_);
         if (!context_.lost_ && context_.fup_) {
-            printf("execute until tip.pgd\n");
+            fprintf(output_stream(), "execute until tip.pgd\n");
             execute_until_ipt_packet(&instruction::tip);
         } else {
             // TODO
@@ -156,7 +359,7 @@ public:
         if (begin > context_.tsc_.begin) {
             SAT_ERR("ERROR on CPU %u @ %08" PRIx64 ": TSC %" PRIu64 " steps back in time (%" PRIx64 " -> %" PRIx64 ")\n",
                    context_.cpu_, input_.beginning_of_packet(), context_.tsc_.begin - begin, context_.tsc_.begin, begin);
-            exit(EXIT_FAILURE);
+            failed_ = true; // give up on the task
         }
 
         SAT_LOG(1, "%08" PRIx64 ": TSC %" PRIx64 " -> %" PRIx64 "..%" PRIx64 "\n",
@@ -198,12 +401,12 @@ public:
         SAT_LOG(1, "%08lx: OVERFLOW\n", input_.beginning_of_packet());
         in_ovf_ = true;
         //context_.get_lost();
-        ++global_ipt_buffer_overflow_count;
+        ++ipt_buffer_overflow_count_;
         context_.tnts_.clean();
         context_.fup_ = 0;
         in_psb_ = false;
         context_.lost_ = false;
-        output_lost("overflow", global_ipt_buffer_overflow_count);
+        output_lost("overflow", ipt_buffer_overflow_count_, true);
         get_tsc(input_.beginning_of_packet());
     }
 
@@ -212,11 +415,34 @@ public:
         got_to_eof_ = true;
     }
 
+    void skip(ipt_pos pos, ipt_offset count)
+    {
+        SAT_LOG(1, "%08lx: SKIP %lx\n", pos, count);
+        context_.get_lost();
+        context_.fup_ = 0;
+        in_psb_ = false;
+        in_ovf_ = false;
+        ipt_input_skipped_bytes_ += count;
+        output_lost("skip", ipt_input_skipped_bytes_, true);
+    }
+
     // ---^^^--- parser token handlers ---^^^---
     //
 
     void set_ff_state(bool state)
     {
+        if (!state && want_snapshot_) {
+            want_snapshot_ = false;
+            save(snapshot_.state_);
+            snapshot_.cpu_           = context_.cpu_;
+            snapshot_.pos_           = input_.absolute_beginning_of_packet();
+            snapshot_.output_offset_ = ftell(output_stream());
+            have_snapshot_           = true;
+            if (speculative_) {
+                // the temporary stack has been used before the snapshot
+                context_.call_stack_.restart_temp_low_water_mark();
+            }
+        }
         context_.fast_forward_ = state;
         if(state) {
             SAT_LOG(1,"Fast-Forward STARTS\n");
@@ -240,8 +466,8 @@ public:
     {
         bool ok = true;
 
-        ok = symbols_.set_path(symbols_path) &&
-             executables_.set_path(executables_path);
+        ok = symbols_->set_path(symbols_path) &&
+             executables_->set_path(executables_path);
 
         if (ok && host_executables_path != "") {
             host_executables_ =
@@ -254,19 +480,22 @@ public:
 
     bool set_system_map_path(const string path)
     {
-        bool ok = kernel_map_.read(path);
+        bool ok = kernel_map_->read(path);
 
         if (ok) {
-            kernel_map_.get_address("this_cpu_cmpxchg16b_emu",
+            if (!kernel_map_->get_range(kernel_begin_, kernel_end_)) {
+                kernel_begin_ = kernel_end_ = 0;
+            }
+            kernel_map_->get_address("this_cpu_cmpxchg16b_emu",
                                     instruction::cmpxchg_address_);
             SAT_LOG(1, "will skip calls to " \
                     "this_cpu_cmpxchg16b_emu at 0x%" \
                     PRIx64 "\n",
                     instruction::cmpxchg_address_);
 
-            kernel_map_.get_address("copy_user_generic_unrolled",
+            kernel_map_->get_address("copy_user_generic_unrolled",
                                     instruction::copy_user1_address_);
-            kernel_map_.get_address("copy_user_enhanced_fast_string",
+            kernel_map_->get_address("copy_user_enhanced_fast_string",
                                     instruction::copy_user2_address_);
             SAT_LOG(1, "will replace calls and jumps to" \
                     " copy_user_generic_unrolled by calls" \
@@ -276,7 +505,7 @@ public:
                     instruction::copy_user2_address_);
 
             // Handle RETPOLINE mitigation
-            kernel_map_.get_address("__switch_to_asm",
+            kernel_map_->get_address("__switch_to_asm",
                                     cached_switch_to_asm_addr_,
                                     cached_switch_to_asm_size_);
 #if 0
@@ -333,8 +562,32 @@ public:
         context_.call_stack_.temp_stack_enable();
     }
 
+    void report_warnings()
+    {
+        if (ipt_buffer_overflow_count_) {
+            fprintf(output_stream(),
+                    "@ ! iWARNING: there were %u IPT buffer overflows\n",
+                    ipt_buffer_overflow_count_);
+        }
+
+        if (ipt_input_skipped_bytes_) {
+            fprintf(output_stream(),
+                    "@ ! iWARNING: total of %" PRIu64 " bytes of IPT input were not parsable\n",
+                    ipt_input_skipped_bytes_);
+        }
+    }
+
+    // what the workers have decoded into the shared caches, and how many
+    // times one of them found something there that another had decoded
+    void cache_statistics(size_t& instructions, size_t& blocks, size_t& reused)
+    {
+        shared_caches_->statistics(instructions, blocks, reused);
+    }
+
     bool                                   got_to_eof_;
-    sideband_model                         sideband_;
+    bool                                   failed_;
+    shared_ptr<sideband_model>             sideband_;
+    sideband_view                          sideband_view_; // of the task
     vector<shared_ptr<tsc_heuristics>>     tsc_heuristics_;
 
 private:
@@ -355,61 +608,162 @@ private:
                 context_.tsc_.end   - global_initial_tsc);
     }
 
-    bool get_instruction_iterator(rva                    address,
-                                  uint64_t               tsc,
-                                  class instruction_iterator*& ii,
-                                  string&                target_path,
-                                  string&                host_path,
-                                  rva&                   start)
+    // what an output knows of a module it has executed in
+    struct loaded_module {
+        loaded_module() :
+            loaded_(), cache_(), start_(), have_id_(), id_()
+        {}
+
+        bool                     loaded_;
+        shared_ptr<disassembler> disassembler_; // nullptr if not found
+        module_cache*            cache_;
+        string                   target_path_;
+        string                   host_path_;
+        rva                      start_;
+        bool                     have_id_;
+        unsigned                 id_;           // in executables_
+        unique_ptr<instruction_iterator> iterator_; // reused
+    }; // loaded_module
+
+    // a range of addresses and the span of time in which a module stays
+    // mapped there
+    struct module_range {
+        rva           begin_;
+        rva           end_;
+        uint64_t      tsc_begin_;
+        uint64_t      tsc_end_;
+        module_handle module_;
+    }; // module_range
+
+    // the module behind a handle, loaded on first use
+    loaded_module& get_module(module_handle m)
     {
-        SAT_LOG(1, "getting instruction iterator for tsc %" PRIx64
-                   ", addr %" PRIx64 "\n",
-               tsc, address);
-        bool got_it = false;
+        loaded_module* result;
+        if (m == kernel_module) {
+            result = &kernel_module_;
+        } else {
+            if (m >= modules_.size()) {
+                modules_.resize(m + 1);
+            }
+            result = &modules_[m];
+        }
 
-        string name;
+        if (!result->loaded_) {
+            load_module(m, *result);
+        }
+
+        return *result;
+    }
 
-        unsigned dummy;
+    void load_module(module_handle m, loaded_module& module)
+    {
         string sym_path;
 
-        if (kernel_map_.get_function(address, name, dummy)) {
-            target_path = "/vmlinux";
-            host_path   = kernel_image_path_;
-            sym_path   = host_path;
-            start       = 0; // let the disassembler resolve the start address
-        } else if (sideband_.get_target_path(address, tsc, target_path, start)) {
-            SAT_LOG(1, "got target path '%s'\n", target_path.c_str());
-            sym_path = target_path;
-            host_filesystem_->find_file(target_path, host_path, sym_path);
+        if (m == kernel_module) {
+            module.target_path_ = "/vmlinux";
+            module.host_path_   = kernel_image_path_;
+            sym_path            = module.host_path_;
+            module.start_       = 0; // let the disassembler resolve the start address
         } else {
-            SAT_LOG(1, "target path not found\n");
+            sideband_->get_module_path(m, module.target_path_, module.start_);
+            SAT_LOG(1, "got target path '%s'\n", module.target_path_.c_str());
+            sym_path = module.target_path_;
+            host_filesystem_->find_file(module.target_path_,
+                                        module.host_path_,
+                                        sym_path);
+        }
+
+        if (module.host_path_ != "") {
+            SAT_LOG(1, "got host path '%s'\n", module.host_path_.c_str());
+            module.disassembler_ = disassembler::obtain(module.host_path_,
+                                                        sym_path,
+                                                        module.start_);
+            if (module.disassembler_) {
+                auto& cache = caches_[module.disassembler_.get()];
+                if (!cache) {
+                    cache.reset(new module_cache(
+                        shared_caches_->get(module.disassembler_)));
+                }
+                module.cache_ = cache.get();
+            }
+        }
+
+        module.loaded_ = true;
+    }
+
+    // forget the user mappings of the previous task
+    void forget_recent_modules()
+    {
+        for (auto& r : recent_modules_) {
+            r = module_range{};
         }
+        next_recent_module_ = 0;
+    }
 
-        if (host_path != "") {
-            SAT_LOG(1, "got host path '%s'\n", host_path.c_str());
-            shared_ptr<disassembler> d(disassembler::obtain(host_path, sym_path, start));
+    // the module executing at address, if any; the kernel and the
+    // recently executed user mappings are checked first
+    bool find_module(rva address, uint64_t tsc, module_handle& m)
+    {
+        bool found = false;
 
-            if (d) {
+        if (kernel_begin_ <= address && address < kernel_end_) {
+            m     = kernel_module;
+            found = true;
+        } else {
+            for (const auto& r : recent_modules_) {
+                if (r.begin_     <= address && address < r.end_ &&
+                    r.tsc_begin_ <  tsc     && tsc     <= r.tsc_end_)
                 {
-                    string name; unsigned offset;
-                    if (d->get_function(address, name, offset)) {
-                        SAT_LOG(1, "got disassembler for function '%s'\n",
-                               name.c_str());
-                    } else {
-                        SAT_LOG(1, "got disassembler\n");
-                    }
+                    m     = r.module_;
+                    found = true;
+                    break;
                 }
+            }
 
-                instruction_cache* ic;
-                auto ici = caches_.find(d.get());
-                if (ici == caches_.end()) {
-                    ic = new instruction_cache;
-                    caches_.insert({d.get(), ic});
+            if (!found) {
+                pair<rva, rva>           range;
+                pair<uint64_t, uint64_t> tscs;
+                if (sideband_view_.get_module(address, tsc, m, range, tscs)) {
+                    recent_modules_[next_recent_module_] =
+                        {range.first, range.second, tscs.first, tscs.second, m};
+                    next_recent_module_ =
+                        (next_recent_module_ + 1) % recent_module_count;
+                    found = true;
                 } else {
-                    ic = ici->second;
+                    SAT_LOG(1, "target path not found\n");
                 }
+            }
+        }
 
-                ii = new instruction_iterator(*ic, d, start, address, name);
+        return found;
+    }
+
+    bool get_instruction_iterator(rva                          address,
+                                  uint64_t                     tsc,
+                                  class instruction_iterator*& ii,
+                                  module_handle&               m)
+    {
+        SAT_LOG(1, "getting instruction iterator for tsc %" PRIx64
+                   ", addr %" PRIx64 "\n",
+               tsc, address);
+        bool got_it = false;
+
+        if (find_module(address, tsc, m)) {
+            loaded_module& module = get_module(m);
+            if (module.disassembler_) {
+                if (module.iterator_) {
+                    module.iterator_->reset(address);
+                } else {
+                    module.iterator_.reset(
+                        new instruction_iterator(
+                                *module.cache_,
+                                *module.disassembler_,
+                                m == kernel_module ? kernel_map_.get()
+                                                   : nullptr,
+                                module.start_,
+                                address));
+                }
+                ii     = module.iterator_.get();
                 got_it = true;
             }
         }
@@ -421,28 +775,48 @@ private:
     {
         unsigned id;
 
-        symbols_.get_new_id(symbol, id);
+        symbols_->get_new_id(symbol, id);
 
         return id;
     }
 
-    void output_lost(const char* synthetic_symbol, uint64_t count)
+    // the id of a symbol name that stays where it is, as the names of
+    // the disassemblers and the kernel map do; the name is only looked
+    // up in the symbol table the first time
+    unsigned stable_symbol_id(const char* symbol)
+    {
+        auto i = symbol_ids_.find(symbol);
+        if (i == symbol_ids_.end()) {
+            i = symbol_ids_.insert({symbol, symbol_id(symbol)}).first;
+        }
+
+        return i->second;
+    }
+
+    void output_lost(const char* synthetic_symbol,
+                     uint64_t    count,
+                     bool        is_total = false)
     {
         context_.output_instructions();
 
         unsigned synthetic_id = symbol_id(synthetic_symbol);
         if (show_disassembly_) {
-            printf("@ d %u %d %s\n",
-                   context_.cpu_,
-                   context_.call_stack_.depth(),
-                   synthetic_symbol);
+            fprintf(output_stream(),
+                    "@ d %u %s%d %s\n",
+                    context_.cpu_,
+                    context_.call_stack_.depth_mark(),
+                    context_.call_stack_.depth(),
+                    synthetic_symbol);
         }
         // synthetic instruction count of one to get a unique timestamp
         context_.instruction_count_++;
         context_.output_instructions(synthetic_id);
 
         // output for the UI to display stats to the user
-        printf("@ ! %c %" PRIu64 "\n", synthetic_symbol[0], count);
+        fprintf(output_stream(), "@ ! %c %s%" PRIu64 "\n",
+                synthetic_symbol[0],
+                is_total && speculative_ ? "~" : "",
+                count);
     }
 
 
@@ -453,38 +827,28 @@ private:
          bool same_stack       = true;
 
          if (context_.call_stack_.depth() == 100) {
-             static bool stack_dumped = false;
-             if (!stack_dumped) {
+             if (!stack_dumped_) {
                  SAT_LOG(0, "CALL STACK HAS GROWN SUSPICIOUSLY DEEP:\n");
                  context_.call_stack_.iterate([this](rva return_address) {
                      SAT_LOG(0, "%" PRIx64 " %s\n",
                              return_address,
                              get_location(return_address).c_str());
                  });
-                 stack_dumped = true;
+                 stack_dumped_ = true;
              }
          }
 
          // TODO: can we remove the check for !context_.lost here?
          while (!context_.lost_ && !done_with_packet) {
-             // TODO: these statics are unsafe if we ever go parallel
-             static string target_path{};
-             static rva    load_address{};
-
-             string old_path(target_path);
-             rva    old_load_address(load_address);
-
-             string host_path;
+             module_handle old_module = module_;
 
-             sideband_.adjust_for_hooks(context_.pc_);
+             sideband_->adjust_for_hooks(context_.pc_);
 
              class instruction_iterator* ii;
              if (!get_instruction_iterator(context_.pc_,
                                            context_.tsc_.begin,
                                            ii,
-                                           target_path,
-                                           host_path,
-                                           load_address))
+                                           module_))
              {
                  SAT_LOG(1, "...could not get iterator\n");
                  if (context_.syscall_)
@@ -505,37 +869,41 @@ private:
              if (context_.instruction_count_ ==
                    context_.previously_output_instruction_count_ ||
                  context_.pending_output_call_ ||
-                 target_path != old_path ||
-                 load_address != old_load_address)
+                 module_ != old_module)
              {
                  // save the point of entry to a stream of instructions
-                 unsigned entry_id = symbol_id(ii->symbol());
+                 unsigned entry_id = stable_symbol_id(ii->symbol());
 
                  if (context_.pending_output_call_) {
                      context_.output_call(entry_id);
                      context_.pending_output_call_ = false;
                  }
 
-                 if (target_path  != old_path ||
-                     load_address != old_load_address)
-                 {
+                 if (module_ != old_module) {
+                     loaded_module& module = get_module(module_);
                      context_.output_instructions();
-                     unsigned id;
-                     if (executables_.get_new_id(target_path, id) &&
-                         host_executables_)
-                     {
-                         // we entered a file we have not been in before;
-                         // store the corresponding host path with id as well
-                         host_executables_->insert(host_path, id);
+                     if (!module.have_id_) {
+                         if (executables_->get_new_id(module.target_path_,
+                                                      module.id_) &&
+                             host_executables_)
+                         {
+                             // we entered a file we have not been in before;
+                             // store the corresponding host path with id as well
+                             host_executables_->insert(module.host_path_,
+                                                       module.id_);
+                         }
+                         module.have_id_ = true;
                      }
-                     context_.output_module(id);
+                     context_.output_module(module.id_);
                      if (show_disassembly_ && !context_.fast_forward_) {
-                         printf("@ d %u %d %u@%" PRIx64 " (%s)\n",
-                                context_.cpu_,
-                                context_.call_stack_.depth(),
-                                id,
-                                load_address,
-                                target_path.c_str());
+                         fprintf(output_stream(),
+                                 "@ d %u %s%d %u@%" PRIx64 " (%s)\n",
+                                 context_.cpu_,
+                                 context_.call_stack_.depth_mark(),
+                                 context_.call_stack_.depth(),
+                                 module.id_,
+                                 module.start_,
+                                 module.target_path_.c_str());
                      }
                  }
 
@@ -543,10 +911,12 @@ private:
              }
 
              if (show_disassembly_ && !done_with_packet && !context_.fast_forward_) {
-                 printf("@ d %u %d -> %s\n",
-                        context_.cpu_,
-                        context_.call_stack_.depth(),
-                        get_location(context_.pc_).c_str());
+                 fprintf(output_stream(),
+                         "@ d %u %s%d -> %s\n",
+                         context_.cpu_,
+                         context_.call_stack_.depth_mark(),
+                         context_.call_stack_.depth(),
+                         get_location(context_.pc_).c_str());
              }
              rva next_address;
              rva entry_pc;
@@ -554,15 +924,32 @@ private:
 
              entry_pc = context_.pc_;
              do {
+                 if (!show_disassembly_ || context_.fast_forward_) {
+                     // run straight through to the next control transfer,
+                     // unless a FUP is due on the way
+                     const basic_block& b = ii->block(context_.pc_);
+                     rva end = b.terminator_->address();
+                     if (b.count_ &&
+                         !(context_.tnts_.empty() &&
+                           context_.pc_ <= context_.fup_ && context_.fup_ < end))
+                     {
+                         context_.instruction_count_ += b.count_;
+                         context_.pc_                 = end;
+                         ii->skip(b);
+                     }
+                 }
+
                  const instruction* i = ii->next(); // next() must be lazy!
                  ++context_.instruction_count_;
 
                  if (show_disassembly_ && !context_.fast_forward_) {
-                     printf("@ d %u %d %" PRIx64 ": %s\n",
-                            context_.cpu_,
-                            context_.call_stack_.depth(),
-                            context_.pc_,
-                            i->text().c_str());
+                     fprintf(output_stream(),
+                             "@ d %u %s%d %" PRIx64 ": %s\n",
+                             context_.cpu_,
+                             context_.call_stack_.depth_mark(),
+                             context_.call_stack_.depth(),
+                             context_.pc_,
+                             ii->text(*i).c_str());
                  }
                  //printf("%" PRIx64 ": [%02" PRIu64 "] %s\n", context_.pc_, context_.call_stack_.size(), i->text().c_str());
                  next_address = i->next_address(context_);
@@ -605,7 +992,7 @@ private:
                      if (context_.tnts_.size() == context_.exec_loop_tnts_ &&
                          input_.beginning_of_packet() == context_.exec_loop_ipt_location_)
                      {
-                         SAT_LOG(0, "@ ! iNON-TERMINATING LOOP DETECTED: %s\n", ii->symbol().c_str());
+                         SAT_LOG(0, "@ ! iNON-TERMINATING LOOP DETECTED: %s\n", ii->symbol());
                          cerr << "\rNON-TERMINATING LOOP DETECTED: " << ii->symbol() << "                                      " << endl;
                          sleep(1);
                          context_.get_lost();
@@ -625,80 +1012,78 @@ private:
                  //context_.exec_loop_tnts_ = context_.tnts_.size();
                  //context_.exec_loop_ipt_location_ = input_.beginning_of_packet();
              }
-             delete ii; // TODO: consider caching
-
              if (context_.lost_) {
                  output_lost("lost", 1);
              }
          }
 
          if (context_.pending_output_call_) {
-             context_.output_call(symbol_id(symbol(context_.pc_)));
+             context_.output_call(stable_symbol_id(symbol(context_.pc_)));
              context_.pending_output_call_ = false;
          }
 
          return same_stack;
      }
 
-     string symbol(rva address)
+     // the name of the function at address, without copying it
+     const char* symbol(rva address)
      {
-         string   result;
-         unsigned offset; // TODO: use it or remove it
-         string   path;
-         string   sym_path;
-         rva      start;
+         const char*   result = nullptr;
+         unsigned      offset; // TODO: use it or remove it
+         module_handle m;
+         const string* kernel_function;
 
-         if (kernel_map_.get_function(address, result, offset))
+         if (kernel_map_->get_function(address, kernel_function, offset))
          {
              // it is a kernel address
-         } else if (sideband_.get_target_path(address,
-                                               context_.tsc_.begin,
-                                               path,
-                                               start))
-         {
+             result = kernel_function->c_str();
+         } else if (sideband_view_.get_module(address, context_.tsc_.begin, m)) {
              // it is a userspace address
-             host_filesystem_->find_file(path, path, sym_path);
-             shared_ptr<disassembler> d(disassembler::obtain(path, sym_path, start));
-             SAT_LOG(1, "symbol(%" PRIx64 "/%" PRIx64 ")\n", address, address - start);
-             if (!d || !d->get_function(address, result, offset)) {
-                 result = "unknown";
+             loaded_module& module = get_module(m);
+             SAT_LOG(1, "symbol(%" PRIx64 "/%" PRIx64 ")\n",
+                     address, address - module.start_);
+             disassembler::symbol_id id;
+             if (module.disassembler_ &&
+                 module.disassembler_->get_function_id(address, id, offset))
+             {
+                 result = module.disassembler_->symbol_name(id);
              }
-         } else {
-             result = "unknown";
          }
 
-         return result;
+         return result ? result : "unknown";
      }
 
 
     string get_location(rva address)
     {
-        string   result;
-        unsigned offset; // TODO: use it or remove it
-        string   path;
-        string   sym_path;
-        rva      start;
+        string        result;
+        unsigned      offset; // TODO: use it or remove it
+        module_handle m;
+        const string* kernel_function;
 
-        if (kernel_map_.get_function(address, result, offset))
+        if (kernel_map_->get_function(address, kernel_function, offset))
         {
             // it is a kernel address
-            result = string("KERNEL:") + result;
-        } else if (sideband_.get_target_path(address,
-                                              context_.tsc_.begin,
-                                              path,
-                                              start))
-        {
+            result = "KERNEL:" + *kernel_function;
+        } else if (sideband_view_.get_module(address, context_.tsc_.begin, m)) {
             // it is a userspace address
-            host_filesystem_->find_file(path, path, sym_path);
+            loaded_module& module = get_module(m);
             string f;
-            shared_ptr<disassembler> d(disassembler::obtain(path, sym_path, start));
-            SAT_LOG(1, "get_function(%" PRIx64 "/%" PRIx64 ")\n", address, address - start);
-            if (!d || !d->get_function(address, f, offset)) {
+            SAT_LOG(1, "get_function(%" PRIx64 "/%" PRIx64 ")\n",
+                    address, address - module.start_);
+            disassembler::symbol_id id;
+            if (module.disassembler_ &&
+                module.disassembler_->get_function_id(address, id, offset))
+            {
+                f = module.disassembler_->symbol_name(id);
+            } else {
                 ostringstream a;
                 a << hex << address;
                 f = a.str();
             }
-            result = path + ": " + f;
+            result = (module.host_path_ != "" ? module.host_path_
+                                              : module.target_path_) +
+                     ": " + f;
         }
 
         return result;
@@ -707,55 +1092,30 @@ private:
 
     bool resolve_relocation(rva& target)
     {
-        bool resolved_it = false;
         SAT_LOG(0, "RESOLVING %" PRIx64 " :|\n", target);
-        string target_path;
-        rva    start;
-        if (!sideband_.get_target_path(target,
-                                        context_.tsc_.begin,
-                                        target_path,
-                                        start))
-        {
+        module_handle m;
+        if (!sideband_view_.get_module(target, context_.tsc_.begin, m)) {
             return false;
         }
-        string host_path;
-        string sym_path;
-        host_filesystem_->find_file(target_path, host_path, sym_path);
-        shared_ptr<disassembler>
-            d(disassembler::obtain(host_path, sym_path, start));
+        loaded_module& module = get_module(m);
 
         string name;
-        if (!d || !d->get_relocation(target, name)) {
+        if (!module.disassembler_ ||
+            !module.disassembler_->get_relocation(target, name))
+        {
             return false;
         }
 
         SAT_LOG(0, "RESOLVING %s :)\n", name.c_str());
 
-        sideband_.iterate_target_paths(
-                       context_.tid_,
-                       context_.tsc_.begin,
-                       [&](const string& target_path, rva start) -> bool
-                       {
-                           SAT_LOG(3, "CONSIDERING %s @ %" PRIx64 "\n",
-                                   target_path.c_str(),
-                                   start);
-
-                           string host_path;
-                           string sym_path;
-                           host_filesystem_-> find_file(target_path,
-                                                        host_path, sym_path);
-                           shared_ptr<disassembler>
-                               d(disassembler::obtain(host_path, sym_path, start));
-                           resolved_it =
-                               d && d->get_global_function(name, target);
-                           if (resolved_it) {
-                               SAT_LOG(0, "FOUND %s in %s @ %" PRIx64 " :D\n",
-                                       name.c_str(),
-                                       target_path.c_str(),
-                                       target);
-                           }
-                           return resolved_it;
-                       });
+        bool resolved_it = sideband_->find_export(context_.tid_,
+                                                  context_.tsc_.begin,
+                                                  name,
+                                                  target);
+        if (resolved_it) {
+            SAT_LOG(0, "FOUND %s @ %" PRIx64 " :D\n", name.c_str(), target);
+        }
+
         return resolved_it;
     }
 
@@ -763,25 +1123,65 @@ private:
     bool                                   in_psb_;
     bool                                   in_ovf_;
     context                                context_;
-    system_map                             kernel_map_;
+    shared_ptr<system_map>                 kernel_map_;
     string                                 kernel_image_path_;
     shared_ptr<path_mapper>                host_filesystem_;
 
-    map<disassembler*, instruction_cache*> caches_;
+    // the instructions and basic blocks that this output has seen; each
+    // worker thread has an output of its own, and they all find what
+    // any of them has decoded in the shared caches
+    map<disassembler*, unique_ptr<module_cache>> caches_;
+
+    // the modules this output has executed in, by module handle;
+    // a deque, so that growing it keeps references to the modules valid
+    deque<loaded_module>                   modules_;
+    loaded_module                          kernel_module_;
+
+    // recently executed user mappings, where get_instruction_iterator()
+    // looks first
+    static const unsigned                  recent_module_count = 4;
+    module_range                           recent_modules_[recent_module_count];
+    unsigned                               next_recent_module_;
 
     bool                                   show_disassembly_;
 
-    file_backed_symbol_table               symbols_;
-    file_backed_symbol_table               executables_;
+    shared_ptr<file_backed_symbol_table>   symbols_;
+    unordered_map<const char*, unsigned>   symbol_ids_; // by stable name
+    shared_ptr<file_backed_symbol_table>   executables_;
     shared_ptr<symbol_table_file>          host_executables_;
+    shared_ptr<shared_module_caches>       shared_caches_;
 
     rva                                    cached_switch_to_asm_addr_;
     unsigned                               cached_switch_to_asm_size_;
+    rva                                    kernel_begin_; // of the functions
+    rva                                    kernel_end_;   // in the kernel map
+
+    // per task state
+    unsigned                               ipt_buffer_overflow_count_;
+    ipt_offset                             ipt_input_skipped_bytes_;
+    bool                                   stack_dumped_;
+    module_handle                          module_; // of the previous instructions
+
+    bool                                   speculative_;
+    bool                                   want_snapshot_;
+    bool                                   pause_at_snapshot_;
+    bool                                   have_snapshot_;
+    snapshot                               snapshot_;
 }; // ipt_output
 
-class ipt_model : public ipt_parser<input_from_file_block, ipt_output>
+class ipt_model : public ipt_parser<input_from_trace_file_block, ipt_output>
 {
 public:
+    using output_type = ipt_output<input_from_trace_file_block>;
+    using blocks      = vector<shared_ptr<ipt_block>>;
+
+    // the state of a task between blocks
+    struct state {
+        output_type::task_state output_;
+        bool                    at_eof_;
+        bool                    ff_state_;
+    }; // state
+
     ipt_model(const ipt_collection& collection,
             const string&          symbols_path,
             const string&          executables_path,
@@ -812,8 +1212,8 @@ public:
         } else {
             SAT_LOG(0, "not using System.map\n");
         }
-        output().sideband_.set_host_filesystem(host_filesystem);
-        if (!output().sideband_.build(collection.sideband_path())) {
+        output().sideband_->set_host_filesystem(host_filesystem);
+        if (!output().sideband_->build(collection.sideband_path())) {
             printf("sideband building failed\n");
             exit(EXIT_FAILURE);
         } else {
@@ -830,11 +1230,65 @@ public:
 #if 1
         tid_t tid;
         uint32_t pkt_mask;
-        output().sideband_.get_initial(0, tid, pkt_mask);
+        output().sideband_->get_initial(0, tid, pkt_mask);
         SAT_LOG(1, "initial tid: %d\n", tid);
 #endif
     }
 
+    // load the symbols of the kernel and of all executables mapped in
+    // the sideband on the pool, instead of in whichever task happens
+    // to run in them first
+    void preload(thread_pool&       pool,
+                 const path_mapper& host_filesystem,
+                 const string&      kernel_image_path)
+    {
+        auto load = [](const string& host_path, const string& sym_path)
+        {
+            auto start = chrono::steady_clock::now();
+            shared_ptr<mmapped> m = mmapped::obtain(host_path, sym_path);
+            if (m && m->is_ok()) {
+                m->load_symbols();
+            }
+            SAT_LOG(1, "preloaded '%s' in %.3f s\n",
+                    host_path.c_str(),
+                    chrono::duration<double>(chrono::steady_clock::now() -
+                                             start).count());
+        };
+
+        vector<string> target_paths;
+        output().sideband_->iterate_executables([&](const string& path) {
+            target_paths.push_back(path);
+        });
+
+        auto start = chrono::steady_clock::now();
+        if (kernel_image_path != "") {
+            pool.submit([&]() { load(kernel_image_path, kernel_image_path); });
+        }
+        for (const auto& t : target_paths) {
+            pool.submit([&]() {
+                string host_path;
+                string sym_path = t;
+                if (host_filesystem.find_file(t, host_path, sym_path)) {
+                    load(host_path, sym_path);
+                }
+            });
+        }
+        pool.wait();
+        SAT_LOG(0, "preloaded %zu executables in %.3f s\n",
+                target_paths.size() + (kernel_image_path != ""),
+                chrono::duration<double>(chrono::steady_clock::now() -
+                                         start).count());
+    }
+
+    // make a model for another worker thread; it shares everything
+    // but the execution state with this one
+    shared_ptr<ipt_model> make_worker()
+    {
+        shared_ptr<ipt_model> worker(new ipt_model(collection_));
+        worker->output().share(output());
+        return worker;
+    }
+
     void set_host_filesystem(shared_ptr<path_mapper> host_filesystem)
     {
         output().set_host_filesystem(host_filesystem);
@@ -842,16 +1296,47 @@ public:
 
     bool run(tid_t tid)
     {
-        bool ok   = true;
-        auto task = collection_.task(tid);
+        auto all = get_blocks(tid);
+
+        return begin_task(tid) && run(all, 0, all.size());
+    } // run()
+
+    blocks get_blocks(tid_t tid) const
+    {
+        blocks result;
+
+        collection_.task(tid)->iterate_blocks([&](shared_ptr<ipt_block> b) {
+            result.push_back(b);
+            return true;
+        });
+
+        return result;
+    }
+
+    bool begin_task(tid_t tid)
+    {
+        bool ok = true;
 
-        if(!output().sideband_.set_tid_for_target_path_resolution(tid))
+        reset();
+        output().reset();
+
+        if(!output().sideband_view_.set_tid(tid))
         {
-            SAT_LOG(0, "ERROR: Cannot set tid for sideband!!\n");
-            fprintf(stderr, "ERROR: Cannot set tid for sideband!!\n");
-            exit(EXIT_FAILURE);
+            SAT_ERR("ERROR: Cannot set tid for sideband!!\n");
+            ok = false;
         }
-        task->iterate_blocks([&](shared_ptr<ipt_block> block) {
+
+        return ok;
+    }
+
+    // run blocks [first, last) of a task;
+    // stop at the first one that fails, or at a paused snapshot
+    bool run(const blocks& task_blocks, size_t first, size_t last)
+    {
+        bool ok = true;
+
+        for (size_t b = first; ok && b < last && !output().paused(); ++b) {
+            auto block = task_blocks[b];
             output().set_cpu(block->cpu_);
             switch (block->type_) {
             case ipt_block::TRACE:
@@ -868,17 +1353,53 @@ public:
             default:
             break;
             } // switch
-            return ok;
-        });
+        }
 
         return ok;
     } // run()
 
+    // model blocks in the middle of a task, guessing that the task has
+    // got through its first block like it normally would
+    void speculate()
+    {
+        resume(true, false);
+        output().got_to_eof_ = true;
+        output().speculate();
+        output().take_snapshot(false);
+    }
+
+    void save(state& s)
+    {
+        output().save(s.output_);
+        s.at_eof_   = at_eof();
+        s.ff_state_ = ff_state();
+    }
+
+    void restore(const state& s)
+    {
+        output().restore(s.output_);
+        resume(s.at_eof_, s.ff_state_);
+    }
+
+    // continue from the end of speculatively modelled blocks
+    void restore_rebased(const state&                     end,
+                         const output_type::snapshot&     speculated,
+                         const output_type::snapshot&     real)
+    {
+        output().restore_rebased(end.output_, speculated, real);
+        resume(end.at_eof_, end.ff_state_);
+    }
+
     int stack_low_water_mark()
     {
         return output().stack_low_water_mark();
     }
 
+    void report_warnings()
+    {
+        output().report_warnings();
+    }
+
     bool set_symbol_paths(const string& symbols_path,
                           const string& executables_path,
                           const string& host_executables_path)
@@ -889,6 +1410,10 @@ public:
     }
 
 private:
+    ipt_model(const ipt_collection& collection) :
+        collection_(collection)
+    {}
+
     bool run(const string& ipt_path, shared_ptr<ipt_block> block)
     {
         bool ok = true;
@@ -897,8 +1422,8 @@ private:
 
         if (ok) {
             output().start_new_block_execution();
-            while (parse()) {}
-            ok = output().got_to_eof_;
+            while (parse() && !output().failed_ && !output().paused()) {}
+            ok = output().got_to_eof_ && !output().failed_;
         }
 
         return ok;
@@ -909,19 +1434,6 @@ private:
     vector<string>            ipt_paths_;
 }; // ipt_model
 
-void report_warnings()
-{
-    if (global_ipt_buffer_overflow_count) {
-        printf("@ ! iWARNING: there were %u IPT buffer overflows\n",
-                global_ipt_buffer_overflow_count);
-    }
-
-    if (global_ipt_input_skipped_bytes) {
-        printf("@ ! iWARNING: total of %" PRIu64 " bytes of IPT input were not parsable\n",
-                global_ipt_input_skipped_bytes);
-    }
-}
-
 string make_path(const string& format, tid_t tid)
 {
     string path;
@@ -941,52 +1453,257 @@ string make_path(const string& format, tid_t tid)
     return path;
 }
 
-void run(tid_t                      tid,
-         shared_ptr<ipt_model>      model,
-         shared_ptr<helper_path_mapper> host_filesystem,
-         const string&              symbols_path,
-         const string&              executables_path,
-         const string&              host_executables_path,
-         const string&              output_path_format,
-         const string&              stack_low_water_marks_path_format)
-{
-    // replace stdout with a file
-    int    output_file = -1;
-    string output_path = make_path(output_path_format, tid);
+// A run of consecutive blocks of a big task. Segments after the first
+// one are modelled speculatively by idle workers, not knowing the state
+// the task will be in when the segment starts. The worker modelling the
+// task then only replays the fast-forward at the start of a segment to
+// check the guess, and either stitches the speculative output to the
+// model, rebasing call stack depths and totals, or models the segment
+// again itself.
+struct segment {
+    segment(size_t first, size_t last) :
+        first_(first), last_(last), claimed_(), done_(),
+        output_(), ok_(), have_snapshot_()
+    {}
+
+    ~segment()
+    {
+        if (output_) {
+            fclose(output_);
+        }
+    }
 
-    close(STDOUT_FILENO);
-    output_file = creat(output_path.c_str(), S_IRUSR|S_IWUSR);
-    if (output_file == -1) {
-        fprintf(stderr, "cannot open file '%s' for writing model\n",
-                output_path.c_str());
-        exit(EXIT_FAILURE);
+    void wait()
+    {
+        unique_lock<mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return done_; });
     }
 
-    if (!model->set_symbol_paths(symbols_path,
-                                   executables_path,
-                                   host_executables_path))
+    void set_done()
     {
-        SAT_LOG(0, "Setting symbol paths failed!!\n");
-        exit(EXIT_FAILURE);
+        {
+            lock_guard<mutex> lock(mutex_);
+            done_ = true;
+        }
+        done_cv_.notify_all();
     }
 
-    model->set_host_filesystem(host_filesystem);
-    // obtain the task
-    // SAT_LOG(0, "picking task ID '%u'\n", tid);
-    // auto task = collection.task(tid);
-    // if (!task) {
-    //     SAT_ERR("no such task ID: %u\n", tid);
-    //     exit(EXIT_FAILURE);
-    // }
+    size_t                         first_; // index of the first block
+    size_t                         last_;  // index past the last block
+    atomic<bool>                   claimed_;
+    mutex                          mutex_;
+    condition_variable             done_cv_;
+    bool                           done_;
+
+    // results of the speculative modelling
+    FILE*                          output_;
+    bool                           ok_;
+    bool                           have_snapshot_;
+    ipt_model::output_type::snapshot snapshot_;
+    ipt_model::state               end_;
+}; // segment
+
+// split a task into at most max_segments of at least min_size bytes
+// of trace each; segments start at trace blocks
+vector<shared_ptr<segment>> split(const ipt_model::blocks& blocks,
+                                  unsigned                 max_segments,
+                                  uint64_t                 min_size)
+{
+    vector<shared_ptr<segment>> segments;
+    uint64_t                    total = 0;
+
+    for (const auto& b : blocks) {
+        if (b->type_ == ipt_block::TRACE) {
+            total += b->pos_.second - b->pos_.first;
+        }
+    }
+
+    uint64_t count = min_size ? min<uint64_t>(max_segments, total / min_size)
+                              : 1;
+    uint64_t target = count > 1 ? total / count : total + 1;
+    size_t   first  = 0;
+    uint64_t size   = 0;
+    bool     traced = false;
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (blocks[b]->type_ == ipt_block::TRACE) {
+            if (traced && size >= target && segments.size() + 1 < count) {
+                segments.push_back(make_shared<segment>(first, b));
+                first = b;
+                size  = 0;
+            }
+            traced = true;
+            size  += blocks[b]->pos_.second - blocks[b]->pos_.first;
+        }
+    }
+    segments.push_back(make_shared<segment>(first, blocks.size()));
+
+    return segments;
+}
+
+void speculate(tid_t                                tid,
+               shared_ptr<const ipt_model::blocks>  blocks,
+               shared_ptr<segment>                  s,
+               ipt_model&                           model)
+{
+    if (s->claimed_.exchange(true)) {
+        return; // the task got to the segment first
+    }
+
+    s->output_ = tmpfile();
+    if (s->output_) {
+        redirect_output_stream(s->output_);
+        if (model.begin_task(tid)) {
+            model.speculate();
+            s->ok_            = model.run(*blocks, s->first_, s->last_);
+            s->have_snapshot_ = model.output().have_snapshot();
+            s->snapshot_      = model.output().get_snapshot();
+            model.save(s->end_);
+        }
+        model.output().forget_snapshot();
+        redirect_output_stream(nullptr);
+    }
+
+    s->set_done();
+}
+
+// model a speculatively modelled segment, stitching its output if the
+// guess was right
+bool stitch(segment&                 s,
+            const ipt_model::blocks& blocks,
+            ipt_model&               model,
+            FILE*                    output)
+{
+    bool            ok       = false;
+    bool            stitched = false;
+    ipt_model::state base;
+
+    model.save(base);
+
+    // replay the fast-forward at the start of the segment
+    FILE* prefix = s.have_snapshot_ ? tmpfile() : nullptr;
+    if (prefix) {
+        redirect_output_stream(prefix);
+        model.output().take_snapshot(true);
+        model.run(blocks, s.first_, s.last_);
+        redirect_output_stream(output);
+
+        const auto& guess = s.snapshot_;
+        auto        real  = model.output().get_snapshot();
+        if (model.output().have_snapshot()           &&
+            real.cpu_ == guess.cpu_                  &&
+            real.pos_ == guess.pos_                  &&
+            ipt_model::output_type::alike(real.state_, guess.state_) &&
+            s.end_.output_.context_.call_stack_.fits_on(
+                real.state_.context_.call_stack_))
+        {
+            copy_output(prefix, real.output_offset_, output);
+            copy_rebased_output(
+                s.output_,
+                guess.output_offset_,
+                output,
+                real.state_.context_.call_stack_.original_depth(),
+                (int64_t)real.state_.ipt_buffer_overflow_count_ -
+                    guess.state_.ipt_buffer_overflow_count_,
+                (int64_t)real.state_.ipt_input_skipped_bytes_ -
+                    guess.state_.ipt_input_skipped_bytes_);
+            model.restore_rebased(s.end_, guess, real);
+            ok       = s.ok_;
+            stitched = true;
+            SAT_LOG(1, "stitched blocks %lu..%lu\n", s.first_, s.last_);
+        }
+        model.output().forget_snapshot();
+        fclose(prefix);
+    }
+
+    if (!stitched) {
+        SAT_LOG(1, "modelling blocks %lu..%lu again\n", s.first_, s.last_);
+        model.restore(base);
+        ok = model.run(blocks, s.first_, s.last_);
+    }
+
+    return ok;
+}
+
+// model a task, letting idle workers speculate on its later segments
+bool run_segmented(tid_t                                tid,
+                   shared_ptr<ipt_model>                model,
+                   thread_pool&                         pool,
+                   const vector<shared_ptr<ipt_model>>& models,
+                   uint64_t                             min_segment_size,
+                   FILE*                                output)
+{
+    bool ok;
+    auto blocks   = make_shared<const ipt_model::blocks>(model->get_blocks(tid));
+    auto segments = split(*blocks, pool.size(), min_segment_size);
+
+    segments[0]->claimed_ = true;
+    for (size_t i = 1; i < segments.size(); ++i) {
+        auto s = segments[i];
+        pool.submit([tid, blocks, s, &models]() {
+            speculate(tid, blocks, s, *models[thread_pool::worker_index()]);
+        });
+    }
+    SAT_LOG(1, "task %u: %lu segments\n", tid, segments.size());
+
+    ok = model->begin_task(tid) &&
+         model->run(*blocks, segments[0]->first_, segments[0]->last_);
+    for (size_t i = 1; ok && i < segments.size(); ++i) {
+        auto& s = *segments[i];
+        if (!s.claimed_.exchange(true)) {
+            // no idle worker got to it
+            ok = model->run(*blocks, s.first_, s.last_);
+        } else {
+            s.wait();
+            ok = stitch(s, *blocks, *model, output);
+        }
+    }
+
+    // no use speculating on the rest after a failure
+    for (auto& s : segments) {
+        s->claimed_ = true;
+    }
+
+    return ok;
+}
+
+void run(tid_t                                tid,
+         shared_ptr<ipt_model>                model,
+         thread_pool&                         pool,
+         const vector<shared_ptr<ipt_model>>& models,
+         uint64_t                             min_segment_size,
+         const string&                        output_path_format,
+         const string&                        stack_low_water_marks_path_format)
+{
+    // write the model and the log of this thread to a file
+    string output_path = make_path(output_path_format, tid);
+
+    int   output_file = open(output_path.c_str(),
+                             O_CREAT | O_WRONLY | O_TRUNC,
+                             S_IRUSR | S_IWUSR);
+    FILE* output      = output_file == -1 ? nullptr : fdopen(output_file, "w");
+    if (!output) {
+        fprintf(stderr, "cannot open file '%s' for writing model\n",
+                output_path.c_str());
+        if (output_file != -1) {
+            close(output_file);
+        }
+        return;
+    }
+    redirect_output_stream(output);
 
     // run the model
     SAT_LOG(0, "running IPT model with task ID '%u'\n", tid);
     SAT_LOG(0, "earliest tsc: %lx\n", global_initial_tsc);
-    if (!model->run(tid)) {
-        printf("@ ! iWARNING: IPT input for task %u ended abruptly\n", tid);
+    bool ok = pool.size() > 1 && min_segment_size ?
+              run_segmented(tid, model, pool, models, min_segment_size, output) :
+              model->run(tid);
+    if (!ok) {
+        fprintf(output,
+                "@ ! iWARNING: IPT input for task %u ended abruptly\n", tid);
     }
 
-    report_warnings();
+    model->report_warnings();
 
     if (stack_low_water_marks_path_format != "") {
         string slwm_path = make_path(stack_low_water_marks_path_format, tid);
@@ -997,12 +1714,8 @@ void run(tid_t                      tid,
         }
     }
 
-    fflush(stdout);
-    if (output_file != -1) {
-        close(output_file);
-    }
-
-
+    redirect_output_stream(nullptr);
+    fclose(output);
 }
 
 } // namespace sat
@@ -1073,7 +1786,9 @@ int main(int argc, char* argv[])
     string          executables_path;
     string          host_executables_path;
     string          symbols_path;
-    unsigned        max_processes = 3; // default parallel processes
+    unsigned        max_processes = 3; // default worker threads
+    uint64_t        min_segment_size = 0; // MiB; no segmenting by default
+    bool            use_x86_tables   = false;
     // default path formats
     string          output_path_format = "task%u.model";
     string          stack_low_water_marks_path_format; // no output by default
@@ -1081,7 +1796,7 @@ int main(int argc, char* argv[])
     //global_use_stderr = false;
     // process command line switches
     int c;
-    while ((c = getopt(argc, argv, ":C:dDe:f:F:h:lm:n:o:P:w:")) != EOF) {
+    while ((c = getopt(argc, argv, ":C:dDe:f:F:h:lm:n:o:P:S:w:x")) != EOF) {
         switch (c) {
         case 'C':
             collection_path = optarg;
@@ -1117,9 +1832,17 @@ int main(int argc, char* argv[])
             output_path_format = optarg;
             break;
         case 'P':
-            if (sscanf(optarg, "%u", &max_processes) != 1) {
+            if (sscanf(optarg, "%u", &max_processes) != 1 || max_processes == 0) {
+                fprintf(stderr,
+                        "must specify # of worker threads with -P\n");
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            if (sscanf(optarg, "%" SCNu64, &min_segment_size) != 1) {
                 fprintf(stderr,
-                        "must specify max # of parallel processes with -P\n");
+                        "must specify min segment size in MiB with -S\n");
                 usage(argv[0]);
                 exit(EXIT_FAILURE);
             }
@@ -1127,6 +1850,9 @@ int main(int argc, char* argv[])
         case 'w':
             stack_low_water_marks_path_format = optarg;
             break;
+        case 'x':
+            use_x86_tables = true;
+            break;
         case '?':
             fprintf(stderr, "unknown option '%c'\n", optopt);
             usage(argv[0]);
@@ -1194,6 +1920,11 @@ int main(int argc, char* argv[])
 
     host_filesystem->find_file("vmlinux", kernel_image_path, kernel_image_path);
 
+    // decode common instructions with the x86 tables if asked to, and
+    // keep decoded instructions across runs next to the path cache
+    disassembler::use_x86_tables(use_x86_tables);
+    disassembler::use_decode_cache(path_mapper_cache_dir_path);
+
     shared_ptr<system_map> kernel_map;
     if (system_map_path != "") {
         kernel_map = make_shared<system_map>();
@@ -1227,6 +1958,13 @@ int main(int argc, char* argv[])
                                         system_map_path,
                                         show_disassembly,
                                         host_filesystem);
+    if (!model->set_symbol_paths(symbols_path,
+                                 executables_path,
+                                 host_executables_path))
+    {
+        SAT_LOG(0, "Setting symbol paths failed!!\n");
+        exit(EXIT_FAILURE);
+    }
 
     // prime the model memory maps
     SAT_LOG(0, "priming memory maps\n");
@@ -1237,75 +1975,62 @@ int main(int argc, char* argv[])
                                                              dummy));
     }
 
-    // loop through tasks forking processes
-    host_filesystem->close(); // close before fork() to avoid sharing cache fd
-    SAT_LOG(0, "running IPT model of %u tasks with %u parallel processes\n\n",
+    // give each worker thread a model of its own
+    thread_pool pool(max_processes);
+    SAT_LOG(0, "preloading symbols\n");
+    model->preload(pool, *host_filesystem, kernel_image_path);
+    vector<shared_ptr<ipt_model>> models{model};
+    while (models.size() < pool.size()) {
+        models.push_back(model->make_worker());
+    }
+
+    SAT_LOG(0, "running IPT model of %u tasks with %u worker threads\n\n",
             collection.tasks(),
-            max_processes);
-    //SAT_LOG(0, "| started |  ready | total |\n");
-    //SAT_LOG(0, "============================\n");
+            pool.size());
     print_progress_header();
-    unsigned forked  = 0;
-    unsigned running = 0;
+    mutex    progress_mutex;
+    unsigned started   = 0;
+    unsigned completed = 0;
     auto tids = collection.tids_in_decreasing_order_of_trace_size();
     for (auto tid : tids) {
-        // fork a process for each task
-        pid_t pid;
-        switch (pid = fork()) {
-        case -1:
-            // TODO
-            break;
-        case 0:
-            // child
+        pool.submit([&, tid]() {
             {
-                // re-open path mapper cache files after fork()
-                host_filesystem->open();
-                run(tid,
-                    model,
-                    host_filesystem,
-                    symbols_path,
-                    executables_path,
-                    host_executables_path,
-                    output_path_format,
-                    stack_low_water_marks_path_format);
-                goto child_exit;
+                lock_guard<mutex> lock(progress_mutex);
+                ++started;
+                print_progress(started, completed, tids.size());
+                SAT_LOG(1, "started %u/%" PRIu64 ", tid: %u, size: %lu\n",
+                        started,
+                        tids.size(),
+                        tid,
+                        collection.task(tid)->size());
             }
-            break;
-        default:
-            // parent
-            ++forked;
-            ++running;
-            print_progress(forked, (forked-running), tids.size());
-            SAT_LOG(1, "forked pid %u: %u/%" PRIu64
-                       ", tid: %u, size: %lu, running: %u\n",
-                   pid,
-                   forked,
-                   tids.size(),
-                   tid,
-                   collection.task(tid)->size(),
-                   running);
-            while ((pid = waitpid(-1,
-                                  nullptr,
-                                  running < max_processes ? WNOHANG : 0)) > 0)
+
+            run(tid,
+                models[thread_pool::worker_index()],
+                pool,
+                models,
+                min_segment_size * 1024 * 1024,
+                output_path_format,
+                stack_low_water_marks_path_format);
+
             {
-                // TODO: handle EINTR
-                --running;
-                print_progress(forked, (forked-running), tids.size());
-                SAT_LOG(1, "waited pid %u, running: %u\n", pid, running);
+                lock_guard<mutex> lock(progress_mutex);
+                ++completed;
+                print_progress(started, completed, tids.size());
+                SAT_LOG(1, "completed tid %u\n", tid);
             }
-            break;
-        }
-    }
-    while (running > 0) {
-        pid_t pid = wait(nullptr);
-        // TODO: handle EINTR
-        --running;
-        print_progress(forked, (forked-running), tids.size());
-        SAT_LOG(1, "waited pid %u, running: %u\n", pid, running);
+        });
     }
+    pool.wait();
     printf("\n");
 
-child_exit:
+    size_t instructions, blocks, reused;
+    model->output().cache_statistics(instructions, blocks, reused);
+    SAT_LOG(0, "decoded %zu instructions and %zu basic blocks for %u workers; "
+               "%zu times, a worker found one that another had decoded\n",
+            instructions, blocks, pool.size(), reused);
+
+    disassembler::save_decode_cache();
 
     exit(EXIT_SUCCESS);
 
@@ -18,7 +18,9 @@
 #include "sat-ipt-scheduling-heuristics.h"
 #include "sat-ipt-tsc-heuristics.h"
 #include "sat-ipt-iterator.h"
+#include "sat-ipt-index.h"
 #include <map>
+#include <limits>
 
 namespace sat {
 
@@ -126,10 +128,15 @@ void scheduling_heuristics::apply()
     // -----|-----------|------------|----------|-----------------|----------------------|-------------||------------------|----|------|-----|-oef
     //        
 
-    ipt_iterator ipt(imp_->ipt_path_);
-    ipt.iterate([&](const ipt_iterator::token& t, size_t offset) {
-        if (t.func == &ipt_iterator::output::tip) {
-            if (t.tip == imp_->scheduler_tip_) {
+    auto index = ipt_index::obtain(imp_->ipt_path_, imp_->scheduler_tip_);
+    if (!index) {
+        return;
+    }
+    auto packets = index->packets();
+    for (size_t i = 0; i < packets.size; ++i) {
+        size_t offset = packets.offset[i];
+        if (packets.kind[i] == ipt_packet_kind::TIP) {
+            if (packets.payload[i] == imp_->scheduler_tip_) {
                 // printf("#%08" PRIx64 ": SCHEDULER TIP %" PRIx64 " --> ",
                 //        offset, t.tip);
                 map<uint64_t /*tsc*/, scheduling_m>::iterator prev_iter = imp_->schedulings_.end();
@@ -189,7 +196,7 @@ void scheduling_heuristics::apply()
                 // DEBUG other tip
                 //printf("tip %08" PRIx64 "\n", t.tip);
             }
-        } else if (t.func == &ipt_iterator::output::ovf) {
+        } else if (packets.kind[i] == ipt_packet_kind::OVF) {
             // In case of overflow, set all non-earmarked schedule points located in the
             // same tsc range with OVF packet to point to the OVF offset.
             struct scheduling_m *prev_item = nullptr;
@@ -220,10 +227,8 @@ void scheduling_heuristics::apply()
                 prev_item = &sideband_scheduling.second;
             }
 
-        } else if (t.func == &ipt_iterator::output::eof) {
-            //printf("#EOF!!!\n");
         }
-    });
+    }
 }
 
 #if 0
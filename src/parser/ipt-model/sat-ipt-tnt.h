@@ -16,76 +16,227 @@
 #ifndef SAT_IPT_TNT_H
 #define SAT_IPT_TNT_H
 
-#include <queue>
+#include <vector>
+#include <algorithm>
 #include <cinttypes>
 
 namespace sat {
 
     using namespace std;
 
+    // A FIFO of TNT bits packed into a ring of 64-bit words. Bits are
+    // stored in the order they are consumed, starting from the most
+    // significant bit of each word, which lets runs of equal bits be
+    // consumed with a single count-leading-zeros.
     class tnt_buffer {
     public:
-        tnt_buffer() : current_(), buffered_() {}
+        tnt_buffer() : words_(initial_words_), head_(), size_() {}
 
+        // append the bits of a TNT packet; mask has the bit of the
+        // first TNT set and the rest are consumed from there downwards
         void append(uint64_t bits, uint64_t mask)
         {
-            if (empty()) {
-                current_.bits = bits;
-                current_.mask = mask;
-            } else {
-                buffered_.push({bits, mask});
+            if (!mask) {
+                return;
+            }
+
+            unsigned count = 64 - __builtin_clzll(mask);
+            if (size_ + count > capacity()) {
+                grow(size_ + count);
             }
+            write(bits, count);
         }
 
-        bool empty()
+        bool empty() const
         {
-            return !current_.mask;
+            return !size_;
         }
 
         bool taken()
         {
-            bool result = current_.bits & current_.mask;
+            bool result = false;
 
-            if (!(current_.mask >>= 1)) {
-                if (!buffered_.empty()) {
-                    current_ = buffered_.front();
-                    buffered_.pop();
-                }
+            if (size_) {
+                result = words_[head_ / 64] & (1ULL << (63 - head_ % 64));
+                advance(1);
             }
 
             return result;
         }
 
-        unsigned size()
+        unsigned size() const
+        {
+            return size_;
+        }
+
+        // consume the leading run of taken bits, at most max bits;
+        // return the number of bits consumed
+        unsigned consume_taken(unsigned max = ~0U)
+        {
+            return consume_run(true, max);
+        }
+
+        // consume the leading run of not-taken bits, at most max bits;
+        // return the number of bits consumed
+        unsigned consume_not_taken(unsigned max = ~0U)
+        {
+            return consume_run(false, max);
+        }
+
+        // number of taken bits among the next count bits
+        unsigned count_taken(unsigned count) const
         {
             unsigned result = 0;
+            uint64_t pos    = head_;
 
-            tnt c        = current_;
-            queue<tnt> b = buffered_;
-            while (c.mask) {
-                ++result;
-                if (!(c.mask >>= 1) && !b.empty()) {
-                    c = b.front();
-                    b.pop();
-                }
+            count = min(count, size_);
+            while (count) {
+                unsigned n = min(count, 64U);
+                result += __builtin_popcountll(peek(pos) >> (64 - n));
+                pos     = (pos + n) & (capacity() - 1);
+                count  -= n;
             }
 
             return result;
         }
 
+        // drop the next count bits
+        void skip(unsigned count)
+        {
+            advance(min(count, size_));
+        }
+
         void clean()
         {
-            buffered_ = queue<tnt>();
-            current_.bits = 0;
-            current_.mask = 0;
+            head_ = 0;
+            size_ = 0;
         }
+
+        // true if both hold the same bits, however they are laid out
+        bool operator==(const tnt_buffer& other) const
+        {
+            bool     same = size_ == other.size_;
+            uint64_t pos  = head_;
+            uint64_t opos = other.head_;
+
+            for (unsigned left = size_; same && left;) {
+                unsigned n = min(left, 64U);
+                same  = (peek(pos) >> (64 - n)) == (other.peek(opos) >> (64 - n));
+                pos   = (pos + n) & (capacity() - 1);
+                opos  = (opos + n) & (other.capacity() - 1);
+                left -= n;
+            }
+
+            return same;
+        }
+
+        bool operator!=(const tnt_buffer& other) const
+        {
+            return !(*this == other);
+        }
+
     private:
-        using tnt = struct {
-            uint64_t bits;
-            uint64_t mask;
-        };
-        tnt        current_;
-        queue<tnt> buffered_;
+        uint64_t capacity() const
+        {
+            return words_.size() * 64;
+        }
+
+        void advance(unsigned count)
+        {
+            head_  = (head_ + count) & (capacity() - 1);
+            size_ -= count;
+        }
+
+        // up to 64 bits starting from bit position pos, the first one in
+        // the most significant bit; bits past the end are unspecified
+        uint64_t peek(uint64_t pos) const
+        {
+            size_t   word   = pos / 64;
+            unsigned offset = pos % 64;
+            uint64_t result = words_[word] << offset;
+
+            if (offset) {
+                result |= words_[(word + 1) % words_.size()] >> (64 - offset);
+            }
+
+            return result;
+        }
+
+        // write the count lowest bits of bits after the last bit
+        void write(uint64_t bits, unsigned count)
+        {
+            uint64_t pos  = (head_ + size_) & (capacity() - 1);
+            size_t   word = pos / 64;
+            unsigned room = 64 - pos % 64;
+
+            if (count < 64) {
+                bits &= (1ULL << count) - 1;
+            }
+            if (count <= room) {
+                uint64_t field = count < 64 ? ((1ULL << count) - 1) : ~0ULL;
+                unsigned shift = room - count;
+                words_[word] = (words_[word] & ~(field << shift)) |
+                               bits << shift;
+            } else {
+                unsigned rest = count - room; // bits in the following word
+                uint64_t field = (1ULL << room) - 1;
+                words_[word] = (words_[word] & ~field) | bits >> rest;
+                word = (word + 1) % words_.size();
+                words_[word] = (words_[word] & (~0ULL >> rest)) |
+                               bits << (64 - rest);
+            }
+            size_ += count;
+        }
+
+        void grow(uint64_t needed)
+        {
+            size_t words = words_.size();
+            while (words * 64 < needed) {
+                words *= 2;
+            }
+
+            tnt_buffer bigger;
+            bigger.words_.resize(words);
+            uint64_t pos = head_;
+            for (unsigned left = size_; left;) {
+                unsigned n = min(left, 64U);
+                bigger.write(peek(pos) >> (64 - n), n);
+                pos   = (pos + n) & (capacity() - 1);
+                left -= n;
+            }
+
+            words_.swap(bigger.words_);
+            head_ = 0;
+        }
+
+        unsigned consume_run(bool taken, unsigned max)
+        {
+            unsigned result = 0;
+
+            max = min(max, size_);
+            while (result < max) {
+                uint64_t bits = peek(head_);
+                if (taken) {
+                    bits = ~bits;
+                }
+                unsigned n   = min(max - result, 64U);
+                unsigned run = bits ? __builtin_clzll(bits) : 64;
+                run = min(run, n);
+                advance(run);
+                result += run;
+                if (run < n) {
+                    break;
+                }
+            }
+
+            return result;
+        }
+
+        static const size_t initial_words_ = 4;
+
+        vector<uint64_t> words_;
+        uint64_t         head_; // bit position of the next bit
+        unsigned         size_; // number of bits
     }; // tnt_buffer
 
 } // sat
@@ -0,0 +1,183 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Replay the mmaps and munmaps of a sideband file into a range map per
+// process, the way the sideband model does, and time it.
+#include "sat-sideband-parser.h"
+#include "sat-file-input.h"
+#include "sat-range-map.h"
+#include "sat-types.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+const uint32_t unmapped = 0;
+
+uint64_t tsc(const sat_header& header)
+{
+    return (header.tscp & 0xffffffffffffff) - header.tsc_offset;
+}
+
+struct event {
+    uint64_t tsc;
+    pid_t    pid;
+    pid_t    ppid;   // for forks
+    rva      start;
+    rva      end;
+    uint32_t id;     // unmapped for munmaps
+    bool     fork;
+}; // event
+
+class event_collector : public sideband_parser_output {
+public:
+    void process(const sat_header& header,
+                 sat_origin        origin,
+                 pid_t             pid,
+                 pid_t             ppid,
+                 pid_t             tgid,
+                 uint64_t          pgd,
+                 const char*       name) override
+    {
+        if (origin == SAT_ORIGIN_FORK && pid == tgid) {
+            events_.push_back({tsc(header), pid, ppid, 0, 0, unmapped, true});
+        }
+    }
+
+    void mmap(const sat_header& header,
+              sat_origin        origin,
+              pid_t             pid,
+              uint64_t          start,
+              uint64_t          len,
+              uint64_t          pgoff,
+              const char*       path) override
+    {
+        if (origin == SAT_ORIGIN_INIT || origin == SAT_ORIGIN_MMAP) {
+            auto p = paths_.insert({path, (uint32_t)paths_.size() + 1}).first;
+            events_.push_back({tsc(header), pid, 0,
+                               start, start + len, p->second, false});
+        }
+    }
+
+    void munmap(const sat_header& header,
+                sat_origin        origin,
+                pid_t             pid,
+                uint64_t          start,
+                uint64_t          len) override
+    {
+        if (origin == SAT_ORIGIN_MUNMAP) {
+            events_.push_back({tsc(header), pid, 0,
+                               start, start + len, unmapped, false});
+        }
+    }
+
+    vector<event>         events_;
+    map<string, uint32_t> paths_;
+}; // event_collector
+
+using mappings = range_map<rva, uint32_t>;
+
+void replay(const event& e, map<pid_t, mappings>& processes)
+{
+    if (e.fork) {
+        auto parent = processes.find(e.ppid);
+        if (parent != processes.end()) {
+            processes[e.pid] = parent->second;
+        }
+    } else {
+        uint32_t id = e.id;
+        processes[e.pid].insert({e.start, e.end}, id);
+    }
+}
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <sideband-file> [rebuilds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    unsigned rebuilds = argc > 2 ? atoi(argv[2]) : 100;
+
+    using sideband_input = file_input<sideband_parser_input>;
+    shared_ptr<sideband_input>  input{new sideband_input};
+    shared_ptr<event_collector> collector{new event_collector};
+    if (!input->open(argv[1])) {
+        exit(EXIT_FAILURE);
+    }
+    sideband_parser parser(input, collector);
+    if (!parser.parse()) {
+        fprintf(stderr, "cannot parse sideband file '%s'\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    auto& events = collector->events_;
+    if (events.empty()) {
+        fprintf(stderr, "no mmaps in '%s'\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    // the model keeps the mappings of a process in tsc order
+    stable_sort(events.begin(), events.end(),
+                [](const event& a, const event& b) { return a.tsc < b.tsc; });
+
+    // build the final mappings of each process in one go
+    map<pid_t, mappings> processes;
+    auto start = chrono::steady_clock::now();
+    for (const auto& e : events) {
+        replay(e, processes);
+    }
+    double build_seconds = seconds_since(start);
+
+    size_t ranges      = 0;
+    size_t max_ranges  = 0;
+    for (const auto& p : processes) {
+        ranges    += p.second.size();
+        max_ranges = max(max_ranges, p.second.size());
+    }
+    printf("%zu mmaps and munmaps, %zu processes, "
+           "%zu ranges (at most %zu in a process)\n",
+           events.size(), processes.size(), ranges, max_ranges);
+    printf("build:    %.3f s\n", build_seconds);
+
+    // rebuild the mappings as of points spread over the sideband, like
+    // the sideband model does when a task moves to another time slot
+    uint64_t first = events.front().tsc;
+    uint64_t last  = events.back().tsc;
+    start = chrono::steady_clock::now();
+    for (unsigned r = 1; r <= rebuilds; ++r) {
+        uint64_t             until = first + (last - first) / rebuilds * r;
+        map<pid_t, mappings> rebuilt;
+        for (const auto& e : events) {
+            if (e.tsc >= until) {
+                break;
+            }
+            replay(e, rebuilt);
+        }
+    }
+    printf("rebuilds: %.3f s for %u\n", seconds_since(start), rebuilds);
+}
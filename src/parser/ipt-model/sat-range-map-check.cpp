@@ -0,0 +1,164 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Insert random ranges and holes into a range map and compare it after
+// every step with a plain array that has an entry for each address.
+// Every insert gets an ID of its own, so the ranges of the map must be
+// exactly the runs of equal IDs in the array.
+#include "sat-range-map.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+const unsigned domain   = 256;
+const unsigned no_range = 0;
+
+// how often a punch split, trimmed or erased a range
+struct punch_counts {
+    unsigned split;
+    unsigned trimmed;
+    unsigned erased;
+}; // punch_counts
+
+// count what punching hole does to the ranges of the array
+void count_punch(const vector<unsigned>& array,
+                 pair<unsigned, unsigned> hole,
+                 punch_counts&            counts)
+{
+    unsigned b = 0;
+    while (b < domain) {
+        unsigned e = b + 1;
+        while (e < domain && array[e] == array[b]) {
+            ++e;
+        }
+        if (array[b] != no_range && b < hole.second && hole.first < e) {
+            bool before = b < hole.first;
+            bool after  = e > hole.second;
+            if (before && after) {
+                ++counts.split;
+            } else if (before || after) {
+                ++counts.trimmed;
+            } else {
+                ++counts.erased;
+            }
+        }
+        b = e;
+    }
+}
+
+// check that the ranges are the runs of equal IDs of array
+bool same(const range_map<unsigned, unsigned>& ranges,
+          const vector<unsigned>&              array)
+{
+    bool     ok    = true;
+    unsigned runs  = 0;
+    unsigned b     = 0;
+    while (ok && b < domain) {
+        unsigned e = b + 1;
+        while (e < domain && array[e] == array[b]) {
+            ++e;
+        }
+        if (array[b] != no_range) {
+            ++runs;
+        }
+        for (unsigned at = b; ok && at < e; ++at) {
+            pair<unsigned, unsigned> range;
+            unsigned                 id;
+            if (ranges.find(at, range, id)) {
+                ok = id == array[b] && range.first == b && range.second == e;
+            } else {
+                ok = array[b] == no_range;
+            }
+            if (!ok) {
+                fprintf(stderr, "mismatch at %u\n", at);
+            }
+        }
+        b = e;
+    }
+
+    if (ok && ranges.size() != runs) {
+        fprintf(stderr, "%lu ranges instead of %u\n",
+                (unsigned long)ranges.size(), runs);
+        ok = false;
+    }
+
+    return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned steps = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned seed  = argc > 2 ? atoi(argv[2]) : 1;
+
+    mt19937                          random(seed);
+    range_map<unsigned, unsigned>    ranges;
+    vector<unsigned>                 array(domain, no_range);
+    punch_counts                     counts = {};
+    unsigned                         next_id = no_range + 1;
+    bool                             ok      = true;
+    unsigned                         step;
+
+    for (step = 0; ok && step < steps; ++step) {
+        if (random() % 1000 == 0) {
+            ranges.clear();
+            array.assign(domain, no_range);
+            continue;
+        }
+
+        // mostly short ranges, so that there are many of them to punch
+        unsigned begin  = random() % domain;
+        unsigned length = random() % 4 ? random() % 16 : random() % domain;
+        unsigned end    = min(domain, begin + length);
+
+        count_punch(array, {begin, end}, counts);
+        if (random() % 3) {
+            ranges.insert({begin, end}, next_id);
+            for (unsigned at = begin; at < end; ++at) {
+                array[at] = next_id;
+            }
+            ++next_id;
+        } else {
+            ranges.insert_hole({begin, end});
+            for (unsigned at = begin; at < end; ++at) {
+                array[at] = no_range;
+            }
+        }
+
+        if (!same(ranges, array)) {
+            fprintf(stderr, "range map differs after step %u of seed %u\n",
+                    step, seed);
+            ok = false;
+        }
+    }
+
+    printf("%u steps: %u splits, %u trims, %u erases: %s\n",
+           step, counts.split, counts.trimmed, counts.erased,
+           ok ? "ok" : "FAILED");
+
+    if (ok && (!counts.split || !counts.trimmed || !counts.erased)) {
+        fprintf(stderr, "not all ways of punching were tried\n");
+        ok = false;
+    }
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -25,47 +25,46 @@ namespace sat {
 
 using namespace std;
 
+// Disjoint ranges, each with an ID, kept in a balanced tree by their
+// beginnings. Inserting a range punches a hole for it first, splitting
+// the ranges it overlaps; that takes O(log n + k) for the k ranges that
+// the hole touches.
 template <class LIMIT, class ID>
 class range_map {
 public:
     range_map() : ranges_()
     {}
 
-    void insert(pair<LIMIT, LIMIT> range, ID& id)
+    void insert(pair<LIMIT, LIMIT> range, const ID& id)
     {
-        insert_hole(range);
-        ranges_.insert({range, id});
+        if (range.first < range.second) {
+            auto r = punch(range);
+            ranges_.insert(r, {range.first, {range.second, id}});
+        }
     }
 
     void insert_hole(pair<LIMIT, LIMIT> hole)
     {
-        for (auto r = ranges_.begin(); r != ranges_.end(); ++r) {
-            if (hole.first < r->first.second && hole.second > r->first.first) {
-                // the hole intersects with the range
-                if (r->first.first < hole.first) {
-                    // need to make a new entry for beginning of r
-                    ranges_.insert({{r->first.first, hole.first}, r->second});
-                }
-                if (r->first.second > hole.second) {
-                    // need to make a new entry for end of r
-                    ranges_.insert({{hole.second, r->first.second}, r->second});
-                }
-                ranges_.erase(r);
-            }
+        if (hole.first < hole.second) {
+            punch(hole);
         }
     }
 
-    bool find(const LIMIT at, ID& id)
+    bool find(const LIMIT at, ID& id) const
     {
-        auto r = ranges_.lower_bound({at, at});
-        if (r != ranges_.end() && r->first.first == at) {
-                id = r->second;
-                return true;
-        }
+        pair<LIMIT, LIMIT> range;
+        return find(at, range, id);
+    }
+
+    // also return the range that at falls in
+    bool find(const LIMIT at, pair<LIMIT, LIMIT>& range, ID& id) const
+    {
+        auto r = ranges_.upper_bound(at);
         if (r != ranges_.begin()) {
             --r;
-            if (r->first.first <= at && r->first.second > at) {
-                id = r->second;
+            if (at < r->second.end) {
+                range = {r->first, r->second.end};
+                id    = r->second.id;
                 return true;
             }
         }
@@ -76,12 +75,62 @@ public:
     void iterate(function<void(const pair<LIMIT, LIMIT>&, const ID&)> f) const
     {
         for (const auto& r : ranges_) {
-            f(r.first, r.second);
+            f({r.first, r.second.end}, r.second.id);
         }
     }
 
+    size_t size() const
+    {
+        return ranges_.size();
+    }
+
+    void clear()
+    {
+        ranges_.clear();
+    }
+
 private:
-    map<pair<LIMIT, LIMIT>, ID> ranges_;
+    struct range {
+        LIMIT end;
+        ID    id;
+    }; // range
+    using range_tree = map<LIMIT /*begin*/, range>;
+
+    // remove hole from the ranges, keeping the parts of them that stick
+    // out of it; return where a range beginning at the hole would go
+    typename range_tree::iterator punch(pair<LIMIT, LIMIT> hole)
+    {
+        auto r = ranges_.upper_bound(hole.first);
+        if (r != ranges_.begin()) {
+            auto p = prev(r);
+            if (p->second.end > hole.first) {
+                // the range before the hole reaches into it
+                if (p->second.end > hole.second) {
+                    // and out of the other side
+                    r = ranges_.insert(r, {hole.second, p->second});
+                }
+                if (p->first < hole.first) {
+                    p->second.end = hole.first;
+                } else {
+                    ranges_.erase(p);
+                }
+            }
+        }
+        while (r != ranges_.end() && r->first < hole.second) {
+            if (r->second.end > hole.second) {
+                // keep the end of the last range the hole touches
+                range end = r->second;
+                r = ranges_.erase(r);
+                r = ranges_.insert(r, {hole.second, end});
+                break;
+            }
+            r = ranges_.erase(r);
+        }
+
+        return r;
+    }
+
+    range_tree ranges_;
 }; // range_map
 
 } // namespace sat
@@ -0,0 +1,246 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Check what stitching speculative output relies on. Run random calls
+// and returns on top of a random call stack, and the same calls and
+// returns on a relative stack that does not know the one below. Each
+// step outputs lines the way the model does, with the relative depths
+// and totals marked with '~'. The relative stack must fit on the real
+// one exactly when its returns did not need an address that the real
+// one had. If it fits, the rebased stack must equal the real one, and
+// rebasing the '~' output must give the output of the real run.
+#include "sat-call-stack.h"
+#include "sat-rebased-output.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+// calls, and returns that need the return address or know their target
+void random_step(call_stack& stack, mt19937& random, vector<rva>& popped)
+{
+    switch (random() % 5) {
+    case 0:
+    case 1:
+        stack.push(0x1000 + random() % 0x1000);
+        break;
+    case 2:
+    case 3:
+        popped.push_back(stack.pop());
+        break;
+    default:
+        stack.pop_known_target();
+        popped.push_back(0); // the target does not matter
+        break;
+    }
+}
+
+// a line of output at the current depth, as the model writes it, or one
+// without relative values in it
+void print_step(FILE* f, const call_stack& stack, unsigned kind)
+{
+    const char* mark  = stack.depth_mark();
+    int         depth = stack.depth();
+
+    switch (kind % 8) {
+    case 0: fprintf(f, "@ e %s%d 12 3\n", mark, depth); break;
+    case 1: fprintf(f, "@ c %s%d 7\n", mark, depth - 1); break;
+    case 2: fprintf(f, "@ r %s%d ffffffff81000000 (iret)\n", mark, depth); break;
+    case 3: fprintf(f, "@ d 2 %s%d -> f+0x3\n", mark, depth); break;
+    case 4: fprintf(f, "@ d 12 %s%d 4@400000 (/x/~y)\n", mark, depth); break;
+    case 5: fprintf(f, "@ x 5\n"); break;
+    case 6: fprintf(f, "@ ! iWARNING: ~5 is no total\n"); break;
+    default: fprintf(f, "@ t 1f\n"); break;
+    }
+}
+
+string read_file(FILE* f)
+{
+    string result;
+    char   buffer[4096];
+    size_t n;
+
+    fseek(f, 0, SEEK_SET);
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        result.append(buffer, n);
+    }
+    return result;
+}
+
+vector<rva> stack_contents(const call_stack& stack)
+{
+    vector<rva> result;
+    stack.iterate([&](rva r) { result.push_back(r); });
+    return result;
+}
+
+// how many trials fitted, how many of those returned below the bottom
+// of the real stack, and how many did not fit
+struct counts {
+    unsigned fitted;
+    unsigned below_base;
+    unsigned did_not_fit;
+}; // counts
+
+bool trial(mt19937& random, counts& c)
+{
+    bool ok = true;
+
+    // the real stack when the speculative run starts
+    call_stack base;
+    for (unsigned n = random() % 40; n > 0; --n) {
+        vector<rva> dummy;
+        random_step(base, random, dummy);
+    }
+    // the model is not fast-forwarding when it outputs
+    base.temp_stack_disable();
+
+    call_stack  real(base);
+    call_stack  relative;
+    vector<rva> real_popped;
+    vector<rva> relative_popped;
+    relative.make_relative();
+
+    FILE* expected    = tmpfile();
+    FILE* speculative = tmpfile();
+    FILE* rebased     = tmpfile();
+    if (!expected || !speculative || !rebased) {
+        fprintf(stderr, "cannot make temporary files\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // something before the speculative output starts, not to be copied
+    fprintf(speculative, "@ c ~99 1\n");
+    long offset = ftell(speculative);
+
+    int64_t overflow_base = random() % 10;
+    int64_t skip_base     = random() % 10000;
+    int64_t overflows     = 0;
+    int64_t skipped       = 0;
+
+    for (unsigned n = random() % 60; n > 0; --n) {
+        unsigned seed = random();
+        mt19937  r1(seed);
+        mt19937  r2(seed);
+        random_step(real,     r1, real_popped);
+        random_step(relative, r2, relative_popped);
+
+        unsigned kind = random();
+        print_step(expected,    real,     kind);
+        print_step(speculative, relative, kind);
+
+        if (random() % 10 == 0) {
+            if (random() % 2) {
+                ++overflows;
+                fprintf(expected, "@ ! o %" PRId64 "\n",
+                        overflows + overflow_base);
+                fprintf(speculative, "@ ! o ~%" PRId64 "\n", overflows);
+            } else {
+                skipped += random() % 100;
+                fprintf(expected, "@ ! s %" PRId64 "\n", skipped + skip_base);
+                fprintf(speculative, "@ ! s ~%" PRId64 "\n", skipped);
+            }
+        }
+    }
+    fflush(speculative);
+
+    // the returns that needed an address must have got the same one
+    bool same_returns = real_popped == relative_popped;
+    bool fits         = relative.fits_on(base);
+    if (fits != same_returns) {
+        fprintf(stderr, "fits_on() says %d, but the returns %s\n",
+                fits, same_returns ? "were the same" : "differed");
+        ok = false;
+    }
+
+    if (ok && fits) {
+        ++c.fitted;
+        if (real.low_water_mark() < base.low_water_mark()) {
+            ++c.below_base;
+        }
+
+        copy_rebased_output(speculative,
+                            offset,
+                            rebased,
+                            base.original_depth(),
+                            overflow_base,
+                            skip_base);
+        if (read_file(rebased) != read_file(expected)) {
+            fprintf(stderr, "rebased output differs:\n%s\nexpected:\n%s\n",
+                    read_file(rebased).c_str(), read_file(expected).c_str());
+            ok = false;
+        }
+
+        relative.rebase(base);
+        if (relative.depth()           != real.depth()           ||
+            relative.original_depth()  != real.original_depth()  ||
+            relative.low_water_mark()  != real.low_water_mark()  ||
+            stack_contents(relative)   != stack_contents(real)   ||
+            *relative.depth_mark())
+        {
+            fprintf(stderr, "rebased stack at depth %d, low-water mark %d "
+                            "instead of %d, %d\n",
+                    relative.depth(), relative.low_water_mark(),
+                    real.depth(), real.low_water_mark());
+            ok = false;
+        }
+    } else if (ok) {
+        ++c.did_not_fit;
+    }
+
+    fclose(expected);
+    fclose(speculative);
+    fclose(rebased);
+
+    return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned trials = argc > 1 ? atoi(argv[1]) : 20000;
+    unsigned seed   = argc > 2 ? atoi(argv[2]) : 1;
+
+    mt19937  random(seed);
+    counts   c  = {};
+    bool     ok = true;
+    unsigned t;
+
+    for (t = 0; ok && t < trials; ++t) {
+        if (!trial(random, c)) {
+            fprintf(stderr, "trial %u of seed %u failed\n", t, seed);
+            ok = false;
+        }
+    }
+
+    printf("%u trials: %u fitted, %u of them below the real stack, "
+           "%u did not fit: %s\n",
+           t, c.fitted, c.below_base, c.did_not_fit, ok ? "ok" : "FAILED");
+
+    if (ok && (!c.fitted || !c.below_base || !c.did_not_fit)) {
+        fprintf(stderr, "not all ways of rebasing were tried\n");
+        ok = false;
+    }
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,89 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "sat-rebased-output.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+namespace sat {
+
+using namespace std;
+
+// copy bytes [0, size) of a file
+void copy_output(FILE* from, long size, FILE* to)
+{
+    char buffer[64 * 1024];
+
+    fseek(from, 0, SEEK_SET);
+    while (size > 0) {
+        size_t n = fread(buffer, 1, min<long>(size, sizeof(buffer)), from);
+        if (n == 0) {
+            break;
+        }
+        fwrite(buffer, 1, n, to);
+        size -= n;
+    }
+}
+
+// copy speculative output from offset on, rebasing the values that
+// are marked relative with '~'
+void copy_rebased_output(FILE*   from,
+                         long    offset,
+                         FILE*   to,
+                         int64_t depth_base,
+                         int64_t overflow_base,
+                         int64_t skip_base)
+{
+    char*   line   = nullptr;
+    size_t  size   = 0;
+    ssize_t length;
+
+    fseek(from, offset, SEEK_SET);
+    while ((length = getline(&line, &size, from)) != -1) {
+        // the relative value is the depth in "@ e|c|r ~d ..." and
+        // "@ d cpu ~d ...", or the total in "@ ! o|s ~n"
+        char* field = nullptr;
+        if (length > 4 && line[0] == '@') {
+            field = line + 4;
+            if (line[2] == 'd' || line[2] == '!') {
+                field = strchr(field, ' ');
+                if (field) {
+                    ++field;
+                }
+            }
+            if (line[2] == '!' && line[4] != 'o' && line[4] != 's') {
+                field = nullptr; // a warning, not a total
+            }
+        }
+
+        if (field && *field == '~') {
+            int64_t base = depth_base;
+            if (line[2] == '!') {
+                base = line[4] == 'o' ? overflow_base : skip_base;
+            }
+            char*   rest;
+            int64_t value = strtoll(field + 1, &rest, 10);
+            fwrite(line, 1, field - line, to);
+            fprintf(to, "%" PRId64 "%s", value + base, rest);
+        } else {
+            fwrite(line, 1, length, to);
+        }
+    }
+    free(line);
+}
+
+} // namespace sat
@@ -0,0 +1,39 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_REBASED_OUTPUT_H
+#define SAT_REBASED_OUTPUT_H
+
+#include <cstdint>
+#include <cstdio>
+
+namespace sat {
+
+// copy bytes [0, size) of a file
+void copy_output(FILE* from, long size, FILE* to);
+
+// copy speculative output from offset on, rebasing the values that are
+// marked relative with '~': call stack depths by depth_base, and the
+// overflow and skip totals by overflow_base and skip_base
+void copy_rebased_output(FILE*   from,
+                         long    offset,
+                         FILE*   to,
+                         int64_t depth_base,
+                         int64_t overflow_base,
+                         int64_t skip_base);
+
+} // namespace sat
+
+#endif // SAT_REBASED_OUTPUT_H
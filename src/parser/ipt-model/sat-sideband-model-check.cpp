@@ -0,0 +1,425 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Check that the sideband model snapshots do not lose the kernel modules:
+// build a model of a small sideband with a kernel module, alternately
+// without and with a host filesystem to resolve the module in, and check
+// that the module is there exactly when the host filesystem is.
+//
+// Also check the span of time that a module lookup returns at the tscs
+// around two mmaps to the same address; callers cache the lookup for
+// that span.
+//
+// Also check that the threads are numbered in the order of their thread
+// ids, unless following a sideband, where the numbers of the threads
+// must stay as they are when more threads appear; and that following
+// takes only the version that the model was built for.
+#include "sat-sideband-model.h"
+#include "sat-path-mapper.h"
+#include <cstdio>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <limits.h>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+const char*    module_name    = "sat-check";
+const uint64_t module_address = 0xffffffffc0000000;
+const uint64_t mmap_address   = 0x400000;
+const uint64_t first_mmap_tsc = 0x3000;
+const uint64_t next_mmap_tsc  = 0x4000;
+
+// threads scheduled in after init, which is thread 1
+const pid_t scheduled_threads[] = {9, 5};
+
+// resolves all kernel modules to this program, for its .text section
+class self_path_mapper : public path_mapper {
+public:
+    explicit self_path_mapper(const string& self) : self_(self) {}
+
+    bool find_file(const string& target_path,
+                   string&       host_path,
+                   string&       symbols_path) const override
+    {
+        host_path    = self_;
+        symbols_path = self_;
+        return true;
+    }
+
+private:
+    string self_;
+}; // self_path_mapper
+
+template <class MESSAGE>
+void put(FILE* f, MESSAGE& message, sat_type type, uint64_t tsc)
+{
+    message.header.size = sizeof(message);
+    message.header.type = type;
+    message.header.tscp = tsc;
+    fwrite(&message, sizeof(message), 1, f);
+}
+
+void put_schedule(FILE* f, pid_t thread_id)
+{
+    static uint64_t tsc = next_mmap_tsc;
+
+    sat_msg_schedule schedule;
+    memset(&schedule, 0, sizeof(schedule));
+    schedule.pid       = thread_id;
+    schedule.tgid      = thread_id;
+    schedule.prev_pid  = 1;
+    schedule.prev_tgid = 1;
+    put(f, schedule, SAT_MSG_SCHEDULE, ++tsc);
+}
+
+bool write_sideband(const string& path, const char* version)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fwrite(version, sizeof(SIDEBAND_VERSION) - 1, 1, f);
+
+    sat_msg_init init;
+    memset(&init, 0, sizeof(init));
+    init.pid      = 1;
+    init.tgid     = 1;
+    init.tsc_tick = 1;
+    init.fsb_mhz  = 100;
+    put(f, init, SAT_MSG_INIT, 0x1000);
+
+    sat_msg_module_abi2 module;
+    memset(&module, 0, sizeof(module));
+    module.addr = module_address;
+    module.size = 0x10000;
+    strncpy(module.name, module_name, sizeof(module.name) - 1);
+    put(f, module, SAT_MSG_MODULE_ABI2, 0x1001);
+
+    sat_msg_process_abi2 process;
+    memset(&process, 0, sizeof(process));
+    process.origin = SAT_ORIGIN_INIT;
+    process.pid    = 1;
+    process.tgid   = 1;
+    strncpy(process.name, "init", sizeof(process.name) - 1);
+    put(f, process, SAT_MSG_PROCESS_ABI2, 0x1002);
+
+    sat_msg_mmap_abi2 mmap;
+    memset(&mmap, 0, sizeof(mmap));
+    mmap.origin = SAT_ORIGIN_MMAP;
+    mmap.tgid   = 1;
+    mmap.start  = mmap_address;
+    mmap.len    = 0x1000;
+    strncpy(mmap.path, "/first", sizeof(mmap.path) - 1);
+    put(f, mmap, SAT_MSG_MMAP_ABI2, first_mmap_tsc);
+    strncpy(mmap.path, "/next", sizeof(mmap.path) - 1);
+    put(f, mmap, SAT_MSG_MMAP_ABI2, next_mmap_tsc);
+
+    for (auto thread_id : scheduled_threads) {
+        put_schedule(f, thread_id);
+    }
+
+    return fclose(f) == 0;
+}
+
+// append a schedule to a sideband as it would be while being written
+bool append_schedule(const string& path, pid_t thread_id)
+{
+    FILE* f = fopen(path.c_str(), "a");
+    if (!f) {
+        return false;
+    }
+    put_schedule(f, thread_id);
+    return fclose(f) == 0;
+}
+
+// the thread ids of the first count tids of the model
+vector<pid_t> thread_ids(const sideband_model& model, unsigned count)
+{
+    vector<pid_t> ids;
+    for (tid_t tid = 0; tid < count; ++tid) {
+        pid_t    pid;
+        pid_t    thread_id;
+        unsigned cpu;
+        if (model.get_tid_info(tid, pid, thread_id, cpu)) {
+            ids.push_back(thread_id);
+        }
+    }
+    return ids;
+}
+
+string to_string(const vector<pid_t>& ids)
+{
+    string s;
+    for (auto id : ids) {
+        s += (s.empty() ? "" : " ") + std::to_string(id);
+    }
+    return s;
+}
+
+// check that a model built of the sideband, and one restored from its
+// snapshot, number the threads in the order of their thread ids
+bool check_numbering(const string& sideband_path)
+{
+    if (!write_sideband(sideband_path, SIDEBAND_VERSION)) {
+        printf("numbering: cannot write '%s'\n", sideband_path.c_str());
+        return false;
+    }
+
+    const vector<pid_t> expected = {1, 5, 9};
+
+    bool ok = true;
+    for (auto what : {"parsed", "snapshot"}) {
+        auto model = make_shared<sideband_model>();
+        bool good  = model->build(sideband_path);
+        auto ids   = thread_ids(*model, expected.size());
+        good = good && ids == expected;
+        printf("numbering: %s: threads %s: %s\n",
+               what, to_string(ids).c_str(), good ? "ok" : "FAILED");
+        ok = good && ok;
+    }
+
+    for (auto suffix : {"", ".smod"}) {
+        (void)unlink((sideband_path + suffix).c_str());
+    }
+
+    return ok;
+}
+
+// build a model and see if it has the kernel module
+bool check(const string&           sideband_path,
+           shared_ptr<path_mapper> host_filesystem,
+           const char*             what)
+{
+    auto model = make_shared<sideband_model>();
+    if (host_filesystem) {
+        model->set_host_filesystem(host_filesystem);
+    }
+    if (!model->build(sideband_path)) {
+        printf("%s: cannot build the model\n", what);
+        return false;
+    }
+
+    bool listed = false;
+    model->iterate_executables([&](const string& path) {
+        if (path == string(module_name) + ".ko") {
+            listed = true;
+        }
+    });
+
+    bool          mapped = false;
+    sideband_view view(model);
+    module_handle module;
+    if (view.set_tid(0) && view.get_module(module_address, 0x2000, module)) {
+        string path;
+        rva    start;
+        model->get_module_path(module, path, start);
+        mapped = path == string(module_name) + ".ko";
+    }
+
+    bool expected = host_filesystem != nullptr;
+    bool ok       = listed == expected && mapped == expected;
+    printf("%s: kernel module %s, %s: %s\n",
+           what,
+           listed ? "listed" : "not listed",
+           mapped ? "mapped" : "not mapped",
+           ok ? "ok" : "FAILED");
+
+    return ok;
+}
+
+// the path mapped at mmap_address as of tsc, and the span of time in
+// which the lookup holds
+string mapped_path(const sideband_model&     model,
+                   const sideband_view&      view,
+                   uint64_t                  tsc,
+                   pair<uint64_t, uint64_t>& tscs)
+{
+    string         path;
+    module_handle  module;
+    pair<rva, rva> range;
+    if (view.get_module(mmap_address, tsc, module, range, tscs)) {
+        rva start;
+        model.get_module_path(module, path, start);
+    } else {
+        path = "nothing";
+    }
+    return path;
+}
+
+// check that the lookup holds within its span, tscs.first < tsc <=
+// tscs.second, and not just outside it
+bool check_spans(const string& sideband_path)
+{
+    auto model = make_shared<sideband_model>();
+    if (!model->build(sideband_path)) {
+        printf("spans: cannot build the model\n");
+        return false;
+    }
+
+    tid_t         tid = 0;
+    pid_t         pid;
+    pid_t         thread_id;
+    unsigned      cpu;
+    sideband_view view(model);
+    while (model->get_tid_info(tid, pid, thread_id, cpu) && pid != 1) {
+        ++tid;
+    }
+    if (pid != 1 || !view.set_tid(tid)) {
+        printf("spans: no task for the init process\n");
+        return false;
+    }
+
+    struct {
+        uint64_t    tsc;
+        const char* path;
+    } expected[] = {
+        {first_mmap_tsc,     "nothing"},
+        {first_mmap_tsc + 1, "/first"},
+        {next_mmap_tsc,      "/first"},
+        {next_mmap_tsc + 1,  "/next"},
+    };
+
+    bool ok = true;
+    for (const auto& e : expected) {
+        pair<uint64_t, uint64_t> tscs;
+        string path = mapped_path(*model, view, e.tsc, tscs);
+        bool   good = path == e.path &&
+                      tscs.first < e.tsc && e.tsc <= tscs.second;
+
+        // the same lookup at both ends of the span, a different one
+        // just before it
+        pair<uint64_t, uint64_t> ignored;
+        if (good && mapped_path(*model, view, tscs.first + 1, ignored) != path) {
+            good = false;
+        }
+        if (good && mapped_path(*model, view, tscs.second, ignored) != path) {
+            good = false;
+        }
+        if (good && tscs.first &&
+            mapped_path(*model, view, tscs.first, ignored) == path)
+        {
+            good = false;
+        }
+
+        printf("spans: %s as of %#" PRIx64 ", for (%#" PRIx64
+               ", %#" PRIx64 "]: %s\n",
+               path.c_str(), e.tsc, tscs.first, tscs.second,
+               good ? "ok" : "FAILED");
+        ok = good && ok;
+    }
+
+    return ok;
+}
+
+// follow the sideband, and a copy of it with an older version, which
+// shares the magic but must not be followed; a thread that appears in
+// the followed sideband must not renumber the others
+bool check_update(const string& sideband_path, const string& other_path)
+{
+    string other_version = SIDEBAND_VERSION;
+    --other_version.back();
+    if (!write_sideband(sideband_path, SIDEBAND_VERSION) ||
+        !write_sideband(other_path, other_version.c_str()))
+    {
+        printf("update: cannot write the sidebands\n");
+        return false;
+    }
+
+    auto model = make_shared<sideband_model>();
+    bool listed = false;
+    bool ok     = model->update(sideband_path);
+    if (ok) {
+        model->iterate_executables([&](const string& path) {
+            listed = listed || path == "/first";
+        });
+    }
+    ok = ok && listed;
+    printf("update: followed the sideband: %s\n", ok ? "ok" : "FAILED");
+
+    const vector<pid_t> before   = {1, 9, 5};
+    const vector<pid_t> after    = {1, 9, 5, 3};
+    bool                numbered = ok && thread_ids(*model, before.size()) == before &&
+                                   append_schedule(sideband_path, 3) &&
+                                   model->update(sideband_path);
+    auto                ids      = thread_ids(*model, after.size());
+    numbered = numbered && ids == after;
+    printf("update: threads %s: %s\n",
+           to_string(ids).c_str(), numbered ? "ok" : "FAILED");
+
+    auto other    = make_shared<sideband_model>();
+    bool rejected = !other->update(other_path);
+    printf("update: rejected version %s: %s\n",
+           other_version.c_str(), rejected ? "ok" : "FAILED");
+
+    (void)unlink(sideband_path.c_str());
+    (void)unlink(other_path.c_str());
+
+    return ok && numbered && rejected;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        fprintf(stderr, "cannot find the path of %s\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    self[n] = '\0';
+
+    char directory[] = "/tmp/sat-sideband-model-check.XXXXXX";
+    if (!mkdtemp(directory)) {
+        fprintf(stderr, "cannot make a temporary directory\n");
+        exit(EXIT_FAILURE);
+    }
+    string sideband_path = string(directory) + "/sideband.bin";
+    if (!write_sideband(sideband_path, SIDEBAND_VERSION)) {
+        fprintf(stderr, "cannot write '%s'\n", sideband_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    auto host_filesystem = make_shared<self_path_mapper>(self);
+    bool ok = true;
+    ok = check(sideband_path, nullptr,         "parsed without host filesystem")  && ok;
+    ok = check(sideband_path, host_filesystem, "parsed with host filesystem")     && ok;
+    for (auto suffix : {".smod", ".hostfs.smod"}) {
+        if (access((sideband_path + suffix).c_str(), R_OK) != 0) {
+            printf("no snapshot '%s%s'\n", sideband_path.c_str(), suffix);
+            ok = false;
+        }
+    }
+    ok = check(sideband_path, nullptr,         "snapshot without host filesystem") && ok;
+    ok = check(sideband_path, host_filesystem, "snapshot with host filesystem")   && ok;
+    ok = check_spans(sideband_path) && ok;
+    ok = check_numbering(string(directory) + "/numbered.bin") && ok;
+    ok = check_update(string(directory) + "/followed.bin",
+                      string(directory) + "/other.bin") && ok;
+
+    for (auto suffix : {"", ".smod", ".hostfs.smod"}) {
+        (void)unlink((sideband_path + suffix).c_str());
+    }
+    (void)rmdir(directory);
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
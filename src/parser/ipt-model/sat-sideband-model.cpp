@@ -26,10 +26,15 @@
 #include <errno.h>
 #include <memory>
 #include <map>
+#include <unordered_map>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cinttypes>
 #include <algorithm>
 
@@ -66,10 +71,9 @@ namespace {
         printf("# %" PRIx64 " (%x)", tsc(header), header.cpu);
     }
 
+    // the executable of munmaps; the same for all models
     shared_ptr<executable> unmapped = make_shared<executable>("(unmapped)");
 
-    shared_ptr<path_mapper> host_filesystem;
-
     // Kernel modules
     struct kernel_module_struct {
         string                 file_name;
@@ -78,7 +82,6 @@ namespace {
         rva                    offset;
         shared_ptr<executable> exe;
     };
-    vector<kernel_module_struct> kernel_modules;
 
 } // anonymous namespace
 
@@ -97,31 +100,50 @@ namespace sat {
     // TODO: make a class for the executable list
     typedef map<string /*target_path*/, shared_ptr<executable>> executable_map;
 
-    executable_map executables;
 
-    shared_ptr<executable> find_executable(const char* target_path)
+    // the handles of executables at load addresses
+    class module_registry
     {
-        shared_ptr<executable> e;
-        executable_map::iterator ei(executables.find(target_path));
-        if (ei == executables.end()) {
-            SAT_LOG(2, "NEW EXECUTABLE MMAP:\n");
-            e = make_shared<executable>(target_path);
-            executables.insert({target_path, e});
-        } else {
-            SAT_LOG(2, "KNOWN EXECUTABLE MMAP:\n");
-            e = ei->second;
+    public:
+        module_handle intern(const shared_ptr<executable>& exe, rva start)
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto i = handles_.find({exe.get(), start});
+            if (i == handles_.end()) {
+                i = handles_.insert({{exe.get(), start},
+                                     (module_handle)modules_.size()}).first;
+                modules_.push_back({exe, start});
+            }
+            return i->second;
         }
 
-        return e;
-    }
+        void get(module_handle module, string& path, rva& start) const
+        {
+            lock_guard<mutex> lock(mutex_);
+            path  = modules_[module].first->target_path();
+            start = modules_[module].second;
+        }
 
-    // TODO: remove
-    void list_executables()
-    {
-        for (auto& ei : executables) {
-            printf("# %s\n", ei.second->target_path().c_str());
+        // the modules in the order of their handles
+        void iterate(function<void(const shared_ptr<executable>&, rva)> f) const
+        {
+            lock_guard<mutex> lock(mutex_);
+            for (auto& m : modules_) {
+                f(m.first, m.second);
+            }
         }
-    }
+
+        size_t size() const
+        {
+            lock_guard<mutex> lock(mutex_);
+            return modules_.size();
+        }
+
+    private:
+        mutable mutex                                     mutex_;
+        map<pair<const executable*, rva>, module_handle>  handles_;
+        vector<pair<shared_ptr<executable>, rva>>         modules_;
+    }; // module_registry
 
 
     class mmapping
@@ -131,99 +153,165 @@ namespace sat {
                  unsigned               len_in,
                  unsigned               pgoff_in,
                  shared_ptr<executable> exe_in,
-                 uint64_t               tsc_in);
+                 uint64_t               tsc_in,
+                 module_handle          module_in);
 
         rva                    start;
         unsigned               len;
         unsigned               pgoff;
         shared_ptr<executable> exe;
         uint64_t               tsc;
+        module_handle          module; // exe at its load address
     };
 
     mmapping::mmapping(rva                    start_in,
                        unsigned               len_in,
                        unsigned               pgoff_in,
                        shared_ptr<executable> exe_in,
-                       uint64_t               tsc_in)
-        : start(start_in), len(len_in), pgoff(pgoff_in), exe(exe_in), tsc(tsc_in)
+                       uint64_t               tsc_in,
+                       module_handle          module_in)
+        : start(start_in), len(len_in), pgoff(pgoff_in), exe(exe_in), tsc(tsc_in),
+          module(module_in)
     {
     }
 
 
+    // The mappings of an address space over time. A lookup as of a tsc
+    // starts from the latest snapshot of the mappings before it and looks
+    // through the mmaps after the snapshot; snapshots are taken as needed,
+    // so that there are never many mmaps to look through.
     class mmappings
     {
     public:
-        mmappings() : current_tsc_slot_()
+        mmappings() : snapshots_{{0, make_shared<mmapping_map>()}}
+        {}
+
+        mmappings(const mmappings& other) :
+            mmaps_over_time_(other.mmaps_over_time_),
+            snapshots_(other.snapshots_),
+            exports_(other.exports_),
+            exported_modules_(other.exported_modules_),
+            unexported_(other.unexported_)
         {}
 
         void dump()
         {
             for (auto& i : mmaps_over_time_) {
                 printf("mmap: %10.10lx: [%8.8lx .. %8.8lx]  %s\n",
-                       i.first, i.second->start, i.second->start + i.second->len,
-                       i.second->exe->target_path().c_str());
+                       i.tsc, i.begin, i.end,
+                       i.m->exe->target_path().c_str());
             }
         }
 
         void insert(uint64_t tsc, shared_ptr<mmapping>& m)
         {
-            mmaps_over_time_.insert({tsc, m});
-            if (tsc >= current_tsc_slot_.first &&
-                tsc < current_tsc_slot_.second)
-            {
-                current_mmaps_.insert({m->start, m->start + m->len}, m);
-                current_tsc_slot_.first = tsc;
+            lock_guard<mutex> lock(mutex_);
+            auto i = lower_bound(tsc);
+            if (i == mmaps_over_time_.end() || i->tsc != tsc) {
+                size_t position = i - mmaps_over_time_.begin();
+                mmaps_over_time_.insert(i, {tsc,
+                                            m->start,
+                                            m->start + m->len,
+                                            m});
+                // the snapshots after the new mmap no longer hold
+                snapshots_.erase(snapshots_.upper_bound(position),
+                                 snapshots_.end());
+                unexported_.push_back(m);
+            }
+        }
+
+        // the mmaps in tsc order
+        void iterate(function<void(uint64_t                    tsc,
+                                   const shared_ptr<mmapping>& m)> f) const
+        {
+            lock_guard<mutex> lock(mutex_);
+            for (auto& i : mmaps_over_time_) {
+                f(i.tsc, i.m);
             }
         }
 
         bool find(uint64_t tsc, rva address, shared_ptr<mmapping>& m) const
         {
-            if (tsc < current_tsc_slot_.first ||
-                tsc >= current_tsc_slot_.second)
-            {
-                // rebuild current mmaps
-                current_tsc_slot_.first  = 0;
-                current_tsc_slot_.second = numeric_limits<uint64_t>::max();
-                for (auto& i : mmaps_over_time_) {
-                    if (i.first < tsc) {
-                        current_mmaps_.insert({i.second->start,
-                                               i.second->start + i.second->len},
-                                               i.second);
-                        current_tsc_slot_.first = i.first;
-                    } else {
-                        current_tsc_slot_.second = i.first;
-                        break;
-                    }
+            pair<rva, rva>           range;
+            pair<uint64_t, uint64_t> tscs;
+            return find(tsc, address, m, range, tscs);
+        }
+
+        // also return the range of the mapping that address falls in,
+        // as far as it is not covered by other mappings, and the span
+        // of time in which the mappings stay the same; an mmap only
+        // holds after its tsc, so the span is tscs.first < tsc <=
+        // tscs.second
+        bool find(uint64_t                  tsc,
+                  rva                       address,
+                  shared_ptr<mmapping>&     m,
+                  pair<rva, rva>&           range,
+                  pair<uint64_t, uint64_t>& tscs) const
+        {
+            lock_guard<mutex> lock(mutex_);
+
+            // the mmaps before tsc
+            size_t count = lower_bound(tsc) - mmaps_over_time_.begin();
+            tscs.first  = count ? mmaps_over_time_[count - 1].tsc : 0;
+            tscs.second = count < mmaps_over_time_.size() ?
+                              mmaps_over_time_[count].tsc :
+                              numeric_limits<uint64_t>::max();
+
+            auto s = snapshot(count);
+
+            // the latest mmap after the snapshot that covers address
+            // overrides the snapshot
+            size_t latest = count;
+            for (size_t i = count; i-- > s->first;) {
+                const auto& e = mmaps_over_time_[i];
+                if (e.begin <= address && address < e.end) {
+                    latest = i;
+                    break;
                 }
             }
 
-            bool found = current_mmaps_.find(address, m);
+            bool   found;
+            size_t later;
+            if (latest < count) {
+                m     = mmaps_over_time_[latest].m;
+                range = {mmaps_over_time_[latest].begin,
+                         mmaps_over_time_[latest].end};
+                found = true;
+                later = latest + 1;
+            } else {
+                found = s->second->find(address, range, m);
+                later = s->first;
+            }
 
-#if 0
-            if (!found) {
-                printf("address %lx not found:\n", address);
-                current_mmaps_.iterate([](const pair<rva, rva>& addr, const shared_ptr<mmapping>& m) {
-                    printf("    [%lx .. %lx) %s\n",
-                           addr.first, addr.second,
-                           m->exe->target_path().c_str());
-                });
+            if (found) {
+                // cut off what the mmaps after it cover
+                for (size_t i = later; i < count; ++i) {
+                    const auto& e = mmaps_over_time_[i];
+                    if (e.begin < e.end) {
+                        if (e.end <= address) {
+                            range.first = max(range.first, e.end);
+                        } else if (e.begin > address) {
+                            range.second = min(range.second, e.begin);
+                        }
+                    }
+                }
             }
-#endif
 
             return found;
         }
 
         using callback_func = sideband_model::callback_func;
-        void iterate_target_paths(uint64_t tsc, callback_func callback)
+        void iterate_modules(uint64_t tsc, callback_func callback)
         {
-            SAT_LOG(3, "ITERATING PATHS UPTO %" PRIx64 "\n", tsc);
-            auto e = mmaps_over_time_.upper_bound(tsc);
+            SAT_LOG(3, "ITERATING MODULES UPTO %" PRIx64 "\n", tsc);
+            auto e = lower_bound(tsc);
+            if (e != mmaps_over_time_.end() && e->tsc == tsc) {
+                ++e;
+            }
             for (auto i = mmaps_over_time_.begin(); i != e; ++i) {
-                auto m = i->second;
+                auto m = i->m;
                 if (m->exe != unmapped) {
-                    if (callback(m->exe->target_path(),
-                                 m->start - 0x1000 * m->pgoff))
-                    {
+                    if (callback(m->module)) {
                         // the caller found what he was looking for
                         break;
                     }
@@ -231,13 +319,113 @@ namespace sat {
             }
         }
 
+        // the address of the global function name in the first module
+        // that iterate_modules() would give for tsc
+        bool find_export(const sideband_state& state,
+                         uint64_t              tsc,
+                         const string&         name,
+                         rva&                  address) const
+        {
+            lock_guard<mutex> lock(mutex_);
+            index_exports(state);
+
+            bool found = false;
+            auto e = exports_.find(&name);
+            if (e != exports_.end() && e->second.first <= tsc) {
+                address = e->second.second;
+                found   = true;
+            }
+
+            return found;
+        }
+
     private:
-        using mmapping_list = map<uint64_t /*tsc*/, shared_ptr<mmapping>>;
+        struct timed_mmap {
+            uint64_t             tsc;
+            rva                  begin;
+            rva                  end;
+            shared_ptr<mmapping> m;
+        }; // timed_mmap
+
+        using mmapping_list = vector<timed_mmap>; // by tsc
         using mmapping_map  = range_map<rva, shared_ptr<mmapping>>;
+        using snapshot_map  = map<size_t /*mmaps*/,
+                                  shared_ptr<const mmapping_map>>;
+
+        // take a new snapshot rather than look through more mmaps than
+        // an eighth of the ranges in the previous snapshot, but at least
+        // the min and at most the max distance; the max keeps a lookup
+        // from looking through more than a constant number of mmaps,
+        // however many ranges a snapshot has to copy
+        static const size_t min_snapshot_distance = 64;
+        static const size_t max_snapshot_distance = 512;
+        static const size_t snapshot_size_ratio   = 8;
+
+        mmapping_list::const_iterator lower_bound(uint64_t tsc) const
+        {
+            return std::lower_bound(mmaps_over_time_.begin(),
+                                    mmaps_over_time_.end(),
+                                    tsc,
+                                    [](const timed_mmap& e, uint64_t t) {
+                                        return e.tsc < t;
+                                    });
+        }
+
+        // the latest snapshot of at most the first count mmaps
+        snapshot_map::const_iterator snapshot(size_t count) const
+        {
+            auto s = snapshots_.upper_bound(count);
+            --s;
+            size_t distance = s->second->size() / snapshot_size_ratio;
+            if (distance < min_snapshot_distance) {
+                distance = min_snapshot_distance;
+            } else if (distance > max_snapshot_distance) {
+                distance = max_snapshot_distance;
+            }
+            if (count - s->first >= distance) {
+                auto mmaps = make_shared<mmapping_map>(*s->second);
+                for (size_t i = s->first; i < count; ++i) {
+                    auto& e = mmaps_over_time_[i];
+                    mmaps->insert({e.begin, e.end}, e.m);
+                }
+                s = snapshots_.insert({count, mmaps}).first;
+            }
+            return s;
+        }
+
+        // add the global functions of the mappings inserted since the
+        // previous call to the index, keeping the earliest mapping of
+        // each name
+        void index_exports(const sideband_state& state) const;
+
+        // export names point into the symbol tables of the mmapped files,
+        // which are kept for the whole run
+        struct name_hash {
+            size_t operator()(const string* name) const
+            {
+                return hash<string>()(*name);
+            }
+        };
+        struct name_equal {
+            bool operator()(const string* a, const string* b) const
+            {
+                return *a == *b;
+            }
+        };
 
-        mutable mmapping_list            mmaps_over_time_;
-        mutable mmapping_map             current_mmaps_;
-        mutable pair<uint64_t, uint64_t> current_tsc_slot_;
+        using export_map    = unordered_map<const string*,
+                                            pair<uint64_t /*tsc*/,
+                                                 rva      /*address*/>,
+                                            name_hash,
+                                            name_equal>;
+
+        mutable mutex                    mutex_;
+        mmapping_list                    mmaps_over_time_;
+        mutable snapshot_map             snapshots_;
+        mutable export_map               exports_;
+        mutable map<module_handle,
+                    uint64_t /*tsc*/>    exported_modules_;
+        mutable vector<shared_ptr<mmapping>> unexported_;
     }; // class mmappings
 
 
@@ -248,17 +436,30 @@ namespace sat {
 
         process(pid_t p, const process& pp);
 
-        void mmap(rva                    start,
-                  unsigned               len,
-                  unsigned               pgoff,
-                  shared_ptr<executable> exe,
-                  uint64_t               tsc);
+        // for restoring a snapshot of the model
+        process(pid_t p, const string& name, bool newly_forked);
+        // insert a mapping as it is, without taking it for an exec()
+        void insert_mmap(uint64_t tsc, shared_ptr<mmapping>& m);
+        bool newly_forked() const;
+        void iterate_mmaps(function<void(uint64_t                    tsc,
+                                         const shared_ptr<mmapping>& m)> f) const;
+
+        void mmap(shared_ptr<mmapping> m);
         bool get_mmap(rva      address,
                       uint64_t tsc,
                       string&  path,
                       rva&     start) const;
+        bool get_module(rva                       address,
+                        uint64_t                  tsc,
+                        module_handle&            module,
+                        pair<rva, rva>&           range,
+                        pair<uint64_t, uint64_t>& tscs) const;
         using callback_func = sideband_model::callback_func;
-        void iterate_target_paths(uint64_t tsc, callback_func callback);
+        void iterate_modules(uint64_t tsc, callback_func callback);
+        bool find_export(const sideband_state& state,
+                         uint64_t              tsc,
+                         const string&         name,
+                         rva&                  address) const;
 
         void name(const char* name, uint64_t tsc);
         const string& name() const;
@@ -293,6 +494,262 @@ namespace sat {
     process::process(pid_t p)
         : pid(p), name_("<unknown>"), newly_forked_(false)
     {
+    }
+
+
+
+    process::process(pid_t p, const process& pp)
+        : pid(p), name_(), mmaps_(pp.mmaps_), newly_forked_(true)
+    {
+        // TODO: set tsc?
+    }
+
+    process::process(pid_t p, const string& name, bool newly_forked)
+        : pid(p), name_(name), newly_forked_(newly_forked)
+    {
+    }
+
+    void process::insert_mmap(uint64_t tsc, shared_ptr<mmapping>& m)
+    {
+        mmaps_.insert(tsc, m);
+    }
+
+    bool process::newly_forked() const
+    {
+        return newly_forked_;
+    }
+
+    void process::iterate_mmaps(
+             function<void(uint64_t                    tsc,
+                           const shared_ptr<mmapping>& m)> f) const
+    {
+        mmaps_.iterate(f);
+    }
+
+    void process::mmap(shared_ptr<mmapping> m)
+    {
+        // TODO: we could insert an unmap the size of the current usespace,
+        //       if newly_forked_ here
+        mmaps_.insert(m->tsc, m);
+        // assume the first mmap() after fork() is the exec()utable
+        if (newly_forked_ && m->exe != unmapped) {
+            name_ = m->exe->target_path();
+            newly_forked_ = false;
+        }
+#if 0
+        if (global_debug_level >= 3) {
+            print(); // TODO: remove
+        }
+#endif
+    }
+
+    bool process::get_mmap(rva      address,
+                           uint64_t tsc,
+                           string&  path,
+                           rva&     start) const  // target_load_address
+        // TODO: output offset
+    {
+        shared_ptr<mmapping> m;
+        SAT_LOG(1, "process::get_mmap tsc:%lx, addr:%lx\n", tsc, address);
+        bool found = mmaps_.find(tsc, address, m);
+        if (found) {
+            path  = m->exe->target_path();
+            if (m->pgoff) {
+                SAT_LOG(2, "ADJUSTED FOR PGOFF\n");
+            }
+            start = m->start - 0x1000 * m->pgoff;
+        }
+        return found;
+    }
+
+    bool process::get_module(rva                       address,
+                             uint64_t                  tsc,
+                             module_handle&            module,
+                             pair<rva, rva>&           range,
+                             pair<uint64_t, uint64_t>& tscs) const
+    {
+        shared_ptr<mmapping> m;
+        bool found = mmaps_.find(tsc, address, m, range, tscs);
+        if (found) {
+            module = m->module;
+        }
+        return found;
+    }
+
+    void process::iterate_modules(uint64_t tsc, callback_func callback)
+    {
+        mmaps_.iterate_modules(tsc, callback);
+    }
+
+    bool process::find_export(const sideband_state& state,
+                              uint64_t              tsc,
+                              const string&         name,
+                              rva&                  address) const
+    {
+        return mmaps_.find_export(state, tsc, name, address);
+    }
+
+    void process::name(const char* name, uint64_t tsc)
+    {
+        name_ = name;
+    }
+
+    const string& process::name() const
+    {
+        return name_;
+    }
+
+
+    typedef map<pid_t /* pid */,
+                shared_ptr<process>> pid_map;
+    typedef map<pair<unsigned /* cr3 */, uint64_t /* tsc */>,
+                shared_ptr<process>> pgd_map;
+    typedef map<pid_t /* thread_id */, string> thread_name_map;
+    struct scheduling {
+        uint64_t trace_buffer_offset;
+        pid_t    prev_pid;
+        pid_t    prev_thread_id;
+        pid_t    pid;
+        pid_t    thread_id;
+        uint8_t  schedule_id;
+    };
+    typedef map<uint64_t /*tsc*/, scheduling> scheduling_map;
+    typedef map<unsigned /*cpu*/, scheduling_map> cpu_scheduling_map;
+    struct initial_pid_and_thread_id {
+        pid_t    pid;
+        pid_t    thread_id;
+    };
+
+    typedef map<uint64_t, uint8_t> schedule_id_func_map;
+
+    class hooking
+    {
+        public:
+            rva    orig;    // address of the hooked function
+            rva    copy;    // address of the copy of the hooked function
+            rva    end;     // address after the copy of the hooked function
+            rva    wrapper; // address of the wrapper function
+            string name;    // name of the hooked function
+    };
+
+    struct model_image;
+
+    // Everything a sideband model knows. It is filled in while the
+    // sideband is parsed and only looked up after that, so the threads
+    // that model tasks can share it.
+    class sideband_state
+    {
+    public:
+        sideband_state();
+
+        shared_ptr<executable> find_executable(const char* target_path);
+        shared_ptr<mmapping>   new_mmapping(rva                    start,
+                                            unsigned               len,
+                                            unsigned               pgoff,
+                                            shared_ptr<executable> exe,
+                                            uint64_t               tsc);
+        // a process with the kernel modules mapped in it
+        shared_ptr<process>    new_process(pid_t pid);
+        void                   add_hook(const hooking& hook);
+        // make what is only looked up once the sideband has been parsed
+        // or the model restored from a snapshot
+        void                   complete();
+
+        shared_ptr<process> get_process(unsigned cr3, uint64_t tsc) const;
+        shared_ptr<process> get_process(tid_t tid) const;
+
+        // the global functions of a module, at their target addresses
+        void iterate_exports(module_handle                              module,
+                             function<void(const string& /*name*/,
+                                           rva           /*address*/)> callback) const;
+
+        void write_snapshot(const string& sideband_path) const;
+        bool read_snapshot(const string& sideband_path);
+
+        shared_ptr<path_mapper>      host_filesystem;
+        tid_table                    tids;
+        executable_map               executables;
+        vector<kernel_module_struct> kernel_modules;
+        module_registry              modules;
+
+        vector<pid_t>      all_pids;
+        pid_map            pids;
+        pgd_map            pgds;
+        thread_name_map    thread_names;
+        cpu_scheduling_map schedulings;
+        map<unsigned /* cpu */, initial_pid_and_thread_id> initial;
+        map<unsigned /* cpu */, uint32_t /* pkt_mask */>   pkt_masks;
+        uint32_t pkt_mask;
+
+        uint64_t initial_cpu0_tsc;
+        unsigned initial_tsc_tick;
+        unsigned initial_fsb_mhz;
+        uint32_t initial_tsc_ctc_ratio;
+        uint8_t  initial_mtc_freq;
+
+        schedule_id_func_map schedule_id_functions;
+
+        vector<hooking> hooks;
+        rva             hooks_min_orig;
+        rva             hooks_max_orig;
+        rva             hooks_min_copy;
+        rva             hooks_max_copy;
+        // indexes into hooks; where hooks overlap, the first one wins
+        map<rva /*orig*/, size_t> hooks_by_orig;
+        range_map<rva, size_t>    hooks_by_copy;
+        map<string, size_t>       hooks_by_name;
+
+    private:
+        // add a process for the swapper, unless the sideband has one
+        void add_swapper();
+        void index_hooks();
+        void restore_image(model_image& image);
+    }; // sideband_state
+
+    sideband_state::sideband_state() :
+        pkt_mask(),
+        initial_cpu0_tsc(),
+        initial_tsc_tick(),
+        initial_fsb_mhz(),
+        initial_tsc_ctc_ratio(1),
+        initial_mtc_freq(),
+        hooks_min_orig(),
+        hooks_max_orig(),
+        hooks_min_copy(),
+        hooks_max_copy()
+    {
+    }
+
+    shared_ptr<executable> sideband_state::find_executable(const char* target_path)
+    {
+        shared_ptr<executable> e;
+        executable_map::iterator ei(executables.find(target_path));
+        if (ei == executables.end()) {
+            SAT_LOG(2, "NEW EXECUTABLE MMAP:\n");
+            e = make_shared<executable>(target_path);
+            executables.insert({target_path, e});
+        } else {
+            SAT_LOG(2, "KNOWN EXECUTABLE MMAP:\n");
+            e = ei->second;
+        }
+
+        return e;
+    }
+
+    shared_ptr<mmapping> sideband_state::new_mmapping(rva                    start,
+                                                      unsigned               len,
+                                                      unsigned               pgoff,
+                                                      shared_ptr<executable> exe,
+                                                      uint64_t               tsc)
+    {
+        return make_shared<mmapping>(start, len, pgoff, exe, tsc,
+                                     modules.intern(exe, start - 0x1000 * pgoff));
+    }
+
+    shared_ptr<process> sideband_state::new_process(pid_t pid)
+    {
+        auto p = make_shared<process>(pid);
+
         int index = 1;
         for (auto& km: kernel_modules) {
             if (km.address != 0) {
@@ -305,185 +762,882 @@ namespace sat {
                 }
                 // make kernel module mmap .text and everything before
                 {
-                    auto m = make_shared<mmapping>(km.address - km.offset,
-                                                   km.size + km.offset,
-                                                   0,
-                                                   km.exe,
-                                                   index);
-                    mmaps_.insert(index, m);
+                    auto m = new_mmapping(km.address - km.offset,
+                                          km.size + km.offset,
+                                          0,
+                                          km.exe,
+                                          index);
+                    p->insert_mmap(index, m);
                 }
                 ++index;
             }
         }
+
+        return p;
     }
 
+    void sideband_state::add_swapper()
+    {
+        if (pids.find(0) == pids.end()) {
+            // create a process for the swapper
+            auto p = new_process(0);
+            p->name("swapper", 0);
+            pids.insert({0, p});
+        }
+    }
 
+    void sideband_state::complete()
+    {
+        tids.number();
+        add_swapper();
+        index_hooks();
+    }
 
-    process::process(pid_t p, const process& pp)
-        : pid(p), name_(), mmaps_(pp.mmaps_), newly_forked_(true)
+    void sideband_state::index_hooks()
     {
-        // TODO: set tsc?
+        hooks_by_orig.clear();
+        hooks_by_copy.clear();
+        hooks_by_name.clear();
+
+        for (size_t h = 0; h < hooks.size(); ++h) {
+            hooks_by_orig.insert({hooks[h].orig, h});
+            hooks_by_name.insert({hooks[h].name, h});
+        }
+        // insert the copies backwards, so that the earlier ones go on top
+        for (size_t h = hooks.size(); h-- > 0;) {
+            hooks_by_copy.insert({hooks[h].copy, hooks[h].end}, h);
+        }
     }
 
-    void process::mmap(rva                    start,
-                       unsigned               len,
-                       unsigned               pgoff,
-                       shared_ptr<executable> exe,
-                       uint64_t               tsc)
+    void sideband_state::add_hook(const hooking& hook)
     {
-        // TODO: we could insert an unmap the size of the current usespace,
-        //       if newly_forked_ here
-        auto m = make_shared<mmapping>(start, len, pgoff, exe, tsc);
-        mmaps_.insert(tsc, m);
-        // assume the first mmap() after fork() is the exec()utable
-        if (newly_forked_ && exe != unmapped) {
-            name_ = exe->target_path();
-            newly_forked_ = false;
+        hooks.push_back(hook);
+
+        if (hooks_min_orig == 0 ||
+            hooks_min_orig > hook.orig)
+        {
+            hooks_min_orig = hook.orig;
+        }
+        if (hooks_max_orig == 0 ||
+            hooks_max_orig < hook.orig)
+        {
+            hooks_max_orig = hook.orig;
+        }
+        if (hooks_min_copy == 0 ||
+            hooks_min_copy > hook.copy)
+        {
+            hooks_min_copy = hook.copy;
+        }
+        if (hooks_max_copy == 0 ||
+            hooks_max_copy < hook.end)
+        {
+            hooks_max_copy = hook.end;
+        }
+    }
+
+    // TODO: use some other kind of pointer
+    shared_ptr<process> sideband_state::get_process(unsigned cr3,
+                                                    uint64_t tsc) const
+    {
+        auto i = pgds.upper_bound({cr3, tsc});
+        if (i != pgds.begin()) {
+            --i;
+            if (i->first.first == cr3) {
+                return i->second;
+            }
+        }
+
+        return 0;
+    }
+
+    shared_ptr<process> sideband_state::get_process(tid_t tid) const
+    {
+        pid_t pid;
+        if (tids.get_pid(tid, pid)) {
+            auto i = pids.find(pid);
+            if (i != pids.end()) {
+                return i->second;
+            } else {
+                SAT_LOG(1, "#FOUND PID %d, BUT NO PROCESS\n", pid);
+            }
+        } else {
+            SAT_LOG(1, "#UNKNOWN TID %u\n", tid);
+        }
+
+        return 0;
+    }
+
+    void sideband_state::iterate_exports(
+             module_handle                              module,
+             function<void(const string& /*name*/,
+                           rva           /*address*/)> callback) const
+    {
+        string target_path;
+        rva    start;
+        modules.get(module, target_path, start);
+
+        string host_path;
+        string sym_path = target_path;
+        if (host_filesystem) {
+            host_filesystem->find_file(target_path, host_path, sym_path);
+        }
+        if (host_path != "") {
+            shared_ptr<mmapped> m = mmapped::obtain(host_path, sym_path);
+            if (m && m->is_ok()) {
+                if (!start) {
+                    start = m->default_load_address();
+                }
+                m->iterate_global_functions([&](const string& name, rva offset)
+                {
+                    callback(name, start + offset);
+                });
+            }
+        }
+    }
+
+    void mmappings::index_exports(const sideband_state& state) const
+    {
+        for (auto& m : unexported_) {
+            if (m->exe == unmapped) {
+                continue;
+            }
+            auto i = exported_modules_.find(m->module);
+            if (i != exported_modules_.end() && i->second <= m->tsc) {
+                continue; // already indexed as of an earlier mapping
+            }
+            exported_modules_[m->module] = m->tsc;
+            state.iterate_exports(m->module, [&](const string& name, rva address)
+            {
+                auto e = exports_.insert({&name, {m->tsc, address}});
+                if (!e.second && m->tsc < e.first->second.first) {
+                    e.first->second = {m->tsc, address};
+                }
+            });
+        }
+        unexported_.clear();
+    }
+
+
+    // Snapshots of the built model. The model is written next to the
+    // sideband file (sideband.bin -> sideband.bin.smod) after it has been
+    // built, and is validated against the size and modification time of
+    // the sideband; later runs map the snapshot and restore the model from
+    // it instead of parsing the sideband again. Kernel modules are only
+    // resolved with a host filesystem, so models built with one are kept
+    // apart (sideband.bin.hostfs.smod) and flagged in the header.
+
+    const char     snapshot_magic[8] = {'S', 'A', 'T', 'T', 'S', 'B', 'M', '\0'};
+    const uint32_t snapshot_version  = 2;
+
+    // snapshot_header flags
+    const uint32_t snapshot_with_host_filesystem = 0x1;
+
+    struct snapshot_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t sideband_size;
+        int64_t  sideband_mtime_sec;
+        int64_t  sideband_mtime_nsec;
+        uint64_t body_size;
+    }; // snapshot_header
+
+    string snapshot_path(const string& sideband_path, bool with_host_filesystem)
+    {
+        return sideband_path + (with_host_filesystem ? ".hostfs.smod" : ".smod");
+    }
+
+    bool stat_sideband(const string&    path,
+                       bool             with_host_filesystem,
+                       snapshot_header& header)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version             = snapshot_version;
+        header.flags               = with_host_filesystem ?
+                                         snapshot_with_host_filesystem : 0;
+        header.sideband_size       = st.st_size;
+        header.sideband_mtime_sec  = st.st_mtim.tv_sec;
+        header.sideband_mtime_nsec = st.st_mtim.tv_nsec;
+
+        return true;
+    }
+
+    bool same_sideband(const snapshot_header& a, const snapshot_header& b)
+    {
+        return memcmp(a.magic, b.magic, sizeof(a.magic)) == 0     &&
+               a.version             == b.version                 &&
+               a.flags               == b.flags                   &&
+               a.sideband_size       == b.sideband_size           &&
+               a.sideband_mtime_sec  == b.sideband_mtime_sec      &&
+               a.sideband_mtime_nsec == b.sideband_mtime_nsec;
+    }
+
+    class snapshot_writer
+    {
+    public:
+        template <class T>
+        void put(T value)
+        {
+            const char* p = reinterpret_cast<const char*>(&value);
+            data_.insert(data_.end(), p, p + sizeof(value));
+        }
+
+        void put_string(const string& s)
+        {
+            put<uint32_t>(s.size());
+            data_.insert(data_.end(), s.begin(), s.end());
+        }
+
+        const vector<char>& data() const
+        {
+            return data_;
+        }
+
+    private:
+        vector<char> data_;
+    }; // snapshot_writer
+
+    class snapshot_reader
+    {
+    public:
+        snapshot_reader(const char* data, size_t size) :
+            p_(data), end_(data + size), ok_(true)
+        {}
+
+        template <class T>
+        T get()
+        {
+            T value{};
+            if ((size_t)(end_ - p_) >= sizeof(value)) {
+                memcpy(&value, p_, sizeof(value));
+                p_ += sizeof(value);
+            } else {
+                ok_ = false;
+            }
+            return value;
+        }
+
+        string get_string()
+        {
+            string s;
+            uint32_t size = get<uint32_t>();
+            if ((size_t)(end_ - p_) >= size) {
+                s.assign(p_, size);
+                p_ += size;
+            } else {
+                ok_ = false;
+            }
+            return s;
+        }
+
+        // a count of items of at least item_size bytes each
+        size_t get_count(size_t item_size)
+        {
+            uint64_t count = get<uint64_t>();
+            if (count > (size_t)(end_ - p_) / item_size) {
+                ok_   = false;
+                count = 0;
+            }
+            return count;
+        }
+
+        // an index into a table of count items
+        uint32_t get_index(size_t count)
+        {
+            uint32_t index = get<uint32_t>();
+            if (index >= count) {
+                ok_   = false;
+                index = 0;
+            }
+            return index;
+        }
+
+        bool ok() const
+        {
+            return ok_;
+        }
+
+        bool at_end() const
+        {
+            return ok_ && p_ == end_;
+        }
+
+    private:
+        const char* p_;
+        const char* end_;
+        bool        ok_;
+    }; // snapshot_reader
+
+    // the model as read from a snapshot, before it is restored; reading
+    // it all first leaves the model alone if the snapshot is broken
+    struct model_image {
+        enum executable_kind : uint8_t { LISTED, UNMAPPED, UNLISTED };
+        struct tid_info {
+            pid_t    pid;
+            pid_t    thread_id;
+            uint32_t cpu;
+        };
+        struct executable_info {
+            string          path;
+            executable_kind kind;
+        };
+        struct kernel_module_info {
+            string   file_name;
+            rva      address;
+            rva      size;
+            rva      offset;
+            uint32_t exe; // ~0U if none
+        };
+        struct module_info {
+            uint32_t exe;
+            rva      start;
+        };
+        struct mmapping_info {
+            rva      start;
+            uint32_t len;
+            uint32_t pgoff;
+            uint32_t exe;
+            uint64_t tsc;
+        };
+        struct process_info {
+            pid_t                              pid;
+            string                             name;
+            bool                               newly_forked;
+            vector<pair<uint64_t, uint32_t>>   mmaps; // tsc, mmapping
+        };
+        struct cpu_scheduling {
+            unsigned                           cpu;
+            vector<pair<uint64_t, scheduling>> schedulings;
+        };
+
+        uint64_t                                  cpu0_tsc;
+        uint32_t                                  tsc_tick;
+        uint32_t                                  fsb_mhz;
+        uint32_t                                  tsc_ctc_ratio;
+        uint8_t                                   mtc_freq;
+        uint32_t                                  pkt_mask;
+        vector<tid_info>                          tids; // in tid order
+        vector<executable_info>                   executables;
+        vector<kernel_module_info>                kernel_modules;
+        vector<module_info>                       modules;
+        vector<mmapping_info>                     mmappings;
+        vector<process_info>                      processes;
+        vector<pair<pid_t, uint32_t>>             pids;
+        vector<pair<pair<unsigned, uint64_t>,
+                    uint32_t>>                    pgds;
+        vector<pid_t>                             all_pids;
+        vector<pair<pid_t, string>>               thread_names;
+        vector<cpu_scheduling>                    schedulings;
+        vector<pair<unsigned,
+                    initial_pid_and_thread_id>>   initial;
+        vector<pair<unsigned, uint32_t>>          pkt_masks;
+        vector<pair<uint64_t, uint8_t>>           schedule_id_functions;
+        vector<hooking>                           hooks;
+        rva                                       hooks_min_orig;
+        rva                                       hooks_max_orig;
+        rva                                       hooks_min_copy;
+        rva                                       hooks_max_copy;
+    }; // model_image
+
+    void sideband_state::write_snapshot(const string& sideband_path) const
+    {
+        snapshot_header header;
+        if (!stat_sideband(sideband_path, host_filesystem != nullptr, header)) {
+            return;
+        }
+
+        snapshot_writer w;
+
+        w.put<uint64_t>(initial_cpu0_tsc);
+        w.put<uint32_t>(initial_tsc_tick);
+        w.put<uint32_t>(initial_fsb_mhz);
+        w.put<uint32_t>(initial_tsc_ctc_ratio);
+        w.put<uint8_t>(initial_mtc_freq);
+        w.put<uint32_t>(pkt_mask);
+
+        // threads; restored in the order of their tids to keep the tids
+        vector<pair<tid_t, model_image::tid_info>> tid_list;
+        tids.iterate([&](tid_t tid, pid_t pid, pid_t thread_id, unsigned cpu)
+        {
+            tid_list.push_back({tid, {pid, thread_id, cpu}});
+            return true;
+        });
+        sort(tid_list.begin(), tid_list.end(),
+             [](const pair<tid_t, model_image::tid_info>& a,
+                const pair<tid_t, model_image::tid_info>& b) {
+                 return a.first < b.first;
+             });
+        w.put<uint64_t>(tid_list.size());
+        for (auto& t : tid_list) {
+            w.put<int32_t>(t.second.pid);
+            w.put<int32_t>(t.second.thread_id);
+            w.put<uint32_t>(t.second.cpu);
+        }
+
+        // executables, by the modules and kernel modules that refer to them
+        vector<pair<shared_ptr<executable>, model_image::executable_kind>> exes;
+        map<const executable*, uint32_t> exe_index;
+        auto add_exe = [&](const shared_ptr<executable>&  e,
+                           model_image::executable_kind kind) -> uint32_t
+        {
+            auto i = exe_index.insert({e.get(), (uint32_t)exes.size()});
+            if (i.second) {
+                exes.push_back({e, kind});
+            }
+            return i.first->second;
+        };
+        add_exe(unmapped, model_image::UNMAPPED);
+        for (auto& e : executables) {
+            add_exe(e.second, model_image::LISTED);
+        }
+        vector<uint32_t> kernel_module_exes;
+        for (auto& km : kernel_modules) {
+            kernel_module_exes.push_back(
+                km.exe ? add_exe(km.exe, model_image::UNLISTED) : ~0U);
+        }
+        vector<pair<uint32_t, rva>> module_list;
+        modules.iterate([&](const shared_ptr<executable>& e, rva start)
+        {
+            module_list.push_back({add_exe(e, model_image::UNLISTED), start});
+        });
+
+        w.put<uint64_t>(exes.size());
+        for (auto& e : exes) {
+            w.put_string(e.first->target_path());
+            w.put<uint8_t>(e.second);
+        }
+        w.put<uint64_t>(kernel_modules.size());
+        for (size_t k = 0; k < kernel_modules.size(); ++k) {
+            w.put_string(kernel_modules[k].file_name);
+            w.put<uint64_t>(kernel_modules[k].address);
+            w.put<uint64_t>(kernel_modules[k].size);
+            w.put<uint64_t>(kernel_modules[k].offset);
+            w.put<uint32_t>(kernel_module_exes[k]);
+        }
+        w.put<uint64_t>(module_list.size());
+        for (auto& m : module_list) {
+            w.put<uint32_t>(m.first);
+            w.put<uint64_t>(m.second);
+        }
+
+        // processes and the mappings they share after forks
+        vector<const sat::process*>          process_list;
+        map<const sat::process*, uint32_t>   process_index;
+        auto add_process = [&](const shared_ptr<sat::process>& p) -> uint32_t
+        {
+            auto i = process_index.insert({p.get(),
+                                           (uint32_t)process_list.size()});
+            if (i.second) {
+                process_list.push_back(p.get());
+            }
+            return i.first->second;
+        };
+        for (auto& p : pids) {
+            add_process(p.second);
+        }
+        for (auto& p : pgds) {
+            add_process(p.second);
+        }
+
+        vector<const mmapping*>        mmapping_list;
+        map<const mmapping*, uint32_t> mmapping_index;
+        for (auto p : process_list) {
+            p->iterate_mmaps([&](uint64_t, const shared_ptr<mmapping>& m)
+            {
+                if (mmapping_index.insert({m.get(),
+                                           (uint32_t)mmapping_list.size()})
+                        .second)
+                {
+                    mmapping_list.push_back(m.get());
+                }
+            });
+        }
+        w.put<uint64_t>(mmapping_list.size());
+        for (auto m : mmapping_list) {
+            w.put<uint64_t>(m->start);
+            w.put<uint32_t>(m->len);
+            w.put<uint32_t>(m->pgoff);
+            w.put<uint32_t>(add_exe(m->exe, model_image::UNLISTED));
+            w.put<uint64_t>(m->tsc);
+        }
+        w.put<uint64_t>(process_list.size());
+        for (auto p : process_list) {
+            w.put<int32_t>(p->pid);
+            w.put_string(p->name());
+            w.put<uint8_t>(p->newly_forked());
+            vector<pair<uint64_t, uint32_t>> mmaps;
+            p->iterate_mmaps([&](uint64_t tsc, const shared_ptr<mmapping>& m)
+            {
+                mmaps.push_back({tsc, mmapping_index[m.get()]});
+            });
+            w.put<uint64_t>(mmaps.size());
+            for (auto& m : mmaps) {
+                w.put<uint64_t>(m.first);
+                w.put<uint32_t>(m.second);
+            }
+        }
+
+        w.put<uint64_t>(pids.size());
+        for (auto& p : pids) {
+            w.put<int32_t>(p.first);
+            w.put<uint32_t>(process_index[p.second.get()]);
+        }
+        w.put<uint64_t>(pgds.size());
+        for (auto& p : pgds) {
+            w.put<uint32_t>(p.first.first);
+            w.put<uint64_t>(p.first.second);
+            w.put<uint32_t>(process_index[p.second.get()]);
+        }
+        w.put<uint64_t>(all_pids.size());
+        for (auto p : all_pids) {
+            w.put<int32_t>(p);
+        }
+        w.put<uint64_t>(thread_names.size());
+        for (auto& t : thread_names) {
+            w.put<int32_t>(t.first);
+            w.put_string(t.second);
+        }
+        w.put<uint64_t>(schedulings.size());
+        for (auto& c : schedulings) {
+            w.put<uint32_t>(c.first);
+            w.put<uint64_t>(c.second.size());
+            for (auto& s : c.second) {
+                w.put<uint64_t>(s.first);
+                w.put<uint64_t>(s.second.trace_buffer_offset);
+                w.put<int32_t>(s.second.prev_pid);
+                w.put<int32_t>(s.second.prev_thread_id);
+                w.put<int32_t>(s.second.pid);
+                w.put<int32_t>(s.second.thread_id);
+                w.put<uint8_t>(s.second.schedule_id);
+            }
+        }
+        w.put<uint64_t>(initial.size());
+        for (auto& i : initial) {
+            w.put<uint32_t>(i.first);
+            w.put<int32_t>(i.second.pid);
+            w.put<int32_t>(i.second.thread_id);
+        }
+        w.put<uint64_t>(pkt_masks.size());
+        for (auto& m : pkt_masks) {
+            w.put<uint32_t>(m.first);
+            w.put<uint32_t>(m.second);
         }
-#if 0
-        if (global_debug_level >= 3) {
-            print(); // TODO: remove
+        w.put<uint64_t>(schedule_id_functions.size());
+        for (auto& f : schedule_id_functions) {
+            w.put<uint64_t>(f.first);
+            w.put<uint8_t>(f.second);
         }
-#endif
-    }
-
-    bool process::get_mmap(rva      address,
-                           uint64_t tsc,
-                           string&  path,
-                           rva&     start) const  // target_load_address
-        // TODO: output offset
-    {
-        shared_ptr<mmapping> m;
-        SAT_LOG(1, "process::get_mmap tsc:%lx, addr:%lx\n", tsc, address);
-        bool found = mmaps_.find(tsc, address, m);
-        if (found) {
-            path  = m->exe->target_path();
-            if (m->pgoff) {
-                SAT_LOG(2, "ADJUSTED FOR PGOFF\n");
+        w.put<uint64_t>(hooks.size());
+        for (auto& h : hooks) {
+            w.put<uint64_t>(h.orig);
+            w.put<uint64_t>(h.copy);
+            w.put<uint64_t>(h.end);
+            w.put<uint64_t>(h.wrapper);
+            w.put_string(h.name);
+        }
+        w.put<uint64_t>(hooks_min_orig);
+        w.put<uint64_t>(hooks_max_orig);
+        w.put<uint64_t>(hooks_min_copy);
+        w.put<uint64_t>(hooks_max_copy);
+
+        header.body_size = w.data().size();
+
+        string path = snapshot_path(sideband_path, host_filesystem != nullptr);
+        string temp = path + "." + to_string(getpid());
+        bool   done = false;
+        FILE*  f    = fopen(temp.c_str(), "w");
+        if (f) {
+            done = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   fwrite(w.data().data(), 1, w.data().size(), f) ==
+                       w.data().size();
+            done = (fclose(f) == 0) && done;
+            done = done && rename(temp.c_str(), path.c_str()) == 0;
+            if (!done) {
+                (void)unlink(temp.c_str());
             }
-            start = m->start - 0x1000 * m->pgoff;
         }
-        return found;
-    }
-
-    void process::iterate_target_paths(uint64_t tsc, callback_func callback)
-    {
-        mmaps_.iterate_target_paths(tsc, callback);
-    }
 
-    void process::name(const char* name, uint64_t tsc)
-    {
-        name_ = name;
+        if (done) {
+            SAT_LOG(1, "wrote sideband model snapshot '%s'\n", path.c_str());
+        } else {
+            SAT_LOG(1, "could not write sideband model snapshot '%s'\n",
+                    path.c_str());
+        }
     }
 
-    const string& process::name() const
+    bool read_image(snapshot_reader& r, model_image& image)
     {
-        return name_;
-    }
-
-
-    typedef map<pid_t /* pid */,
-                shared_ptr<process>> pid_map;
-    typedef map<pair<unsigned /* cr3 */, uint64_t /* tsc */>,
-                shared_ptr<process>> pgd_map;
-    typedef map<pid_t /* thread_id */, string> thread_name_map;
-    struct scheduling {
-        uint64_t trace_buffer_offset;
-        pid_t    prev_pid;
-        pid_t    prev_thread_id;
-        pid_t    pid;
-        pid_t    thread_id;
-        uint8_t  schedule_id;
-    };
-    typedef map<uint64_t /*tsc*/, scheduling> scheduling_map;
-    typedef map<unsigned /*cpu*/, scheduling_map> cpu_scheduling_map;
-
-    // TODO: make these non-static member of some class
-    vector<pid_t>      all_pids;
-    pid_map            pids;
-    pgd_map            pgds;
-    thread_name_map    thread_names;
-    cpu_scheduling_map schedulings;
-    struct initial_pid_and_thread_id {
-        pid_t    pid;
-        pid_t    thread_id;
-    };
-    map<unsigned /* cpu */, initial_pid_and_thread_id> initial;
-    map<unsigned /* cpu */, uint32_t /* pkt_mask */>   pkt_masks;
-    uint32_t pkt_mask;
+        image.cpu0_tsc      = r.get<uint64_t>();
+        image.tsc_tick      = r.get<uint32_t>();
+        image.fsb_mhz       = r.get<uint32_t>();
+        image.tsc_ctc_ratio = r.get<uint32_t>();
+        image.mtc_freq      = r.get<uint8_t>();
+        image.pkt_mask      = r.get<uint32_t>();
+
+        image.tids.resize(r.get_count(12));
+        for (auto& t : image.tids) {
+            t.pid       = r.get<int32_t>();
+            t.thread_id = r.get<int32_t>();
+            t.cpu       = r.get<uint32_t>();
+        }
 
-    uint64_t initial_cpu0_tsc;
-    unsigned initial_tsc_tick = 0;
-    unsigned initial_fsb_mhz  = 0;
-    uint32_t initial_tsc_ctc_ratio = 1;
-    uint8_t  initial_mtc_freq = 0;
+        image.executables.resize(r.get_count(5));
+        for (auto& e : image.executables) {
+            e.path = r.get_string();
+            e.kind = (model_image::executable_kind)r.get<uint8_t>();
+            if (e.kind > model_image::UNLISTED) {
+                return false;
+            }
+        }
+        size_t exe_count = image.executables.size();
+
+        image.kernel_modules.resize(r.get_count(32));
+        for (auto& km : image.kernel_modules) {
+            km.file_name = r.get_string();
+            km.address   = r.get<uint64_t>();
+            km.size      = r.get<uint64_t>();
+            km.offset    = r.get<uint64_t>();
+            km.exe       = r.get<uint32_t>();
+            if (km.exe != ~0U && km.exe >= exe_count) {
+                return false;
+            }
+        }
 
-    typedef map<uint64_t, uint8_t> schedule_id_func_map;
-    schedule_id_func_map schedule_id_functions;
+        image.modules.resize(r.get_count(12));
+        for (auto& m : image.modules) {
+            m.exe   = r.get_index(exe_count);
+            m.start = r.get<uint64_t>();
+        }
 
-    shared_ptr<process> the_process; // for get_target_path()
+        image.mmappings.resize(r.get_count(28));
+        for (auto& m : image.mmappings) {
+            m.start = r.get<uint64_t>();
+            m.len   = r.get<uint32_t>();
+            m.pgoff = r.get<uint32_t>();
+            m.exe   = r.get_index(exe_count);
+            m.tsc   = r.get<uint64_t>();
+        }
+        size_t mmapping_count = image.mmappings.size();
+
+        image.processes.resize(r.get_count(17));
+        for (auto& p : image.processes) {
+            p.pid          = r.get<int32_t>();
+            p.name         = r.get_string();
+            p.newly_forked = r.get<uint8_t>();
+            p.mmaps.resize(r.get_count(12));
+            for (auto& m : p.mmaps) {
+                m.first  = r.get<uint64_t>();
+                m.second = r.get_index(mmapping_count);
+            }
+        }
+        size_t process_count = image.processes.size();
 
-    // TODO: use some other kind of pointer
-    shared_ptr<process> get_process(unsigned cr3, uint64_t tsc)
-    {
-        auto i = pgds.upper_bound({cr3, tsc});
-        if (i != pgds.begin()) {
-            --i;
-            if (i->first.first == cr3) {
-                return i->second;
+        image.pids.resize(r.get_count(8));
+        for (auto& p : image.pids) {
+            p.first  = r.get<int32_t>();
+            p.second = r.get_index(process_count);
+        }
+        image.pgds.resize(r.get_count(16));
+        for (auto& p : image.pgds) {
+            p.first.first  = r.get<uint32_t>();
+            p.first.second = r.get<uint64_t>();
+            p.second       = r.get_index(process_count);
+        }
+        image.all_pids.resize(r.get_count(4));
+        for (auto& p : image.all_pids) {
+            p = r.get<int32_t>();
+        }
+        image.thread_names.resize(r.get_count(8));
+        for (auto& t : image.thread_names) {
+            t.first  = r.get<int32_t>();
+            t.second = r.get_string();
+        }
+        image.schedulings.resize(r.get_count(12));
+        for (auto& c : image.schedulings) {
+            c.cpu = r.get<uint32_t>();
+            c.schedulings.resize(r.get_count(33));
+            for (auto& s : c.schedulings) {
+                s.first                      = r.get<uint64_t>();
+                s.second.trace_buffer_offset = r.get<uint64_t>();
+                s.second.prev_pid            = r.get<int32_t>();
+                s.second.prev_thread_id      = r.get<int32_t>();
+                s.second.pid                 = r.get<int32_t>();
+                s.second.thread_id           = r.get<int32_t>();
+                s.second.schedule_id         = r.get<uint8_t>();
             }
         }
+        image.initial.resize(r.get_count(12));
+        for (auto& i : image.initial) {
+            i.first            = r.get<uint32_t>();
+            i.second.pid       = r.get<int32_t>();
+            i.second.thread_id = r.get<int32_t>();
+        }
+        image.pkt_masks.resize(r.get_count(8));
+        for (auto& m : image.pkt_masks) {
+            m.first  = r.get<uint32_t>();
+            m.second = r.get<uint32_t>();
+        }
+        image.schedule_id_functions.resize(r.get_count(9));
+        for (auto& f : image.schedule_id_functions) {
+            f.first  = r.get<uint64_t>();
+            f.second = r.get<uint8_t>();
+        }
+        image.hooks.resize(r.get_count(36));
+        for (auto& h : image.hooks) {
+            h.orig    = r.get<uint64_t>();
+            h.copy    = r.get<uint64_t>();
+            h.end     = r.get<uint64_t>();
+            h.wrapper = r.get<uint64_t>();
+            h.name    = r.get_string();
+        }
+        image.hooks_min_orig = r.get<uint64_t>();
+        image.hooks_max_orig = r.get<uint64_t>();
+        image.hooks_min_copy = r.get<uint64_t>();
+        image.hooks_max_copy = r.get<uint64_t>();
 
-        return 0;
+        return r.at_end();
     }
 
-    shared_ptr<process> get_process(tid_t tid)
+    void sideband_state::restore_image(model_image& image)
     {
-        pid_t pid;
-        if (tid_get_pid(tid, pid)) {
-            auto i = pids.find(pid);
-            if (i != pids.end()) {
-                return i->second;
-            } else {
-                if (pid == 0) {
-                    // create a process for the swapper
-                    shared_ptr<sat::process> p(new sat::process(pid));
-                    p->name("swapper", 0);
-                    pids.insert({pid, p});
-                    return p;
-                } else {
-                    SAT_LOG(1, "#FOUND PID %d, BUT NO PROCESS\n", pid);
-                }
+        initial_cpu0_tsc      = image.cpu0_tsc;
+        initial_tsc_tick      = image.tsc_tick;
+        initial_fsb_mhz       = image.fsb_mhz;
+        initial_tsc_ctc_ratio = image.tsc_ctc_ratio;
+        initial_mtc_freq      = image.mtc_freq;
+        pkt_mask              = image.pkt_mask;
+
+        for (auto& t : image.tids) {
+            tids.add(t.pid, t.thread_id, t.cpu);
+        }
+
+        vector<shared_ptr<executable>> exes;
+        for (auto& e : image.executables) {
+            switch (e.kind) {
+            case model_image::LISTED:
+                exes.push_back(find_executable(e.path.c_str()));
+                break;
+            case model_image::UNMAPPED:
+                exes.push_back(unmapped);
+                break;
+            default:
+                exes.push_back(make_shared<executable>(e.path.c_str()));
             }
-        } else {
-            SAT_LOG(1, "#UNKNOWN TID %u\n", tid);
+        }
+        for (auto& km : image.kernel_modules) {
+            kernel_modules.push_back({km.file_name,
+                                      km.address,
+                                      km.size,
+                                      km.offset,
+                                      km.exe != ~0U ? exes[km.exe] : nullptr});
+        }
+        // intern the modules in the order of their handles, so that the
+        // mappings get the handles they had
+        for (auto& m : image.modules) {
+            modules.intern(exes[m.exe], m.start);
         }
 
-        return 0;
+        vector<shared_ptr<mmapping>> mmaps;
+        for (auto& m : image.mmappings) {
+            mmaps.push_back(new_mmapping(m.start,
+                                         m.len,
+                                         m.pgoff,
+                                         exes[m.exe],
+                                         m.tsc));
+        }
+        vector<shared_ptr<sat::process>> processes;
+        for (auto& p : image.processes) {
+            auto process = make_shared<sat::process>(p.pid,
+                                                     p.name,
+                                                     p.newly_forked);
+            for (auto& m : p.mmaps) {
+                process->insert_mmap(m.first, mmaps[m.second]);
+            }
+            processes.push_back(process);
+        }
+
+        for (auto& p : image.pids) {
+            pids.insert({p.first, processes[p.second]});
+        }
+        for (auto& p : image.pgds) {
+            pgds.insert({p.first, processes[p.second]});
+        }
+        all_pids = image.all_pids;
+        for (auto& t : image.thread_names) {
+            thread_names.insert(t);
+        }
+        for (auto& c : image.schedulings) {
+            auto& s = schedulings[c.cpu];
+            for (auto& i : c.schedulings) {
+                s.insert(s.end(), i);
+            }
+        }
+        for (auto& i : image.initial) {
+            initial.insert(i);
+        }
+        for (auto& m : image.pkt_masks) {
+            pkt_masks.insert(m);
+        }
+        for (auto& f : image.schedule_id_functions) {
+            schedule_id_functions.insert(f);
+        }
+        hooks          = image.hooks;
+        hooks_min_orig = image.hooks_min_orig;
+        hooks_max_orig = image.hooks_max_orig;
+        hooks_min_copy = image.hooks_min_copy;
+        hooks_max_copy = image.hooks_max_copy;
     }
 
-    class hooking
+    bool sideband_state::read_snapshot(const string& sideband_path)
     {
-        public:
-            rva    orig;    // address of the hooked function
-            rva    copy;    // address of the copy of the hooked function
-            rva    end;     // address after the copy of the hooked function
-            rva    wrapper; // address of the wrapper function
-            string name;    // name of the hooked function
+        bool done = false;
 
-            static rva min_orig;
-            static rva max_orig;
-            static rva min_copy;
-            static rva max_copy;
-    };
+        snapshot_header current;
+        if (!stat_sideband(sideband_path, host_filesystem != nullptr, current)) {
+            return false;
+        }
 
-    vector<hooking> hooks_;
+        string path = snapshot_path(sideband_path, host_filesystem != nullptr);
+        int    fd   = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 &&
+            (size_t)st.st_size >= sizeof(snapshot_header))
+        {
+            void* m = ::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                snapshot_header header;
+                memcpy(&header, m, sizeof(header));
+                if (same_sideband(header, current) &&
+                    header.body_size == st.st_size - sizeof(header))
+                {
+                    snapshot_reader r(static_cast<const char*>(m) +
+                                          sizeof(header),
+                                      header.body_size);
+                    model_image image;
+                    if (read_image(r, image)) {
+                        restore_image(image);
+                        done = true;
+                    } else {
+                        SAT_LOG(0, "ignoring invalid sideband model snapshot '%s'\n",
+                                path.c_str());
+                    }
+                }
+                (void)munmap(m, st.st_size);
+            }
+        }
+        (void)close(fd);
 
-    // statics
-    rva hooking::min_orig = 0;
-    rva hooking::max_orig = 0;
-    rva hooking::min_copy = 0;
-    rva hooking::max_copy = 0;
+        return done;
+    }
 
 } // namespace sat
 
@@ -507,9 +1661,40 @@ public:
 };
 
 
+// sideband messages that have already been read to memory
+class sideband_buffer : public sideband_parser_input {
+public:
+    sideband_buffer(const uint8_t* data, size_t size) :
+        data_(data), size_(size), position_()
+    {}
+
+    bool read(unsigned size, void* buffer)
+    {
+        if (size > size_ - position_) {
+            return false;
+        } else {
+            memcpy(buffer, data_ + position_, size);
+            position_ += size;
+            return true;
+        }
+    }
+
+    bool eof() { return position_ == size_; }
+
+    bool bad() { return false; }
+
+private:
+    const uint8_t* data_;
+    size_t         size_;
+    size_t         position_;
+};
+
+
 class sideband_collector : public sideband_parser_output {
 public:
-        sideband_collector() : done_with_init(false) {}
+        explicit sideband_collector(sideband_state& state) :
+            state_(state), done_with_init(false)
+        {}
 
         virtual void init(const sat_header& header,
                           pid_t             pid,
@@ -521,17 +1706,17 @@ public:
                           uint8_t           mtc_freq) override
         {
             // collect threads that got executed during the trace
-            tid_add(pid, thread_id, header.cpu);
-            initial.insert({header.cpu, {pid, thread_id}});
+            state_.tids.add(pid, thread_id, header.cpu);
+            state_.initial.insert({header.cpu, {pid, thread_id}});
             if (header.cpu == 0) {
-                initial_cpu0_tsc = tsc(header);
+                state_.initial_cpu0_tsc = tsc(header);
             }
-            initial_tsc_tick = tsc_tick;
-            initial_fsb_mhz  = fsb_mhz;
+            state_.initial_tsc_tick = tsc_tick;
+            state_.initial_fsb_mhz  = fsb_mhz;
             if (tma_ratio_tsc && tma_ratio_ctc) {
-                initial_tsc_ctc_ratio = (uint32_t) (tma_ratio_tsc / tma_ratio_ctc);
+                state_.initial_tsc_ctc_ratio = (uint32_t) (tma_ratio_tsc / tma_ratio_ctc);
             }
-            initial_mtc_freq = mtc_freq;
+            state_.initial_mtc_freq = mtc_freq;
             done_with_init = true;
             SAT_LOG(1, "GOT INITIAL PID: %d, THREAD ID: %u, TSC: %" PRIx64 " TICK: %u FSB %u\n",
                    pid, thread_id, tsc(header), tsc_tick, fsb_mhz);
@@ -549,32 +1734,32 @@ public:
             const char* o;
             const char* haba = "TODO"; // TODO: remove
 
-            all_pids.insert(all_pids.end(), pid);
+            state_.all_pids.insert(state_.all_pids.end(), pid);
             if (origin == SAT_ORIGIN_INIT) {
                 o = "init";
                 if (pid == tgid) {
                     // we are getting a process
                     shared_ptr<sat::process> p;
-                    pid_map::iterator i(pids.find(pid));
-                    if (i == pids.end()) {
+                    pid_map::iterator i(state_.pids.find(pid));
+                    if (i == state_.pids.end()) {
                         haba = "A NEW ONE!";
-                        p = make_shared<sat::process>(pid);
-                        pids.insert({pid, p});
+                        p = state_.new_process(pid);
+                        state_.pids.insert({pid, p});
                     } else {
                         p = i->second;
                         haba = "GOT NAME";
                     }
                     auto t = tsc(header);
                     p->name(name, t);
-                    pgds.insert({{pgd, t}, p});
+                    state_.pgds.insert({{pgd, t}, p});
                 } else {
                     // we are getting a thread; store its name
-                    thread_names[pid] = name;
+                    state_.thread_names[pid] = name;
                 }
             } else if (origin == SAT_ORIGIN_FORK) {
                 o = "fork";
-                pid_map::iterator i(pids.find(ppid));
-                if (i == pids.end()) {
+                pid_map::iterator i(state_.pids.find(ppid));
+                if (i == state_.pids.end()) {
                     // TODO: should we do something other than discard?
                     SAT_LOG(0, "--- TROUBLE: PARENTLESS FORK (%d/%d <- %d)\n",
                                                              pid, tgid, ppid);
@@ -583,9 +1768,9 @@ public:
                     shared_ptr<sat::process> pp;
                     pp = i->second;
                     shared_ptr<sat::process> p(new sat::process(pid, *pp));
-                    pids.insert({pid, p});
+                    state_.pids.insert({pid, p});
                     auto t = tsc(header);
-                    pgds.insert({{pgd, t}, p});
+                    state_.pgds.insert({{pgd, t}, p});
                     if (global_debug_level >= 3) {
                         p->print(); // TODO: REMOVE
                     }
@@ -593,7 +1778,7 @@ public:
             } else if (origin == SAT_ORIGIN_SET_TASK_COMM) {
                 // we are getting a new name for a thread
                 o = "set_task_comm";
-                thread_names[pid] = name;
+                state_.thread_names[pid] = name;
             } else {
                 o = "--- process";
             }
@@ -622,25 +1807,25 @@ public:
                 pid = thread_id;
                 o = "mmap(init)";
 
-                auto e = find_executable(path);
+                auto e = state_.find_executable(path);
 
                 shared_ptr<sat::process> p;
-                pid_map::iterator i(pids.find(pid));
-                if (i == pids.end()) {
+                pid_map::iterator i(state_.pids.find(pid));
+                if (i == state_.pids.end()) {
                     haba = "A NEW ONE!";
-                    p = make_shared<sat::process>(pid);
-                    pids.insert({pid, p});
+                    p = state_.new_process(pid);
+                    state_.pids.insert({pid, p});
                 } else {
                     p = i->second;
                     haba = "OLD";
                 }
-                p->mmap(start, len, pgoff, e, tsc(header));
+                p->mmap(state_.new_mmapping(start, len, pgoff, e, tsc(header)));
             } else if (origin == SAT_ORIGIN_MMAP) {
                 o = "mmap";
                 // kernel module sends pids for mmaps
                 pid = thread_id;
-                pid_map::iterator i(pids.find(pid));
-                if (i == pids.end()) {
+                pid_map::iterator i(state_.pids.find(pid));
+                if (i == state_.pids.end()) {
                     if (!done_with_init) {
                         SAT_LOG(0, "SAFELY IGNORING mmap() TO PID %d\n", pid);
                     } else {
@@ -648,9 +1833,9 @@ public:
                         SAT_LOG(0, "--- TROUBLE: MMAP TO AN UNKNOWN PID %d\n", pid);
                     }
                 } else {
-                    auto e = find_executable(path);
+                    auto e = state_.find_executable(path);
                     auto p = i->second;
-                    p->mmap(start, len, pgoff, e, tsc(header));
+                    p->mmap(state_.new_mmapping(start, len, pgoff, e, tsc(header)));
                     haba = "MMAP";
                 }
             } else if (origin == SAT_ORIGIN_MPROTECT) {
@@ -682,8 +1867,8 @@ public:
             if (origin == SAT_ORIGIN_MUNMAP) {
                 o = "munmap";
 
-                pid_map::iterator i(pids.find(pid));
-                if (i == pids.end()) {
+                pid_map::iterator i(state_.pids.find(pid));
+                if (i == state_.pids.end()) {
                     if (!done_with_init) {
                         SAT_LOG(0, "SAFELY IGNORING munmap() to PID %d\n", pid);
                     } else {
@@ -692,7 +1877,7 @@ public:
                     }
                 } else {
                     auto p = i->second;
-                    p->mmap(start, len, 0, unmapped, tsc(header));
+                    p->mmap(state_.new_mmapping(start, len, 0, unmapped, tsc(header)));
                 }
             } else if (origin == SAT_ORIGIN_MPROTECT) {
                 o = "TODO: munmap(mprotect)";
@@ -716,13 +1901,13 @@ public:
                               uint8_t           schedule_id) override
         {
             // collect threads that got executed during the trace
-            tid_add(pid, thread_id, header.cpu);
-            schedulings[header.cpu].insert({tsc(header),
+            state_.tids.add(pid, thread_id, header.cpu);
+            state_.schedulings[header.cpu].insert({tsc(header),
                                             { buff_offset,
                                               prev_pid, prev_thread_id,
                                               pid, thread_id, schedule_id}});
             // grab the last pkt_mask
-            pkt_masks[header.cpu] = ipt_pkt_mask;
+            state_.pkt_masks[header.cpu] = ipt_pkt_mask;
 
             if (global_debug_level >= 2) {
                 print_header(header);
@@ -735,7 +1920,7 @@ public:
                                   uint64_t          address,
                                    uint8_t          id)
         {
-            schedule_id_functions[address] = id;
+            state_.schedule_id_functions[address] = id;
         }
 
         virtual void hook(const sat_header& header,
@@ -745,34 +1930,11 @@ public:
                           uint64_t          wrapper_address,
                           const char*       name) override
         {
-            rva end = new_address + size;
-
-            hooks_.push_back({original_address,
-                              new_address,
-                              end,
-                              wrapper_address,
-                              name});
-
-            if (hooking::min_orig == 0 ||
-                hooking::min_orig > original_address)
-            {
-                hooking::min_orig = original_address;
-            }
-            if (hooking::max_orig == 0 ||
-                hooking::max_orig < original_address)
-            {
-                hooking::max_orig = original_address;
-            }
-            if (hooking::min_copy == 0 ||
-                hooking::min_copy > new_address)
-            {
-                hooking::min_copy = new_address;
-            }
-            if (hooking::max_copy == 0 ||
-                hooking::max_copy < end)
-            {
-                hooking::max_copy = end;
-            }
+            state_.add_hook({original_address,
+                             new_address,
+                             new_address + size,
+                             wrapper_address,
+                             name});
         }
 
         virtual void module(const sat_header& header,
@@ -780,20 +1942,20 @@ public:
                             uint64_t          size,
                             const char*       name) override
         {
-            if (host_filesystem) {
+            if (state_.host_filesystem) {
                 string target_path = string(name) + ".ko";
                 string host_path;
                 string sym_path;
 
-                if (host_filesystem->find_file(target_path, sym_path, host_path)) {
+                if (state_.host_filesystem->find_file(target_path, sym_path, host_path)) {
                     shared_ptr<mmapped> module = mmapped::obtain(host_path, sym_path);
                     rva offset;
                     rva size_ = 0;
                     if (module->get_text_section(offset, size_)) {
-                        kernel_modules.push_back({ target_path,
-                                                   address,
-                                                   size-offset,
-                                                   offset });
+                        state_.kernel_modules.push_back({ target_path,
+                                                          address,
+                                                          size-offset,
+                                                          offset });
                         SAT_LOG(1, "kernel module '%s' address %" PRIx64 \
                                 ", .text section offset %" PRIx64 \
                                 ", size %" PRIx64 "\n",
@@ -811,33 +1973,53 @@ public:
         }
 
 private:
-        bool done_with_init;
+        sideband_state& state_;
+        bool            done_with_init;
 }; // class sideband_collector
 
 // TODO: join with the other namespace sat above
 namespace sat {
 
+        sideband_model::sideband_model() :
+            state_(new sideband_state), followed_bytes_(), follower_()
+        {
+        }
+
+        sideband_model::~sideband_model()
+        {
+        }
+
         void sideband_model::set_host_filesystem(shared_ptr<path_mapper> filesystem)
         {
-            host_filesystem = filesystem;
+            state_->host_filesystem = filesystem;
         }
 
         bool sideband_model::build(const string& sideband_path)
         {
+            // a model that has not been built yet can be restored from a
+            // snapshot of an earlier build
+            bool fresh = state_->pids.empty() && state_->modules.size() == 0;
+            if (fresh && state_->read_snapshot(sideband_path)) {
+                SAT_LOG(1, "restored sideband model from snapshot of '%s'\n",
+                        sideband_path.c_str());
+                state_->complete();
+                return true;
+            }
+
             bool built = false;
             using sideband_input = file_input<sideband_parser_input>;
             shared_ptr<sideband_input> input{new sideband_input};
             if (input->open(sideband_path)) {
                 shared_ptr<sideband_collector>
-                    output{new sideband_collector};
+                    output{new sideband_collector(*state_)};
 
                 sideband_parser parser(input, output);
 
                 if (parser.parse()) {
                     built = true;
-                    {
-                        tid_t dummy;
-                        tid_get(0, 0, dummy);
+                    state_->complete();
+                    if (fresh) {
+                        state_->write_snapshot(sideband_path);
                     }
 
                 } else {
@@ -851,6 +2033,77 @@ namespace sat {
             return built;
         }
 
+        bool sideband_model::update(const string& sideband_path)
+        {
+            bool updated = false;
+
+            vector<uint8_t> data;
+            FILE* f = fopen(sideband_path.c_str(), "rb");
+            if (!f) {
+                SAT_ERR("cannot open sideband file for input: '%s'\n",
+                        sideband_path.c_str());
+                return false;
+            }
+            if (fseeko(f, followed_bytes_, SEEK_SET) == 0) {
+                uint8_t buffer[64 * 1024];
+                size_t  n;
+                while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+                    data.insert(data.end(), buffer, buffer + n);
+                }
+            }
+            fclose(f);
+
+            // find the end of the last whole message; the file begins
+            // with a version string
+            const size_t version_size = sizeof(SIDEBAND_VERSION) - 1;
+            size_t       first        = 0;
+            if (followed_bytes_ == 0) {
+                if (data.size() < version_size) {
+                    return false;
+                }
+                if (memcmp(data.data(), SIDEBAND_VERSION, version_size) != 0) {
+                    SAT_ERR("unsupported sideband version in '%s'\n",
+                            sideband_path.c_str());
+                    return false;
+                }
+                first = version_size;
+            }
+            size_t whole = first;
+            while (whole + sizeof(uint32_t) <= data.size()) {
+                uint32_t size;
+                memcpy(&size, &data[whole], sizeof(size));
+                if (size < sizeof(sat_header)) {
+                    whole = data.size(); // broken; let the parser tell
+                    break;
+                } else if (whole + size > data.size()) {
+                    break; // not completely written yet
+                }
+                whole += size;
+            }
+
+            if (whole > first) {
+                if (!follower_) {
+                    // keep the tids of the threads that the model has
+                    // already numbered
+                    state_->tids.follow();
+                    follower_ = make_shared<sideband_collector>(*state_);
+                }
+                shared_ptr<sideband_buffer>
+                    input{new sideband_buffer(data.data(), whole)};
+                sideband_parser parser(input, follower_);
+
+                if (parser.parse()) {
+                    updated = true;
+                    state_->complete();
+                } else {
+                    SAT_ERR("sideband model update failed\n");
+                }
+                followed_bytes_ += whole;
+            }
+
+            return updated;
+        }
+
         void sideband_model::iterate_schedulings(
                  unsigned cpu,
                  function<void(uint64_t /* tsc */,
@@ -859,10 +2112,14 @@ namespace sat {
                                tid_t    /* tid */,
                                uint8_t  /* schedule id*/)> callback) const
         {
-            for (auto& i : schedulings[cpu]) {
+            auto c = state_->schedulings.find(cpu);
+            if (c == state_->schedulings.end()) {
+                return;
+            }
+            for (auto& i : c->second) {
                 tid_t prev_tid;
                 tid_t tid;
-                if (tid_get(i.second.thread_id, cpu, tid)) {
+                if (state_->tids.get(i.second.thread_id, cpu, tid)) {
                     // NOTE: The below if() looks strange, but there
                     // is an explanation: If we are looking at the very first
                     // scheduling for the cpu, and it happened before ipt
@@ -875,7 +2132,7 @@ namespace sat {
                     // got scheduled out. The only safe value is the tid of
                     // the thread that got scheduled in, so use that as
                     // the false value.
-                    if (!tid_get(i.second.prev_thread_id, cpu, prev_tid)) {
+                    if (!state_->tids.get(i.second.prev_thread_id, cpu, prev_tid)) {
                         prev_tid = tid;
                     }
                     callback(i.first,
@@ -889,13 +2146,13 @@ namespace sat {
 
         void sideband_model::set_cr3(unsigned cr3, uint64_t tsc, tid_t tid)
         {
-            auto p_by_cr3 = get_process(cr3, tsc);
-            auto p_by_tid = get_process(tid);
+            auto p_by_cr3 = state_->get_process(cr3, tsc);
+            auto p_by_tid = state_->get_process(tid);
             if (!p_by_cr3) {
                 SAT_LOG(1, "NEW (CR3, TSC) (%x, %" PRIx64 "); ASSUME WE ARE IN EXEC()...\n",
                         cr3, tsc);
                 if (p_by_tid) {
-                    pgds.insert({{cr3, tsc}, p_by_tid});
+                    state_->pgds.insert({{cr3, tsc}, p_by_tid});
                     SAT_LOG(0, "...FOR TID %u\n", tid);
                 } else {
                     SAT_LOG(0, "...FOR AN UNKNOWN TID %u\n", tid);
@@ -918,19 +2175,21 @@ namespace sat {
                                          tid_t&    tid,
                                          uint32_t& pkt_mask) const
         {
-            const auto& m = pkt_masks.find(cpu);
-            if (m != pkt_masks.end()) {
+            const auto& m = state_->pkt_masks.find(cpu);
+            if (m != state_->pkt_masks.end()) {
                 pkt_mask = m->second;
             } else {
                 pkt_mask = 2; // default by kernel module
             }
 
-            return tid_get(initial[cpu].thread_id, cpu, tid);
+            auto i = state_->initial.find(cpu);
+            pid_t thread_id = i != state_->initial.end() ? i->second.thread_id : 0;
+            return state_->tids.get(thread_id, cpu, tid);
         }
 
         uint64_t sideband_model::initial_tsc() const
         {
-            return initial_cpu0_tsc;
+            return state_->initial_cpu0_tsc;
         }
 
         string sideband_model::process(pid_t pid) const
@@ -940,8 +2199,8 @@ namespace sat {
             if (pid == 0) {
                 process = "swapper";
             } else {
-                auto p = pids.find(pid);
-                if (p != pids.end()) {
+                auto p = state_->pids.find(pid);
+                if (p != state_->pids.end()) {
                     process = p->second->name();
                 }
             }
@@ -953,8 +2212,8 @@ namespace sat {
         {
             bool found = false;
 
-            auto t = thread_names.find(thread_id);
-            if (t != thread_names.end()) {
+            auto t = state_->thread_names.find(thread_id);
+            if (t != state_->thread_names.end()) {
                 name = t->second;
                 found = true;
             }
@@ -962,28 +2221,12 @@ namespace sat {
             return found;
         }
 
-        bool get_target_path(shared_ptr<process> p,
-                             rva                 address,
-                             uint64_t            tsc,
-                             string&             path,
-                             rva&                start)
+        bool sideband_model::get_tid_info(tid_t     tid,
+                                          pid_t&    pid,
+                                          pid_t&    thread_id,
+                                          unsigned& cpu) const
         {
-            bool got_it = false;
-
-            if (p->get_mmap(address, tsc, path, start)) {
-                got_it = true;
-            } else {
-                printf("TROUBLE: AN UNMAPPED ADDRESS\n");
-                ostringstream p;
-                p.setf(ios::showbase);
-                p << "TROUBLE: AN UNMAPPED ADDRESS "
-                    << hex << address
-                    << "; KERNEL MODULE?";
-                path = p.str();
-                // TODO: what should we do?
-            }
-
-            return got_it;
+            return state_->tids.get_info(tid, pid, thread_id, cpu);
         }
 
         bool sideband_model::get_target_path(tid_t    tid,
@@ -993,9 +2236,10 @@ namespace sat {
                                              rva&     start) const
         {
             bool got_it = false;
-            printf("sideband_model::get_target_path; tid:%d, add:%lx, tsc:%lx, '%s', start:%lx\n",
+            fprintf(output_stream(),
+                    "sideband_model::get_target_path; tid:%d, add:%lx, tsc:%lx, '%s', start:%lx\n",
                     tid, address, tsc, path.c_str(), start);
-            auto p = get_process(tid).get();
+            auto p = state_->get_process(tid);
             if (p) {
                 if (p->get_mmap(address, tsc, path, start)) {
                     got_it = true;
@@ -1024,74 +2268,82 @@ namespace sat {
             return got_it;
         }
 
-        bool sideband_model::set_tid_for_target_path_resolution(tid_t tid)
+        void sideband_model::get_module_path(module_handle module,
+                                             string&       path,
+                                             rva&          start) const
         {
-            bool set_it = false;
-            if ((the_process = get_process(tid))) {
-                set_it = true;
-            }
-
-            return set_it;
+            state_->modules.get(module, path, start);
         }
 
-        bool sideband_model::get_target_path(rva      address,
-                                             uint64_t tsc,
-                                             string&  path,
-                                             rva&     start) const
+        void sideband_model::iterate_modules(tid_t         tid,
+                                             uint64_t      tsc,
+                                             callback_func callback)
         {
-            bool got_it = false;
-            if (the_process) {
-                got_it = ::get_target_path(the_process, address, tsc, path,start);
-            }
+            SAT_LOG(3, "ITERATING MODULES IN %u UPTO %" PRIx64 "\n", tid, tsc);
 
-            return got_it;
+            auto p = state_->get_process(tid);
+            if (p) {
+                p->iterate_modules(tsc, callback);
+            }
         }
 
-        void sideband_model::iterate_target_paths(tid_t         tid,
-                                                  uint64_t      tsc,
-                                                  callback_func callback)
+        bool sideband_model::find_export(tid_t         tid,
+                                         uint64_t      tsc,
+                                         const string& name,
+                                         rva&          address) const
         {
-            SAT_LOG(3, "ITERATING PATHS IN %u UPTO %" PRIx64 "\n", tid, tsc);
+            bool found = false;
 
-            auto p = get_process(tid).get();
+            auto p = state_->get_process(tid);
             if (p) {
-                p->iterate_target_paths(tsc, callback);
+                found = p->find_export(*state_, tsc, name, address);
+            }
+
+            return found;
+        }
+
+        void sideband_model::iterate_executables(
+                 function<void(const string& /*target_path*/)> callback) const
+        {
+            for (auto& e : state_->executables) {
+                callback(e.first);
+            }
+            for (auto& km : state_->kernel_modules) {
+                callback(km.file_name);
             }
         }
 
         void sideband_model::adjust_for_hooks(rva& pc) const
         {
-            if (pc >= hooking::min_orig && pc <= hooking::max_orig) {
+            const auto& s = *state_;
+            if (pc >= s.hooks_min_orig && pc <= s.hooks_max_orig) {
                 // program counter is in the range of hooked functions;
                 // see if it maches the start of a hooked function
-                for (auto& h : hooks_) {
-                    if (pc == h.orig) {
-                        // at the start of hooked function; do we have wrapper?
-                        if (h.wrapper) {
-                            // yes, we have a wrapper; jump to it
-                            SAT_LOG(1, "hook: jumping from %s "
-                                       "to its wrapper @ %" PRIx64 "\n",
-                                    h.name.c_str(), h.wrapper);
-                            pc = h.wrapper;
-                        } else {
-                            SAT_LOG(0, "hook: no wrapper for %s\n",
-                                    h.name.c_str());
-                        }
-                        break;
+                auto i = s.hooks_by_orig.find(pc);
+                if (i != s.hooks_by_orig.end()) {
+                    // at the start of hooked function; do we have wrapper?
+                    const auto& h = s.hooks[i->second];
+                    if (h.wrapper) {
+                        // yes, we have a wrapper; jump to it
+                        SAT_LOG(1, "hook: jumping from %s "
+                                   "to its wrapper @ %" PRIx64 "\n",
+                                h.name.c_str(), h.wrapper);
+                        pc = h.wrapper;
+                    } else {
+                        SAT_LOG(0, "hook: no wrapper for %s\n",
+                                h.name.c_str());
                     }
                 }
-            } else if (pc >= hooking::min_copy && pc <= hooking::max_copy) {
+            } else if (pc >= s.hooks_min_copy && pc <= s.hooks_max_copy) {
                 // program counter is in the range of copied functions;
                 // see if it is within a copy
-                for (auto& h : hooks_) {
-                    if (pc >= h.copy && pc < h.end) {
-                        // program counter is within the copy;
-                        // jump to same offset in the hooked function
-                        SAT_LOG(1, "hook: jumping from %s copy to original\n",
-                                h.name.c_str());
-                        pc = h.orig + (pc - h.copy);
-                        break;
-                    }
+                size_t h;
+                if (s.hooks_by_copy.find(pc, h)) {
+                    // program counter is within the copy;
+                    // jump to same offset in the hooked function
+                    SAT_LOG(1, "hook: jumping from %s copy to original\n",
+                            s.hooks[h].name.c_str());
+                    pc = s.hooks[h].orig + (pc - s.hooks[h].copy);
                 }
             }
         }
@@ -1100,11 +2352,9 @@ namespace sat {
         {
             rva result = 0;
 
-            for (auto &h : hooks_) {
-                if (h.name == "__switch_to") {
-                    result = h.copy;
-                    break;
-                }
+            auto h = state_->hooks_by_name.find("__switch_to");
+            if (h != state_->hooks_by_name.end()) {
+                result = state_->hooks[h->second].copy;
             }
 
             return result;
@@ -1113,8 +2363,8 @@ namespace sat {
         bool sideband_model::get_schedule_id(uint64_t address, uint8_t &schedule_id) const
         {
             bool ret_val = false;
-            const auto &id = schedule_id_functions.find(address);
-            if (id != schedule_id_functions.end()) {
+            const auto &id = state_->schedule_id_functions.find(address);
+            if (id != state_->schedule_id_functions.end()) {
                 schedule_id = (int8_t)id->second;
                 ret_val = true;
             }
@@ -1123,20 +2373,85 @@ namespace sat {
 
         unsigned sideband_model::tsc_tick() const
         {
-            return initial_tsc_tick;
+            return state_->initial_tsc_tick;
         }
 
         unsigned sideband_model::fsb_mhz() const
         {
-            return initial_fsb_mhz;
+            return state_->initial_fsb_mhz;
         }
         uint32_t sideband_model::tsc_ctc_ratio() const
         {
-            return initial_tsc_ctc_ratio;
+            return state_->initial_tsc_ctc_ratio;
         }
         uint8_t sideband_model::mtc_freq() const
         {
-            return initial_mtc_freq;
+            return state_->initial_mtc_freq;
+        }
+
+
+        sideband_view::sideband_view(shared_ptr<const sideband_model> model) :
+            model_(model), process_()
+        {
+        }
+
+        bool sideband_view::set_tid(tid_t tid)
+        {
+            process_ = model_->state_->get_process(tid);
+
+            return process_ != nullptr;
+        }
+
+        bool sideband_view::get_target_path(rva      address,
+                                            uint64_t tsc,
+                                            string&  path,
+                                            rva&     start) const
+        {
+            bool got_it = false;
+
+            if (process_) {
+                if (process_->get_mmap(address, tsc, path, start)) {
+                    got_it = true;
+                } else {
+                    fprintf(output_stream(), "TROUBLE: AN UNMAPPED ADDRESS\n");
+                    ostringstream p;
+                    p.setf(ios::showbase);
+                    p << "TROUBLE: AN UNMAPPED ADDRESS "
+                        << hex << address
+                        << "; KERNEL MODULE?";
+                    path = p.str();
+                    // TODO: what should we do?
+                }
+            }
+
+            return got_it;
+        }
+
+        bool sideband_view::get_module(rva            address,
+                                       uint64_t       tsc,
+                                       module_handle& module) const
+        {
+            pair<rva, rva>           range;
+            pair<uint64_t, uint64_t> tscs;
+            return get_module(address, tsc, module, range, tscs);
+        }
+
+        bool sideband_view::get_module(rva                       address,
+                                       uint64_t                  tsc,
+                                       module_handle&            module,
+                                       pair<rva, rva>&           range,
+                                       pair<uint64_t, uint64_t>& tscs) const
+        {
+            bool got_it = false;
+            if (process_) {
+                got_it = process_->get_module(address, tsc, module,
+                                              range, tscs);
+                if (!got_it) {
+                    fprintf(output_stream(), "TROUBLE: AN UNMAPPED ADDRESS\n");
+                }
+            }
+
+            return got_it;
         }
 
 } // namespace sat
@@ -23,16 +23,34 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <utility>
 
 namespace sat {
 
     using namespace std;
 
+    // An executable mapped at a load address. Handles are assigned
+    // when a mapping is first seen in the sideband, in order, and are the
+    // same for all threads; use them to index per-module state.
+    typedef uint32_t module_handle;
+
+    class sideband_state;
+    class process;
+
+    // The model of a sideband file. It is built once and then shared by
+    // all the threads that model tasks; each of them resolves addresses
+    // through a sideband_view of its own.
     class sideband_model
     {
     public:
+        sideband_model();
+        ~sideband_model();
         void set_host_filesystem(shared_ptr<path_mapper> filesystem);
         bool build(const string& sideband_path);
+        // follow a sideband file that is still being written: parse the
+        // whole messages appended since the previous call and extend the
+        // model with them; returns true if there were any
+        bool update(const string& sideband_path);
         void iterate_schedulings(
                  unsigned cpu,
                  function<void(uint64_t /* tsc */,
@@ -46,21 +64,32 @@ namespace sat {
         uint64_t initial_tsc() const;
         string   process(pid_t pid) const;
         bool     get_thread_name(pid_t thread_id, string& name) const;
+        bool     get_tid_info(tid_t     tid,
+                              pid_t&    pid,
+                              pid_t&    thread_id,
+                              unsigned& cpu) const;
         bool     get_target_path(tid_t    tid,
                                  rva      address,
                                  uint64_t tsc,
                                  string&  path,
                                  rva&     start) const;
-        bool     set_tid_for_target_path_resolution(tid_t tid);
-        bool     get_target_path(rva      address,
-                                 uint64_t tsc,
-                                 string&  path,
-                                 rva&     start) const;
-        using callback_func = function<bool /*stop*/(const string& /*path*/,
-                                                     rva           /*start*/)>;
-        void     iterate_target_paths(tid_t         tid,
-                                      uint64_t      tsc,
-                                      callback_func callback);
+        void     get_module_path(module_handle module,
+                                 string&       path,
+                                 rva&          start) const;
+        using callback_func = function<bool /*stop*/(module_handle /*module*/)>;
+        void     iterate_modules(tid_t         tid,
+                                 uint64_t      tsc,
+                                 callback_func callback);
+        // the address of the global function name in the first module
+        // mapped in the address space of tid by tsc that has one
+        bool     find_export(tid_t         tid,
+                             uint64_t      tsc,
+                             const string& name,
+                             rva&          address) const;
+        // the target paths of all executables and kernel modules
+        // mapped in the sideband
+        void iterate_executables(
+                 function<void(const string& /*target_path*/)> callback) const;
         void adjust_for_hooks(rva& pc) const;
         rva scheduler_tip() const;
         bool get_schedule_id(uint64_t address, uint8_t& schedule_id) const;
@@ -70,6 +99,11 @@ namespace sat {
         uint8_t mtc_freq() const;
 
     private:
+        friend class sideband_view;
+
+        unique_ptr<sideband_state>         state_;
+        uint64_t                           followed_bytes_;
+        shared_ptr<sideband_parser_output> follower_;
 #if 0
         shared_ptr<const executable> exe(unsigned           cr3,
                                          rva                address,
@@ -77,6 +111,35 @@ namespace sat {
 #endif
     };
 
+    // The process of the task that a thread is modelling, in a shared
+    // sideband model. Cheap to copy; keep one per thread.
+    class sideband_view
+    {
+    public:
+        explicit sideband_view(shared_ptr<const sideband_model> model);
+        bool     set_tid(tid_t tid);
+        bool     get_target_path(rva      address,
+                                 uint64_t tsc,
+                                 string&  path,
+                                 rva&     start) const;
+        // like get_target_path(), but return the handle of the module
+        bool     get_module(rva            address,
+                            uint64_t       tsc,
+                            module_handle& module) const;
+        // also return the range of addresses around address and the
+        // span of time in which the same module is mapped there:
+        // tscs.first < tsc <= tscs.second
+        bool     get_module(rva                       address,
+                            uint64_t                  tsc,
+                            module_handle&            module,
+                            pair<rva, rva>&           range,
+                            pair<uint64_t, uint64_t>& tscs) const;
+
+    private:
+        shared_ptr<const sideband_model> model_;
+        shared_ptr<const process>        process_;
+    };
+
 }
 
 #endif
@@ -75,6 +75,7 @@ bool symbol_table_file::insert(const std::string& symbol, unsigned& id)
 
     id = 0;
 
+    lock_guard<mutex> lock(mutex_);
     if ((fd = fileno(file_)) != -1) {
         if (flock(fd, LOCK_EX) != -1) {
 
@@ -18,6 +18,7 @@
 
 #include <string>
 #include <map>
+#include <mutex>
 
 namespace sat {
 
@@ -33,6 +34,7 @@ public:
     bool insert(const string& symbol, unsigned& id);
 
 protected:
+    mutex                 mutex_; // for table_
     map<string, unsigned> table_;
 
 private:
@@ -55,12 +57,20 @@ public:
     bool get_new_id(const string& symbol, unsigned& id)
     {
         bool is_new;
+        bool found;
 
-        auto i = table_.find(symbol);
-        if (i != table_.end()) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            auto i = table_.find(symbol);
+            found = i != table_.end();
+            if (found) {
+                id = i->second;
+            }
+        }
+
+        if (found) {
             // symbol found
             is_new = false;
-            id = i->second;
         } else {
             // symbol not found; add it
             is_new = insert(symbol, id);
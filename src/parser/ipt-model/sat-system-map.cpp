@@ -15,6 +15,7 @@
 */
 #include "sat-system-map.h"
 #include "sat-file-input.h"
+#include <algorithm>
 #include <cstring>
 #include <cinttypes>
 
@@ -58,13 +59,27 @@ namespace sat {
     bool system_map::get_function(rva       address,
                                   string&   function,
                                   unsigned& offset) const
+    {
+        const string* f;
+        bool          got_it = get_function(address, f, offset);
+
+        if (got_it) {
+            function = *f;
+        }
+
+        return got_it;
+    }
+
+    bool system_map::get_function(rva            address,
+                                  const string*& function,
+                                  unsigned&      offset) const
     {
         bool got_it = false;
 
         if (begin_ <= address && address < end_) {
             auto i = functions_.upper_bound(address);
             if (i != functions_.begin()) {
-                function = (--i)->second;
+                function = &(--i)->second;
                 if (i->first == address) {
                     offset = 0;
                     //function += " #"; // indicate the beginning of the function
@@ -78,6 +93,19 @@ namespace sat {
         return got_it;
     }
 
+    bool system_map::get_range(rva& begin, rva& end) const
+    {
+        bool got_it = false;
+
+        if (!functions_.empty()) {
+            begin  = max(begin_, functions_.begin()->first);
+            end    = end_;
+            got_it = begin < end;
+        }
+
+        return got_it;
+    }
+
     bool system_map::get_address(const string& function, rva& address, unsigned& size) const
     {
         bool got_it = false;
@@ -32,6 +32,13 @@ namespace sat {
         bool read(const string& path);
 
         bool get_function(rva address, string& function, unsigned& offset) const;
+        // like get_function() above, but point to the name instead of
+        // copying it; the name stays valid as long as the map
+        bool get_function(rva            address,
+                          const string*& function,
+                          unsigned&      offset) const;
+        // the range of addresses that get_function() finds functions for
+        bool get_range(rva& begin, rva& end) const;
         bool get_address(const string& function, rva& address) const;
         bool get_address(const string& function, rva& address, unsigned& size) const;
 
@@ -23,19 +23,9 @@ namespace sat {
 
 using namespace std;
 
-typedef pair<pid_t /* thread id */, unsigned /* cpu */> unique_tid;
-
 namespace {
 
-bool adding = true;
-
-typedef map<unique_tid, pid_t> pid_map;
-pid_map pids;
-
-typedef map<unique_tid, tid_t> tid_map;
-tid_map tids;
-
-unique_tid make_unique(pid_t thread_id, unsigned cpu)
+pair<pid_t, unsigned> make_unique(pid_t thread_id, unsigned cpu)
 {
     // only use the cpu # for thread 0
     if (thread_id != 0) {
@@ -44,37 +34,57 @@ unique_tid make_unique(pid_t thread_id, unsigned cpu)
     return make_pair(thread_id, cpu);
 }
 
-void assign_tids()
+}
+
+tid_table::tid_table() : numbered_(true), following_(false) {}
+
+void tid_table::add(pid_t pid, pid_t thread_id, unsigned cpu)
 {
-    SAT_LOG(1, "assigning tids\n");
-    tid_t tid_count = 0;
-    for (auto& p : pids) {
-        SAT_LOG(1, "%d => %u\n", p.first.first, tid_count);
-        tids[p.first] = tid_count++;
+    auto t = make_unique(thread_id, cpu);
+
+    pids_[t] = pid;
+    if (tids_.find(t) == tids_.end()) {
+        if (following_) {
+            // number the new thread after the ones already numbered, so
+            // that their numbers stay the same when more sideband gets
+            // appended
+            tid_t tid = tids_.size();
+            SAT_LOG(1, "%d => %u\n", thread_id, tid);
+            tids_.insert({t, tid});
+            threads_.push_back(t);
+        } else {
+            tids_.insert({t, 0});
+            numbered_ = false;
+        }
     }
 }
 
+void tid_table::number()
+{
+    if (!numbered_) {
+        SAT_LOG(1, "assigning tids\n");
+        threads_.clear();
+        for (auto& t : tids_) {
+            t.second = threads_.size();
+            SAT_LOG(1, "%d => %u\n", t.first.first, t.second);
+            threads_.push_back(t.first);
+        }
+        numbered_ = true;
+    }
 }
 
-void tid_add(pid_t pid, pid_t thread_id, unsigned cpu)
+void tid_table::follow()
 {
-    if (adding) {
-        pids[make_unique(thread_id, cpu)] = pid;
-    } else {
-        fprintf(stderr, "WARNING: ADDING A THREAD AFTER ASSIGNING IDS\n");
-    }
+    number();
+    following_ = true;
 }
 
-bool tid_get(pid_t thread_id, unsigned cpu, tid_t& tid)
+bool tid_table::get(pid_t thread_id, unsigned cpu, tid_t& tid) const
 {
     bool found = false;
 
-    if (adding) {
-        assign_tids();
-        adding = false;
-    }
-    auto t = tids.find(make_unique(thread_id, cpu));
-    if (t != tids.end()) {
+    auto t = tids_.find(make_unique(thread_id, cpu));
+    if (t != tids_.end()) {
         tid = t->second;
         found = true;
     }
@@ -82,12 +92,12 @@ bool tid_get(pid_t thread_id, unsigned cpu, tid_t& tid)
     return found;
 }
 
-bool tid_get_pid(pid_t thread_id, unsigned cpu, pid_t& pid)
+bool tid_table::get_pid(pid_t thread_id, unsigned cpu, pid_t& pid) const
 {
     bool found;
 
-    auto i = pids.find(make_unique(thread_id, cpu));
-    if (i == pids.end()) {
+    auto i = pids_.find(make_unique(thread_id, cpu));
+    if (i == pids_.end()) {
         SAT_LOG(0, "COULD NOT FIND PID FOR THREAD_ID %d\n", thread_id);
         found = false;
     } else {
@@ -99,20 +109,19 @@ bool tid_get_pid(pid_t thread_id, unsigned cpu, pid_t& pid)
     return found;
 }
 
-static tid_map::const_iterator tid_find(tid_t tid)
+tid_table::tid_map::const_iterator tid_table::find(tid_t tid) const
 {
-    return find_if(tids.begin(), tids.end(), [tid](tid_map::const_reference t) {
-                                                 return t.second == tid;
-                                             });
+    // the tids are dense, so the threads can be indexed by them
+    return tid < threads_.size() ? tids_.find(threads_[tid]) : tids_.end();
 }
 
-bool tid_get_pid(tid_t tid, pid_t& pid)
+bool tid_table::get_pid(tid_t tid, pid_t& pid) const
 {
     bool found = false;
 
-    const auto& t = tid_find(tid);
-    if (t != tids.end()) {
-        pid =  pids[t->first];
+    const auto& t = find(tid);
+    if (t != tids_.end()) {
+        pid =  pids_.at(t->first);
         found = true;
         SAT_LOG(1, "MAPPED TID %u -> PID %d\n", tid, pid);
     } else {
@@ -122,12 +131,12 @@ bool tid_get_pid(tid_t tid, pid_t& pid)
     return found;
 }
 
-bool tid_get_thread_id(tid_t tid, pid_t& thread_id)
+bool tid_table::get_thread_id(tid_t tid, pid_t& thread_id) const
 {
     bool found = false;
 
-    const auto& t = tid_find(tid);
-    if (t != tids.end()) {
+    const auto& t = find(tid);
+    if (t != tids_.end()) {
         thread_id = t->first.first;
         found = true;
         SAT_LOG(0, "MAPPED TID %d -> THREAD_ID %d\n", tid, thread_id);
@@ -138,12 +147,15 @@ bool tid_get_thread_id(tid_t tid, pid_t& thread_id)
     return found;
 }
 
-bool tid_get_info(tid_t tid, pid_t& pid, pid_t& thread_id, unsigned& cpu)
+bool tid_table::get_info(tid_t     tid,
+                         pid_t&    pid,
+                         pid_t&    thread_id,
+                         unsigned& cpu) const
 {
     bool found = false;
-    const auto& t = tid_find(tid);
-    if (t != tids.end()) {
-        pid = pids[t->first];
+    const auto& t = find(tid);
+    if (t != tids_.end()) {
+        pid = pids_.at(t->first);
         thread_id = t->first.first;
         cpu = t->first.second;
         found = true;
@@ -154,27 +166,27 @@ bool tid_get_info(tid_t tid, pid_t& pid, pid_t& thread_id, unsigned& cpu)
     return found;
 }
 
-//                                  tid,   pid,   thread_id, cpu
-void tid_iterate(std::function<bool(tid_t, pid_t, pid_t,     unsigned)> callback)
+//                                         tid,   pid,   thread_id, cpu
+void tid_table::iterate(std::function<bool(tid_t, pid_t, pid_t,     unsigned)> callback) const
 {
-    for (auto& t : tids) {
-        //            tid,      pid,           thread_id,     cpu
-        if (!callback(t.second, pids[t.first], t.first.first, t.first.second)) {
+    for (auto& t : tids_) {
+        //            tid,      pid,                thread_id,     cpu
+        if (!callback(t.second, pids_.at(t.first), t.first.first, t.first.second)) {
             break;
         }
     }
 }
 
 
-pid_t tid_get_first_free_pid()
+pid_t tid_table::get_first_free_pid() const
 {
     pid_t i;
     bool found = false;
 
     for (i=1; i<0x7FFFFFF0; i++) {
         found = false;
-        auto it = pids.begin();
-        for (; it != pids.end(); it++) {
+        auto it = pids_.begin();
+        for (; it != pids_.end(); it++) {
             //printf("tid_get_first_free_pid(): %d (%d)\n", it->second, i);
             if (it->second == i) {
                 found = true;
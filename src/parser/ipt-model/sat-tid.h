@@ -18,6 +18,9 @@
 
 #include <unistd.h>
 #include <functional>
+#include <map>
+#include <vector>
+#include <utility>
 
 // tid_t - a type for uniquely identifying a thread
 //
@@ -31,16 +34,40 @@ namespace sat {
 
 typedef unsigned tid_t;
 
-void tid_add(pid_t pid, pid_t thread_id, unsigned cpu);
-bool tid_get(pid_t thread_id, unsigned cpu, tid_t& tid);
-bool tid_get_pid(pid_t thread_id, unsigned cpu, pid_t& pid);
-bool tid_get_pid(tid_t tid, pid_t& pid);
-bool tid_get_thread_id(tid_t tid, pid_t& thread_id);
-bool tid_get_info(tid_t tid, pid_t& pid, pid_t& thread_id, unsigned& cpu);
-pid_t tid_get_first_free_pid();
+// The tids of the threads of one sideband. The threads are numbered in
+// the order of their thread ids by number(), which must be called after
+// adding them and before looking them up. Once following, threads that
+// get added are numbered after the ones that are there already.
+class tid_table {
+public:
+    tid_table();
 
-//                                  tid,   pid,   thread_id, cpu
-void tid_iterate(std::function<bool(tid_t, pid_t, pid_t,     unsigned)> callback);
+    void add(pid_t pid, pid_t thread_id, unsigned cpu);
+    void number();
+    void follow();
+    bool get(pid_t thread_id, unsigned cpu, tid_t& tid) const;
+    bool get_pid(pid_t thread_id, unsigned cpu, pid_t& pid) const;
+    bool get_pid(tid_t tid, pid_t& pid) const;
+    bool get_thread_id(tid_t tid, pid_t& thread_id) const;
+    bool get_info(tid_t tid, pid_t& pid, pid_t& thread_id, unsigned& cpu) const;
+    pid_t get_first_free_pid() const;
+
+    //                               tid,   pid,   thread_id, cpu
+    void iterate(std::function<bool(tid_t, pid_t, pid_t,     unsigned)> callback) const;
+
+private:
+    typedef std::pair<pid_t /* thread id */, unsigned /* cpu */> unique_tid;
+    typedef std::map<unique_tid, pid_t> pid_map;
+    typedef std::map<unique_tid, tid_t> tid_map;
+
+    tid_map::const_iterator find(tid_t tid) const;
+
+    pid_map pids_;
+    tid_map tids_;
+    std::vector<unique_tid> threads_; // by tid
+    bool                    numbered_;
+    bool                    following_;
+}; // tid_table
 
 }
 
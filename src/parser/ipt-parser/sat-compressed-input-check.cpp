@@ -0,0 +1,230 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Compress a synthetic trace into small frames, with PSBs placed across
+// and next to the frame boundaries, and check that reading it back from
+// the container gives the same bytes: sequentially, after skipping to
+// each PSB, after seeking back and forth between frames, and in blocks
+// read like the model reads them. Then replace the traces, and check
+// that opening them again does not read the old mappings.
+#include "sat-compressed-input.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <unistd.h>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+const uint32_t frame_size  = 4096;
+const unsigned frame_count = 40;
+
+// a trace of random bytes without PSBs but at the given offsets
+vector<uint8_t> make_trace(const vector<ipt_offset>& psbs, mt19937& random)
+{
+    vector<uint8_t> trace(frame_size * frame_count - 123);
+    for (auto& b : trace) {
+        b = random();
+        if (b == ipt_psb[0]) {
+            ++b;
+        }
+    }
+    for (auto p : psbs) {
+        memcpy(&trace[p], ipt_psb, ipt_psb_size);
+    }
+    return trace;
+}
+
+bool write_file(const string& path, const vector<uint8_t>& data)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
+
+// the first byte of a trace through the input that picks its kind
+bool first_byte(const string& path, uint8_t& c)
+{
+    input_from_trace_file_block block;
+    return block.open(path, 0, 1, 0) && block.get_next(c);
+}
+
+// read count bytes at the current position one by one and in one go,
+// and compare them with the trace
+bool same_bytes(input_from_compressed_file& input,
+                const vector<uint8_t>&      trace,
+                ipt_offset                  at,
+                size_t                      count)
+{
+    bool ok = input.position() == at;
+
+    count = min<size_t>(count, trace.size() - at);
+    for (size_t i = 0; ok && i < count; ++i) {
+        uint8_t c;
+        ok = input.get_next(c) && c == trace[at + i];
+    }
+
+    vector<uint8_t> buffer(count);
+    ok = ok && input.seek(at) &&
+         input.get_next(count, buffer.data()) &&
+         memcmp(buffer.data(), &trace[at], count) == 0;
+
+    return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    mt19937 random(1);
+
+    // a PSB at every possible offset across a boundary, one at the very
+    // beginning of a frame and two within frames, two frames apart
+    vector<ipt_offset> psbs;
+    for (unsigned k = 1; k < ipt_psb_size; ++k) {
+        psbs.push_back((2 * k + 1) * frame_size - k);
+    }
+    psbs.push_back(2 * ipt_psb_size * frame_size);
+    psbs.push_back(2 * ipt_psb_size * frame_size + 2 * frame_size + 1000);
+    psbs.push_back(2 * ipt_psb_size * frame_size + 4 * frame_size + 77);
+
+    auto trace = make_trace(psbs, random);
+
+    char directory[] = "/tmp/sat-compressed-input-check.XXXXXX";
+    if (!mkdtemp(directory)) {
+        fprintf(stderr, "cannot make a temporary directory\n");
+        exit(EXIT_FAILURE);
+    }
+    string raw_path        = string(directory) + "/cpu0.bin";
+    string compressed_path = string(directory) + "/cpu0.binz";
+    if (!write_file(raw_path, trace) ||
+        !compress_ipt_trace(raw_path, compressed_path, frame_size, 1))
+    {
+        fprintf(stderr, "cannot write the traces in '%s'\n", directory);
+        exit(EXIT_FAILURE);
+    }
+
+    bool                       ok = true;
+    input_from_compressed_file input;
+    if (!input.open(compressed_path) || input.size() != trace.size()) {
+        fprintf(stderr, "cannot open '%s'\n", compressed_path.c_str());
+        ok = false;
+    }
+
+    // the whole trace in one go
+    if (ok) {
+        ok = same_bytes(input, trace, 0, trace.size());
+        printf("sequential read: %s\n", ok ? "ok" : "FAILED");
+    }
+
+    // from a little before each PSB to it, and the bytes that follow it
+    unsigned found = 0;
+    for (auto p : psbs) {
+        for (ipt_offset back : {1, 100, (int)frame_size + 5}) {
+            ipt_offset from = p - back;
+            ipt_offset skipped;
+            bool good = input.seek(from);
+            input.mark_beginning_of_packet();
+            good = good && input.skip_to_psb(skipped) &&
+                   input.position() == p && skipped == back &&
+                   same_bytes(input, trace, input.position(), 2 * ipt_psb_size);
+            if (good) {
+                ++found;
+            } else {
+                fprintf(stderr, "PSB at %#" PRIx64 " not found from %#" PRIx64 "\n",
+                        p, from);
+                ok = false;
+            }
+        }
+    }
+    printf("skips to PSBs: %u of %u %s\n",
+           found, (unsigned)psbs.size() * 3, ok ? "ok" : "FAILED");
+
+    // random seeks back and forth, across and within frames
+    unsigned seeks = 0;
+    for (; ok && seeks < 10000; ++seeks) {
+        ipt_offset at = random() % trace.size();
+        ok = input.seek(at) && same_bytes(input, trace, at, random() % 64 + 1);
+        if (!ok) {
+            fprintf(stderr, "wrong bytes after seeking to %#" PRIx64 "\n", at);
+        }
+    }
+    printf("random seeks: %u %s\n", seeks, ok ? "ok" : "FAILED");
+
+    // the same blocks through the input that picks the kind of the file
+    unsigned blocks = 0;
+    for (; ok && blocks < 100; ++blocks) {
+        ipt_offset reset = random() % trace.size();
+        ipt_offset begin = reset + random() % (trace.size() - reset);
+        ipt_offset end   = begin + random() % (trace.size() - begin + 1);
+        for (auto& path : {raw_path, compressed_path}) {
+            input_from_trace_file_block block;
+            ok = ok && block.open(path, begin, end, reset) &&
+                 block.position() == reset && block.is_fast_forwarding() == (reset < begin);
+            vector<uint8_t> bytes;
+            uint8_t         c;
+            while (ok && block.get_next(c)) {
+                bytes.push_back(c);
+            }
+            ok = ok && bytes.size() == end - reset &&
+                 memcmp(bytes.data(), &trace[reset], bytes.size()) == 0;
+            if (!ok) {
+                fprintf(stderr, "wrong block [%#" PRIx64 ", %#" PRIx64 ") of '%s'\n",
+                        reset, end, path.c_str());
+            }
+        }
+    }
+    printf("blocks of both kinds: %u %s\n", blocks, ok ? "ok" : "FAILED");
+
+    // replace both traces with one that starts with another byte by
+    // renaming over them, then rewrite the raw one in place to what it
+    // was; the size stays the same, and the mtime the same second
+    if (ok) {
+        uint8_t c[2];
+        ok = first_byte(raw_path, c[0]) && first_byte(compressed_path, c[1]) &&
+             c[0] == trace[0] && c[1] == trace[0];
+
+        auto changed = trace;
+        ++changed[0];
+        string temp = string(directory) + "/new";
+        ok = ok && write_file(temp, changed) &&
+             compress_ipt_trace(temp, temp + "z", frame_size, 1) &&
+             rename(temp.c_str(), raw_path.c_str()) == 0 &&
+             rename((temp + "z").c_str(), compressed_path.c_str()) == 0 &&
+             first_byte(raw_path, c[0]) && first_byte(compressed_path, c[1]) &&
+             c[0] == changed[0] && c[1] == changed[0];
+
+        // past the granularity of file timestamps
+        usleep(50000);
+        FILE* f = ok ? fopen(raw_path.c_str(), "r+") : nullptr;
+        ok = f && fwrite(&trace[0], 1, 1, f) == 1;
+        ok = f && fclose(f) == 0 && ok &&
+             first_byte(raw_path, c[0]) && c[0] == trace[0];
+
+        printf("replaced traces: %s\n", ok ? "ok" : "FAILED");
+    }
+
+    (void)unlink(raw_path.c_str());
+    (void)unlink(compressed_path.c_str());
+    (void)rmdir(directory);
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,616 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_COMPRESSED_INPUT_H
+#define SAT_COMPRESSED_INPUT_H
+
+#include "sat-ipt.h"
+#include "sat-ipt-psb.h"
+#include "sat-input.h"
+#include <string>
+#include <memory>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace sat {
+
+using namespace std;
+
+// A compressed IPT trace is cut into frames of frame_size bytes that
+// are deflated independently, so that reading from any offset only
+// needs the frames that cover it:
+//
+//   header | frame 0 | frame 1 | ... | frame N-1 | frame index
+//
+// The header is written last and points at the frame index, which has
+// one entry per frame. Frame i holds trace bytes
+// [i * frame_size, min((i + 1) * frame_size, size)).
+const char     ipt_compressed_magic[8]  = {'S', 'A', 'T', 'I', 'P', 'T', 'Z', 0};
+const uint32_t ipt_compressed_version   = 1;
+const uint32_t ipt_compressed_frame_size = 256 * 1024;
+
+struct ipt_compressed_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t frame_size;
+    uint64_t size;        // size of the uncompressed trace
+    uint64_t frame_count;
+    uint64_t index_offset;
+}; // ipt_compressed_header
+
+struct ipt_compressed_frame {
+    uint64_t offset;      // file offset of the deflated frame
+    uint32_t compressed_size;
+    uint32_t reserved;
+}; // ipt_compressed_frame
+
+// write the trace at from into a compressed container at to
+inline bool compress_ipt_trace(const string& from,
+                               const string& to,
+                               uint32_t      frame_size,
+                               int           level)
+{
+    FILE* in = fopen(from.c_str(), "r");
+    if (!in) {
+        fprintf(stderr, "cannot open '%s' for reading\n", from.c_str());
+        return false;
+    }
+    FILE* out = fopen(to.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "cannot open '%s' for writing\n", to.c_str());
+        fclose(in);
+        return false;
+    }
+
+    ipt_compressed_header header{};
+    memcpy(header.magic, ipt_compressed_magic, sizeof(header.magic));
+    header.version    = ipt_compressed_version;
+    header.frame_size = frame_size;
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    vector<ipt_compressed_frame> index;
+    vector<uint8_t>              frame(frame_size);
+    vector<uint8_t>              deflated(compressBound(frame_size));
+    uint64_t                     offset = sizeof(header);
+    size_t                       n;
+
+    while (ok && (n = fread(frame.data(), 1, frame_size, in)) > 0) {
+        uLongf size = deflated.size();
+        if (compress2(deflated.data(), &size, frame.data(), n, level) != Z_OK) {
+            fprintf(stderr, "cannot compress '%s'\n", from.c_str());
+            ok = false;
+            break;
+        }
+        ok = fwrite(deflated.data(), 1, size, out) == size;
+        index.push_back({offset, (uint32_t)size, 0});
+        offset      += size;
+        header.size += n;
+    }
+    ok = ok && !ferror(in);
+
+    header.frame_count  = index.size();
+    header.index_offset = offset;
+    ok = ok &&
+         fwrite(index.data(), sizeof(index[0]), index.size(), out) == index.size() &&
+         fseek(out, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, out) == 1;
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "error writing '%s'\n", to.c_str());
+        (void)unlink(to.c_str());
+    }
+
+    return ok;
+}
+
+// A read-only mapping of a compressed trace, plus the frames that have
+// recently been inflated out of it. Like mapped_input_file, these are
+// shared between all inputs reading the same path.
+class compressed_input_file
+{
+public:
+    using frame = vector<uint8_t>;
+
+    static bool is_compressed(const string& path)
+    {
+        bool  compressed = false;
+        FILE* f          = fopen(path.c_str(), "r");
+        if (f) {
+            char magic[sizeof(ipt_compressed_magic)];
+            compressed = fread(magic, sizeof(magic), 1, f) == 1 &&
+                         memcmp(magic,
+                                ipt_compressed_magic,
+                                sizeof(magic)) == 0;
+            fclose(f);
+        }
+        return compressed;
+    }
+
+    static shared_ptr<compressed_input_file> obtain(const string& path)
+    {
+        static mutex                                               cache_mutex;
+        static map<string, shared_ptr<compressed_input_file>> cache;
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return nullptr;
+        }
+
+        lock_guard<mutex> lock(cache_mutex);
+        auto& file = cache[path];
+        if (!file || file->identity_ != file_identity(st)) {
+            shared_ptr<compressed_input_file> f{new compressed_input_file};
+            if (f->map_file(path)) {
+                file = f;
+            } else {
+                file = nullptr;
+            }
+        }
+
+        return file;
+    }
+
+    ~compressed_input_file()
+    {
+        if (data_) {
+            (void)munmap(const_cast<uint8_t*>(data_), mapped_size_);
+        }
+    }
+
+    ipt_offset size()        const { return header_.size; }
+    uint32_t   frame_size()  const { return header_.frame_size; }
+    uint64_t   frame_count() const { return header_.frame_count; }
+
+    // frame f of the trace, inflated
+    shared_ptr<const frame> get_frame(uint64_t f)
+    {
+        {
+            lock_guard<mutex> lock(frames_mutex_);
+            auto i = frames_.find(f);
+            if (i != frames_.end()) {
+                recent_.remove(f);
+                recent_.push_front(f);
+                return i->second;
+            }
+        }
+
+        shared_ptr<frame> inflated = inflate_frame(f);
+        if (inflated) {
+            lock_guard<mutex> lock(frames_mutex_);
+            if (frames_.insert({f, inflated}).second) {
+                recent_.push_front(f);
+                if (recent_.size() > max_cached_frames) {
+                    frames_.erase(recent_.back());
+                    recent_.pop_back();
+                }
+            }
+        }
+
+        return inflated;
+    }
+
+private:
+    static const size_t max_cached_frames = 16;
+
+    compressed_input_file() :
+        data_(), mapped_size_(), identity_(), header_(), index_()
+    {}
+
+    bool map_file(const string& path)
+    {
+        bool done = false;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(header_)) {
+                mapped_size_ = st.st_size;
+                identity_    = file_identity(st);
+                void* m = mmap(0, mapped_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (m != MAP_FAILED) {
+                    data_ = static_cast<const uint8_t*>(m);
+                    done  = read_header();
+                }
+            }
+            (void)::close(fd);
+        }
+
+        return done;
+    }
+
+    bool read_header()
+    {
+        memcpy(&header_, data_, sizeof(header_));
+        if (memcmp(header_.magic,
+                   ipt_compressed_magic,
+                   sizeof(header_.magic)) != 0          ||
+            header_.version    != ipt_compressed_version ||
+            header_.frame_size == 0                      ||
+            header_.frame_count !=
+                (header_.size + header_.frame_size - 1) / header_.frame_size ||
+            header_.index_offset > mapped_size_          ||
+            (mapped_size_ - header_.index_offset) / sizeof(ipt_compressed_frame) <
+                header_.frame_count)
+        {
+            fprintf(stderr, "not a valid compressed IPT trace\n");
+            return false;
+        }
+
+        index_ = reinterpret_cast<const ipt_compressed_frame*>(
+                     data_ + header_.index_offset);
+        for (uint64_t f = 0; f < header_.frame_count; ++f) {
+            if (index_[f].offset > mapped_size_ ||
+                index_[f].compressed_size > mapped_size_ - index_[f].offset)
+            {
+                fprintf(stderr, "compressed IPT frame %" PRIu64 " is truncated\n", f);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    shared_ptr<frame> inflate_frame(uint64_t f)
+    {
+        if (f >= header_.frame_count) {
+            return nullptr;
+        }
+
+        uint64_t begin = f * header_.frame_size;
+        uLongf   size  = min<uint64_t>(header_.frame_size, header_.size - begin);
+
+        shared_ptr<frame> inflated = make_shared<frame>(size);
+        uLongf            got      = size;
+        if (uncompress(inflated->data(), &got,
+                       data_ + index_[f].offset,
+                       index_[f].compressed_size) != Z_OK ||
+            got != size)
+        {
+            fprintf(stderr, "cannot decompress IPT frame %" PRIu64 "\n", f);
+            return nullptr;
+        }
+
+        return inflated;
+    }
+
+    const uint8_t*              data_;
+    uint64_t                    mapped_size_;
+    file_identity               identity_; // of the file that was mapped
+    ipt_compressed_header       header_;
+    const ipt_compressed_frame* index_;
+
+    mutex                                  frames_mutex_;
+    map<uint64_t, shared_ptr<const frame>> frames_;
+    list<uint64_t>                         recent_; // most recent first
+}; // compressed_input_file
+
+// Reads the trace out of a compressed container, inflating one frame
+// at a time; get_next() is a bounds check and a copy out of the
+// current frame, like in input_from_mapped_file.
+class input_from_compressed_file
+{
+public:
+    input_from_compressed_file() :
+        data_(), window_begin_(), window_end_(),
+        start_position_(), current_(), end_(), beginning_of_packet_()
+    {}
+
+    bool open(const string& path)
+    {
+        close();
+        file_ = compressed_input_file::obtain(path);
+        if (file_) {
+            end_ = file_->size();
+        }
+        return file_ != nullptr;
+    }
+
+    void close()
+    {
+        file_.reset();
+        frame_.reset();
+        data_ = 0;
+        window_begin_ = window_end_ = 0;
+        start_position_ = current_ = end_ = beginning_of_packet_ = 0;
+    }
+
+    bool seek(ipt_offset position)
+    {
+        if (file_ && position <= file_->size()) {
+            start_position_ = current_ = position;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool get_next(uint8_t& c)
+    {
+        if (in_window(current_) || load(current_)) {
+            c = data_[current_++ - window_begin_];
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool get_next(size_t n, uint8_t c[])
+    {
+        if (n > end_ - current_) {
+            return false;
+        }
+
+        while (n) {
+            if (!in_window(current_) && !load(current_)) {
+                return false;
+            }
+            size_t chunk = min<ipt_offset>(n, window_end_ - current_);
+            memcpy(c, data_ + (current_ - window_begin_), chunk);
+            current_ += chunk;
+            c        += chunk;
+            n        -= chunk;
+        }
+
+        return true;
+    }
+
+    bool is_fast_forwarding() { return true; }
+
+    bool bad() { return !file_; }
+
+    // move to the next PSB after the beginning of the current packet,
+    // or to the end of input if there is none; a PSB may straddle two
+    // frames, so the seams are searched separately
+    bool skip_to_psb(ipt_offset& skipped)
+    {
+        ipt_offset from = beginning_of_packet_ + 1;
+
+        current_ = end_;
+        while (from < end_ && load(from)) {
+            const uint8_t* begin = data_ + (from - window_begin_);
+            const uint8_t* end   = data_ + (window_end_ - window_begin_);
+            const uint8_t* psb   = find_psb(begin, end);
+            if (psb != end) {
+                current_ = window_begin_ + (psb - data_);
+                break;
+            }
+
+            // look at the last bytes of this frame with the first
+            // bytes of the next one
+            ipt_offset seam = window_end_ - min<ipt_offset>(window_end_ - from,
+                                                            ipt_psb_size - 1);
+            if (window_end_ < end_) {
+                uint8_t    joined[2 * ipt_psb_size];
+                size_t     n     = min<ipt_offset>(end_ - seam, sizeof(joined));
+                ipt_offset next  = window_end_;
+                current_ = seam;
+                if (!get_next(n, joined)) {
+                    current_ = end_;
+                    break;
+                }
+                const uint8_t* p = find_psb(joined, joined + n);
+                if (p != joined + n) {
+                    current_ = seam + (p - joined);
+                    break;
+                }
+                current_ = end_;
+                from     = next;
+            } else {
+                break;
+            }
+        }
+        skipped = current_ - beginning_of_packet_;
+
+        return true;
+    }
+
+    void mark_beginning_of_packet() { beginning_of_packet_ = current_; }
+
+    size_t beginning_of_packet() const { return beginning_of_packet_; }
+    size_t absolute_beginning_of_packet() const { return beginning_of_packet_; }
+
+    size_t index() const { return current_ - start_position_; }
+
+    ipt_offset size() const { return file_ ? file_->size() : 0; }
+    ipt_offset position() const { return current_; }
+
+protected:
+    // the current frame holds position; seeking and looking for PSBs
+    // across frames can leave position on either side of it
+    bool in_window(ipt_offset position) const
+    {
+        return window_begin_ <= position && position < window_end_;
+    }
+
+    // make the frame holding position current
+    bool load(ipt_offset position)
+    {
+        if (!file_ || position >= end_) {
+            return false;
+        }
+
+        uint64_t f   = position / file_->frame_size();
+        auto     got = file_->get_frame(f);
+        if (!got) {
+            return false;
+        }
+
+        frame_        = got;
+        data_         = frame_->data();
+        window_begin_ = f * file_->frame_size();
+        window_end_   = min<ipt_offset>(window_begin_ + frame_->size(), end_);
+
+        return true;
+    }
+
+    shared_ptr<compressed_input_file>                file_;
+    shared_ptr<const compressed_input_file::frame> frame_;
+    const uint8_t*                                 data_;
+    ipt_offset                                     window_begin_;
+    ipt_offset                                     window_end_;
+    ipt_offset                                     start_position_;
+    ipt_offset                                     current_;
+    ipt_offset                                     end_;
+private:
+    ipt_offset                                     beginning_of_packet_;
+}; // input_from_compressed_file
+
+class input_from_compressed_file_block : public input_from_compressed_file
+{
+public:
+    input_from_compressed_file_block() : start_() {}
+
+    // only the frames from the one holding reset_point up to the one
+    // holding end are inflated
+    bool open(const string& path, ipt_offset begin, ipt_offset end, ipt_offset reset_point)
+    {
+        bool done = false;
+
+        if (input_from_compressed_file::open(path)) {
+            if (end >= begin && begin >= reset_point &&
+                input_from_compressed_file::seek(reset_point))
+            {
+                start_ = begin;
+                if (end < end_) {
+                    end_ = end;
+                }
+                done = true;
+            }
+        }
+
+        return done;
+    }
+
+    bool is_fast_forwarding()
+    {
+        return current_ < start_;
+    }
+
+private:
+    bool open(const string& path);
+
+    ipt_offset start_;
+}; // input_from_compressed_file_block
+
+// Reads a block of either a raw or a compressed trace, whichever the
+// file at path turns out to be, for tools that take their traces from
+// a collection and cannot be instantiated for both kinds of input.
+// Every read goes through one well-predicted branch on the kind.
+class input_from_trace_file_block
+{
+public:
+    input_from_trace_file_block() : compressed_() {}
+
+    bool open(const string& path, ipt_offset begin, ipt_offset end, ipt_offset reset_point)
+    {
+        compressed_ = compressed_input_file::is_compressed(path);
+        if (compressed_) {
+            mapped_.close();
+            return compressed_input_.open(path, begin, end, reset_point);
+        } else {
+            compressed_input_.close();
+            return mapped_.open(path, begin, end, reset_point);
+        }
+    }
+
+    bool get_next(uint8_t& c)
+    {
+        return compressed_ ? compressed_input_.get_next(c) : mapped_.get_next(c);
+    }
+
+    bool get_next(size_t n, uint8_t c[])
+    {
+        return compressed_ ? compressed_input_.get_next(n, c)
+                           : mapped_.get_next(n, c);
+    }
+
+    bool is_fast_forwarding()
+    {
+        return compressed_ ? compressed_input_.is_fast_forwarding()
+                           : mapped_.is_fast_forwarding();
+    }
+
+    bool bad()
+    {
+        return compressed_ ? compressed_input_.bad() : mapped_.bad();
+    }
+
+    bool skip_to_psb(ipt_offset& skipped)
+    {
+        return compressed_ ? compressed_input_.skip_to_psb(skipped)
+                           : mapped_.skip_to_psb(skipped);
+    }
+
+    void mark_beginning_of_packet()
+    {
+        if (compressed_) {
+            compressed_input_.mark_beginning_of_packet();
+        } else {
+            mapped_.mark_beginning_of_packet();
+        }
+    }
+
+    size_t beginning_of_packet() const
+    {
+        return compressed_ ? compressed_input_.beginning_of_packet()
+                           : mapped_.beginning_of_packet();
+    }
+
+    size_t absolute_beginning_of_packet() const
+    {
+        return compressed_ ? compressed_input_.absolute_beginning_of_packet()
+                           : mapped_.absolute_beginning_of_packet();
+    }
+
+    size_t index() const
+    {
+        return compressed_ ? compressed_input_.index() : mapped_.index();
+    }
+
+    ipt_offset size() const
+    {
+        return compressed_ ? compressed_input_.size() : mapped_.size();
+    }
+
+    ipt_offset position() const
+    {
+        return compressed_ ? compressed_input_.position() : mapped_.position();
+    }
+
+private:
+    bool                             compressed_;
+    input_from_mapped_file_block     mapped_;
+    input_from_compressed_file_block compressed_input_;
+}; // input_from_trace_file_block
+
+} // sat
+
+#endif // SAT_COMPRESSED_INPUT_H
@@ -17,9 +17,18 @@
 #define SAT_INPUT_H
 
 #include "sat-ipt.h"
+#include "sat-ipt-psb.h"
 #include <string>
+#include <memory>
+#include <map>
+#include <mutex>
 #include <cstdio>
+#include <cstring>
 #include <cinttypes>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace sat {
 
@@ -29,7 +38,9 @@ using namespace sat;
 class input_from_stdin
 {
 public:
-    input_from_stdin() : file_(stdin), index_(), beginning_of_packet_() {}
+    input_from_stdin() :
+        file_(stdin), start_position_(), index_(), beginning_of_packet_()
+    {}
 
     bool get_next(uint8_t& c)
     {
@@ -55,6 +66,9 @@ public:
 
     bool bad() { return ferror(file_); }
 
+    // cannot look ahead in a stream
+    bool skip_to_psb(ipt_offset& skipped) { return false; }
+
     void mark_beginning_of_packet() { beginning_of_packet_ = index_; }
 
     //size_t beginning_of_packet() const { return beginning_of_packet_; }
@@ -96,7 +110,6 @@ public:
 
     bool seek(long position)
     {
-        printf("start_position_ = %lx\n", position);
         start_position_ = position;
         index_ = 0;
         return fseek(file_, position, SEEK_SET) != -1;
@@ -119,8 +132,6 @@ public:
                 start_   = begin;
                 end_     = end;
                 done     = true;
-                // Print filename
-                printf("input_from_file::open('%s') %08lx ... %08lx - %08lx\n", basename(path).c_str(), current_, start_, end_);
             }
         }
 
@@ -164,23 +175,254 @@ public:
 
 private:
     bool open(const string& path);
-    const string basename(const string& s)
+
+    ipt_offset current_;
+    ipt_offset start_;
+    ipt_offset end_;
+}; // input_from_file_block
+
+// What tells whether a file is still the one that was mapped: a trace
+// replaced by rename() has another inode, and one rewritten in place
+// within the same second has another mtime in nanoseconds.
+struct file_identity {
+    file_identity() : dev_(), ino_(), size_(), mtime_sec_(), mtime_nsec_() {}
+
+    explicit file_identity(const struct stat& st) :
+        dev_(st.st_dev),
+        ino_(st.st_ino),
+        size_(st.st_size),
+        mtime_sec_(st.st_mtim.tv_sec),
+        mtime_nsec_(st.st_mtim.tv_nsec)
+    {}
+
+    bool operator==(const file_identity& other) const
+    {
+        return dev_        == other.dev_        &&
+               ino_        == other.ino_        &&
+               size_       == other.size_       &&
+               mtime_sec_  == other.mtime_sec_  &&
+               mtime_nsec_ == other.mtime_nsec_;
+    }
+
+    bool operator!=(const file_identity& other) const
+    {
+        return !(*this == other);
+    }
+
+    dev_t   dev_;
+    ino_t   ino_;
+    off_t   size_;
+    int64_t mtime_sec_;
+    int64_t mtime_nsec_;
+}; // file_identity
+
+// A read-only mapping of a whole trace file. Mappings are shared
+// between all inputs reading the same path, so that opening the file
+// again for every block costs a map lookup and a stat().
+class mapped_input_file
+{
+public:
+    static shared_ptr<const mapped_input_file> obtain(const string& path)
+    {
+        static mutex                                           cache_mutex;
+        static map<string, shared_ptr<const mapped_input_file>> cache;
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return nullptr;
+        }
+
+        lock_guard<mutex> lock(cache_mutex);
+        auto& mapping = cache[path];
+        if (!mapping || mapping->identity_ != file_identity(st)) {
+            shared_ptr<mapped_input_file> m{new mapped_input_file};
+            if (m->map_file(path)) {
+                mapping = m;
+            } else {
+                mapping = nullptr;
+            }
+        }
+
+        return mapping;
+    }
+
+    ~mapped_input_file()
+    {
+        if (data_) {
+            (void)munmap(const_cast<uint8_t*>(data_), size_);
+        }
+    }
+
+    const uint8_t* data() const { return data_; }
+    ipt_offset     size() const { return size_; }
+
+private:
+    mapped_input_file() : data_(), size_(), identity_() {}
+
+    bool map_file(const string& path)
     {
-        string delim = "/";
-        auto offset = s.find_last_of(delim);
-        if(offset) {
-            return s.substr(offset+1);    
+        bool done = false;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                size_     = st.st_size;
+                identity_ = file_identity(st);
+                if (size_ == 0) {
+                    done = true;
+                } else {
+                    void* m = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (m != MAP_FAILED) {
+                        data_ = static_cast<const uint8_t*>(m);
+                        done  = true;
+                    }
+                }
+            }
+            (void)::close(fd);
+        }
+
+        return done;
+    }
+
+    const uint8_t* data_;
+    ipt_offset     size_;
+    file_identity  identity_; // of the file that was mapped
+}; // mapped_input_file
+
+// Reads the trace straight out of a memory mapping of the file;
+// get_next() is a bounds check and a copy out of the mapping.
+class input_from_mapped_file
+{
+public:
+    input_from_mapped_file() :
+        data_(), start_position_(), current_(), end_(), beginning_of_packet_()
+    {}
+
+    bool open(const string& path)
+    {
+        close();
+        file_ = mapped_input_file::obtain(path);
+        if (file_) {
+            data_ = file_->data();
+            end_  = file_->size();
+        }
+        return file_ != nullptr;
+    }
+
+    void close()
+    {
+        file_.reset();
+        data_ = 0;
+        start_position_ = current_ = end_ = beginning_of_packet_ = 0;
+    }
+
+    bool seek(ipt_offset position)
+    {
+        if (file_ && position <= file_->size()) {
+            start_position_ = current_ = position;
+            return true;
         } else {
-            return s;
+            return false;
         }
-        
-        
     }
 
-    ipt_offset current_;
+    bool get_next(uint8_t& c)
+    {
+        if (current_ < end_) {
+            c = data_[current_++];
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool get_next(size_t n, uint8_t c[])
+    {
+        if (n <= end_ - current_) {
+            memcpy(c, data_ + current_, n);
+            current_ += n;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool is_fast_forwarding() { return true; }
+
+    bool bad() { return !file_; }
+
+    // move to the next PSB after the beginning of the current packet,
+    // or to the end of input if there is none
+    bool skip_to_psb(ipt_offset& skipped)
+    {
+        ipt_offset from = beginning_of_packet_ + 1;
+        if (from < end_) {
+            current_ = find_psb(data_ + from, data_ + end_) - data_;
+        } else {
+            current_ = end_;
+        }
+        skipped = current_ - beginning_of_packet_;
+
+        return true;
+    }
+
+    void mark_beginning_of_packet() { beginning_of_packet_ = current_; }
+
+    size_t beginning_of_packet() const { return beginning_of_packet_; }
+    size_t absolute_beginning_of_packet() const { return beginning_of_packet_; }
+
+    size_t index() const { return current_ - start_position_; }
+
+    // direct access to the mapped trace
+    const uint8_t* data() const { return data_; }
+    ipt_offset     size() const { return file_ ? file_->size() : 0; }
+    ipt_offset     position() const { return current_; }
+
+protected:
+    shared_ptr<const mapped_input_file> file_;
+    const uint8_t*                      data_;
+    ipt_offset                          start_position_;
+    ipt_offset                          current_;
+    ipt_offset                          end_;
+private:
+    ipt_offset                          beginning_of_packet_;
+}; // input_from_mapped_file
+
+class input_from_mapped_file_block : public input_from_mapped_file
+{
+public:
+    input_from_mapped_file_block() : start_() {}
+
+    bool open(const string& path, ipt_offset begin, ipt_offset end, ipt_offset reset_point)
+    {
+        bool done = false;
+
+        if (input_from_mapped_file::open(path)) {
+            if (end >= begin && begin >= reset_point &&
+                input_from_mapped_file::seek(reset_point))
+            {
+                start_ = begin;
+                if (end < end_) {
+                    end_ = end;
+                }
+                done = true;
+            }
+        }
+
+        return done;
+    }
+
+    bool is_fast_forwarding()
+    {
+        return current_ < start_;
+    }
+
+private:
+    bool open(const string& path);
+
     ipt_offset start_;
-    ipt_offset end_;
-}; // input_from_file_block
+}; // input_from_mapped_file_block
 
 } // sat
 
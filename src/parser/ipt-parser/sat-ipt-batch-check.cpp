@@ -0,0 +1,241 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Decode random traces, and any traces given on the command line, both
+// with the batch decoder and with ipt_parser, and check that they give
+// the same packets, payloads and errors, whatever the filter.
+#include "sat-ipt-batch.h"
+#include "sat-input.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <unistd.h>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+// records the packets that ipt_parser outputs the way the batch decoder
+// should
+template <class INPUT>
+class recording_output : public ipt_parser_output_base<recording_output<INPUT>>
+{
+public:
+    using token = ipt_parser_token<recording_output<INPUT>>;
+
+    recording_output(const INPUT& input) : got_to_eof(), input_(input) {}
+
+    void short_tnt(token& t) { add(ipt_packet_kind::SHORT_TNT, t.tnt.bits); }
+    void long_tnt (token& t) { add(ipt_packet_kind::LONG_TNT, t.tnt.bits); }
+    void tip      (token& t) { add(ipt_packet_kind::TIP, t.tip); }
+    void tip_pge  (token& t) { add(ipt_packet_kind::TIP_PGE, t.tip); }
+    void tip_pgd  (token& t) { add(ipt_packet_kind::TIP_PGD, t.tip); }
+    void fup      (token& t) { add(ipt_packet_kind::FUP, t.tip); }
+    void pip      (token& t) { add(ipt_packet_kind::PIP,
+                                   t.pip.cr3 | (t.pip.nr ? 1 : 0)); }
+    void tsc      (token& t) { add(ipt_packet_kind::TSC, t.tsc); }
+    void mtc      (token& t) { add(ipt_packet_kind::MTC, t.ctc); }
+    void mode_exec(token& t) { add(ipt_packet_kind::MODE_EXEC, t.mode); }
+    void mode_tsx (token& t) { add(ipt_packet_kind::MODE_TSX, t.tsx); }
+    void tracestop(token& t) { add(ipt_packet_kind::TRACESTOP, 0); }
+    void cbr      (token& t) { add(ipt_packet_kind::CBR, t.cbr); }
+    void tma      (token& t) { add(ipt_packet_kind::TMA,
+                                   t.tma.ctc | (uint64_t)t.tma.fast << 16); }
+    void cyc      (token& t) { add(ipt_packet_kind::CYC, 0); }
+    void vmcs     (token& t) { add(ipt_packet_kind::VMCS,
+                                   t.vmcs_base_address); }
+    void ovf      (token& t) { add(ipt_packet_kind::OVF, 0); }
+    void psb      (token& t) { add(ipt_packet_kind::PSB, 0); }
+    void psbend   (token& t) { add(ipt_packet_kind::PSBEND, 0); }
+    void mnt      (token& t) { add(ipt_packet_kind::MNT, 0); }
+    void pad      (token& t) { add(ipt_packet_kind::PAD, 0); }
+    void eof      (token& t) { got_to_eof = true; }
+
+    void skip(ipt_pos pos, ipt_offset count)
+    {
+        packets.push_back(pos, ipt_packet_kind::SKIP, count);
+    }
+
+    void report_error(const string& message)
+    {
+        errors.push_back(message);
+    }
+
+    ipt_packet_batch packets;
+    vector<string>   errors;
+    bool             got_to_eof;
+
+private:
+    void add(ipt_packet_kind kind, uint64_t payload)
+    {
+        packets.push_back(input_.beginning_of_packet(), kind, payload);
+    }
+
+    const INPUT& input_;
+}; // recording_output
+
+// bytes that mostly begin or continue packets, with PSBs in between
+vector<uint8_t> make_trace(mt19937& random)
+{
+    static const uint8_t common[] = {
+        0x00, 0x02, 0x19, 0x59, 0x99, 0x03, 0x23, 0x43, 0x73, 0x82, 0xa3,
+        0xc3, 0xc8, 0xf3, 0x0d, 0x2d, 0x4d, 0x6d, 0x8d, 0x11, 0x31, 0x1d,
+        0x7d, 0x01, 0x21, 0x06, 0x07, 0x20
+    };
+
+    vector<uint8_t> trace(random() % 100000 + 1);
+    for (auto& b : trace) {
+        b = random() % 4 ? common[random() % sizeof(common)] : random();
+    }
+    for (unsigned n = random() % 40; n > 0; --n) {
+        size_t at = random() % trace.size();
+        for (size_t i = 0; i < ipt_psb_size && at + i < trace.size(); ++i) {
+            trace[at + i] = ipt_psb[i];
+        }
+    }
+
+    return trace;
+}
+
+bool write_file(const string& path, const vector<uint8_t>& data)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
+
+// decode the trace at path with both, keeping only the packets in the
+// filter, and compare
+bool same_packets(const string& path, ipt_packet_filter filter, size_t batch_size)
+{
+    ipt_parser<input_from_mapped_file, recording_output> parser;
+    if (!parser.input().open(path)) {
+        fprintf(stderr, "cannot open '%s'\n", path.c_str());
+        return false;
+    }
+    while (parser.parse()) {}
+    const auto& expected = parser.output();
+
+    ipt_batch_decoder<input_from_mapped_file> decoder(filter);
+    if (!decoder.input().open(path)) {
+        fprintf(stderr, "cannot open '%s'\n", path.c_str());
+        return false;
+    }
+
+    bool             ok = true;
+    size_t           e  = 0;
+    ipt_packet_batch batch;
+    bool             more;
+    do {
+        more = decoder.decode(batch, batch_size);
+        ok   = ok && batch.size() <= batch_size;
+        for (size_t i = 0; ok && i < batch.size(); ++i) {
+            while (e < expected.packets.size() &&
+                   !ipt_filter_has(filter, expected.packets.kind[e]))
+            {
+                ++e;
+            }
+            ok = e < expected.packets.size()                    &&
+                 batch.offset[i]  == expected.packets.offset[e]  &&
+                 batch.kind[i]    == expected.packets.kind[e]    &&
+                 batch.payload[i] == expected.packets.payload[e];
+            if (!ok) {
+                fprintf(stderr, "packet at %#" PRIx64 " of '%s' differs\n",
+                        batch.offset[i], path.c_str());
+            }
+            ++e;
+        }
+    } while (ok && more);
+
+    while (e < expected.packets.size() &&
+           !ipt_filter_has(filter, expected.packets.kind[e]))
+    {
+        ++e;
+    }
+    if (ok && e != expected.packets.size()) {
+        fprintf(stderr, "packets missing from the end of '%s'\n", path.c_str());
+        ok = false;
+    }
+    if (ok && (decoder.errors() != expected.errors ||
+               decoder.got_to_eof() != expected.got_to_eof))
+    {
+        fprintf(stderr, "errors or end of '%s' differ\n", path.c_str());
+        ok = false;
+    }
+
+    return ok;
+}
+
+bool check(const string& path)
+{
+    const ipt_packet_filter filters[] = {
+        ipt_all_packets,
+        ipt_packets(ipt_packet_kind::TSC,
+                    ipt_packet_kind::MTC,
+                    ipt_packet_kind::TMA,
+                    ipt_packet_kind::CBR,
+                    ipt_packet_kind::PSB),
+        ipt_packets(ipt_packet_kind::FUP, ipt_packet_kind::SKIP),
+        ipt_packets()
+    };
+
+    bool ok = true;
+    for (auto filter : filters) {
+        ok = ok && same_packets(path, filter, 4096) &&
+                   same_packets(path, filter, 7);
+    }
+    return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    bool ok = true;
+
+    for (int i = 1; ok && i < argc; ++i) {
+        ok = check(argv[i]);
+        printf("%s: %s\n", argv[i], ok ? "ok" : "FAILED");
+    }
+
+    char directory[] = "/tmp/sat-ipt-batch-check.XXXXXX";
+    if (!mkdtemp(directory)) {
+        fprintf(stderr, "cannot make a temporary directory\n");
+        exit(EXIT_FAILURE);
+    }
+    string path = string(directory) + "/cpu0.bin";
+
+    mt19937  random(1);
+    unsigned traces;
+    for (traces = 0; ok && traces < 200; ++traces) {
+        if (!write_file(path, make_trace(random))) {
+            fprintf(stderr, "cannot write '%s'\n", path.c_str());
+            ok = false;
+        } else {
+            ok = check(path);
+        }
+    }
+    printf("random traces: %u %s\n", traces, ok ? "ok" : "FAILED");
+
+    (void)unlink(path.c_str());
+    (void)rmdir(directory);
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,444 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_IPT_BATCH_H
+#define SAT_IPT_BATCH_H
+
+#include "sat-ipt-parser.h"
+#include "sat-ipt.h"
+#include "sat-ipt-psb.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+namespace sat {
+
+using namespace std;
+
+// Kinds of packets in a decoded batch.
+enum class ipt_packet_kind : uint8_t {
+    PAD, SHORT_TNT, LONG_TNT, TIP, TIP_PGE, TIP_PGD, FUP, PIP, TSC, MTC,
+    MODE_EXEC, MODE_TSX, TRACESTOP, CBR, TMA, CYC, VMCS, OVF, PSB, PSBEND,
+    MNT, SKIP
+};
+
+// A set of packet kinds to decode, one bit per kind.
+using ipt_packet_filter = uint32_t;
+
+constexpr ipt_packet_filter ipt_packets()
+{
+    return 0;
+}
+
+template <class... KINDS>
+constexpr ipt_packet_filter ipt_packets(ipt_packet_kind kind, KINDS... kinds)
+{
+    return (1u << static_cast<unsigned>(kind)) | ipt_packets(kinds...);
+}
+
+constexpr ipt_packet_filter ipt_all_packets = ~0u;
+
+constexpr bool ipt_filter_has(ipt_packet_filter filter, ipt_packet_kind kind)
+{
+    return filter & ipt_packets(kind);
+}
+
+// Packets as parallel arrays that belong to someone else: to a batch, or
+// to an index that has been mapped from its sidecar.
+struct ipt_packet_arrays {
+    const ipt_pos*         offset;
+    const ipt_packet_kind* kind;
+    const uint64_t*        payload;
+    size_t                 size;
+}; // ipt_packet_arrays
+
+// Decoded packets as parallel arrays, so that passes that look at only
+// a few kinds of packets can scan them in tight loops. The payload is:
+//   SHORT_TNT, LONG_TNT:           TNT bits, including the stop bit
+//   TIP, TIP_PGE, TIP_PGD, FUP:    target address
+//   PIP:                           CR3 | NR bit (bit 0)
+//   TSC:                           TSC
+//   MTC:                           CTC
+//   MODE_EXEC, MODE_TSX:           ipt_exec_mode, ipt_tsx_type
+//   CBR:                           core:bus ratio
+//   TMA:                           CTC | fast counter << 16
+//   VMCS:                          VMCS base address
+//   SKIP:                          number of unparsable bytes skipped
+//   others:                        zero
+struct ipt_packet_batch {
+    vector<ipt_pos>         offset;
+    vector<ipt_packet_kind> kind;
+    vector<uint64_t>        payload;
+
+    size_t size() const  { return kind.size(); }
+    bool   empty() const { return kind.empty(); }
+
+    void clear()
+    {
+        offset.clear();
+        kind.clear();
+        payload.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        offset.reserve(n);
+        kind.reserve(n);
+        payload.reserve(n);
+    }
+
+    void push_back(ipt_pos pos, ipt_packet_kind k, uint64_t value)
+    {
+        offset.push_back(pos);
+        kind.push_back(k);
+        payload.push_back(value);
+    }
+
+    // append the first count packets of other
+    void append(const ipt_packet_arrays& other, size_t count)
+    {
+        offset.insert(offset.end(), other.offset, other.offset + count);
+        kind.insert(kind.end(), other.kind, other.kind + count);
+        payload.insert(payload.end(), other.payload, other.payload + count);
+    }
+
+    ipt_packet_arrays arrays() const
+    {
+        return {offset.data(), kind.data(), payload.data(), size()};
+    }
+}; // ipt_packet_batch
+
+// Decodes an IPT trace a batch of packets at a time, straight into the
+// arrays of the batch. Packets of kinds that are not in the filter are
+// only scanned over: their bytes are read, but nothing is evaluated
+// for them beyond what is needed to tell whether they are well-formed.
+// Decodes the same packets and reports the same errors as ipt_parser.
+template <class INPUT>
+class ipt_batch_decoder {
+public:
+    static const size_t default_batch_size = 4096;
+
+    explicit ipt_batch_decoder(ipt_packet_filter filter = ipt_all_packets) :
+        input_(),
+        filter_(filter),
+        wants_ip_(filter & ipt_packets(ipt_packet_kind::TIP,
+                                       ipt_packet_kind::TIP_PGE,
+                                       ipt_packet_kind::TIP_PGD,
+                                       ipt_packet_kind::FUP)),
+        last_ip_(),
+        at_eof_(),
+        got_to_eof_(),
+        done_()
+    {}
+
+    INPUT& input() { return input_; }
+
+    // decode until the batch holds max_packets packets or the trace ends;
+    // returns false once the decoder has stopped, either at the end of the
+    // trace or at an error it could not recover from
+    bool decode(ipt_packet_batch& batch,
+                size_t            max_packets = default_batch_size)
+    {
+        batch.clear();
+        while (!done_ && batch.size() < max_packets) {
+            done_ = !scan(batch);
+        }
+        return !done_;
+    }
+
+    // as above, but also stop before the first packet that begins at or
+    // after position end
+    bool decode_to(ipt_packet_batch& batch,
+                   ipt_pos           end,
+                   size_t            max_packets = default_batch_size)
+    {
+        batch.clear();
+        while (!done_                     &&
+               batch.size() < max_packets &&
+               input_.position() < end)
+        {
+            done_ = !scan(batch);
+        }
+        return !done_;
+    }
+
+    bool            got_to_eof() { return got_to_eof_; }
+    vector<string>& errors()     { return errors_; }
+
+private:
+    // decode the packet at the current position; returns false when
+    // there is nothing more to decode
+    bool scan(ipt_packet_batch& batch)
+    {
+        uint8_t packet[16];
+
+        input_.mark_beginning_of_packet();
+        if (!input_.get_next(packet[0])) {
+            if (!input_.bad() && !at_eof_) {
+                at_eof_ = got_to_eof_ = true;
+                return true;
+            }
+            return false;
+        }
+
+        const auto& header = ipt_headers[packet[0]];
+        if (header.length > 1 &&
+            !input_.get_next(header.length - 1, &packet[1]))
+        {
+            got_to_eof_ = true; // cut short by the end of the trace
+            return true;
+        }
+
+        switch (header.kind) {
+        case ipt_header_kind::PAD:
+            add(batch, ipt_packet_kind::PAD, 0);
+            return true;
+        case ipt_header_kind::SHORT_TNT:
+            add(batch, ipt_packet_kind::SHORT_TNT, packet[0] >> 1);
+            return true;
+        case ipt_header_kind::TIP:
+            add_ip(batch, ipt_packet_kind::TIP, packet);
+            return true;
+        case ipt_header_kind::TIP_PGE:
+            add_ip(batch, ipt_packet_kind::TIP_PGE, packet);
+            return true;
+        case ipt_header_kind::TIP_PGD:
+            add_ip(batch, ipt_packet_kind::TIP_PGD, packet);
+            return true;
+        case ipt_header_kind::FUP:
+            add_ip(batch, ipt_packet_kind::FUP, packet);
+            return true;
+        case ipt_header_kind::TSC:
+            if (wants(ipt_packet_kind::TSC)) {
+                add(batch, ipt_packet_kind::TSC, load<uint64_t>(packet) >> 8);
+            }
+            return true;
+        case ipt_header_kind::MTC:
+            add(batch, ipt_packet_kind::MTC, packet[1]);
+            return true;
+        case ipt_header_kind::CYC:
+            return scan_cyc(batch, packet);
+        case ipt_header_kind::MODE:
+            return scan_mode(batch, packet);
+        case ipt_header_kind::EXTENDED:
+            return scan_extended(batch, packet);
+        case ipt_header_kind::BAD_TIP:
+            {
+                char tmp[50];
+                sprintf(tmp, "TIP IPBytes value too high (%d) packet[0] = 0x%x", packet[0] >> 5, packet[0]);
+                return resync(batch, tmp);
+            }
+        default:
+            return resync(batch, "unknown packet");
+        }
+    }
+
+    bool scan_extended(ipt_packet_batch& batch, uint8_t packet[])
+    {
+        const auto& header = ipt_extended_headers[packet[1]];
+
+        if (header.length > 2 &&
+            !input_.get_next(header.length - 2, &packet[2]))
+        {
+            if (header.kind == ipt_extended_kind::PSB) {
+                return resync(batch, "broken PSB");
+            }
+            got_to_eof_ = true;
+            return true;
+        }
+
+        switch (header.kind) {
+        case ipt_extended_kind::CBR:
+            add(batch, ipt_packet_kind::CBR, packet[2]);
+            return true;
+        case ipt_extended_kind::PSBEND:
+            add(batch, ipt_packet_kind::PSBEND, 0);
+            return true;
+        case ipt_extended_kind::PIP:
+            if (wants(ipt_packet_kind::PIP)) {
+                uint64_t p = load<uint64_t>(packet);
+                add(batch, ipt_packet_kind::PIP,
+                    ((p >> 17) << 5) | ((p & 0x10000) ? 1 : 0));
+            }
+            return true;
+        case ipt_extended_kind::TMA:
+            if (wants(ipt_packet_kind::TMA)) {
+                uint64_t ctc  = load<uint16_t>(&packet[2]);
+                uint64_t fast = load<uint16_t>(&packet[5]) & 0x01ff;
+                add(batch, ipt_packet_kind::TMA, ctc | fast << 16);
+            }
+            return true;
+        case ipt_extended_kind::PSB:
+            if (memcmp(&packet[2], &ipt_psb[2], ipt_psb_size - 2) != 0) {
+                return resync(batch, "broken PSB");
+            }
+            last_ip_ = 0; // last IP is reset at every PSB
+            add(batch, ipt_packet_kind::PSB, 0);
+            return true;
+        case ipt_extended_kind::TRACESTOP:
+            add(batch, ipt_packet_kind::TRACESTOP, 0);
+            return true;
+        case ipt_extended_kind::LONG_TNT:
+            add(batch, ipt_packet_kind::LONG_TNT, load<uint64_t>(packet) >> 16);
+            return true;
+        case ipt_extended_kind::MNT:
+            add(batch, ipt_packet_kind::MNT, 0);
+            return true;
+        case ipt_extended_kind::VMCS:
+            add(batch, ipt_packet_kind::VMCS,
+                ((uint64_t)packet[6] << 44) |
+                ((uint64_t)packet[5] << 36) |
+                ((uint64_t)packet[4] << 28) |
+                ((uint64_t)packet[3] << 20) |
+                ((uint64_t)packet[2] << 12));
+            return true;
+        case ipt_extended_kind::OVF:
+            add(batch, ipt_packet_kind::OVF, 0);
+            return true;
+        default:
+            return resync(batch, "broken extended package");
+        }
+    }
+
+    bool scan_mode(ipt_packet_batch& batch, uint8_t packet[])
+    {
+        uint8_t value = packet[1] & 0x03;
+
+        switch (packet[1] >> 5) {
+        case 0x00:
+            if (value > 2) {
+                return resync(batch, "illegal exec mode");
+            }
+            add(batch, ipt_packet_kind::MODE_EXEC, value);
+            return true;
+        case 0x01:
+            if (value > 2) {
+                return resync(batch, "illegal transaction mode");
+            }
+            add(batch, ipt_packet_kind::MODE_TSX, value);
+            return true;
+        default:
+            return resync(batch, "unknown MODE");
+        }
+    }
+
+    bool scan_cyc(ipt_packet_batch& batch, uint8_t packet[])
+    {
+        int  i   = 0;
+        bool exp = packet[0] & 0x04;
+        while (exp) {
+            ++i;
+            if (i > 14) {
+                return resync(batch, "CYC package is too long");
+            }
+            if (!input_.get_next(packet[i])) {
+                got_to_eof_ = true;
+                return true;
+            }
+            exp = packet[i] & 0x01;
+        }
+
+        add(batch, ipt_packet_kind::CYC, 0);
+        return true;
+    }
+
+    // skip to the next PSB after a packet that could not be decoded
+    bool resync(ipt_packet_batch& batch, const char* error)
+    {
+        errors_.push_back(error);
+
+        ipt_pos    pos = input_.beginning_of_packet();
+        ipt_offset skipped;
+        if (!input_.skip_to_psb(skipped)) {
+            return false;
+        }
+        add(batch, ipt_packet_kind::SKIP, skipped, pos);
+
+        return true;
+    }
+
+    bool wants(ipt_packet_kind kind) const
+    {
+        return ipt_filter_has(filter_, kind);
+    }
+
+    void add(ipt_packet_batch& batch, ipt_packet_kind kind, uint64_t payload)
+    {
+        add(batch, kind, payload, input_.beginning_of_packet());
+    }
+
+    void add(ipt_packet_batch& batch,
+             ipt_packet_kind   kind,
+             uint64_t          payload,
+             ipt_pos           pos)
+    {
+        if (wants(kind)) {
+            batch.push_back(pos, kind, payload);
+        }
+    }
+
+    // decompress the target address against the last one
+    void add_ip(ipt_packet_batch& batch, ipt_packet_kind kind, const uint8_t packet[])
+    {
+        if (!wants_ip_) {
+            return;
+        }
+
+        uint64_t ip;
+        switch (packet[0] >> 5) {
+        case 0x00: // IP is out of context
+            ip = 0;
+            break;
+        case 0x01:
+            ip = (last_ip_ & 0xffffffffffff0000) | load<uint16_t>(&packet[1]);
+            last_ip_ = ip;
+            break;
+        case 0x02:
+            ip = (last_ip_ & 0xffffffff00000000) | load<uint32_t>(&packet[1]);
+            last_ip_ = ip;
+            break;
+        default: // 0x03; anything larger is a BAD_TIP
+            ip = load<uint32_t>(&packet[1]) |
+                 (uint64_t)load<uint16_t>(&packet[5]) << 32;
+            ip = (uint64_t)((int64_t)(ip << 16) >> 16); // sign-extend bit 47
+            last_ip_ = ip;
+            break;
+        }
+        add(batch, kind, ip);
+    }
+
+    // little-endian value at an unaligned address
+    template <class T>
+    static T load(const uint8_t* p)
+    {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    INPUT             input_;
+    ipt_packet_filter filter_;
+    bool              wants_ip_;
+    uint64_t          last_ip_;
+    bool              at_eof_;
+    bool              got_to_eof_;
+    bool              done_;
+    vector<string>    errors_;
+}; // ipt_batch_decoder
+
+} // namespace sat
+
+#endif // SAT_IPT_BATCH_H
@@ -0,0 +1,119 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "sat-compressed-input.h"
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace sat;
+using namespace std;
+
+namespace {
+
+void usage(const char* name)
+{
+    printf("Usage: %s [-f <frame-kb>] [-l <level>] <ipt-file> <compressed-file>\n"
+           "       %s -d <compressed-file> <ipt-file>\n"
+           "  -f  size of independently compressed frames (default %u KiB)\n"
+           "  -l  compression level 1-9 (default 1)\n"
+           "  -d  decompress\n",
+           name, name, ipt_compressed_frame_size / 1024);
+}
+
+bool decompress_trace(const string& from, const string& to)
+{
+    input_from_compressed_file in;
+    if (!in.open(from)) {
+        fprintf(stderr, "cannot open '%s' for reading\n", from.c_str());
+        return false;
+    }
+    FILE* out = fopen(to.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "cannot open '%s' for writing\n", to.c_str());
+        return false;
+    }
+
+    bool            ok = true;
+    vector<uint8_t> buffer(ipt_compressed_frame_size);
+    while (ok && in.position() < in.size()) {
+        size_t n = min<ipt_offset>(buffer.size(), in.size() - in.position());
+        ok = in.get_next(n, buffer.data()) &&
+             fwrite(buffer.data(), 1, n, out) == n;
+    }
+
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "error decompressing '%s'\n", from.c_str());
+        (void)unlink(to.c_str());
+    }
+
+    return ok;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    bool     decompress = false;
+    uint32_t frame_size = ipt_compressed_frame_size;
+    int      level      = Z_BEST_SPEED;
+    int      c;
+
+    opterr = 0;
+    while ((c = getopt(argc, argv, ":df:l:")) != EOF) {
+        switch (c) {
+        case 'd':
+            decompress = true;
+            break;
+        case 'f':
+            frame_size = strtoul(optarg, 0, 0) * 1024;
+            if (frame_size == 0) {
+                fprintf(stderr, "invalid frame size: '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            level = atoi(optarg);
+            if (level < 1 || level > 9) {
+                fprintf(stderr, "invalid compression level: '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case '?':
+            fprintf(stderr, "unknown option '%c'\n", optopt);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+            break;
+        case ':':
+            fprintf(stderr, "missing argument to option '%c'\n", optopt);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bool ok = decompress ? decompress_trace(argv[optind], argv[optind + 1])
+                         : compress_ipt_trace(argv[optind], argv[optind + 1],
+                                              frame_size, level);
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -14,6 +14,7 @@
 // limitations under the License.
 */
 #include "sat-input.h"
+#include "sat-compressed-input.h"
 #include "sat-ipt-parser.h"
 #include <cstdio>
 #include <cinttypes>
@@ -176,6 +177,11 @@ public:
         printf("EOF\n");
     }
 
+    void skip(ipt_pos pos, ipt_offset count)
+    {
+        printf("%08lx| skipped %lu bytes to the next PSB\n", pos, count);
+    }
+
     void report_warning(const string& message)
     {
         printf("%lxh: WARNING: %s in packet starting at %lxh\n",
@@ -227,6 +233,19 @@ public:
 };
 #endif
 
+template <class INPUT>
+void dump(const char* path)
+{
+    ipt_parser<INPUT, dump_ipt/*, prefix_with_packet_offset*/> parser;
+
+    if (!parser.input().open(path)) {
+        fprintf(stderr, "cannot open '%s' for reading\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    while (parser.parse()) {}
+}
+
 int main(int argc, char* argv[])
 {
     if (argc != 2) {
@@ -237,12 +256,9 @@ int main(int argc, char* argv[])
     ipt_parser<> dummy_parser;
     dummy_parser.parse();
 
-    ipt_parser<input_from_file, dump_ipt/*, prefix_with_packet_offset*/> parser;
-
-    if (argc == 2 && !parser.input().open(argv[1])) {
-        fprintf(stderr, "cannot open '%s' for reading\n", argv[1]);
-        exit(EXIT_FAILURE);
+    if (compressed_input_file::is_compressed(argv[1])) {
+        dump<input_from_compressed_file>(argv[1]);
+    } else {
+        dump<input_from_mapped_file>(argv[1]);
     }
-
-    while (parser.parse()) {}
 }
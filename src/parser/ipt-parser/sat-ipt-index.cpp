@@ -0,0 +1,488 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "sat-ipt-index.h"
+#include "sat-ipt-batch.h"
+#include "sat-input.h"
+#include "sat-compressed-input.h"
+#include "sat-ipt-psb.h"
+#include "sat-thread-pool.h"
+#include "sat-log.h"
+#include <map>
+#include <set>
+#include <mutex>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sat {
+
+namespace {
+
+const char     index_magic[8] = {'S', 'A', 'T', 'T', 'I', 'D', 'X', '\0'};
+const uint32_t index_version  = 2;
+
+struct ipt_index_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t complete;
+    uint64_t ipt_size;
+    int64_t  ipt_mtime_sec;
+    int64_t  ipt_mtime_nsec;
+    uint64_t watched_tip;
+    uint64_t has_watched_tip;
+    uint64_t item_count;
+}; // ipt_index_header
+
+// the sidecar is the header followed by the arrays of the packets
+size_t sidecar_size(uint64_t item_count)
+{
+    return sizeof(ipt_index_header) +
+           item_count * (sizeof(ipt_pos) + sizeof(uint64_t) +
+                         sizeof(ipt_packet_kind));
+}
+
+bool stat_ipt(const string& path, ipt_index_header& header)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, index_magic, sizeof(header.magic));
+    header.version        = index_version;
+    header.ipt_size       = st.st_size;
+    header.ipt_mtime_sec  = st.st_mtim.tv_sec;
+    header.ipt_mtime_nsec = st.st_mtim.tv_nsec;
+
+    return true;
+}
+
+bool same_trace(const ipt_index_header& a, const ipt_index_header& b)
+{
+    return memcmp(a.magic, b.magic, sizeof(a.magic)) == 0 &&
+           a.version        == b.version                &&
+           a.ipt_size       == b.ipt_size               &&
+           a.ipt_mtime_sec  == b.ipt_mtime_sec          &&
+           a.ipt_mtime_nsec == b.ipt_mtime_nsec;
+}
+
+// indices obtained so far and traces that are still being appended to
+mutex                                    cache_mutex;
+map<string, shared_ptr<const ipt_index>> cache;
+set<string>                              growing_traces;
+
+bool watches(const ipt_index_header& header, bool any, rva watched_tip)
+{
+    return any || (header.has_watched_tip && header.watched_tip == watched_tip);
+}
+
+
+// the packets that are recorded in the index
+const ipt_packet_filter index_filter = ipt_packets(ipt_packet_kind::TSC,
+                                                   ipt_packet_kind::MTC,
+                                                   ipt_packet_kind::TMA,
+                                                   ipt_packet_kind::OVF,
+                                                   ipt_packet_kind::PSB,
+                                                   ipt_packet_kind::PSBEND,
+                                                   ipt_packet_kind::TIP_PGE,
+                                                   ipt_packet_kind::CBR,
+                                                   ipt_packet_kind::TIP);
+
+// append the packets of the batch, leaving out TIPs to other addresses
+void add_index_items(const ipt_packet_batch& batch,
+                     rva                     watched_tip,
+                     ipt_packet_batch&       items)
+{
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (batch.kind[i] != ipt_packet_kind::TIP ||
+            batch.payload[i] == watched_tip)
+        {
+            items.push_back(batch.offset[i], batch.kind[i], batch.payload[i]);
+        }
+    }
+}
+
+// a part of the trace that begins with a PSB
+struct segment {
+    ipt_offset             begin;
+    ipt_offset             end;
+    ipt_offset             decoded_end;
+    ipt_packet_batch       items;
+    vector<string>         errors;
+    bool                   ok;
+    bool                   got_to_eof;
+}; // segment
+
+const ipt_offset min_segment_size = 1024 * 1024;
+
+template <class INPUT>
+bool plan_segments(const string& path, ipt_offset begin, vector<segment>& segments)
+{
+    INPUT input;
+    if (!input.open(path)) {
+        return false;
+    }
+
+    ipt_offset size  = input.size();
+    ipt_offset count = min<ipt_offset>((size - begin) / min_segment_size,
+                                       4 * thread_pool::hardware_threads());
+    if (count < 2) {
+        count = 1;
+    }
+
+    ipt_offset first = begin;
+    for (ipt_offset s = 1; s < count && begin < size; ++s) {
+        ipt_offset from = first + s * ((size - first) / count);
+        if (from <= begin) {
+            continue;
+        }
+        // skip_to_psb() looks from the byte after the packet beginning
+        ipt_offset skipped;
+        if (!input.seek(from - 1)) {
+            break;
+        }
+        input.mark_beginning_of_packet();
+        (void)input.skip_to_psb(skipped);
+        ipt_offset end = input.position();
+        if (end < size) {
+            segments.push_back({begin, end, 0, {}, {}, false, false});
+            begin = end;
+        }
+    }
+    segments.push_back({begin, size, 0, {}, {}, false, false});
+
+    return true;
+}
+
+// decode packets from the beginning of the segment up to the first
+// packet that begins at or after the end of the segment
+template <class INPUT>
+void decode_segment(const string& path, rva watched_tip, segment& s)
+{
+    ipt_batch_decoder<INPUT> decoder(index_filter);
+
+    s.items.clear();
+    s.errors.clear();
+    s.ok         = decoder.input().open(path) && decoder.input().seek(s.begin);
+    s.got_to_eof = false;
+
+    if (s.ok) {
+        ipt_packet_batch batch;
+        while (s.ok && decoder.input().position() < s.end) {
+            s.ok = decoder.decode_to(batch, s.end);
+            add_index_items(batch, watched_tip, s.items);
+        }
+        if (s.ok && s.end == decoder.input().size()) {
+            (void)decoder.decode(batch); // let the parser see the end of file
+        }
+        s.decoded_end = decoder.input().position();
+        s.got_to_eof  = decoder.got_to_eof();
+        s.errors.swap(decoder.errors());
+    }
+}
+
+} // anonymous namespace
+
+
+class ipt_index::imp {
+public:
+    imp() : header_(), packets_(), mapping_(), mapping_size_() {}
+
+    ~imp()
+    {
+        if (mapping_) {
+            (void)munmap(mapping_, mapping_size_);
+        }
+    }
+
+    bool map_sidecar(const string& path, bool any, rva watched_tip)
+    {
+        bool done = false;
+
+        ipt_index_header expected;
+        if (!stat_ipt(path, expected)) {
+            return false;
+        }
+
+        int fd = open(sidecar_path(path).c_str(), O_RDONLY);
+        if (fd != -1) {
+            struct stat st;
+            if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header_)) {
+                void* m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (m != MAP_FAILED) {
+                    memcpy(&header_, m, sizeof(header_));
+                    if (same_trace(header_, expected)          &&
+                        watches(header_, any, watched_tip)     &&
+                        (size_t)st.st_size == sidecar_size(header_.item_count))
+                    {
+                        auto   p = static_cast<const char*>(m) + sizeof(header_);
+                        size_t n = header_.item_count;
+                        mapping_         = m;
+                        mapping_size_    = st.st_size;
+                        packets_.offset  = reinterpret_cast<const ipt_pos*>(p);
+                        packets_.payload = reinterpret_cast<const uint64_t*>(
+                                               p + n * sizeof(ipt_pos));
+                        packets_.kind    = reinterpret_cast<const ipt_packet_kind*>(
+                                               p + n * (sizeof(ipt_pos) +
+                                                        sizeof(uint64_t)));
+                        packets_.size    = n;
+                        done             = true;
+                    } else {
+                        (void)munmap(m, st.st_size);
+                    }
+                }
+            }
+            (void)close(fd);
+        }
+
+        return done;
+    }
+
+    bool build(const string& path, rva watched_tip)
+    {
+        return build(path, watched_tip, 0);
+    }
+
+    // extend the index of a trace that has been appended to since the
+    // previous index was built: keep the items up to the last PSB of the
+    // previous index and decode the trace again from there
+    bool extend(const string& path, const ipt_index& previous)
+    {
+        const imp& p = *previous.imp_;
+
+        if (!p.header_.complete || !p.header_.has_watched_tip) {
+            return false;
+        }
+
+        const auto& packets  = p.packets_;
+        size_t      last_psb = packets.size;
+        for (size_t i = packets.size; i > 0; --i) {
+            if (packets.kind[i - 1] == ipt_packet_kind::PSB) {
+                last_psb = i - 1;
+                break;
+            }
+        }
+        if (last_psb == packets.size) {
+            return false;
+        }
+
+        built_.clear();
+        built_.append(packets, last_psb);
+        SAT_LOG(1, "extending IPT index for '%s' from %" PRIx64 "\n",
+                path.c_str(), packets.offset[last_psb]);
+
+        return build(path, p.header_.watched_tip, packets.offset[last_psb]);
+    }
+
+    // decode the trace from offset begin onwards, appending to built_
+    bool build(const string& path, rva watched_tip, ipt_offset begin)
+    {
+        if (!stat_ipt(path, header_)) {
+            return false;
+        }
+
+        if (compressed_input_file::is_compressed(path)) {
+            return build_from<input_from_compressed_file>(path, watched_tip, begin);
+        } else {
+            return build_from<input_from_mapped_file>(path, watched_tip, begin);
+        }
+    }
+
+    template <class INPUT>
+    bool build_from(const string& path, rva watched_tip, ipt_offset begin)
+    {
+        // split the trace at PSBs and decode the segments concurrently
+        vector<segment> segments;
+        if (!plan_segments<INPUT>(path, begin, segments)) {
+            return false;
+        }
+        if (segments.size() > 1) {
+            thread_pool pool(min<size_t>(segments.size(),
+                                         thread_pool::hardware_threads()));
+            for (auto& s : segments) {
+                segment* sp = &s;
+                pool.submit([&path, watched_tip, sp]() {
+                    decode_segment<INPUT>(path, watched_tip, *sp);
+                });
+            }
+            pool.wait();
+        } else {
+            decode_segment<INPUT>(path, watched_tip, segments.front());
+        }
+
+        // merge the segments in file order; if decoding a segment did not
+        // end exactly where the next one begins, the serial decoder would
+        // not have synced at that PSB, so decode the next one again from
+        // where the previous one really ended
+        bool       complete = false;
+        ipt_offset carry    = begin;
+        for (auto& s : segments) {
+            if (s.begin != carry) {
+                s.begin = carry;
+                decode_segment<INPUT>(path, watched_tip, s);
+            }
+            built_.append(s.items.arrays(), s.items.size());
+            s.items = ipt_packet_batch(); // free it
+            for (auto& e : s.errors) {
+                fprintf(stderr, "error parsing IPT: %s\n", e.c_str());
+            }
+            if (!s.ok) {
+                break; // the serial decoder stops at the first error
+            }
+            complete = s.got_to_eof;
+            carry    = s.decoded_end;
+        }
+
+        packets_                = built_.arrays();
+        header_.complete        = complete;
+        header_.watched_tip     = watched_tip;
+        header_.has_watched_tip = true;
+        header_.item_count      = built_.size();
+
+        return true;
+    }
+
+    void write_sidecar(const string& path) const
+    {
+        string sidecar = sidecar_path(path);
+        string temp    = sidecar + "." + to_string(getpid());
+
+        bool done = false;
+        FILE* f = fopen(temp.c_str(), "w");
+        if (f) {
+            size_t n = built_.size();
+            done = fwrite(&header_, sizeof(header_), 1, f) == 1 &&
+                   fwrite(built_.offset.data(),
+                          sizeof(ipt_pos), n, f) == n &&
+                   fwrite(built_.payload.data(),
+                          sizeof(uint64_t), n, f) == n &&
+                   fwrite(built_.kind.data(),
+                          sizeof(ipt_packet_kind), n, f) == n;
+            done = (fclose(f) == 0) && done;
+            done = done && rename(temp.c_str(), sidecar.c_str()) == 0;
+            if (!done) {
+                (void)unlink(temp.c_str());
+            }
+        }
+
+        if (done) {
+            SAT_LOG(1, "wrote IPT index '%s'\n", sidecar.c_str());
+        } else {
+            SAT_LOG(1, "could not write IPT index '%s'\n", sidecar.c_str());
+        }
+    }
+
+    bool is_valid_for(const string& path) const
+    {
+        ipt_index_header current;
+        return stat_ipt(path, current) && same_trace(header_, current);
+    }
+
+    ipt_index_header       header_;
+    ipt_packet_arrays      packets_;
+    ipt_packet_batch       built_;
+    void*                  mapping_;
+    size_t                 mapping_size_;
+}; // ipt_index::imp
+
+
+ipt_index::ipt_index() : imp_{new imp} {}
+
+ipt_index::~ipt_index() {}
+
+shared_ptr<const ipt_index> ipt_index::obtain(const string& ipt_path)
+{
+    return obtain(ipt_path, 0, true);
+}
+
+shared_ptr<const ipt_index> ipt_index::obtain(const string& ipt_path,
+                                              rva           watched_tip)
+{
+    return obtain(ipt_path, watched_tip, false);
+}
+
+shared_ptr<const ipt_index> ipt_index::obtain(const string& ipt_path,
+                                              rva           watched_tip,
+                                              bool          any)
+{
+    lock_guard<mutex> lock(cache_mutex);
+
+    auto& index = cache[ipt_path];
+    if (index                                  &&
+        index->imp_->is_valid_for(ipt_path)    &&
+        watches(index->imp_->header_, any, watched_tip))
+    {
+        return index;
+    }
+
+    bool growing = index                                   &&
+                   growing_traces.count(ipt_path)          &&
+                   watches(index->imp_->header_, any, watched_tip);
+
+    shared_ptr<ipt_index> fresh{new ipt_index};
+    if (fresh->imp_->map_sidecar(ipt_path, any, watched_tip)) {
+        SAT_LOG(1, "mapped IPT index for '%s'\n", ipt_path.c_str());
+        index = fresh;
+    } else if (growing && fresh->imp_->extend(ipt_path, *index)) {
+        fresh->imp_->write_sidecar(ipt_path);
+        index = fresh;
+    } else if (fresh->imp_->build(ipt_path, watched_tip)) {
+        fresh->imp_->write_sidecar(ipt_path);
+        index = fresh;
+    } else {
+        index = nullptr;
+    }
+
+    return index;
+}
+
+void ipt_index::follow(const string& ipt_path)
+{
+    lock_guard<mutex> lock(cache_mutex);
+    growing_traces.insert(ipt_path);
+}
+
+bool ipt_index::complete() const
+{
+    return imp_->header_.complete;
+}
+
+rva ipt_index::watched_tip() const
+{
+    return imp_->header_.watched_tip;
+}
+
+ipt_packet_arrays ipt_index::packets() const
+{
+    return imp_->packets_;
+}
+
+size_t ipt_index::size() const
+{
+    return imp_->header_.item_count;
+}
+
+string ipt_index::sidecar_path(const string& ipt_path)
+{
+    return ipt_path + ".tidx";
+}
+
+} // sat
@@ -0,0 +1,76 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_IPT_INDEX_H
+#define SAT_IPT_INDEX_H
+
+#include "sat-ipt.h"
+#include "sat-ipt-batch.h"
+#include "sat-types.h"
+#include "sat-memory.h"
+#include <string>
+#include <vector>
+
+namespace sat {
+
+using namespace std;
+
+// An index of the timing packets, sync points and CBRs of one IPT
+// trace file: the TSC, MTC, TMA, OVF, PSB, PSBEND, TIP_PGE and CBR
+// packets, in the parallel arrays of the batch decoder, with the same
+// payloads. The index is stored next to the trace in a sidecar file
+// (cpuN.bin -> cpuN.bin.tidx) that is validated against the size and
+// modification time of the trace; the first tool to need the index
+// writes the sidecar and the rest just map it.
+//
+// TIP packets are only indexed if they target the watched address,
+// which is used for locating the scheduler in the trace.
+class ipt_index {
+public:
+    // obtain an index, building it if there is no valid one;
+    // any valid index is fine, whatever address it watches
+    static shared_ptr<const ipt_index> obtain(const string& ipt_path);
+    // obtain an index that records TIPs to watched_tip
+    static shared_ptr<const ipt_index> obtain(const string& ipt_path,
+                                              rva           watched_tip);
+
+    // the trace is still being appended to; when it has grown, extend
+    // the index obtained for it so far instead of decoding it all again
+    static void follow(const string& ipt_path);
+
+    ~ipt_index();
+
+    // true if the trace was decoded all the way to the end
+    bool complete() const;
+    rva  watched_tip() const;
+
+    ipt_packet_arrays packets() const;
+    size_t            size() const;
+
+    static string sidecar_path(const string& ipt_path);
+
+private:
+    ipt_index();
+    static shared_ptr<const ipt_index> obtain(const string& ipt_path,
+                                              rva           watched_tip,
+                                              bool          any);
+
+    class imp;
+    unique_ptr<imp> imp_;
+}; // ipt_index
+
+} // sat
+
+#endif // SAT_IPT_INDEX_H
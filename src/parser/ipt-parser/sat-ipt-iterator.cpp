@@ -65,7 +65,7 @@ bool ipt_iterator::iterate(callback_func callback)
 {
     bool done = false;
 
-    ipt_parser<input_from_file, ipt_token_output, call_callback> parser;
+    ipt_parser<input_from_mapped_file, ipt_token_output, call_callback> parser;
     if (parser.input().open(imp_->path_)) {
         parser.policy().callback_ = callback;
         while (parser.parse()) {}
@@ -53,6 +53,7 @@ public:
     void mnt      (token&) {}
     void pad      (token&) {}
     void eof      (token&) {}
+    void skip(ipt_pos pos, ipt_offset count) {}
     void report_warning(const string& message) {}
     void report_error(const string& message) {}
     void set_ff_state(bool state) {}
@@ -63,7 +64,7 @@ public:
     explicit ipt_iterator(const string& path);
     ~ipt_iterator();
 
-    using output = ipt_token_output<input_from_file>;
+    using output = ipt_token_output<input_from_mapped_file>;
     using token = output::token;
     using callback_func = function<void(const token&, size_t offset)>;
     bool iterate(callback_func callback);
@@ -29,6 +29,8 @@
 #include <dirent.h>
 #include <cinttypes>
 #include <algorithm>
+#include <set>
+#include <mutex>
 
 using namespace sat;
 using namespace std;
@@ -79,8 +81,27 @@ public:
 
 }; // class sideband_info_collector
 
+namespace {
+
+mutex       growing_sidebands_mutex;
+set<string> growing_sidebands;
+
+bool is_growing(const string& sideband_path)
+{
+    lock_guard<mutex> lock(growing_sidebands_mutex);
+    return growing_sidebands.count(sideband_path) != 0;
+}
+
+} // anonymous namespace
+
 namespace sat {
 
+        void sideband_info::follow(const string& sideband_path)
+        {
+            lock_guard<mutex> lock(growing_sidebands_mutex);
+            growing_sidebands.insert(sideband_path);
+        }
+
         uint32_t sideband_info::tsc_ctc_ratio() const
         {
             return init_tsc_ctc_ratio;
@@ -101,6 +122,9 @@ namespace sat {
                     output{new sideband_info_collector};
 
                 sideband_parser parser(input, output);
+                if (is_growing(sideband_path)) {
+                    parser.follow();
+                }
 
                 if (parser.parse()) {
                     built = true;
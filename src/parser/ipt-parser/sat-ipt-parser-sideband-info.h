@@ -28,6 +28,10 @@ namespace sat {
     class sideband_info
     {
     public:
+        // the sideband is still being written; build() stops at the
+        // last whole message instead of failing on a partial one
+        static void follow(const string& sideband_path);
+
         bool build(const string& sideband_path);
         uint32_t tsc_ctc_ratio() const;
         uint8_t mtc_freq() const;
@@ -192,6 +192,11 @@ public:
         printf("EOF\n");
     }
 
+    void skip(ipt_pos pos, ipt_offset count)
+    {
+        printf("%08lx| skipped %lu bytes to the next PSB\n", pos, count);
+    }
+
     void report_warning(const string& message)
     {
         printf("%lxh: WARNING: %s in packet starting at %lxh\n",
@@ -261,7 +266,7 @@ int main(int argc, char* argv[])
     ipt_parser<> dummy_parser;
     dummy_parser.parse();
 
-    ipt_parser<input_from_file, dump_ipt/*, prefix_with_packet_offset*/> parser;
+    ipt_parser<input_from_mapped_file, dump_ipt/*, prefix_with_packet_offset*/> parser;
 
     if (argc == 3 && !parser.input().open(argv[1])) {
         fprintf(stderr, "cannot open '%s' for reading\n", argv[1]);
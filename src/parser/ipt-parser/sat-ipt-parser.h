@@ -16,7 +16,11 @@
 #ifndef SAT_IPT_PARSER_H
 #define SAT_IPT_PARSER_H
 
+#include "sat-ipt.h"
+#include "sat-ipt-psb.h"
 #include <cstdint>
+#include <cstring>
+#include <cstdio>
 #include <string>
 #include <algorithm>
 
@@ -32,6 +36,8 @@ public:
     bool bad() { return true; }
     void mark_beginning_of_packet() {}
     bool is_fast_forwarding() { return true; }
+    size_t beginning_of_packet() const { return 0; }
+    bool skip_to_psb(ipt_offset& skipped) { return false; }
 }; // ipt_parser_dummy_input
 
 using ipt_exec_mode = enum {
@@ -112,6 +118,7 @@ public:
     void pad      (token&) {}
     void eof      (token&) {}
 
+    void skip(ipt_pos pos, ipt_offset count) {}
     void report_warning(const string& message) {}
     void report_error(const string& message) {}
     void set_ff_state(bool state) {}
@@ -148,6 +155,7 @@ public:
     void pad      (token&) {}
     void eof      (token&) {}
 
+    void skip(ipt_pos pos, ipt_offset count) {}
     void report_warning(const string& message) {}
     void report_error(const string& message) {}
     void set_ff_state(bool state) {}
@@ -229,11 +237,103 @@ public:
         output_.report_error(message);
     }
 
+    void report_skip(ipt_pos pos, ipt_offset count)
+    {
+        output_.skip(pos, count);
+    }
+
 protected:
     const INPUT& input_;
     OUTPUT&      output_;
 }; // ipt_call_output_method
 
+// packet kinds by the first byte of the packet
+enum class ipt_header_kind : uint8_t {
+    UNKNOWN, PAD, EXTENDED, TSC, MTC, MODE, SHORT_TNT, CYC,
+    TIP_PGD, TIP, TIP_PGE, FUP, BAD_TIP
+};
+
+// packet kinds by the second byte of an extended packet
+enum class ipt_extended_kind : uint8_t {
+    UNKNOWN, CBR, PSBEND, PIP, TMA, PSB, TRACESTOP, LONG_TNT, MNT, VMCS, OVF
+};
+
+// packet kind and length; the length is the full length of the packet
+// for all but CYC packets, the length of which is found by scanning
+template <class KIND>
+struct ipt_header_info {
+    KIND    kind;
+    uint8_t length;
+}; // ipt_header_info
+
+constexpr ipt_header_info<ipt_header_kind>
+ipt_tip_header(ipt_header_kind kind, uint8_t header)
+{
+    return (header >> 5) > 3 ?
+               ipt_header_info<ipt_header_kind>{ipt_header_kind::BAD_TIP, 1} :
+               ipt_header_info<ipt_header_kind>{kind, uint8_t(1 + 2 * (header >> 5))};
+}
+
+constexpr ipt_header_info<ipt_header_kind> ipt_classify_header(uint8_t h)
+{
+    using k = ipt_header_kind;
+    using i = ipt_header_info<ipt_header_kind>;
+    return h == 0x00          ? i{k::PAD,       1} : // 00000000
+           h == 0x02          ? i{k::EXTENDED,  2} : // 00000010
+           h == 0x19          ? i{k::TSC,       8} : // 00011001
+           h == 0x59          ? i{k::MTC,       2} : // 01011001
+           h == 0x99          ? i{k::MODE,      2} : // 10011001
+           (h & 0x01) == 0x00 ? i{k::SHORT_TNT, 1} : // xxxxxxx0
+           (h & 0x03) == 0x03 ? i{k::CYC,       1} : // xxxxxx11
+           (h & 0x1f) == 0x01 ? ipt_tip_header(k::TIP_PGD, h) : // xxx00001
+           (h & 0x1f) == 0x0d ? ipt_tip_header(k::TIP,     h) : // xxx01101
+           (h & 0x1f) == 0x11 ? ipt_tip_header(k::TIP_PGE, h) : // xxx10001
+           (h & 0x1f) == 0x1d ? ipt_tip_header(k::FUP,     h) : // xxx11101
+                                i{k::UNKNOWN,   1};
+}
+
+constexpr ipt_header_info<ipt_extended_kind> ipt_classify_extended(uint8_t h)
+{
+    using k = ipt_extended_kind;
+    using i = ipt_header_info<ipt_extended_kind>;
+    return h == 0x03 ? i{k::CBR,        4} : // 00000011
+           h == 0x23 ? i{k::PSBEND,     2} : // 00100011
+           h == 0x43 ? i{k::PIP,        8} : // 01000011
+           h == 0x73 ? i{k::TMA,        7} : // 01110011
+           h == 0x82 ? i{k::PSB,       16} : // 10000010
+           h == 0x83 ? i{k::TRACESTOP,  2} : // 10000011
+           h == 0xa3 ? i{k::LONG_TNT,   8} : // 10100011
+           h == 0xc3 ? i{k::MNT,       10} : // 11000011
+           h == 0xc8 ? i{k::VMCS,       7} : // 11001000
+           h == 0xf3 ? i{k::OVF,        2} : // 11110011
+                       i{k::UNKNOWN,    2};
+}
+
+#define SAT_IPT_CLASSIFY_4(f, b) \
+    f(b), f(b + 1), f(b + 2), f(b + 3)
+#define SAT_IPT_CLASSIFY_16(f, b) \
+    SAT_IPT_CLASSIFY_4(f, b),     SAT_IPT_CLASSIFY_4(f, b + 4), \
+    SAT_IPT_CLASSIFY_4(f, b + 8), SAT_IPT_CLASSIFY_4(f, b + 12)
+#define SAT_IPT_CLASSIFY_64(f, b) \
+    SAT_IPT_CLASSIFY_16(f, b),      SAT_IPT_CLASSIFY_16(f, b + 16), \
+    SAT_IPT_CLASSIFY_16(f, b + 32), SAT_IPT_CLASSIFY_16(f, b + 48)
+#define SAT_IPT_CLASSIFY_256(f) \
+    SAT_IPT_CLASSIFY_64(f, 0),   SAT_IPT_CLASSIFY_64(f, 64), \
+    SAT_IPT_CLASSIFY_64(f, 128), SAT_IPT_CLASSIFY_64(f, 192)
+
+constexpr ipt_header_info<ipt_header_kind> ipt_headers[256] = {
+    SAT_IPT_CLASSIFY_256(ipt_classify_header)
+};
+
+constexpr ipt_header_info<ipt_extended_kind> ipt_extended_headers[256] = {
+    SAT_IPT_CLASSIFY_256(ipt_classify_extended)
+};
+
+#undef SAT_IPT_CLASSIFY_256
+#undef SAT_IPT_CLASSIFY_64
+#undef SAT_IPT_CLASSIFY_16
+#undef SAT_IPT_CLASSIFY_4
+
 template <class INPUT, class OUTPUT>
 class ipt_scanner
 {
@@ -247,145 +347,125 @@ public:
 
     token scan(uint8_t packet[])
     {
-        token t;
+        const auto& header = ipt_headers[packet[0]];
 
-        switch (packet[0]) {
-        case 0x00: // 00000000
-            t = &OUTPUT::pad;
-            break;
-        case 0x02: // 00000010
-            t = parse_extended(packet);
-            break;
-        case 0x19: // 00011001
-            t = read_packet(&OUTPUT::tsc, packet, 1, 7);
-            break;
-        case 0x59: // 01011001
-            t = read_packet(&OUTPUT::mtc, packet, 1, 1);
-            break;
-        case 0x99: // 10011001
-            t = parse_mode(packet);
-            break;
-        default:
-            if ((packet[0] & 0x01) == 0x00) {        // xxxxxxx0
-                t = &OUTPUT::short_tnt;
-            } else if ((packet[0] & 0x03) == 0x03) { // xxxxxx11
-                t = parse_cyc(packet);
-            } else if ((packet[0] & 0x1f) == 0x01) { // xxx00001
-                t = read_tip_packet(&OUTPUT::tip_pgd, packet);
-            } else if ((packet[0] & 0x1f) == 0x0d) { // xxx01101
-                t = read_tip_packet(&OUTPUT::tip, packet);
-            } else if ((packet[0] & 0x1f) == 0x11) { // xxx10001
-                t = read_tip_packet(&OUTPUT::tip_pge, packet);
-            } else if ((packet[0] & 0x1f) == 0x1d) { // xxx11101
-                t = read_tip_packet(&OUTPUT::fup, packet);
-            } else {
-                output_policy_->report_error("unknown packet");
-                t = 0;
-            }
+        // read the rest of a fixed-size packet in one go
+        if (header.length > 1 &&
+            !input_.get_next(header.length - 1, &packet[1]))
+        {
+            return unexpected_eof(header.kind);
         }
 
-        return t;
+        switch (header.kind) {
+        case ipt_header_kind::PAD:
+            return &OUTPUT::pad;
+        case ipt_header_kind::SHORT_TNT:
+            return &OUTPUT::short_tnt;
+        case ipt_header_kind::TIP:
+            return &OUTPUT::tip;
+        case ipt_header_kind::TIP_PGE:
+            return &OUTPUT::tip_pge;
+        case ipt_header_kind::TIP_PGD:
+            return &OUTPUT::tip_pgd;
+        case ipt_header_kind::FUP:
+            return &OUTPUT::fup;
+        case ipt_header_kind::TSC:
+            return &OUTPUT::tsc;
+        case ipt_header_kind::MTC:
+            return &OUTPUT::mtc;
+        case ipt_header_kind::CYC:
+            return parse_cyc(packet);
+        case ipt_header_kind::MODE:
+            return parse_mode(packet);
+        case ipt_header_kind::EXTENDED:
+            return parse_extended(packet);
+        case ipt_header_kind::BAD_TIP:
+            {
+                char tmp[50];
+                sprintf(tmp, "TIP IPBytes value too high (%d) packet[0] = 0x%x", packet[0] >> 5, packet[0]);
+                output_policy_->report_error(tmp);
+            }
+            return 0;
+        default:
+            output_policy_->report_error("unknown packet");
+            return 0;
+        }
     }
 
 private:
-    bool get_next(uint8_t& c)
-    {
-        return input_.get_next(c);
-    }
-
-    bool get_next(unsigned from, unsigned to, uint8_t c[])
+    token unexpected_eof(ipt_header_kind kind)
     {
-        return input_.get_next(to - from + 1, &c[from]);
-    }
-
-    token read_packet(token t, uint8_t packet[], unsigned from, unsigned to)
-    {
-        if (input_.get_next(to - from + 1, &packet[from])) {
-            return t;
-        } else {
+        switch (kind) {
+        case ipt_header_kind::EXTENDED:
+            output_policy_->report_warning("unexpected EOF in extended package");
+            break;
+        case ipt_header_kind::MODE:
+            output_policy_->report_warning("unexpected EOF in mode package");
+            break;
+        default:
             output_policy_->report_warning("unexpected EOF");
-            return &OUTPUT::eof;
+            break;
         }
+        return &OUTPUT::eof;
     }
 
     token parse_extended(uint8_t packet[])
     {
-        token t;
-
-        if (get_next(packet[1])) {
-            switch (packet[1]) {
-                case 0x03: // 00000011
-                    t = read_packet(&OUTPUT::cbr, packet, 2, 3);
-                    break;
-                case 0x23: // 00100011
-                    t = &OUTPUT::psbend;
-                    break;
-                case 0x43: // 01000011
-                    t = read_packet(&OUTPUT::pip, packet, 2, 7);
-                    break;
-                case 0x73: // 01110011
-                    t = read_packet(&OUTPUT::tma, packet, 2, 6);
-                    break;
-                case 0x82: // 10000010
-                    t = parse_psb(packet);
-                    break;
-                case 0x83: // 10000011
-                    t = &OUTPUT::tracestop;
-                    break;
-                case 0xa3: // 10100011
-                    t = read_packet(&OUTPUT::long_tnt, packet, 2, 7);
-                    break;
-                case 0xc3: // 11000011
-                    t = read_packet(&OUTPUT::mnt, packet, 2, 9);
-                    break;
-                case 0xc8: // 11001000
-                    t = read_packet(&OUTPUT::vmcs, packet, 2, 6);
-                    break;
-                case 0xf3: // 11110011
-                    t = &OUTPUT::ovf;
-                    break;
-                default:
-                    output_policy_->report_error("broken extended package");
-                    t = 0;
-            }
-        } else {
-            output_policy_->report_warning("unexpected EOF in extended package");
-            t = &OUTPUT::eof;
-        }
+        const auto& header = ipt_extended_headers[packet[1]];
 
-        return t;
-    }
-
-    token parse_mode(uint8_t packet[])
-    {
-        if (get_next(packet[1])) {
-            auto leaf_id = packet[1] >> 5;
-            switch (leaf_id) {
-            case 0x00:
-                return &OUTPUT::mode_exec;
-            case 0x01:
-                return &OUTPUT::mode_tsx;
-            default:
-                output_policy_->report_error("unknown MODE");
+        // read the rest of the packet in one go; PSB is validated below
+        if (header.length > 2 &&
+            !input_.get_next(header.length - 2, &packet[2]))
+        {
+            if (header.kind == ipt_extended_kind::PSB) {
+                output_policy_->report_error("broken PSB");
                 return 0;
             }
-        } else {
-            output_policy_->report_warning("unexpected EOF in mode package");
+            output_policy_->report_warning("unexpected EOF");
             return &OUTPUT::eof;
         }
+
+        switch (header.kind) {
+        case ipt_extended_kind::CBR:
+            return &OUTPUT::cbr;
+        case ipt_extended_kind::PSBEND:
+            return &OUTPUT::psbend;
+        case ipt_extended_kind::PIP:
+            return &OUTPUT::pip;
+        case ipt_extended_kind::TMA:
+            return &OUTPUT::tma;
+        case ipt_extended_kind::PSB:
+            if (memcmp(&packet[2], &ipt_psb[2], ipt_psb_size - 2) == 0) {
+                return &OUTPUT::psb;
+            }
+            output_policy_->report_error("broken PSB");
+            return 0;
+        case ipt_extended_kind::TRACESTOP:
+            return &OUTPUT::tracestop;
+        case ipt_extended_kind::LONG_TNT:
+            return &OUTPUT::long_tnt;
+        case ipt_extended_kind::MNT:
+            return &OUTPUT::mnt;
+        case ipt_extended_kind::VMCS:
+            return &OUTPUT::vmcs;
+        case ipt_extended_kind::OVF:
+            return &OUTPUT::ovf;
+        default:
+            output_policy_->report_error("broken extended package");
+            return 0;
+        }
     }
 
-    token read_tip_packet(token t, uint8_t packet[])
+    token parse_mode(uint8_t packet[])
     {
-        unsigned ip_bytes = packet[0] >> 5;
-
-        if (ip_bytes > 3) {
-            char tmp[50];
-            sprintf(tmp, "TIP IPBytes value too high (%d) packet[0] = 0x%x", ip_bytes, packet[0]);
-            output_policy_->report_error(tmp);
+        switch (packet[1] >> 5) {
+        case 0x00:
+            return &OUTPUT::mode_exec;
+        case 0x01:
+            return &OUTPUT::mode_tsx;
+        default:
+            output_policy_->report_error("unknown MODE");
             return 0;
-        } else {
-            return read_packet(t, packet, 1, 2 * ip_bytes);
         }
     }
 
@@ -399,7 +479,7 @@ private:
                 output_policy_->report_error("CYC package is too long");
                 return 0;
             }
-            if (!get_next(packet[i])) {
+            if (!input_.get_next(packet[i])) {
                 output_policy_->report_warning("unexpected EOF in CYC");
                 return &OUTPUT::eof;
             }
@@ -409,34 +489,6 @@ private:
         return &OUTPUT::cyc;
     }
 
-    token parse_psb(uint8_t packet[])
-    {
-        token t;
-
-        if (get_next(packet[ 2]) && packet[ 2] == 0x02 &&
-            get_next(packet[ 3]) && packet[ 3] == 0x82 &&
-            get_next(packet[ 4]) && packet[ 4] == 0x02 &&
-            get_next(packet[ 5]) && packet[ 5] == 0x82 &&
-            get_next(packet[ 6]) && packet[ 6] == 0x02 &&
-            get_next(packet[ 7]) && packet[ 7] == 0x82 &&
-            get_next(packet[ 8]) && packet[ 8] == 0x02 &&
-            get_next(packet[ 9]) && packet[ 9] == 0x82 &&
-            get_next(packet[10]) && packet[10] == 0x02 &&
-            get_next(packet[11]) && packet[11] == 0x82 &&
-            get_next(packet[12]) && packet[12] == 0x02 &&
-            get_next(packet[13]) && packet[13] == 0x82 &&
-            get_next(packet[14]) && packet[14] == 0x02 &&
-            get_next(packet[15]) && packet[15] == 0x82)
-        {
-            t = &OUTPUT::psb;
-        } else {
-            output_policy_->report_error("broken PSB");
-            t = 0;
-        }
-
-        return t;
-    }
-
     INPUT&                         input_;
     ipt_parser_base_output_policy* output_policy_;
 }; // ipt_scanner
@@ -450,7 +502,7 @@ public:
 
     // TODO: also grab a reference to input to be able to determine packet size
     ipt_evaluator(ipt_parser_base_output_policy& output_policy) :
-        output_policy_(&output_policy)
+        output_policy_(&output_policy), value()
     {}
 
     token& evaluate(lexeme l, const uint8_t packet[])
@@ -640,6 +692,8 @@ public:
 
     token& psb(const uint8_t packet[])
     {
+        // last IP is reset at every PSB
+        value.last_ip = 0;
         value.func = &OUTPUT::psb;
         return value;
     }
@@ -747,6 +801,21 @@ public:
     output_t&      output() { return output_; }
     output_policy& policy() { return output_policy_; }
 
+    // forget about the end of the previous input
+    void reset()
+    {
+        resume(false, false);
+    }
+
+    // the state that carries over from one input to the next
+    bool at_eof() const   { return at_eof_; }
+    bool ff_state() const { return ff_state_; }
+    void resume(bool at_eof, bool ff_state)
+    {
+        at_eof_   = at_eof;
+        ff_state_ = ff_state;
+    }
+
     bool parse()
     {
         bool ok = true;
@@ -763,10 +832,10 @@ public:
                 if (token.func) {
                     output_policy_.output_token(token);
                 } else {
-                    ok = false;
+                    ok = resync();
                 }
             } else {
-                ok = false;
+                ok = resync();
             }
         } else {
             if (!input_.bad() && !at_eof_) {
@@ -783,6 +852,21 @@ public:
     }
 
 private:
+    // skip to the next PSB after a packet that could not be parsed
+    bool resync()
+    {
+        bool       ok  = false;
+        ipt_pos    pos = input_.beginning_of_packet();
+        ipt_offset skipped;
+
+        if (input_.skip_to_psb(skipped)) {
+            output_policy_.report_skip(pos, skipped);
+            ok = true;
+        }
+
+        return ok;
+    }
+
     void check_ff_state()
     {
         bool state = input_.is_fast_forwarding();
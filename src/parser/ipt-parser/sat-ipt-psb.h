@@ -0,0 +1,138 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SAT_IPT_PSB_H
+#define SAT_IPT_PSB_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SAT_IPT_PSB_AVX2
+#endif
+
+namespace sat {
+
+// PSB packet is 02 82 repeated eight times
+const size_t  ipt_psb_size = 16;
+const uint8_t ipt_psb[ipt_psb_size] = {
+    0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+    0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82
+};
+
+namespace psb_search {
+
+inline const uint8_t* scalar(const uint8_t* begin, const uint8_t* end)
+{
+    const uint8_t* p = begin;
+
+    while (end - p >= (ptrdiff_t)ipt_psb_size) {
+        p = static_cast<const uint8_t*>(
+                memchr(p, ipt_psb[0], end - p - ipt_psb_size + 1));
+        if (!p) {
+            break;
+        }
+        if (memcmp(p, ipt_psb, ipt_psb_size) == 0) {
+            return p;
+        }
+        ++p;
+    }
+
+    return end;
+}
+
+#ifdef __SSE2__
+// look for 02 82 pairs sixteen positions at a time
+// and compare the whole PSB only at those
+inline const uint8_t* sse2(const uint8_t* begin, const uint8_t* end)
+{
+    const __m128i first  = _mm_set1_epi8(0x02);
+    const __m128i second = _mm_set1_epi8((char)0x82);
+    const uint8_t* p     = begin;
+
+    while (end - p >= 32) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        unsigned candidates = _mm_movemask_epi8(
+                                  _mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                _mm_cmpeq_epi8(b, second)));
+        while (candidates) {
+            const uint8_t* c = p + __builtin_ctz(candidates);
+            if (memcmp(c, ipt_psb, ipt_psb_size) == 0) {
+                return c;
+            }
+            candidates &= candidates - 1;
+        }
+        p += 16;
+    }
+
+    return scalar(p, end);
+}
+#endif
+
+#ifdef SAT_IPT_PSB_AVX2
+// same as above, thirty-two positions at a time
+__attribute__((target("avx2")))
+inline const uint8_t* avx2(const uint8_t* begin, const uint8_t* end)
+{
+    const __m256i first  = _mm256_set1_epi8(0x02);
+    const __m256i second = _mm256_set1_epi8((char)0x82);
+    const uint8_t* p     = begin;
+
+    while (end - p >= 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        unsigned candidates = _mm256_movemask_epi8(
+                                  _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                   _mm256_cmpeq_epi8(b, second)));
+        while (candidates) {
+            const uint8_t* c = p + __builtin_ctz(candidates);
+            if (memcmp(c, ipt_psb, ipt_psb_size) == 0) {
+                return c;
+            }
+            candidates &= candidates - 1;
+        }
+        p += 32;
+    }
+
+    return sse2(p, end);
+}
+#endif
+
+} // psb_search
+
+// Find the first PSB in [begin, end); return end if there is none.
+inline const uint8_t* find_psb(const uint8_t* begin, const uint8_t* end)
+{
+#ifdef SAT_IPT_PSB_AVX2
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        return psb_search::avx2(begin, end);
+    }
+#endif
+#ifdef __SSE2__
+    return psb_search::sse2(begin, end);
+#else
+    return psb_search::scalar(begin, end);
+#endif
+}
+
+} // sat
+
+#endif // SAT_IPT_PSB_H
@@ -0,0 +1,348 @@
+/*
+// Copyright (c) 2015 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "sat-input.h"
+#include "sat-ipt-parser.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+using namespace sat;
+
+namespace {
+
+// The branchy scanner that classified packets with nested switches and
+// mask tests before ipt_scanner became table-driven; kept here as the
+// baseline to measure the table-driven scanner against.
+template <class INPUT, class OUTPUT>
+class switch_scanner
+{
+public:
+    using token = decltype(&OUTPUT::eof);
+
+    switch_scanner(INPUT& input, ipt_parser_base_output_policy& output_policy) :
+        input_(input),
+        output_policy_(&output_policy)
+    {}
+
+    token scan(uint8_t packet[])
+    {
+        token t;
+
+        switch (packet[0]) {
+        case 0x00: // 00000000
+            t = &OUTPUT::pad;
+            break;
+        case 0x02: // 00000010
+            t = parse_extended(packet);
+            break;
+        case 0x19: // 00011001
+            t = read_packet(&OUTPUT::tsc, packet, 1, 7);
+            break;
+        case 0x59: // 01011001
+            t = read_packet(&OUTPUT::mtc, packet, 1, 1);
+            break;
+        case 0x99: // 10011001
+            t = parse_mode(packet);
+            break;
+        default:
+            if ((packet[0] & 0x01) == 0x00) {        // xxxxxxx0
+                t = &OUTPUT::short_tnt;
+            } else if ((packet[0] & 0x03) == 0x03) { // xxxxxx11
+                t = parse_cyc(packet);
+            } else if ((packet[0] & 0x1f) == 0x01) { // xxx00001
+                t = read_tip_packet(&OUTPUT::tip_pgd, packet);
+            } else if ((packet[0] & 0x1f) == 0x0d) { // xxx01101
+                t = read_tip_packet(&OUTPUT::tip, packet);
+            } else if ((packet[0] & 0x1f) == 0x11) { // xxx10001
+                t = read_tip_packet(&OUTPUT::tip_pge, packet);
+            } else if ((packet[0] & 0x1f) == 0x1d) { // xxx11101
+                t = read_tip_packet(&OUTPUT::fup, packet);
+            } else {
+                output_policy_->report_error("unknown packet");
+                t = 0;
+            }
+        }
+
+        return t;
+    }
+
+private:
+    bool get_next(uint8_t& c)
+    {
+        return input_.get_next(c);
+    }
+
+    bool get_next(unsigned from, unsigned to, uint8_t c[])
+    {
+        return input_.get_next(to - from + 1, &c[from]);
+    }
+
+    token read_packet(token t, uint8_t packet[], unsigned from, unsigned to)
+    {
+        if (input_.get_next(to - from + 1, &packet[from])) {
+            return t;
+        } else {
+            output_policy_->report_warning("unexpected EOF");
+            return &OUTPUT::eof;
+        }
+    }
+
+    token parse_extended(uint8_t packet[])
+    {
+        token t;
+
+        if (get_next(packet[1])) {
+            switch (packet[1]) {
+                case 0x03: // 00000011
+                    t = read_packet(&OUTPUT::cbr, packet, 2, 3);
+                    break;
+                case 0x23: // 00100011
+                    t = &OUTPUT::psbend;
+                    break;
+                case 0x43: // 01000011
+                    t = read_packet(&OUTPUT::pip, packet, 2, 7);
+                    break;
+                case 0x73: // 01110011
+                    t = read_packet(&OUTPUT::tma, packet, 2, 6);
+                    break;
+                case 0x82: // 10000010
+                    t = parse_psb(packet);
+                    break;
+                case 0x83: // 10000011
+                    t = &OUTPUT::tracestop;
+                    break;
+                case 0xa3: // 10100011
+                    t = read_packet(&OUTPUT::long_tnt, packet, 2, 7);
+                    break;
+                case 0xc3: // 11000011
+                    t = read_packet(&OUTPUT::mnt, packet, 2, 9);
+                    break;
+                case 0xc8: // 11001000
+                    t = read_packet(&OUTPUT::vmcs, packet, 2, 6);
+                    break;
+                case 0xf3: // 11110011
+                    t = &OUTPUT::ovf;
+                    break;
+                default:
+                    output_policy_->report_error("broken extended package");
+                    t = 0;
+            }
+        } else {
+            output_policy_->report_warning("unexpected EOF in extended package");
+            t = &OUTPUT::eof;
+        }
+
+        return t;
+    }
+
+    token parse_mode(uint8_t packet[])
+    {
+        if (get_next(packet[1])) {
+            auto leaf_id = packet[1] >> 5;
+            switch (leaf_id) {
+            case 0x00:
+                return &OUTPUT::mode_exec;
+            case 0x01:
+                return &OUTPUT::mode_tsx;
+            default:
+                output_policy_->report_error("unknown MODE");
+                return 0;
+            }
+        } else {
+            output_policy_->report_warning("unexpected EOF in mode package");
+            return &OUTPUT::eof;
+        }
+    }
+
+    token read_tip_packet(token t, uint8_t packet[])
+    {
+        unsigned ip_bytes = packet[0] >> 5;
+
+        if (ip_bytes > 3) {
+            char tmp[50];
+            sprintf(tmp, "TIP IPBytes value too high (%d) packet[0] = 0x%x", ip_bytes, packet[0]);
+            output_policy_->report_error(tmp);
+            return 0;
+        } else {
+            return read_packet(t, packet, 1, 2 * ip_bytes);
+        }
+    }
+
+    token parse_cyc(uint8_t packet[])
+    {
+        int i = 0;
+        bool exp = packet[0] & 0x04;
+        while (exp) {
+            ++i;
+            if (i > 14) {
+                output_policy_->report_error("CYC package is too long");
+                return 0;
+            }
+            if (!get_next(packet[i])) {
+                output_policy_->report_warning("unexpected EOF in CYC");
+                return &OUTPUT::eof;
+            }
+            exp = packet[i] & 0x01;
+        }
+
+        return &OUTPUT::cyc;
+    }
+
+    token parse_psb(uint8_t packet[])
+    {
+        token t;
+
+        if (get_next(packet[ 2]) && packet[ 2] == 0x02 &&
+            get_next(packet[ 3]) && packet[ 3] == 0x82 &&
+            get_next(packet[ 4]) && packet[ 4] == 0x02 &&
+            get_next(packet[ 5]) && packet[ 5] == 0x82 &&
+            get_next(packet[ 6]) && packet[ 6] == 0x02 &&
+            get_next(packet[ 7]) && packet[ 7] == 0x82 &&
+            get_next(packet[ 8]) && packet[ 8] == 0x02 &&
+            get_next(packet[ 9]) && packet[ 9] == 0x82 &&
+            get_next(packet[10]) && packet[10] == 0x02 &&
+            get_next(packet[11]) && packet[11] == 0x82 &&
+            get_next(packet[12]) && packet[12] == 0x02 &&
+            get_next(packet[13]) && packet[13] == 0x82 &&
+            get_next(packet[14]) && packet[14] == 0x02 &&
+            get_next(packet[15]) && packet[15] == 0x82)
+        {
+            t = &OUTPUT::psb;
+        } else {
+            output_policy_->report_error("broken PSB");
+            t = 0;
+        }
+
+        return t;
+    }
+
+    INPUT&                         input_;
+    ipt_parser_base_output_policy* output_policy_;
+}; // switch_scanner
+
+template <class INPUT>
+class count_packets : public ipt_parser_output_base<count_packets<INPUT>>
+{
+public:
+    count_packets(const INPUT&) : packets_(), skipped_() {}
+
+    void output_packet(const uint8_t packet[]) { ++packets_; }
+    void skip(ipt_pos pos, ipt_offset count) { skipped_ += count; }
+
+    uint64_t packets() const { return packets_; }
+    uint64_t skipped() const { return skipped_; }
+
+private:
+    uint64_t packets_;
+    uint64_t skipped_;
+}; // count_packets
+
+template <template <class, class> class SCANNER>
+class bench_parser : public ipt_parser<input_from_mapped_file,
+                                       count_packets,
+                                       ipt_call_output_method,
+                                       SCANNER>
+{
+}; // bench_parser
+
+struct result {
+    uint64_t packets;
+    uint64_t skipped;
+    double   seconds;
+};
+
+template <template <class, class> class SCANNER>
+bool run(const char* path, unsigned rounds, result& r)
+{
+    r = result{};
+    for (unsigned i = 0; i < rounds; ++i) {
+        bench_parser<SCANNER> parser;
+        if (!parser.input().open(path)) {
+            fprintf(stderr, "cannot open IPT trace '%s'\n", path);
+            return false;
+        }
+        auto start = chrono::steady_clock::now();
+        while (parser.parse()) {}
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        r.seconds += elapsed.count();
+        r.packets  = parser.output().packets();
+        r.skipped  = parser.output().skipped();
+    }
+    return true;
+}
+
+void report(const char* name, const result& r, unsigned rounds)
+{
+    double seconds = r.seconds / rounds;
+    printf("%-14s %10lu packets %10.3f ms %8.2f Mpackets/s\n",
+           name, r.packets, seconds * 1000, r.packets / seconds / 1e6);
+}
+
+void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-r rounds] <ipt trace>\n", name);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned rounds = 10;
+
+    int c;
+    while ((c = getopt(argc, argv, "r:h")) != EOF) {
+        switch (c) {
+        case 'r':
+            rounds = max(1, atoi(optarg));
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* path = argv[optind];
+
+    result table;
+    result branchy;
+    if (!run<ipt_scanner>(path, 1, table)) { // warm up the page cache
+        return EXIT_FAILURE;
+    }
+    if (!run<switch_scanner>(path, rounds, branchy) ||
+        !run<ipt_scanner>(path, rounds, table))
+    {
+        return EXIT_FAILURE;
+    }
+
+    report("switch_scanner", branchy, rounds);
+    report("ipt_scanner", table, rounds);
+    printf("speedup        %.2fx\n", branchy.seconds / table.seconds);
+
+    if (table.packets != branchy.packets || table.skipped != branchy.skipped) {
+        fprintf(stderr, "scanners disagree: %lu vs. %lu packets\n",
+                table.packets, branchy.packets);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
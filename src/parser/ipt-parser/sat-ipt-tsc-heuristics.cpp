@@ -14,6 +14,7 @@
 // limitations under the License.
 */
 #include "sat-ipt-tsc-heuristics.h"
+#include "sat-ipt-index.h"
 #include "sat-ipt-parser.h"
 #include "sat-input.h"
 #include "sat-ipt-iterator.h"
@@ -1545,88 +1546,107 @@ void fill_between_mtcs_with_tscs(tscs& tscs)
 } // anonymous namespace
 
 
-template <class INPUT>
-class collect_timing_packets :
-    public ipt_parser_output_base<collect_timing_packets<INPUT>>
+// Collects the timing packets and block start locations of a trace
+// from the packets of its index.
+class collect_timing_packets
 {
 public:
-    using token = ipt_parser_token<collect_timing_packets<INPUT>>;
-
-    collect_timing_packets(const INPUT& input) :
-        got_to_eof(), input_(input), tscs_(new tscs), strts_(new strts),
+    collect_timing_packets() :
+        tscs_(new tscs), strts_(new strts),
         wait_for_tma_(false), in_psb_(false)
     {
         // cannot put BEGIN at offset 0, because 0 might be occupied by MTC/TSC
         //tscs_->insert({0, {tsc_item_type::BEGIN, -1, 0}});
     }
 
-    void tsc(token& t)
-    {
-        tscs_->insert({input_.beginning_of_packet(),
-                       {tsc_item_type::TSC, 0, t.tsc, 0, 0, 0, 0, 0, false, false}});
-        wait_for_tma_ = true;
-    }
-
-    void mtc(token& t)
+    void collect(const ipt_packet_arrays& packets)
     {
-        // Skip MTCs tht comes between tsc and tma.
-        if (!wait_for_tma_ && !in_psb_) {
-            tscs_->insert({input_.beginning_of_packet(), {tsc_item_type::MTC, t.ctc, MAX_TSC_VAL, 0, 0, 0, 0, 0, false, false}});
+        for (size_t i = 0; i < packets.size; ++i) {
+            ipt_pos  pos     = packets.offset[i];
+            uint64_t payload = packets.payload[i];
+            switch (packets.kind[i]) {
+            case ipt_packet_kind::TSC:
+                tsc(pos, payload);
+                break;
+            case ipt_packet_kind::MTC:
+                mtc(pos, payload);
+                break;
+            case ipt_packet_kind::TMA:
+                tma(pos, payload & 0xffff, payload >> 16);
+                break;
+            case ipt_packet_kind::OVF:
+                ovf(pos);
+                break;
+            case ipt_packet_kind::PSB:
+                psb(pos);
+                break;
+            case ipt_packet_kind::PSBEND:
+                psbend(pos);
+                break;
+            case ipt_packet_kind::TIP_PGE:
+                tip_pge(pos);
+                break;
+            default:
+                break;
+            }
         }
     }
 
-    void tma(token& t)
+    shared_ptr<tscs> timing_packets()
     {
-        tscs_->insert({input_.beginning_of_packet(),
-                       {tsc_item_type::TMA, 0, MAX_TSC_VAL, t.tma.ctc, t.tma.fast, 0, 0, 0, false, false}});
-        wait_for_tma_ = false;
+        return tscs_;
     }
 
-    void ovf(token& t)
+    shared_ptr<strts> start_locations()
     {
-        tscs_->insert({input_.beginning_of_packet(), {tsc_item_type::OVF, 0, MAX_TSC_VAL, 0, 0, 0, 0, 0, false, false}});
-        strts_->insert({(ipt_pos)input_.beginning_of_packet(), tsc_item_type::OVF});
+        return strts_;
     }
 
-    void eof(token& t)
+private:
+    void tsc(ipt_pos pos, uint64_t tsc)
     {
-        got_to_eof = true;
+        tscs_->insert({pos,
+                       {tsc_item_type::TSC, 0, tsc, 0, 0, 0, 0, 0, false, false}});
+        wait_for_tma_ = true;
     }
 
-    void psb(token& t)
+    void mtc(ipt_pos pos, uint8_t ctc)
     {
-        //tscs_->insert({input_.beginning_of_packet(), {tsc_item_type::PSB, 0, MAX_TSC_VAL, 0, 0, 0, 0, 0, false}});
-        strts_->insert({(ipt_pos)input_.beginning_of_packet(), tsc_item_type::PSB});
-        in_psb_ = true;
+        // Skip MTCs tht comes between tsc and tma.
+        if (!wait_for_tma_ && !in_psb_) {
+            tscs_->insert({pos, {tsc_item_type::MTC, ctc, MAX_TSC_VAL, 0, 0, 0, 0, 0, false, false}});
+        }
     }
-    void psbend(token& t)
+
+    void tma(ipt_pos pos, uint16_t ctc, uint16_t fast)
     {
-        in_psb_ = false;
+        tscs_->insert({pos,
+                       {tsc_item_type::TMA, 0, MAX_TSC_VAL, ctc, fast, 0, 0, 0, false, false}});
+        wait_for_tma_ = false;
     }
 
-    void tip_pge(token& t)
+    void ovf(ipt_pos pos)
     {
-        strts_->insert({(ipt_pos)input_.beginning_of_packet(), tsc_item_type::PGE});
+        tscs_->insert({pos, {tsc_item_type::OVF, 0, MAX_TSC_VAL, 0, 0, 0, 0, 0, false, false}});
+        strts_->insert({pos, tsc_item_type::OVF});
     }
 
-    void report_error(const string& message)
+    void psb(ipt_pos pos)
     {
-        fprintf(stderr, "error parsing IPT: %s\n", message.c_str());
+        //tscs_->insert({pos, {tsc_item_type::PSB, 0, MAX_TSC_VAL, 0, 0, 0, 0, 0, false}});
+        strts_->insert({pos, tsc_item_type::PSB});
+        in_psb_ = true;
     }
-
-    shared_ptr<tscs> timing_packets()
+    void psbend(ipt_pos pos)
     {
-        return tscs_;
+        in_psb_ = false;
     }
 
-    shared_ptr<strts> start_locations()
+    void tip_pge(ipt_pos pos)
     {
-        return strts_;
+        strts_->insert({pos, tsc_item_type::PGE});
     }
-    bool got_to_eof;
 
-private:
-    const INPUT&      input_;
     shared_ptr<tscs>  tscs_;
     shared_ptr<strts> strts_;
     bool              wait_for_tma_;
@@ -1656,17 +1676,14 @@ bool tsc_heuristics::parse_ipt(const std::string& path)
 {
     bool ok = true;
 
-    ipt_parser<input_from_file, collect_timing_packets> parser;
-    ok = parser.input().open(path);
-
-    if (ok) {
-        while (parser.parse()) {}
-        ok = parser.output().got_to_eof;
-    }
+    auto index = ipt_index::obtain(path);
+    ok = index && index->complete();
 
     if (ok) {
-        imp_->tscs_ = parser.output().timing_packets();
-        imp_->strts_ = parser.output().start_locations();
+        collect_timing_packets timing_packets;
+        timing_packets.collect(index->packets());
+        imp_->tscs_ = timing_packets.timing_packets();
+        imp_->strts_ = timing_packets.start_locations();
     }
 
     return ok;
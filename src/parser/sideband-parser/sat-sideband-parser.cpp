@@ -23,10 +23,16 @@ static bool version_checked = false;
 sideband_parser::sideband_parser(shared_ptr<sideband_parser_input>  input,
                                  shared_ptr<sideband_parser_output> output)
     : input_(input),
-      output_(output)
+      output_(output),
+      following_(false)
 {
 }
 
+void sideband_parser::follow()
+{
+    following_ = true;
+}
+
 bool sideband_parser::check_version_once(uint32_t *data)
 {
     const string parser_version_str = SIDEBAND_VERSION;
@@ -128,6 +134,11 @@ bool sideband_parser::parse_message()
         } else {
             size = message.header.size - size;
             ok = input_->read(size, (&message.header.size) + 1);
+            if (!ok && following_ && input_->eof()) {
+                // a file that is still being written may end in the
+                // middle of a message; stop at the last whole one
+                return true;
+            }
         }
 
         if (ok) {
@@ -107,6 +107,10 @@ namespace sat {
         sideband_parser(shared_ptr<sideband_parser_input>  input,
                         shared_ptr<sideband_parser_output> output);
 
+        // the input is still being written; a message that is cut
+        // short at the end of it ends the parse instead of failing it
+        void follow();
+
         bool parse();
         bool check_version_once(uint32_t *data);
 
@@ -115,6 +119,7 @@ namespace sat {
 
         shared_ptr<sideband_parser_input>  input_;
         shared_ptr<sideband_parser_output> output_;
+        bool                               following_;
     };
 
 }